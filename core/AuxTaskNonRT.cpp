@@ -7,11 +7,33 @@
 #include <errno.h>
 
 extern int volatile gRTAudioVerbose;
+extern unsigned int gAuxiliaryTaskCpus;
 
 bool AuxTaskNonRT::shouldStop(){
 	return (gShouldStop || lShouldStop);
 }
 
+unsigned int AuxTaskNonRT::getCpus(){
+	return hasCpus ? cpus : gAuxiliaryTaskCpus;
+}
+
+int AuxTaskNonRT::setCpus(unsigned int _cpus){
+	cpus = _cpus;
+	hasCpus = true;
+	if(!started)
+		return 0;
+#ifdef XENOMAI_SKIN_native
+	fprintf(stderr, "AuxTaskNonRT %s: the CPUs can only be set before create() when using the native skin\n", name.c_str());
+	return ENOSYS;
+#endif
+#ifdef XENOMAI_SKIN_posix
+	int ret = set_running_thread_cpus(thread, cpus);
+	if(ret)
+		fprintf(stderr, "AuxTaskNonRT %s: unable to set the CPUs: (%d) %s\n", name.c_str(), ret, strerror(ret));
+	return ret;
+#endif
+}
+
 void AuxTaskNonRT::create(std::string _name, std::function<void()> callback){
 	name = _name;
 	empty_callback = callback;
@@ -37,7 +59,7 @@ void AuxTaskNonRT::__create(){
 	int priority = 0;
 	int stackSize = 65536 * 4;
 #ifdef XENOMAI_SKIN_native //posix skin does evertything in one go below
-	if (int ret = rt_task_create(&task, name.c_str(), stackSize, priority, T_JOINABLE))
+	if (int ret = rt_task_create(&task, name.c_str(), stackSize, priority, T_JOINABLE | cpus_to_task_mode(getCpus())))
 	{
 		fprintf(stderr, "Unable to create AuxTaskNonRT %s: %i\n", name.c_str(), ret);
 		return;
@@ -67,12 +89,13 @@ void AuxTaskNonRT::__create(){
 	if (int ret = rt_task_start(&task, AuxTaskNonRT::thread_func, this))
 #endif
 #ifdef XENOMAI_SKIN_posix
-	if(int ret = create_and_start_thread(&thread, name.c_str(), priority, stackSize, (pthread_callback_t*)AuxTaskNonRT::thread_func, this))
+	if(int ret = create_and_start_thread(&thread, name.c_str(), priority, stackSize, (pthread_callback_t*)AuxTaskNonRT::thread_func, this, getCpus()))
 #endif
 	{
 		fprintf(stderr, "Unable to start AuxTaskNonRT %s: %i, %s\n", name.c_str(), ret, strerror(ret));
 		return;
 	}
+	started = true;
 }
 
 int AuxTaskNonRT::schedule(void* ptr, size_t size){
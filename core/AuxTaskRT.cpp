@@ -3,13 +3,36 @@
 #include "../include/xenomai_wraps.h"
 #include <Bela.h>
 #include <stdlib.h>
+#include <errno.h>
 
 extern int volatile gRTAudioVerbose;
+extern unsigned int gAuxiliaryTaskCpus;
 
 bool AuxTaskRT::shouldStop(){
 	return (gShouldStop || lShouldStop);
 }
 
+unsigned int AuxTaskRT::getCpus(){
+	return hasCpus ? cpus : gAuxiliaryTaskCpus;
+}
+
+int AuxTaskRT::setCpus(unsigned int _cpus){
+	cpus = _cpus;
+	hasCpus = true;
+	if(!started)
+		return 0;
+#ifdef XENOMAI_SKIN_native
+	fprintf(stderr, "AuxTaskRT %s: the CPUs can only be set before create() when using the native skin\n", name.c_str());
+	return ENOSYS;
+#endif
+#ifdef XENOMAI_SKIN_posix
+	int ret = set_running_thread_cpus(thread, cpus);
+	if(ret)
+		fprintf(stderr, "AuxTaskRT %s: unable to set the CPUs: (%d) %s\n", name.c_str(), ret, strerror(ret));
+	return ret;
+#endif
+}
+
 void AuxTaskRT::create(std::string _name, std::function<void()> callback, int _priority){
 	name = _name;
 	priority = _priority;
@@ -37,7 +60,7 @@ void AuxTaskRT::__create(){
 	// create the xenomai task
 	int stackSize = 0;
 #ifdef XENOMAI_SKIN_native //posix skin does evertything in one go below
-	if (int ret = rt_task_create(&task, name.c_str(), stackSize, priority, T_JOINABLE)){
+	if (int ret = rt_task_create(&task, name.c_str(), stackSize, priority, T_JOINABLE | cpus_to_task_mode(getCpus()))){
 		fprintf(stderr, "Unable to create AuxTaskRT %s: %i\n", name.c_str(), ret);
 		return;
 	}
@@ -69,13 +92,13 @@ void AuxTaskRT::__create(){
 	if (int ret = rt_task_start(&task, AuxTaskRT::thread_func, this))
 #endif
 #ifdef XENOMAI_SKIN_posix
-	if(int ret = create_and_start_thread(&thread, name.c_str(), priority, stackSize, (pthread_callback_t*)AuxTaskRT::thread_func, this))
+	if(int ret = create_and_start_thread(&thread, name.c_str(), priority, stackSize, (pthread_callback_t*)AuxTaskRT::thread_func, this, getCpus()))
 #endif
 	{
 		fprintf(stderr, "Unable to start AuxTaskRT %s: %i\n", name.c_str(), ret);
 		return;
 	}
-	
+	started = true;
 }
 
 void AuxTaskRT::schedule(void* buf, size_t size){
@@ -0,0 +1,467 @@
+/***** AuxTaskReactor.cpp *****/
+#include "../include/Bela.h"
+#include <AuxTaskReactor.h>
+#include "../include/xenomai_wraps.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+
+extern int volatile gRTAudioVerbose;
+
+AuxTaskReactor::AuxTaskReactor(){
+	for(unsigned int n = 0; n < kMaxDoorbells; ++n){
+		doorbellIds[n] = -1;
+		ringing[n] = 0;
+		doorbells[n] = NULL;
+	}
+}
+
+int AuxTaskReactor::setup(){
+	if(started)
+		return 0;
+	lShouldStop = false;
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if(epollFd < 0){
+		int err = errno;
+		fprintf(stderr, "AuxTaskReactor: unable to create epoll instance: (%d) %s\n", err, strerror(err));
+		return err;
+	}
+	// used to interrupt epoll_wait() on cleanup() and remove()
+	wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(wakeFd < 0){
+		int err = errno;
+		fprintf(stderr, "AuxTaskReactor: unable to create eventfd: (%d) %s\n", err, strerror(err));
+		cleanup();
+		return err;
+	}
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if(epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev)){
+		int err = errno;
+		fprintf(stderr, "AuxTaskReactor: unable to watch eventfd: (%d) %s\n", err, strerror(err));
+		cleanup();
+		return err;
+	}
+	// this is a regular Linux thread: it never needs to run in primary mode
+	if(int ret = pthread_create(&thread, NULL, AuxTaskReactor::thread_func, this)){ // NOWRAP
+		fprintf(stderr, "AuxTaskReactor: unable to start thread: (%d) %s\n", ret, strerror(ret));
+		cleanup();
+		return ret;
+	}
+	pthread_setname_np(thread, "bela-reactor"); // NOWRAP
+	started = true;
+	return 0;
+}
+
+void AuxTaskReactor::cleanup(){
+	if(started){
+		lShouldStop = true;
+		uint64_t one = 1;
+		write(wakeFd, &one, sizeof(one));
+		pthread_join(thread, NULL); // NOWRAP
+		started = false;
+	}
+	for(unsigned int n = 0; n < sources.size(); ++n)
+		releaseSource(sources[n]);
+	sources.clear();
+	for(unsigned int n = 0; n < kMaxDoorbells; ++n){
+		doorbellIds[n] = -1;
+		doorbells[n] = NULL;
+	}
+	if(wakeFd >= 0)
+		close(wakeFd);
+	wakeFd = -1;
+	if(epollFd >= 0)
+		close(epollFd);
+	epollFd = -1;
+}
+
+AuxTaskReactor& AuxTaskReactor::get(){
+	static AuxTaskReactor reactor;
+	// C++11 guarantees this is only executed once, even with
+	// concurrent callers
+	static int ret = reactor.setup();
+	(void)ret;
+	return reactor;
+}
+
+int AuxTaskReactor::add(Source* source, uint32_t events){
+	source->removed = false;
+	pthread_mutex_lock(&mutex); // NOWRAP
+	// the source may be removed and freed as soon as we unlock
+	int id = source->id = nextId++;
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.ptr = source;
+	if(epoll_ctl(epollFd, EPOLL_CTL_ADD, source->fd, &ev)){
+		int err = errno;
+		pthread_mutex_unlock(&mutex); // NOWRAP
+		fprintf(stderr, "AuxTaskReactor: unable to watch fd %d: (%d) %s\n", source->fd, err, strerror(err));
+		return -err;
+	}
+	sources.push_back(source);
+	pthread_mutex_unlock(&mutex); // NOWRAP
+	return id;
+}
+
+int AuxTaskReactor::addFd(int fd, uint32_t events, FdCallback callback){
+	Source* source = new Source;
+	source->type = kFd;
+	source->fd = fd;
+	source->pipeSocket = -1;
+	source->fdCallback = callback;
+	int id = add(source, events);
+	if(id < 0)
+		delete source;
+	return id;
+}
+
+int AuxTaskReactor::addTimer(unsigned int periodMs, Callback callback){
+	if(0 == periodMs)
+		return -EINVAL;
+	// a Linux timer, which epoll can watch
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC); // NOWRAP
+	if(fd < 0){
+		int err = errno;
+		fprintf(stderr, "AuxTaskReactor: unable to create timer: (%d) %s\n", err, strerror(err));
+		return -err;
+	}
+	struct itimerspec spec;
+	spec.it_interval.tv_sec = periodMs / 1000;
+	spec.it_interval.tv_nsec = (periodMs % 1000) * 1000000;
+	spec.it_value = spec.it_interval;
+	if(timerfd_settime(fd, 0, &spec, NULL)){ // NOWRAP
+		int err = errno;
+		fprintf(stderr, "AuxTaskReactor: unable to start timer: (%d) %s\n", err, strerror(err));
+		close(fd);
+		return -err;
+	}
+	Source* source = new Source;
+	source->type = kTimer;
+	source->fd = fd;
+	source->pipeSocket = -1;
+	source->callback = callback;
+	int id = add(source, EPOLLIN);
+	if(id < 0)
+		releaseSource(source);
+	return id;
+}
+
+int AuxTaskReactor::addDoorbell(std::string name, Callback callback){
+	Source* source = new Source;
+	source->type = kDoorbell;
+	source->fd = -1;
+	source->pipeSocket = -1;
+	source->callback = callback;
+	source->name = "p_" + name;
+#ifdef XENOMAI_SKIN_native
+	int ret = rt_pipe_create(&source->pipe, source->name.c_str(), P_MINOR_AUTO, 0);
+	if(ret < 0)
+#endif
+#ifdef XENOMAI_SKIN_posix
+	int ret = createXenomaiPipe(source->name.c_str(), 0);
+	source->pipeSocket = ret;
+	if(ret < 0)
+#endif
+	{
+		fprintf(stderr, "AuxTaskReactor: unable to create doorbell pipe %s: (%d) %s\n", source->name.c_str(), ret, strerror(-ret));
+		delete source;
+		return ret;
+	}
+#ifdef XENOMAI_SKIN_posix
+	// ring() must never block the audio thread
+	int flags = __wrap_fcntl(source->pipeSocket, F_GETFL);
+	__wrap_fcntl(source->pipeSocket, F_SETFL, flags | O_NONBLOCK);
+#endif
+#if XENOMAI_SKIN_posix || XENOMAI_MAJOR == 3
+	std::string path = "/proc/xenomai/registry/rtipc/xddp/" + source->name;
+#else
+	std::string path = "/proc/xenomai/registry/native/pipes/" + source->name;
+#endif
+	// see Pipe::setup(): the registry entry is not available straight away
+	usleep(10000);
+	source->fd = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if(source->fd < 0){
+		int err = errno;
+		fprintf(stderr, "AuxTaskReactor: unable to open doorbell pipe %s: (%d) %s\n", path.c_str(), err, strerror(err));
+		releaseSource(source);
+		return -err;
+	}
+	int id = add(source, EPOLLIN);
+	if(id < 0){
+		releaseSource(source);
+		return id;
+	}
+	pthread_mutex_lock(&mutex); // NOWRAP
+	unsigned int slot;
+	for(slot = 0; slot < kMaxDoorbells; ++slot){
+		if(NULL == doorbells[slot])
+			break;
+	}
+	if(slot < kMaxDoorbells){
+		doorbells[slot] = source;
+		doorbellIds[slot] = id;
+	}
+	pthread_mutex_unlock(&mutex); // NOWRAP
+	if(slot == kMaxDoorbells){
+		fprintf(stderr, "AuxTaskReactor: too many doorbells (max %u)\n", kMaxDoorbells);
+		remove(id);
+		return -ENOSPC;
+	}
+	return id;
+}
+
+int AuxTaskReactor::ring(int id){
+	for(unsigned int n = 0; n < kMaxDoorbells; ++n){
+		if(doorbellIds[n] != id)
+			continue;
+		++ringing[n];
+		// check again: remove() may have started in the meantime and,
+		// if it has not, it will wait for us to be done
+		if(doorbellIds[n] != id){
+			--ringing[n];
+			continue;
+		}
+		Source* source = doorbells[n];
+		char t = 0;
+#ifdef XENOMAI_SKIN_native
+		int ret = rt_pipe_write(&source->pipe, &t, sizeof(t), P_NORMAL);
+		--ringing[n];
+		// a full pipe means that the doorbell is already pending
+		if(ret < 0 && ret != -ENOMEM)
+			return ret;
+#endif
+#ifdef XENOMAI_SKIN_posix
+		int ret = __wrap_sendto(source->pipeSocket, &t, sizeof(t), 0, NULL, 0);
+		int err = errno;
+		--ringing[n];
+		// a full pipe means that the doorbell is already pending
+		if(ret < 0 && err != EAGAIN && err != ENOMEM)
+			return -err;
+#endif
+		return 0;
+	}
+	return -EINVAL;
+}
+
+int AuxTaskReactor::remove(int id){
+	Source* source = NULL;
+	pthread_mutex_lock(&mutex); // NOWRAP
+	for(unsigned int n = 0; n < sources.size(); ++n){
+		if(sources[n]->id == id && !sources[n]->removed){
+			source = sources[n];
+			break;
+		}
+	}
+	if(source){
+		source->removed = true;
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, source->fd, NULL);
+		for(unsigned int n = 0; n < kMaxDoorbells; ++n){
+			if(doorbells[n] == source){
+				doorbellIds[n] = -1;
+				// ring() does not block, so this is short
+				while(ringing[n])
+					sched_yield(); // NOWRAP
+				doorbells[n] = NULL;
+			}
+		}
+		// wait for the callback to return, unless we are being called
+		// from a callback: then the callback running is the caller
+		if(!(started && pthread_equal(pthread_self(), thread))){ // NOWRAP
+			while(dispatching == source)
+				pthread_cond_wait(&dispatchDone, &mutex); // NOWRAP
+		}
+	}
+	pthread_mutex_unlock(&mutex); // NOWRAP
+	if(!source)
+		return -EINVAL;
+	// the source is freed by the reactor thread
+	uint64_t one = 1;
+	write(wakeFd, &one, sizeof(one));
+	return 0;
+}
+
+void AuxTaskReactor::releaseSource(Source* source){
+	if(kTimer == source->type || kDoorbell == source->type){
+		if(source->fd >= 0)
+			close(source->fd);
+	}
+	if(kDoorbell == source->type){
+#ifdef XENOMAI_SKIN_native
+		rt_pipe_delete(&source->pipe);
+#endif
+#ifdef XENOMAI_SKIN_posix
+		if(source->pipeSocket >= 0)
+			__wrap_close(source->pipeSocket);
+#endif
+	}
+	delete source;
+}
+
+void AuxTaskReactor::collectRemoved(){
+	pthread_mutex_lock(&mutex); // NOWRAP
+	for(unsigned int n = 0; n < sources.size(); ){
+		if(sources[n]->removed){
+			releaseSource(sources[n]);
+			sources.erase(sources.begin() + n);
+		} else {
+			++n;
+		}
+	}
+	pthread_mutex_unlock(&mutex); // NOWRAP
+}
+
+// returns true if the source has been removed
+bool AuxTaskReactor::dispatch(Source* source, uint32_t events){
+	pthread_mutex_lock(&mutex); // NOWRAP
+	if(source->removed){
+		pthread_mutex_unlock(&mutex); // NOWRAP
+		return true;
+	}
+	dispatching = source;
+	pthread_mutex_unlock(&mutex); // NOWRAP
+	switch(source->type){
+	case kFd:
+		source->fdCallback(source->fd, events);
+		break;
+	case kTimer:
+	{
+		uint64_t expirations;
+		if(read(source->fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+			source->callback();
+		break;
+	}
+	case kDoorbell:
+	{
+		// drain all pending rings and serve them with a single call
+		char buf[64];
+		bool rung = false;
+		while(read(source->fd, buf, sizeof(buf)) > 0)
+			rung = true;
+		if(rung)
+			source->callback();
+		break;
+	}
+	}
+	pthread_mutex_lock(&mutex); // NOWRAP
+	dispatching = NULL;
+	bool removed = source->removed;
+	pthread_cond_broadcast(&dispatchDone); // NOWRAP
+	pthread_mutex_unlock(&mutex); // NOWRAP
+	return removed;
+}
+
+void AuxTaskReactor::loop(){
+	const int kMaxEvents = 16;
+	struct epoll_event events[kMaxEvents];
+	while(!lShouldStop){
+		int num = epoll_wait(epollFd, events, kMaxEvents, -1);
+		if(num < 0){
+			if(EINTR == errno)
+				continue;
+			fprintf(stderr, "AuxTaskReactor: epoll_wait failed: (%d) %s\n", errno, strerror(errno));
+			break;
+		}
+		bool shouldCollect = false;
+		for(int n = 0; n < num; ++n){
+			Source* source = (Source*)events[n].data.ptr;
+			if(NULL == source){
+				uint64_t count;
+				read(wakeFd, &count, sizeof(count));
+				shouldCollect = true;
+				continue;
+			}
+			if(dispatch(source, events[n].events))
+				shouldCollect = true;
+		}
+		if(shouldCollect)
+			collectRemoved();
+	}
+}
+
+void* AuxTaskReactor::thread_func(void* ptr){
+	AuxTaskReactor* instance = (AuxTaskReactor*)ptr;
+	if(gRTAudioVerbose)
+		printf("AuxTaskReactor starting\n");
+	instance->loop();
+	if(gRTAudioVerbose)
+		printf("AuxTaskReactor exiting\n");
+	return NULL;
+}
+
+#undef NDEBUG
+#include <assert.h>
+static bool waitFor(volatile int& var, int target, int timeoutMs){
+	for(int n = 0; n < timeoutMs && var < target; ++n)
+		usleep(1000);
+	return var >= target;
+}
+
+bool AuxTaskReactor::test(){
+	AuxTaskReactor reactor;
+	assert(0 == reactor.setup());
+
+	// file descriptors
+	int fds[2];
+	assert(0 == pipe(fds));
+	volatile int fdCalls = 0;
+	int fdId = reactor.addFd(fds[0], EPOLLIN, [&fdCalls](int fd, uint32_t events) {
+		char c;
+		while(read(fd, &c, 1) != 1)
+			;
+		fdCalls = fdCalls + 1;
+	});
+	assert(fdId >= 0);
+	assert(1 == write(fds[1], "a", 1));
+	assert(waitFor(fdCalls, 1, 1000));
+	assert(1 == write(fds[1], "b", 1));
+	assert(waitFor(fdCalls, 2, 1000));
+
+	// timers, and removal from within a callback
+	volatile int timerCalls = 0;
+	int timerId = -1;
+	timerId = reactor.addTimer(1, [&reactor, &timerCalls, &timerId]() {
+		timerCalls = timerCalls + 1;
+		if(3 == timerCalls)
+			reactor.remove(timerId);
+	});
+	assert(timerId >= 0);
+	assert(waitFor(timerCalls, 3, 1000));
+	usleep(20000);
+	assert(3 == timerCalls);
+
+	// removing a file descriptor stops its callbacks
+	assert(0 == reactor.remove(fdId));
+	assert(-EINVAL == reactor.remove(fdId));
+	assert(-EINVAL == reactor.ring(fdId));
+	assert(1 == write(fds[1], "c", 1));
+	usleep(20000);
+	assert(2 == fdCalls);
+
+	// remove() waits for a running callback to return
+	volatile int slowCalls = 0;
+	volatile bool inSlowCallback = false;
+	int slowId = reactor.addTimer(1, [&slowCalls, &inSlowCallback]() {
+		inSlowCallback = true;
+		slowCalls = slowCalls + 1;
+		usleep(50000);
+		inSlowCallback = false;
+	});
+	assert(slowId >= 0);
+	assert(waitFor(slowCalls, 1, 1000));
+	assert(0 == reactor.remove(slowId));
+	assert(!inSlowCallback);
+	int calls = slowCalls;
+	usleep(20000);
+	assert(calls == slowCalls);
+
+	reactor.cleanup();
+	close(fds[0]);
+	close(fds[1]);
+	return true;
+}
@@ -0,0 +1,87 @@
+#include <AuxTaskRing.h>
+#include <unistd.h>
+
+#undef NDEBUG
+#include <assert.h>
+static bool waitFor(std::atomic<int>& var, int target, int timeoutMs)
+{
+	for(int n = 0; n < timeoutMs && var < target; ++n)
+		usleep(1000);
+	return var >= target;
+}
+
+bool AuxTaskRingBase::test()
+{
+	// without a doorbell: the consumer calls process()
+	std::vector<int> got;
+	AuxTaskRing<std::vector<float>> polled("", 3, [&got](std::vector<float>& v) {
+		got.push_back(v[0]);
+	}, std::vector<float>(16));
+	for(unsigned int n = 0; n < 4; ++n)
+	{
+		std::vector<float>* slot = polled.reserve();
+		assert(slot && 16 == slot->size());
+		(*slot)[0] = n;
+		assert(0 == polled.commit());
+	}
+	// 3 slots are rounded up to 4, which are now all in use
+	assert(!polled.reserve());
+	assert(4 == polled.pending());
+	assert(4 == polled.process());
+	assert(0 == polled.pending());
+	assert(4 == got.size());
+	for(unsigned int n = 0; n < got.size(); ++n)
+		assert((int)n == got[n]);
+
+	// batch consumer on the thread of the AuxTaskReactor
+	const int kNumItems = 2000;
+	const unsigned int kMaxBatch = 5;
+	std::atomic<int> received{0};
+	std::atomic<int> errors{0};
+	std::atomic<int> batches{0};
+	AuxTaskRing<int> batched;
+	assert(0 == batched.setup("AuxTaskRingTest", 16, kMaxBatch, [&](int* const* items, unsigned int count) {
+		if(0 == count || count > kMaxBatch)
+			++errors;
+		for(unsigned int n = 0; n < count; ++n)
+		{
+			// items arrive in order and exactly once
+			if(*items[n] != received)
+				++errors;
+			++received;
+		}
+		++batches;
+	}));
+	for(int n = 0; n < kNumItems; ++n)
+	{
+		int* slot;
+		while(!(slot = batched.reserve()))
+			usleep(100);
+		*slot = n;
+		assert(0 == batched.commit());
+	}
+	assert(waitFor(received, kNumItems, 2000));
+	assert(0 == errors);
+	assert(batches <= kNumItems);
+	assert(0 == batched.pending());
+
+	// cleanup() waits for a running callback, after which the slots can
+	// be destroyed
+	std::atomic<int> slowCalls{0};
+	std::atomic<bool> inSlowCallback{false};
+	AuxTaskRing<std::vector<int>>* slow = new AuxTaskRing<std::vector<int>>;
+	assert(0 == slow->setup("AuxTaskRingTestSlow", 2, [&](std::vector<int>& v) {
+		inSlowCallback = true;
+		++slowCalls;
+		usleep(50000);
+		v.assign(v.size(), 0);
+		inSlowCallback = false;
+	}, std::vector<int>(100)));
+	assert(slow->reserve());
+	assert(0 == slow->commit());
+	assert(waitFor(slowCalls, 1, 1000));
+	slow->cleanup();
+	assert(!inSlowCallback);
+	delete slow;
+	return true;
+}
@@ -3,6 +3,8 @@
 #include <vector>
 #include <iostream>
 #include <string.h>
+#include <errno.h>
+#include "../include/LatencyStats.h"
 
 #ifdef XENOMAI_SKIN_native
 #include <native/task.h>
@@ -33,6 +35,8 @@ typedef struct {
 	int priority;
 	bool started;
 	void* args;
+	LatencyStats latency; // from being scheduled to running
+	uint64_t scheduledNs; // when last scheduled, 0 if it has run since
 } InternalAuxiliaryTask;
 
 vector<InternalAuxiliaryTask*> &getAuxTasks(){
@@ -42,11 +46,14 @@ vector<InternalAuxiliaryTask*> &getAuxTasks(){
 
 void auxiliaryTaskLoop(void *taskStruct);
 
+extern int gReportLatency;
+
 // Create a calculation loop which can run independently of the audio, at a different
 // (equal or lower) priority. Audio priority is defined in BELA_AUDIO_PRIORITY;
 // priority should be generally be less than this.
 // Returns an (opaque) pointer to the created task on success; 0 on failure
 extern unsigned int gAuxiliaryTaskStackSize;
+extern unsigned int gAuxiliaryTaskCpus;
 AuxiliaryTask Bela_createAuxiliaryTask(void (*functionToCall)(void* args), int priority, const char *name, void* args)
 {
 #if XENOMAI_MAJOR == 3
@@ -65,10 +72,12 @@ AuxiliaryTask Bela_createAuxiliaryTask(void (*functionToCall)(void* args), int p
 	newTask->priority = priority;
 	newTask->started = false;
 	newTask->args = args;
+	newTask->latency.reset();
+	newTask->scheduledNs = 0;
 	// Attempt to create the task
 	unsigned int stackSize = gAuxiliaryTaskStackSize;
 #ifdef XENOMAI_SKIN_native
-	if(int ret = rt_task_create(&(newTask->task), name, stackSize, priority, T_JOINABLE | T_FPU))
+	if(int ret = rt_task_create(&(newTask->task), name, stackSize, priority, T_JOINABLE | T_FPU | cpus_to_task_mode(gAuxiliaryTaskCpus)))
 #endif
 #ifdef XENOMAI_SKIN_posix
 	if(int ret = __wrap_pthread_cond_init(&(newTask->cond), NULL))
@@ -85,7 +94,7 @@ AuxiliaryTask Bela_createAuxiliaryTask(void (*functionToCall)(void* args), int p
 	}
 	// Upon calling this function, the thread will start and immediately wait
 	// on the condition variable.
-	if(int ret = create_and_start_thread(&(newTask->task), name, priority, stackSize,(pthread_callback_t*)auxiliaryTaskLoop, newTask))
+	if(int ret = create_and_start_thread(&(newTask->task), name, priority, stackSize,(pthread_callback_t*)auxiliaryTaskLoop, newTask, gAuxiliaryTaskCpus))
 #endif
 	{
 		fprintf(stderr, "Error: unable to create auxiliary task %s : (%d) %s\n", name, ret, strerror(ret));
@@ -109,6 +118,8 @@ int Bela_scheduleAuxiliaryTask(AuxiliaryTask task)
                                            // A safer approach would use rt_task_inquire()
 	}
 #ifdef XENOMAI_SKIN_native
+	if(gReportLatency)
+		taskToSchedule->scheduledNs = task_time_ns();
 	rt_task_resume(&taskToSchedule->task);
 	// the return value here is hardcoded: returns success
 	// regardless of whether the task is actually scheduled or was
@@ -152,6 +163,8 @@ int Bela_scheduleAuxiliaryTask(AuxiliaryTask task)
 		// If we cannot get the lock, then the task is probably still running.
 		return ret;
 	} else {
+		if(gReportLatency)
+			taskToSchedule->scheduledNs = task_time_ns();
 		ret = __wrap_pthread_cond_signal(&taskToSchedule->cond);
 		__wrap_pthread_mutex_unlock(&taskToSchedule->mutex);
 		return 0;
@@ -161,15 +174,24 @@ int Bela_scheduleAuxiliaryTask(AuxiliaryTask task)
 
 static void suspendCurrentTask(InternalAuxiliaryTask* task)
 {
+	uint64_t scheduledNs;
 #ifdef XENOMAI_SKIN_native
 	rt_task_suspend(NULL);
+	scheduledNs = task->scheduledNs;
+	task->scheduledNs = 0;
 #endif
 #ifdef XENOMAI_SKIN_posix
 	__wrap_pthread_mutex_lock(&task->mutex);
 	task->started = true;
 	__wrap_pthread_cond_wait(&task->cond, &task->mutex);
+	// read it while holding the lock, so that it is not set again in
+	// the meantime by the next call to Bela_scheduleAuxiliaryTask()
+	scheduledNs = task->scheduledNs;
+	task->scheduledNs = 0;
 	__wrap_pthread_mutex_unlock(&task->mutex);
 #endif
+	if(scheduledNs)
+		task->latency.add(task_time_ns() - scheduledNs);
 }
 // Calculation loop that can be used for other tasks running at a lower
 // priority than the audio thread. Simple wrapper for Xenomai calls.
@@ -206,6 +228,21 @@ void auxiliaryTaskLoop(void *taskStruct)
 }
 
 
+int Bela_setAuxiliaryTaskCpus(AuxiliaryTask task, unsigned int cpus)
+{
+	InternalAuxiliaryTask *taskStruct = (InternalAuxiliaryTask *)task;
+#ifdef XENOMAI_SKIN_native
+	fprintf(stderr, "Error: the CPUs of auxiliary task %s can only be set with --aux-cpus when using the native skin\n", taskStruct->name);
+	return ENOSYS;
+#endif
+#ifdef XENOMAI_SKIN_posix
+	int ret = set_running_thread_cpus(taskStruct->task, cpus);
+	if(ret)
+		fprintf(stderr, "Error: unable to set the CPUs of auxiliary task %s: (%d) %s\n", taskStruct->name, ret, strerror(ret));
+	return ret;
+#endif
+}
+
 int Bela_startAuxiliaryTask(AuxiliaryTask task){
 	InternalAuxiliaryTask *taskStruct;
 	taskStruct = (InternalAuxiliaryTask *)task;
@@ -267,6 +304,15 @@ void Bela_stopAllAuxiliaryTasks()
 	}
 }
 
+// Print a row of the latency table for each task that has run, once
+// they have been stopped
+void Bela_printAuxiliaryTaskLatency(FILE* file)
+{
+	for(auto task : getAuxTasks())
+		if(task->latency.getCount())
+			task->latency.print(file, task->name);
+}
+
 void Bela_deleteAllAuxiliaryTasks()
 {
 	// Clean up the auxiliary tasks
@@ -0,0 +1,380 @@
+#include <BelaChannelView.h>
+#include <string.h>
+#include <stdio.h>
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BELA_CHANNEL_OPS_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define BELA_CHANNEL_OPS_SSE2
+#endif
+
+void BelaChannelOps::copy(float* dst, unsigned int dstStride, const float* src, unsigned int srcStride, unsigned int count)
+{
+	unsigned int n = 0;
+	if(1 == dstStride && 1 == srcStride)
+	{
+		memcpy(dst, src, count * sizeof(float));
+		return;
+	}
+	// The stride-2 vectors cover the other channel of the last frame
+	// too, which is past the end of the buffer when this is channel 1,
+	// so they stop one vector early and the scalar loop does the rest.
+	if(1 == dstStride && 2 == srcStride)
+	{
+		// deinterleave
+#if defined(BELA_CHANNEL_OPS_NEON)
+		for(; n + 4 < count; n += 4)
+			vst1q_f32(dst + n, vld2q_f32(src + 2 * n).val[0]);
+#elif defined(BELA_CHANNEL_OPS_SSE2)
+		for(; n + 4 < count; n += 4)
+		{
+			__m128 a = _mm_loadu_ps(src + 2 * n);
+			__m128 b = _mm_loadu_ps(src + 2 * n + 4);
+			_mm_storeu_ps(dst + n, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		}
+#endif
+	}
+	else if(2 == dstStride && 1 == srcStride)
+	{
+		// interleave, keeping the other channel
+#if defined(BELA_CHANNEL_OPS_NEON)
+		for(; n + 4 < count; n += 4)
+		{
+			float32x4x2_t frames = vld2q_f32(dst + 2 * n);
+			frames.val[0] = vld1q_f32(src + n);
+			vst2q_f32(dst + 2 * n, frames);
+		}
+#elif defined(BELA_CHANNEL_OPS_SSE2)
+		for(; n + 4 < count; n += 4)
+		{
+			__m128 in = _mm_loadu_ps(src + n);
+			__m128 others = _mm_shuffle_ps(_mm_loadu_ps(dst + 2 * n), _mm_loadu_ps(dst + 2 * n + 4), _MM_SHUFFLE(3, 1, 3, 1));
+			_mm_storeu_ps(dst + 2 * n, _mm_unpacklo_ps(in, others));
+			_mm_storeu_ps(dst + 2 * n + 4, _mm_unpackhi_ps(in, others));
+		}
+#endif
+	}
+	for(; n < count; ++n)
+		dst[n * dstStride] = src[n * srcStride];
+}
+
+void BelaChannelOps::fill(float* dst, unsigned int stride, unsigned int count, float value)
+{
+	unsigned int n = 0;
+	if(1 == stride)
+	{
+#if defined(BELA_CHANNEL_OPS_NEON)
+		const float32x4_t v = vdupq_n_f32(value);
+		for(; n + 4 <= count; n += 4)
+			vst1q_f32(dst + n, v);
+#elif defined(BELA_CHANNEL_OPS_SSE2)
+		const __m128 v = _mm_set1_ps(value);
+		for(; n + 4 <= count; n += 4)
+			_mm_storeu_ps(dst + n, v);
+#endif
+	}
+	for(; n < count; ++n)
+		dst[n * stride] = value;
+}
+
+void BelaChannelOps::ramp(float* dst, unsigned int stride, unsigned int count, float from, float to)
+{
+	if(!count)
+		return;
+	// each sample is computed from its index rather than accumulated, so
+	// that the vector and scalar code give the same results
+	const float step = (to - from) / count;
+	unsigned int n = 0;
+	if(1 == stride)
+	{
+#if defined(BELA_CHANNEL_OPS_NEON)
+		const float32x4_t vFrom = vdupq_n_f32(from);
+		const float32x4_t vStep = vdupq_n_f32(step);
+		const float32x4_t four = vdupq_n_f32(4);
+		const float init[4] = { 1, 2, 3, 4 };
+		float32x4_t index = vld1q_f32(init);
+		for(; n + 4 <= count; n += 4)
+		{
+			vst1q_f32(dst + n, vaddq_f32(vFrom, vmulq_f32(vStep, index)));
+			index = vaddq_f32(index, four);
+		}
+#elif defined(BELA_CHANNEL_OPS_SSE2)
+		const __m128 vFrom = _mm_set1_ps(from);
+		const __m128 vStep = _mm_set1_ps(step);
+		const __m128 four = _mm_set1_ps(4);
+		__m128 index = _mm_setr_ps(1, 2, 3, 4);
+		for(; n + 4 <= count; n += 4)
+		{
+			_mm_storeu_ps(dst + n, _mm_add_ps(vFrom, _mm_mul_ps(vStep, index)));
+			index = _mm_add_ps(index, four);
+		}
+#endif
+	}
+	for(; n < count; ++n)
+		dst[n * stride] = from + step * (float)(n + 1);
+	dst[(count - 1) * stride] = to;
+}
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <math.h>
+#include <PRU.h> // InternalBelaContext
+#include <vector>
+
+// a context whose analog outputs are written with analogWrite()
+struct ChannelTestContext {
+	ChannelTestContext(bool interleaved, unsigned int frames, unsigned int channels, bool pending)
+	{
+		memset(&ctx, 0, sizeof(ctx));
+		ctx.audioFrames = frames;
+		ctx.audioInChannels = channels;
+		ctx.audioOutChannels = channels;
+		ctx.analogFrames = frames;
+		ctx.analogInChannels = channels;
+		ctx.analogOutChannels = channels;
+		ctx.flags = interleaved ? BELA_FLAG_INTERLEAVED : 0;
+		audioIn.resize(frames * channels);
+		for(unsigned int n = 0; n < audioIn.size(); ++n)
+			audioIn[n] = n;
+		audioOut.resize(frames * channels);
+		analogIn = audioIn;
+		analogOut.resize(frames * channels);
+		analogOutPending.resize(channels);
+		ctx.audioIn = audioIn.data();
+		ctx.audioOut = audioOut.data();
+		ctx.analogIn = analogIn.data();
+		ctx.analogOut = analogOut.data();
+		ctx.analogOutPending = pending ? analogOutPending.data() : nullptr;
+	}
+	BelaContext* get() { return (BelaContext*)&ctx; }
+	InternalBelaContext ctx;
+	std::vector<float> audioIn;
+	std::vector<float> audioOut;
+	std::vector<float> analogIn;
+	std::vector<float> analogOut;
+	std::vector<BelaAnalogOutPending> analogOutPending;
+};
+
+static bool testOps()
+{
+	// not NaN, which -ffast-math assumes never happens
+	const float kUntouched = -1000;
+	for(unsigned int dstStride : { 1, 2, 3, 8 })
+	{
+		for(unsigned int srcStride : { 1, 2, 3, 8 })
+		{
+			for(unsigned int count = 0; count < 19; ++count)
+			{
+				// offset by one to check unaligned accesses
+				std::vector<float> src(1 + count * srcStride);
+				std::vector<float> dst(1 + count * dstStride, kUntouched);
+				for(unsigned int n = 0; n < src.size(); ++n)
+					src[n] = n;
+				BelaChannelOps::copy(dst.data() + 1, dstStride, src.data() + 1, srcStride, count);
+				for(unsigned int n = 0; n < dst.size(); ++n)
+				{
+					if(n && 0 == (n - 1) % dstStride)
+						assert(dst[n] == src[1 + (n - 1) / dstStride * srcStride]);
+					else
+						assert(kUntouched == dst[n]); // other channels untouched
+				}
+			}
+		}
+		for(unsigned int count = 0; count < 19; ++count)
+		{
+			std::vector<float> dst(1 + count * dstStride, kUntouched);
+			BelaChannelOps::fill(dst.data() + 1, dstStride, count, 0.5);
+			for(unsigned int n = 0; n < dst.size(); ++n)
+				assert((n && 0 == (n - 1) % dstStride) ? 0.5 == dst[n] : kUntouched == dst[n]);
+			dst.assign(dst.size(), kUntouched);
+			BelaChannelOps::ramp(dst.data() + 1, dstStride, count, 1, -1);
+			for(unsigned int n = 0; n < dst.size(); ++n)
+			{
+				if(n && 0 == (n - 1) % dstStride)
+				{
+					unsigned int frame = (n - 1) / dstStride;
+					assert(fabsf(dst[n] - (1 - 2.f * (frame + 1) / count)) < 1e-6);
+				} else
+					assert(kUntouched == dst[n]);
+			}
+			if(count)
+				assert(-1 == dst[1 + (count - 1) * dstStride]);
+		}
+	}
+	// channel 1 of an interleaved stereo buffer, as returned by
+	// audioOutChannel(context, 1), ends at the end of the buffer
+	for(unsigned int count = 0; count < 19; ++count)
+	{
+		std::vector<float> stereo(2 * count, kUntouched);
+		std::vector<float> mono(count);
+		for(unsigned int n = 0; n < count; ++n)
+			mono[n] = n;
+		BelaChannelView right(stereo.data() + 1, count, 2);
+		right.write(0, mono.data(), count);
+		for(unsigned int n = 0; n < stereo.size(); ++n)
+			assert((n & 1) ? n / 2 == stereo[n] : kUntouched == stereo[n]);
+		std::vector<float> back(count, kUntouched);
+		right.read(back.data(), 0, count);
+		assert(back == mono);
+	}
+	return true;
+}
+
+// analogWrite() and analogWriteOnce() as they were before the values
+// were left pending
+static void referenceAnalogWrite(std::vector<float>& out, bool interleaved, unsigned int frames, unsigned int channels, unsigned int frame, unsigned int channel, float value, bool once)
+{
+	for(unsigned int f = frame; f < (once ? frame + 1 : frames); ++f)
+		out[interleaved ? f * channels + channel : channel * frames + f] = value;
+}
+
+static bool testAnalogWrite()
+{
+	const unsigned int frames = 16;
+	const unsigned int channels = 4;
+	srand(0);
+	for(bool interleaved : { true, false })
+	{
+		for(bool pending : { true, false })
+		{
+			ChannelTestContext tc(interleaved, frames, channels, pending);
+			BelaContext* context = tc.get();
+			std::vector<float> expected(frames * channels);
+			for(unsigned int block = 0; block < 200; ++block)
+			{
+				// random writes, in and out of order, including some past
+				// the end of the block
+				for(unsigned int n = 0; n < 12; ++n)
+				{
+					unsigned int frame = rand() % (frames + 2);
+					unsigned int channel = rand() % channels;
+					float value = rand() % 100;
+					bool once = !(rand() % 3);
+					if(once && frame >= frames)
+						continue;
+					if(interleaved)
+						once ? analogWriteOnce(context, frame, channel, value) : analogWrite(context, frame, channel, value);
+					else
+						once ? analogWriteOnceNI(context, frame, channel, value) : analogWriteNI(context, frame, channel, value);
+					referenceAnalogWrite(expected, interleaved, frames, channels, frame, channel, value, once);
+				}
+				if(block % 5 == 0)
+				{
+					// writing through a view comes after what is pending
+					unsigned int channel = rand() % channels;
+					float value = rand() % 100;
+					analogOutChannel(context, channel).fill(frames / 2, frames / 2, value);
+					for(unsigned int f = frames / 2; f < frames; ++f)
+						referenceAnalogWrite(expected, interleaved, frames, channels, f, channel, value, true);
+				}
+				analogWriteFlush(context);
+				assert(tc.analogOut == expected);
+			}
+			// writing every frame of a channel
+			for(unsigned int f = 0; f < frames; ++f)
+				interleaved ? analogWrite(context, f, 1, f) : analogWriteNI(context, f, 1, f);
+			analogWriteFlush(context);
+			for(unsigned int f = 0; f < frames; ++f)
+				assert(f == analogOutChannel(context, 1)[f]);
+		}
+	}
+	return true;
+}
+
+static bool testViews()
+{
+	for(bool interleaved : { true, false })
+	{
+		ChannelTestContext tc(interleaved, 8, 3, true);
+		BelaContext* context = tc.get();
+		for(unsigned int c = 0; c < context->audioOutChannels; ++c)
+		{
+			BelaConstChannelView in = audioInChannel(context, c);
+			BelaChannelView out = audioOutChannel(context, c);
+			assert(in.size() == context->audioFrames);
+			for(unsigned int n = 0; n < in.size(); ++n)
+			{
+				assert(in[n] == (interleaved ? audioRead(context, n, c) : audioReadNI(context, n, c)));
+				assert(analogInChannel(context, c)[n] == (interleaved ? analogRead(context, n, c) : analogReadNI(context, n, c)));
+			}
+			out.write(0, in, 0, in.size());
+			float buffer[8];
+			in.read(buffer, 0, 8);
+			for(unsigned int n = 0; n < 8; ++n)
+				assert(buffer[n] == in[n]);
+		}
+		assert(tc.audioOut == tc.audioIn);
+	}
+	return true;
+}
+
+bool BelaChannelOps::test()
+{
+	assert(testOps());
+	assert(testAnalogWrite());
+	assert(testViews());
+	return true;
+}
+
+#include <time.h>
+
+static double benchmarkNow()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts); // NOWRAP
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+// every analog output written with analogWrite() at every frame
+static double benchmarkAnalogWrite(bool pending, unsigned int frames, unsigned int iterations)
+{
+	ChannelTestContext tc(true, frames, 8, pending);
+	BelaContext* context = tc.get();
+	double start = benchmarkNow();
+	for(unsigned int i = 0; i < iterations; ++i)
+	{
+		for(unsigned int n = 0; n < context->analogFrames; ++n)
+			for(unsigned int c = 0; c < context->analogOutChannels; ++c)
+				analogWrite(context, n, c, n * c * 0.01f);
+		analogWriteFlush(context);
+	}
+	return (benchmarkNow() - start) / iterations;
+}
+
+void BelaChannelOps::benchmark()
+{
+	const unsigned int iterations = 100000;
+	for(unsigned int frames : { 8, 16, 64 })
+	{
+		double before = benchmarkAnalogWrite(false, frames, iterations);
+		double after = benchmarkAnalogWrite(true, frames, iterations);
+		printf("BelaChannelOps: analogWrite() on every frame, 8 channels, %u frames: filling to the end %.0fns, pending %.0fns per block\n",
+			frames, before * 1e9, after * 1e9);
+	}
+	// a ramp on an audio channel, non-interleaved and interleaved stereo,
+	// written through a view one sample at a time or as a block
+	for(unsigned int stride : { 1, 2 })
+	{
+		const unsigned int frames = 128;
+		std::vector<float> buffer(frames * 2);
+		volatile unsigned int runtimeStride = stride;
+		BelaChannelView view(buffer.data(), frames, runtimeStride);
+		double start = benchmarkNow();
+		for(unsigned int i = 0; i < iterations; ++i)
+		{
+			float from = i & 1;
+			float step = 1.f / frames;
+			for(unsigned int n = 0; n < view.size(); ++n)
+				view[n] = from + step * (n + 1);
+		}
+		double scalar = benchmarkNow() - start;
+		start = benchmarkNow();
+		for(unsigned int i = 0; i < iterations; ++i)
+			view.ramp(0, view.size(), i & 1, (i & 1) + 1);
+		double block = benchmarkNow() - start;
+		printf("BelaChannelOps: ramp, %u frames, stride %u: per-sample %.0fns, ramp() %.0fns per block\n",
+			frames, stride, scalar / iterations * 1e9, block / iterations * 1e9);
+	}
+}
@@ -1,39 +1,115 @@
 #include <BelaContextFifo.h>
+#include <algorithm>
+#include <errno.h>
 
 BelaContext* BelaContextFifo::setup(const BelaContext* context, unsigned int factor)
 {
-	this->factor = factor;
-	for(auto& bcs : bcss[kToLong])
-		bcs.setup(factor, 1, context);
+	return setup(context, &factor, 1, factor);
+}
+
+BelaContext* BelaContextFifo::setup(const BelaContext* context, const unsigned int* newFactors, unsigned int newNumFactors, unsigned int initialFactor)
+{
+	if(!newNumFactors || newNumFactors > kMaxFactors)
+		return nullptr;
+	numFactors = newNumFactors;
+	unsigned int maxFactor = 1;
+	for(unsigned int n = 0; n < numFactors; ++n)
+	{
+		factors[n] = newFactors[n];
+		if(!factors[n])
+			return nullptr;
+		maxFactor = std::max(maxFactor, factors[n]);
+	}
+	current = findMode(initialFactor);
+	if(current >= numFactors)
+		return nullptr;
+	shortFrames = context->audioFrames;
+
+	for(unsigned int m = 0; m < numFactors; ++m)
+	{
+		unsigned int factor = factors[m];
+		Mode& mode = modes[m];
+		for(auto& bcs : mode.bcss[kToLong])
+			bcs.setup(factor, 1, context);
 
-	BelaContext cctx = *context;
-	InternalBelaContext* ctx = (InternalBelaContext*)&cctx;
-	ctx->audioFrames *= factor;
-	ctx->analogFrames *= factor;
-	ctx->digitalFrames *= factor;
+		BelaContext cctx = *context;
+		InternalBelaContext* ctx = (InternalBelaContext*)&cctx;
+		ctx->audioFrames *= factor;
+		ctx->analogFrames *= factor;
+		ctx->digitalFrames *= factor;
 
-	for(auto& bcs : bcss[kToShort])
-		bcs.setup(1, factor, (BelaContext*)ctx);
+		for(auto& bcs : mode.bcss[kToShort])
+			bcs.setup(1, factor, (BelaContext*)ctx);
+		mode.counts.fill(0);
+	}
 
-	if(dfs[kToLong].setup("/toLong", sizeof(BelaContext*), factor * kNumBuffers, 1))
+	// while switching, the contexts of the old and new factor may both be
+	// in the fifos
+	if(dfs[kToLong].setup("/toLong", sizeof(BelaContext*), maxFactor * kNumBuffers * 2, 1))
 	{
 		printf("couldn't create queue\n");
 		return nullptr;
 	}
-	if(dfs[kToShort].setup("/toShort", sizeof(BelaContext*), factor * kNumBuffers, 0))
+	if(dfs[kToShort].setup("/toShort", sizeof(BelaContext*), maxFactor * kNumBuffers * 2, 0))
 	{
 		printf("couldn't create queue\n");
 		return nullptr;
 	}
 
-	counts.fill(0);
-	return bcss[kToLong][0].getContext();
+	requested = current.load();
+	draining = false;
+	pushedInLong = 0;
+	outstanding = 0;
+	return modes[current].bcss[kToLong][0].getContext();
+}
+
+int BelaContextFifo::requestFactor(unsigned int factor)
+{
+	unsigned int mode = findMode(factor);
+	if(mode >= numFactors)
+		return EINVAL;
+	requested = mode;
+	return 0;
+}
+
+unsigned int BelaContextFifo::findMode(unsigned int factor)
+{
+	for(unsigned int m = 0; m < numFactors; ++m)
+		if(factors[m] == factor)
+			return m;
+	return numFactors;
 }
 
 void BelaContextFifo::push(fifo_id_t fifo, const BelaContext* context)
 {
-	unsigned int& count = counts[fifo];
-	BelaContextSplitter& bcs = bcss[fifo][getCurrentBuffer(fifo)];
+	unsigned int m;
+	if(kToLong == fifo)
+	{
+		if(!pushedInLong && requested != current)
+			draining = true;
+		if(draining)
+		{
+			// the inputs are discarded until all the long contexts
+			// of the old factor have come back
+			if(outstanding)
+				return;
+			current = requested.load();
+			draining = false;
+		}
+		if(isDirect())
+			return;
+		m = current;
+		pushedInLong = (pushedInLong + 1) % factors[m];
+		++outstanding;
+	} else {
+		// contexts come back in the order they were sent, possibly
+		// with the factor used before a switch
+		m = findMode(context->audioFrames / shortFrames);
+		if(m >= numFactors)
+			return;
+	}
+	unsigned int& count = modes[m].counts[fifo];
+	BelaContextSplitter& bcs = modes[m].bcss[fifo][getCurrentBuffer(fifo, m)];
 	DataFifo& df = dfs[fifo];
 
 	bcs.push(context);
@@ -52,15 +128,17 @@ BelaContext* BelaContextFifo::pop(fifo_id_t fifo, double timeoutMs)
 	size_t ret = df.receive((char*)&ctx, timeoutMs);
 	if(sizeof(BelaContext*) != ret)
 		ctx = nullptr;
+	if(ctx && kToShort == fifo)
+		--outstanding;
 	return ctx;
 }
 
-unsigned int BelaContextFifo::getCurrentBuffer(fifo_id_t fifo)
+unsigned int BelaContextFifo::getCurrentBuffer(fifo_id_t fifo, unsigned int m)
 {
 	if(kToLong == fifo)
-		return counts[fifo] % kNumBuffers;
+		return modes[m].counts[fifo] % kNumBuffers;
 	else
-		return (counts[fifo] / factor) % kNumBuffers;
+		return (modes[m].counts[fifo] / factors[m]) % kNumBuffers;
 }
 
 #undef NDEBUG
@@ -132,5 +210,76 @@ bool BelaContextFifo::test()
 		assert(BelaContextSplitter::contextEqual(&recCtxs[n], &sentCtxs[n]));
 	}
 
+	// switching between factors
+	{
+		const unsigned int factors[] = { 1, 2, 4 };
+		BelaContextFifo bcf;
+		assert(!bcf.setup((BelaContext*)&ctx, factors, 3, 3));
+		assert(bcf.setup((BelaContext*)&ctx, factors, 3, 2));
+		assert(2 == bcf.getFactor() && !bcf.isDirect());
+		assert(EINVAL == bcf.requestFactor(8));
+
+		InternalBelaContext sent = ctx;
+		BelaContextSplitter::contextAllocate(&sent);
+		InternalBelaContext received = ctx;
+		BelaContextSplitter::contextAllocate(&received);
+		InternalBelaContext expected = ctx;
+		BelaContextSplitter::contextAllocate(&expected);
+		const struct {
+			unsigned int block;
+			unsigned int factor;
+		} requests[] = {
+			{ 10, 4 },
+			{ 30, 1 },
+			{ 50, 2 },
+			{ 70, 4 },
+		};
+		unsigned int nextRequest = 0;
+		unsigned int lastStart = 0;
+		unsigned int longFrames = 2 * ctx.audioFrames;
+		unsigned int direct = 0;
+		unsigned int switches = 0;
+		for(unsigned int n = 1; n < 100; ++n)
+		{
+			if(nextRequest < sizeof(requests) / sizeof(requests[0]) && requests[nextRequest].block == n)
+				assert(0 == bcf.requestFactor(requests[nextRequest++].factor));
+			// long thread: the contexts sent in the previous block
+			// are rendered now
+			BelaContext* context;
+			while((context = bcf.pop(kToLong, 0.01)))
+			{
+				if(longFrames != context->audioFrames)
+					++switches;
+				longFrames = context->audioFrames;
+				bcf.push(kToShort, context);
+			}
+			// short thread
+			contextFill(&sent, n * ctx.audioFrames);
+			bcf.push(kToLong, (BelaContext*)&sent);
+			if(bcf.isDirect())
+			{
+				++direct;
+				continue;
+			}
+			const InternalBelaContext* rctx = (InternalBelaContext*)bcf.pop(kToShort);
+			if(!rctx)
+				continue;
+			// the contexts come back in order, with the ones that
+			// arrived while switching missing
+			BelaContextSplitter::contextCopy(rctx, &received);
+			unsigned int start = received.audioIn[0];
+			assert(start > lastStart && !(start % ctx.audioFrames));
+			lastStart = start;
+			contextFill(&expected, start);
+			assert(BelaContextSplitter::contextEqual(&received, &expected));
+		}
+		assert(nextRequest == sizeof(requests) / sizeof(requests[0]));
+		assert(4 == bcf.getFactor());
+		// 2 -> 4, then 1 -> 2 -> 4
+		assert(3 == switches);
+		// from the end of the switch to 1 until the request for 2
+		assert(direct > 10 && direct < 20);
+	}
+
 	return true;
 }
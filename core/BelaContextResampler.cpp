@@ -0,0 +1,405 @@
+/***** BelaContextResampler.cpp *****/
+#include <BelaContextResampler.h>
+#include <math.h>
+#include <string.h>
+#include <errno.h>
+#include "../include/xenomai_wraps.h"
+
+// Sample c of frame n of a buffer is at n * frameStride + c * channelStride
+static unsigned int frameStride(bool interleaved, unsigned int channels)
+{
+	return interleaved ? channels : 1;
+}
+
+static unsigned int channelStride(bool interleaved, unsigned int frames)
+{
+	return interleaved ? 1 : frames;
+}
+
+// Read frames into a buffer, filling those that are not available yet
+// with zeros. Returns whether they were all available.
+static bool readOrZero(Resampler& resampler, float* out, unsigned int frames, unsigned int channels, bool interleaved)
+{
+	unsigned int read = resampler.read(out, frames, frameStride(interleaved, channels), channelStride(interleaved, frames));
+	if(read == frames)
+		return true;
+	if(interleaved)
+		memset(out + read * channels, 0, (frames - read) * channels * sizeof(float));
+	else
+		for(unsigned int c = 0; c < channels; ++c)
+			memset(out + c * frames + read, 0, (frames - read) * sizeof(float));
+	return false;
+}
+
+BelaContext* BelaContextResampler::setup(const BelaContext* context, unsigned int sampleRate, unsigned int frames, bool uniformSampleRate)
+{
+	const InternalBelaContext* hw = (const InternalBelaContext*)context;
+	if(!hw || !sampleRate || !frames || !hw->audioFrames)
+		return nullptr;
+	unsigned int hwRate = lrintf(hw->audioSampleRate);
+	bool hasAnalog = hw->analogFrames && (hw->analogInChannels || hw->analogOutChannels);
+	// the analog channels run at the audio rate, or keep their ratio to
+	// the audio ones, which must give a whole number of frames per block
+	unsigned int analogFrames = 0;
+	unsigned int analogRate = 0;
+	if(hasAnalog && uniformSampleRate)
+	{
+		analogFrames = frames;
+		analogRate = sampleRate;
+	} else if(hasAnalog) {
+		analogFrames = frames * hw->analogFrames / hw->audioFrames;
+		if(analogFrames * hw->audioFrames != frames * hw->analogFrames)
+		{
+			fprintf(stderr, "BelaContextResampler: %u frames per block do not give a whole number of analog frames\n", frames);
+			return nullptr;
+		}
+		analogRate = (uint64_t)sampleRate * hw->analogFrames / hw->audioFrames;
+	}
+	unsigned int hwAnalogRate = lrintf(hw->analogSampleRate);
+
+	userContext = *hw;
+	userContext.audioFrames = frames;
+	userContext.audioSampleRate = sampleRate;
+	userContext.analogFrames = analogFrames;
+	userContext.analogSampleRate = analogRate;
+	if(!hasAnalog)
+	{
+		userContext.analogInChannels = 0;
+		userContext.analogOutChannels = 0;
+	}
+	userContext.digitalFrames = 0;
+	userContext.digitalChannels = 0;
+	userContext.digitalSampleRate = 0;
+	userContext.digital = nullptr;
+	userContext.multiplexerChannels = 0;
+	userContext.multiplexerStartingChannel = 0;
+	userContext.multiplexerAnalogIn = nullptr;
+	userContext.audioFramesElapsed = 0;
+
+	audioIn.assign(frames * hw->audioInChannels, 0);
+	audioOut.assign(frames * hw->audioOutChannels, 0);
+	analogIn.assign(analogFrames * userContext.analogInChannels, 0);
+	analogOut.assign(analogFrames * userContext.analogOutChannels, 0);
+	userContext.audioIn = audioIn.data();
+	userContext.audioOut = audioOut.data();
+	userContext.analogIn = analogIn.data();
+	userContext.analogOut = analogOut.data();
+	analogOutPending.assign(userContext.analogOutChannels, BelaAnalogOutPending());
+	userContext.analogOutPending = analogOutPending.data();
+
+	// render() is called once a whole block of inputs is available, which
+	// may take up to a hardware block longer than the block itself.
+	// Meanwhile the hardware outputs are taken from silence primed here,
+	// plus a little more to absorb the rounding of the number of frames
+	// available each time.
+	const unsigned int kSlack = 2;
+	unsigned int hwFramesInUser = ((uint64_t)hw->audioFrames * sampleRate + hwRate - 1) / hwRate;
+	unsigned int primeFrames = frames + hwFramesInUser + kSlack;
+	unsigned int primeAnalogFrames = hasAnalog ? primeFrames * analogFrames / frames + kSlack : 0;
+	// before they are read, the outputs may receive as many blocks as it
+	// takes to consume the inputs of one hardware block
+	unsigned int maxOutFrames = 2 * primeFrames;
+	unsigned int maxOutAnalogFrames = 2 * primeAnalogFrames;
+	// the inputs may hold almost a block that was not rendered yet when
+	// the next hardware block is written
+	unsigned int userFramesInHw = ((uint64_t)frames * hwRate + sampleRate - 1) / sampleRate;
+	unsigned int maxInFrames = hw->audioFrames + userFramesInHw + kSlack;
+	unsigned int maxInAnalogFrames = hasAnalog ? maxInFrames * hw->analogFrames / hw->audioFrames + kSlack : 0;
+	struct {
+		Resampler& resampler;
+		unsigned int channels;
+		unsigned int inRate;
+		unsigned int outRate;
+		unsigned int maxFrames;
+		unsigned int primeFrames;
+	} streams[] = {
+		{ audioInResampler, hw->audioInChannels, hwRate, sampleRate, maxInFrames, 0 },
+		{ audioOutResampler, hw->audioOutChannels, sampleRate, hwRate, maxOutFrames, primeFrames },
+		{ analogInResampler, userContext.analogInChannels, hwAnalogRate, analogRate, maxInAnalogFrames, 0 },
+		{ analogOutResampler, userContext.analogOutChannels, analogRate, hwAnalogRate, maxOutAnalogFrames, primeAnalogFrames },
+	};
+	for(auto& s : streams)
+	{
+		if(!s.channels)
+			continue;
+		if(s.resampler.setup(s.channels, s.inRate, s.outRate, s.maxFrames))
+		{
+			fprintf(stderr, "BelaContextResampler: unable to resample from %u to %u\n", s.inRate, s.outRate);
+			return nullptr;
+		}
+		std::vector<float> zeros(s.primeFrames * s.channels);
+		s.resampler.write(zeros.data(), s.primeFrames, s.channels, 1);
+	}
+	latencyMs = (primeFrames + audioOutResampler.getDelay()) * 1000.f / sampleRate
+		+ audioInResampler.getDelay() * 1000.f / hwRate;
+	blocks = 0;
+	underruns = 0;
+	conversionNsSum = 0;
+	lastConversionNs = 0;
+	maxConversionNs = 0;
+	return (BelaContext*)&userContext;
+}
+
+void BelaContextResampler::process(BelaContext* context, void (*render)(BelaContext*, void*), void* userData)
+{
+	InternalBelaContext* hw = (InternalBelaContext*)context;
+	InternalBelaContext& user = userContext;
+	bool interleaved = hw->flags & BELA_FLAG_INTERLEAVED;
+	uint64_t start = task_time_ns();
+	uint64_t renderNs = 0;
+
+	audioInResampler.write(hw->audioIn, hw->audioFrames, frameStride(interleaved, hw->audioInChannels), channelStride(interleaved, hw->audioFrames));
+	if(user.analogInChannels)
+		analogInResampler.write(hw->analogIn, hw->analogFrames, frameStride(interleaved, hw->analogInChannels), channelStride(interleaved, hw->analogFrames));
+	while(audioInResampler.getAvailable() >= user.audioFrames
+		&& (!user.analogInChannels || analogInResampler.getAvailable() >= user.analogFrames))
+	{
+		audioInResampler.read(user.audioIn, user.audioFrames, frameStride(interleaved, user.audioInChannels), channelStride(interleaved, user.audioFrames));
+		if(user.analogInChannels)
+			analogInResampler.read(user.analogIn, user.analogFrames, frameStride(interleaved, user.analogInChannels), channelStride(interleaved, user.analogFrames));
+		memset(user.audioOut, 0, audioOut.size() * sizeof(float));
+		if(user.analogOutChannels)
+		{
+			if(user.flags & BELA_FLAG_ANALOG_OUTPUTS_PERSIST)
+			{
+				// start from the last values of the previous block
+				unsigned int last = user.analogFrames - 1;
+				for(unsigned int c = 0; c < user.analogOutChannels; ++c)
+				{
+					float* ch = user.analogOut + c * channelStride(interleaved, user.analogFrames);
+					unsigned int stride = frameStride(interleaved, user.analogOutChannels);
+					float value = ch[last * stride];
+					for(unsigned int n = 0; n < last; ++n)
+						ch[n * stride] = value;
+				}
+			}
+			else
+				memset(user.analogOut, 0, analogOut.size() * sizeof(float));
+		}
+		uint64_t renderStart = task_time_ns();
+		render((BelaContext*)&user, userData);
+		analogWriteFlush((BelaContext*)&user);
+		renderNs += task_time_ns() - renderStart;
+		user.audioFramesElapsed += user.audioFrames;
+		audioOutResampler.write(user.audioOut, user.audioFrames, frameStride(interleaved, user.audioOutChannels), channelStride(interleaved, user.audioFrames));
+		if(user.analogOutChannels)
+			analogOutResampler.write(user.analogOut, user.analogFrames, frameStride(interleaved, user.analogOutChannels), channelStride(interleaved, user.analogFrames));
+	}
+	bool complete = readOrZero(audioOutResampler, hw->audioOut, hw->audioFrames, hw->audioOutChannels, interleaved);
+	if(user.analogOutChannels)
+		complete &= readOrZero(analogOutResampler, hw->analogOut, hw->analogFrames, hw->analogOutChannels, interleaved);
+
+	uint32_t conversionNs = task_time_ns() - start - renderNs;
+	++blocks;
+	underruns += !complete;
+	conversionNsSum += conversionNs;
+	lastConversionNs = conversionNs;
+	if(conversionNs > maxConversionNs)
+		maxConversionNs = conversionNs;
+}
+
+BelaContextResampler::Stats BelaContextResampler::getStats() const
+{
+	Stats stats;
+	stats.blocks = blocks;
+	stats.underruns = underruns;
+	stats.lastConversionUs = lastConversionNs / 1000.f;
+	stats.meanConversionUs = blocks ? conversionNsSum / 1000.f / blocks : 0;
+	stats.maxConversionUs = maxConversionNs / 1000.f;
+	return stats;
+}
+
+#undef NDEBUG
+#include <assert.h>
+
+namespace {
+struct TestState {
+	double phase;
+	double frequency;
+	unsigned int renders;
+	uint64_t framesElapsed;
+	unsigned int analogFrames;
+};
+}
+
+// write a sine wave at the rate of the context, on all outputs
+static void testRender(BelaContext* context, void* userData)
+{
+	TestState& state = *(TestState*)userData;
+	assert(context->audioFramesElapsed == state.framesElapsed);
+	assert(context->analogFrames == state.analogFrames);
+	state.framesElapsed += context->audioFrames;
+	++state.renders;
+	bool interleaved = context->flags & BELA_FLAG_INTERLEAVED;
+	for(unsigned int n = 0; n < context->audioFrames; ++n)
+	{
+		float value = 0.5f * sin(state.phase);
+		state.phase += 2 * M_PI * state.frequency / context->audioSampleRate;
+		for(unsigned int c = 0; c < context->audioOutChannels; ++c)
+			interleaved ? audioWrite(context, n, c, value) : audioWriteNI(context, n, c, value);
+		// the analog channels run at half the rate
+		if(context->analogFrames && !(n & 1))
+			for(unsigned int c = 0; c < context->analogOutChannels; ++c)
+				interleaved ? analogWriteOnce(context, n / 2, c, value) : analogWriteOnceNI(context, n / 2, c, value);
+	}
+}
+
+namespace {
+struct PeakState {
+	unsigned int renders;
+	float peak;
+};
+}
+
+// measure the peak of the analog inputs, after the start of the filter's
+// response
+static void peakRender(BelaContext* context, void* userData)
+{
+	PeakState& state = *(PeakState*)userData;
+	if(++state.renders < 10)
+		return;
+	for(unsigned int n = 0; n < context->analogFrames * context->analogInChannels; ++n)
+		state.peak = fmaxf(state.peak, fabsf(context->analogIn[n]));
+}
+
+bool BelaContextResampler::test()
+{
+	for(bool interleaved : { true, false })
+	for(unsigned int hwFrames : { 16, 32, 128 })
+	for(unsigned int userFrames : { 16, 64, 96 })
+	{
+		const unsigned int kHwRate = 44100;
+		const unsigned int kUserRate = 48000;
+		const unsigned int kChannels = 2;
+		InternalBelaContext hw;
+		memset((void*)&hw, 0, sizeof(hw));
+		hw.audioFrames = hwFrames;
+		hw.audioSampleRate = kHwRate;
+		hw.audioInChannels = kChannels;
+		hw.audioOutChannels = kChannels;
+		hw.analogFrames = hwFrames / 2;
+		hw.analogSampleRate = kHwRate / 2;
+		hw.analogInChannels = 8;
+		hw.analogOutChannels = 8;
+		hw.digitalFrames = hwFrames;
+		hw.digitalChannels = 16;
+		hw.flags = interleaved ? BELA_FLAG_INTERLEAVED : 0;
+		std::vector<float> hwAudioIn(hwFrames * kChannels);
+		std::vector<float> hwAudioOut(hwFrames * kChannels);
+		std::vector<float> hwAnalogIn(hw.analogFrames * 8);
+		std::vector<float> hwAnalogOut(hw.analogFrames * 8);
+		hw.audioIn = hwAudioIn.data();
+		hw.audioOut = hwAudioOut.data();
+		hw.analogIn = hwAnalogIn.data();
+		hw.analogOut = hwAnalogOut.data();
+
+		BelaContextResampler resampler;
+		BelaContext* user = resampler.setup((BelaContext*)&hw, kUserRate, userFrames);
+		assert(user);
+		assert(userFrames == user->audioFrames);
+		assert(kUserRate == user->audioSampleRate);
+		assert(userFrames / 2 == user->analogFrames);
+		assert(kUserRate / 2 == user->analogSampleRate);
+		assert(0 == user->digitalChannels && 0 == user->digitalFrames);
+
+		// the user's sine wave comes out of the hardware at the same
+		// frequency
+		TestState state = { 0, 1000, 0, 0, userFrames / 2 };
+		const unsigned int kBlocks = kHwRate / hwFrames / 2;
+		double hwPhase = 0;
+		float maxError = 0;
+		// the inputs are not used here, so only the outputs delay the
+		// sine wave
+		double latency = resampler.getLatencyMs() / 1000.0 - resampler.audioInResampler.getDelay() / kHwRate;
+		unsigned int skipFrames = latency * kHwRate + 64;
+		for(unsigned int b = 0; b < kBlocks; ++b)
+		{
+			resampler.process((BelaContext*)&hw, testRender, &state);
+			for(unsigned int n = 0; n < hwFrames; ++n)
+			{
+				unsigned int frame = b * hwFrames + n;
+				hwPhase = 2 * M_PI * state.frequency * ((double)frame / kHwRate - latency);
+				if(frame < skipFrames)
+					continue;
+				float expected = 0.5f * sin(hwPhase);
+				for(unsigned int c = 0; c < kChannels; ++c)
+				{
+					float actual = interleaved ? hwAudioOut[n * kChannels + c] : hwAudioOut[c * hwFrames + n];
+					float error = fabsf(actual - expected);
+					if(error > maxError)
+						maxError = error;
+				}
+			}
+		}
+		Stats stats = resampler.getStats();
+		assert(kBlocks == stats.blocks);
+		assert(0 == stats.underruns);
+		// render() was called at the user's block rate
+		float expectedRenders = (float)kBlocks * hwFrames * kUserRate / kHwRate / userFrames;
+		assert(fabsf(state.renders - expectedRenders) <= 2);
+		assert(maxError < 0.001f);
+	}
+	// with a uniform sample rate, analog inputs at twice the audio rate
+	// are lowpass filtered before being decimated
+	for(bool interleaved : { true, false })
+	for(double frequency : { 1000., 30000. })
+	{
+		const unsigned int kRate = 44100;
+		const unsigned int kFrames = 32;
+		const unsigned int kChannels = 4;
+		InternalBelaContext hw;
+		memset((void*)&hw, 0, sizeof(hw));
+		hw.audioFrames = kFrames;
+		hw.audioSampleRate = kRate;
+		hw.audioInChannels = 2;
+		hw.audioOutChannels = 2;
+		hw.analogFrames = kFrames * 2;
+		hw.analogSampleRate = kRate * 2;
+		hw.analogInChannels = kChannels;
+		hw.flags = interleaved ? BELA_FLAG_INTERLEAVED : 0;
+		std::vector<float> hwAudioIn(kFrames * 2);
+		std::vector<float> hwAudioOut(kFrames * 2);
+		std::vector<float> hwAnalogIn(hw.analogFrames * kChannels);
+		hw.audioIn = hwAudioIn.data();
+		hw.audioOut = hwAudioOut.data();
+		hw.analogIn = hwAnalogIn.data();
+
+		BelaContextResampler resampler;
+		BelaContext* user = resampler.setup((BelaContext*)&hw, kRate, kFrames, true);
+		assert(user);
+		assert(kFrames == user->analogFrames);
+		assert(kRate == user->analogSampleRate);
+		PeakState peak = { 0, 0 };
+		for(unsigned int b = 0; b < 100; ++b)
+		{
+			for(unsigned int n = 0; n < hw.analogFrames; ++n)
+			{
+				unsigned int frame = b * hw.analogFrames + n;
+				float value = 0.5f * sin(2 * M_PI * frequency * frame / hw.analogSampleRate);
+				for(unsigned int c = 0; c < kChannels; ++c)
+					hwAnalogIn[interleaved ? n * kChannels + c : c * hw.analogFrames + n] = value;
+			}
+			resampler.process((BelaContext*)&hw, peakRender, &peak);
+		}
+		if(frequency < kRate / 2)
+			assert(fabsf(peak.peak - 0.5f) < 0.01f);
+		else
+			// dropping every other frame would alias it to 14.1kHz
+			assert(peak.peak < 0.001f);
+	}
+	// blocks that do not give a whole number of analog frames
+	{
+		InternalBelaContext hw;
+		memset((void*)&hw, 0, sizeof(hw));
+		hw.audioFrames = 16;
+		hw.audioSampleRate = 44100;
+		hw.audioInChannels = 2;
+		hw.audioOutChannels = 2;
+		hw.analogFrames = 8;
+		hw.analogSampleRate = 22050;
+		hw.analogInChannels = 8;
+		BelaContextResampler resampler;
+		assert(!resampler.setup((BelaContext*)&hw, 48000, 15));
+	}
+	return true;
+}
@@ -146,6 +146,7 @@ void BelaContextSplitter::cleanup()
 		delete [] context.audioOut;
 		delete [] context.analogIn;
 		delete [] context.analogOut;
+		delete [] context.analogOutPending;
 		delete [] context.digital;
 	}
 	outContexts.clear();
@@ -184,6 +185,7 @@ bool BelaContextSplitter::contextEqual(const InternalBelaContext* ctx1, const In
 		c.audioOut = 0;
 		c.analogIn = 0;
 		c.analogOut = 0;
+		c.analogOutPending = 0;
 		c.digital = 0;
 	}
 	// compare values
@@ -209,6 +211,7 @@ void BelaContextSplitter::contextAllocate(InternalBelaContext* ctx)
 	ctx->audioOut = new float[ctx->audioFrames * ctx->audioOutChannels];
 	ctx->analogIn = new float[ctx->analogFrames * ctx->analogInChannels];
 	ctx->analogOut = new float[ctx->analogFrames * ctx->analogOutChannels];
+	ctx->analogOutPending = new BelaAnalogOutPending[ctx->analogOutChannels]();
 	ctx->digital = new uint32_t[ctx->digitalFrames];
 	ctx->multiplexerAnalogIn = nullptr; // TODO
 }
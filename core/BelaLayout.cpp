@@ -0,0 +1,256 @@
+#include <BelaLayout.h>
+#include <PRU.h> // InternalBelaContext
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+BelaLayoutInfo BelaLayoutInfo::get(const BelaContext* context)
+{
+	BelaLayoutInfo info;
+	info.audioFrames = context->audioFrames;
+	info.audioInChannels = context->audioInChannels;
+	info.audioOutChannels = context->audioOutChannels;
+	info.analogFrames = context->analogFrames;
+	info.analogInChannels = context->analogInChannels;
+	info.analogOutChannels = context->analogOutChannels;
+	info.digitalFrames = context->digitalFrames;
+	info.digitalChannels = context->digitalChannels;
+	info.interleaved = !!(context->flags & BELA_FLAG_INTERLEAVED);
+	return info;
+}
+
+bool BelaLayoutInfo::operator==(const BelaLayoutInfo& other) const
+{
+	return audioFrames == other.audioFrames
+		&& audioInChannels == other.audioInChannels
+		&& audioOutChannels == other.audioOutChannels
+		&& analogFrames == other.analogFrames
+		&& analogInChannels == other.analogInChannels
+		&& analogOutChannels == other.analogOutChannels
+		&& digitalFrames == other.digitalFrames
+		&& digitalChannels == other.digitalChannels
+		&& interleaved == other.interleaved;
+}
+
+int BelaLayoutInfo::writeHeader(const char* path) const
+{
+	char content[1024];
+	snprintf(content, sizeof(content),
+		"// Generated by Bela for make FIXED_LAYOUT=1: do not edit.\n"
+		"// It is rewritten when the project runs with a different layout.\n"
+		"#define BELA_LAYOUT_AUDIO_FRAMES %u\n"
+		"#define BELA_LAYOUT_AUDIO_IN_CHANNELS %u\n"
+		"#define BELA_LAYOUT_AUDIO_OUT_CHANNELS %u\n"
+		"#define BELA_LAYOUT_ANALOG_FRAMES %u\n"
+		"#define BELA_LAYOUT_ANALOG_IN_CHANNELS %u\n"
+		"#define BELA_LAYOUT_ANALOG_OUT_CHANNELS %u\n"
+		"#define BELA_LAYOUT_DIGITAL_FRAMES %u\n"
+		"#define BELA_LAYOUT_DIGITAL_CHANNELS %u\n"
+		"#define BELA_LAYOUT_INTERLEAVED %u\n",
+		audioFrames, audioInChannels, audioOutChannels,
+		analogFrames, analogInChannels, analogOutChannels,
+		digitalFrames, digitalChannels, interleaved);
+	FILE* f = fopen(path, "r");
+	if(f)
+	{
+		char existing[sizeof(content)];
+		size_t size = fread(existing, 1, sizeof(existing) - 1, f);
+		existing[size] = '\0';
+		fclose(f);
+		if(!strcmp(existing, content))
+			return 0;
+	}
+	f = fopen(path, "w");
+	if(!f || fputs(content, f) < 0)
+	{
+		int err = errno;
+		fprintf(stderr, "Unable to write the layout to %s: %s\n", path, strerror(err));
+		if(f)
+			fclose(f);
+		return -err;
+	}
+	fclose(f);
+	return 1;
+}
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <vector>
+
+// a context with the given layout, whose sizes the compiler can't see
+// through
+struct LayoutTestContext {
+	LayoutTestContext(const BelaLayoutInfo& info)
+	{
+		memset(&ctx, 0, sizeof(ctx));
+		volatile const BelaLayoutInfo* v = &info;
+		ctx.audioFrames = v->audioFrames;
+		ctx.audioInChannels = v->audioInChannels;
+		ctx.audioOutChannels = v->audioOutChannels;
+		ctx.analogFrames = v->analogFrames;
+		ctx.analogInChannels = v->analogInChannels;
+		ctx.analogOutChannels = v->analogOutChannels;
+		ctx.digitalFrames = v->digitalFrames;
+		ctx.digitalChannels = v->digitalChannels;
+		ctx.flags = v->interleaved ? BELA_FLAG_INTERLEAVED : 0;
+		audioIn.resize(ctx.audioFrames * ctx.audioInChannels);
+		audioOut.resize(ctx.audioFrames * ctx.audioOutChannels);
+		analogIn.resize(ctx.analogFrames * ctx.analogInChannels);
+		analogOut.resize(ctx.analogFrames * ctx.analogOutChannels);
+		digital.resize(ctx.digitalFrames);
+		for(unsigned int n = 0; n < audioIn.size(); ++n)
+			audioIn[n] = n;
+		for(unsigned int n = 0; n < analogIn.size(); ++n)
+			analogIn[n] = n;
+		for(unsigned int n = 0; n < digital.size(); ++n)
+			digital[n] = n << 16;
+		ctx.audioIn = audioIn.data();
+		ctx.audioOut = audioOut.data();
+		ctx.analogIn = analogIn.data();
+		ctx.analogOut = analogOut.data();
+		ctx.digital = digital.data();
+	}
+	BelaContext* get() { return (BelaContext*)&ctx; }
+	InternalBelaContext ctx;
+	std::vector<float> audioIn;
+	std::vector<float> audioOut;
+	std::vector<float> analogIn;
+	std::vector<float> analogOut;
+	std::vector<uint32_t> digital;
+};
+
+// the default layout of Bela, and a non-interleaved one
+typedef BelaLayoutT<BelaFixedDims<16, 2, 2, 8, 8, 8, 16, 16, true>> TestFixedLayout;
+typedef BelaLayoutT<BelaFixedDims<16, 2, 2, 8, 8, 8, 16, 16, false>> TestFixedLayoutNI;
+static const BelaLayoutInfo kTestLayout = { 16, 2, 2, 8, 8, 8, 16, 16, 1 };
+
+template <class Layout>
+static void testPassthrough(BelaContext* context)
+{
+	for(unsigned int n = 0; n < Layout::audioFrames(context); ++n)
+		for(unsigned int c = 0; c < Layout::audioOutChannels(context); ++c)
+			Layout::audioWrite(context, n, c, Layout::audioRead(context, n, c));
+	for(unsigned int n = 0; n < Layout::analogFrames(context); ++n)
+		for(unsigned int c = 0; c < Layout::analogOutChannels(context); ++c)
+			Layout::analogWriteOnce(context, n, c, Layout::analogRead(context, n, c));
+}
+
+template <class Layout>
+static void testSinetone(BelaContext* context, float& phase)
+{
+	for(unsigned int n = 0; n < Layout::audioFrames(context); ++n)
+	{
+		float out = 0.8f * sinf(phase);
+		phase += 2.0f * (float)M_PI * 440.f / 44100.f;
+		if(phase > M_PI)
+			phase -= 2.0f * (float)M_PI;
+		for(unsigned int c = 0; c < Layout::audioOutChannels(context); ++c)
+			Layout::audioWrite(context, n, c, out);
+	}
+}
+
+template <class Layout>
+static bool testAccessors(const BelaLayoutInfo& info)
+{
+	LayoutTestContext tc(info);
+	BelaContext* context = tc.get();
+	testPassthrough<Layout>(context);
+	assert(tc.audioOut == tc.audioIn);
+	assert(tc.analogOut == tc.analogIn);
+	// the same elements as the functions in Utilities.h
+	for(unsigned int n = 0; n < context->audioFrames; ++n)
+		for(unsigned int c = 0; c < context->audioInChannels; ++c)
+			assert(Layout::audioRead(context, n, c) == (info.interleaved ? audioRead(context, n, c) : audioReadNI(context, n, c)));
+	for(unsigned int n = 0; n < context->analogFrames; ++n)
+		for(unsigned int c = 0; c < context->analogInChannels; ++c)
+			assert(Layout::analogRead(context, n, c) == (info.interleaved ? analogRead(context, n, c) : analogReadNI(context, n, c)));
+	for(unsigned int n = 0; n < context->digitalFrames; ++n)
+		for(unsigned int c = 0; c < context->digitalChannels; ++c)
+			assert(Layout::digitalRead(context, n, c) == digitalRead(context, n, c));
+	Layout::analogWrite(context, 3, 1, -1);
+	for(unsigned int n = 0; n < context->analogFrames; ++n)
+	{
+		float out = tc.analogOut[info.interleaved ? n * context->analogOutChannels + 1 : context->analogFrames + n];
+		assert((-1 == out) == (n >= 3));
+	}
+	return true;
+}
+
+bool BelaLayoutInfo::test()
+{
+	assert(testAccessors<TestFixedLayout>(kTestLayout));
+	assert(testAccessors<BelaLayoutT<BelaRuntimeDims>>(kTestLayout));
+	BelaLayoutInfo ni = kTestLayout;
+	ni.interleaved = 0;
+	assert(testAccessors<TestFixedLayoutNI>(ni));
+	assert(testAccessors<BelaLayoutT<BelaRuntimeDims>>(ni));
+
+	LayoutTestContext tc(kTestLayout);
+	assert(get(tc.get()) == kTestLayout);
+	assert(get(tc.get()) != ni);
+
+	// only written when it changes
+	char path[] = "/tmp/BelaLayoutTestXXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+	assert(1 == kTestLayout.writeHeader(path));
+	assert(0 == kTestLayout.writeHeader(path));
+	assert(1 == ni.writeHeader(path));
+	FILE* f = fopen(path, "r");
+	char content[1024];
+	size_t size = fread(content, 1, sizeof(content) - 1, f);
+	content[size] = '\0';
+	fclose(f);
+	assert(strstr(content, "#define BELA_LAYOUT_AUDIO_FRAMES 16\n"));
+	assert(strstr(content, "#define BELA_LAYOUT_INTERLEAVED 0\n"));
+	unlink(path);
+	assert(kTestLayout.writeHeader("/nonexistent/BelaLayoutConfig.h") < 0);
+	return true;
+}
+
+#include <time.h>
+
+static double benchmarkNow()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts); // NOWRAP
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+template <class Layout>
+static double benchmarkPassthrough(unsigned int iterations)
+{
+	LayoutTestContext tc(kTestLayout);
+	double start = benchmarkNow();
+	for(unsigned int n = 0; n < iterations; ++n)
+		testPassthrough<Layout>(tc.get());
+	return (benchmarkNow() - start) / iterations;
+}
+
+template <class Layout>
+static double benchmarkSinetone(unsigned int iterations)
+{
+	LayoutTestContext tc(kTestLayout);
+	float phase = 0;
+	double start = benchmarkNow();
+	for(unsigned int n = 0; n < iterations; ++n)
+		testSinetone<Layout>(tc.get(), phase);
+	return (benchmarkNow() - start) / iterations;
+}
+
+void BelaLayoutInfo::benchmark()
+{
+	// the render() of the passthrough and sinetone examples with the
+	// default layout of Bela
+	const unsigned int iterations = 1000000;
+	double runtime = benchmarkPassthrough<BelaLayoutT<BelaRuntimeDims>>(iterations);
+	double fixed = benchmarkPassthrough<TestFixedLayout>(iterations);
+	printf("BelaLayout: passthrough: runtime %.0fns, fixed %.0fns per block\n", runtime * 1e9, fixed * 1e9);
+	runtime = benchmarkSinetone<BelaLayoutT<BelaRuntimeDims>>(iterations);
+	fixed = benchmarkSinetone<TestFixedLayout>(iterations);
+	printf("BelaLayout: sinetone: runtime %.0fns, fixed %.0fns per block\n", runtime * 1e9, fixed * 1e9);
+}
@@ -0,0 +1,317 @@
+/***** DeadlineScheduler.cpp *****/
+#include <DeadlineScheduler.h>
+#include <errno.h>
+#include "../include/xenomai_wraps.h"
+
+extern unsigned int gAuxiliaryTaskStackSize;
+extern unsigned int gAuxiliaryTaskCpus;
+
+DeadlineScheduler::DeadlineScheduler(unsigned int numWorkers, int priority, unsigned int maxJobs)
+{
+	setup(numWorkers, priority, maxJobs);
+}
+
+DeadlineScheduler::~DeadlineScheduler()
+{
+	cleanup();
+}
+
+int DeadlineScheduler::setup(unsigned int numWorkers, int priority, unsigned int maxJobs)
+{
+	cleanup();
+#ifdef XENOMAI_SKIN_native
+	fprintf(stderr, "DeadlineScheduler is only supported on the posix skin\n");
+	return -1;
+#endif
+#ifdef XENOMAI_SKIN_posix
+	if(!numWorkers || !maxJobs)
+		return EINVAL;
+	std::vector<Job>(maxJobs).swap(jobs);
+	for(auto& job : jobs)
+	{
+		job.status = kFree;
+		job.outcome = kUndecided;
+	}
+	currentBlock = 0;
+	nextSequence = 0;
+	missedDeadlines = 0;
+	shouldStop = false;
+	if(int ret = __wrap_sem_init(&sem, 0, 0))
+	{
+		fprintf(stderr, "DeadlineScheduler: unable to initialise semaphore: (%d) %s\n", errno, strerror(errno));
+		return ret;
+	}
+	inited = true;
+	workers.resize(numWorkers);
+	for(unsigned int n = 0; n < numWorkers; ++n)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "bela-deadline-%u", n);
+		if(int ret = create_and_start_thread(&workers[n], name, priority, gAuxiliaryTaskStackSize, (pthread_callback_t*)workerFunc, this, hasCpus ? cpus : gAuxiliaryTaskCpus))
+		{
+			fprintf(stderr, "DeadlineScheduler: unable to create worker %s: (%d) %s\n", name, ret, strerror(ret));
+			workers.resize(n);
+			cleanup();
+			return ret;
+		}
+	}
+	return 0;
+#endif
+}
+
+void DeadlineScheduler::cleanup()
+{
+#ifdef XENOMAI_SKIN_posix
+	if(!inited)
+		return;
+	shouldStop = true;
+	for(unsigned int n = 0; n < workers.size(); ++n)
+		__wrap_sem_post(&sem);
+	for(unsigned int n = 0; n < workers.size(); ++n)
+		__wrap_pthread_join(workers[n], NULL);
+	workers.clear();
+	__wrap_sem_destroy(&sem);
+	inited = false;
+#endif
+}
+
+int DeadlineScheduler::setCpus(unsigned int cpus)
+{
+	this->cpus = cpus;
+	hasCpus = true;
+#ifdef XENOMAI_SKIN_posix
+	for(unsigned int n = 0; n < workers.size(); ++n)
+	{
+		if(int ret = set_running_thread_cpus(workers[n], cpus))
+		{
+			fprintf(stderr, "DeadlineScheduler: unable to set the CPUs of worker %u: (%d) %s\n", n, ret, strerror(ret));
+			return ret;
+		}
+	}
+#endif
+	return 0;
+}
+
+void DeadlineScheduler::tick(BelaContext* context)
+{
+	tick(context->audioFramesElapsed / context->audioFrames);
+}
+
+void DeadlineScheduler::tick(uint64_t block)
+{
+	currentBlock.store(block, std::memory_order_relaxed);
+	for(unsigned int n = 0; n < jobs.size(); ++n)
+	{
+		Job& job = jobs[n];
+		int status = job.status.load(std::memory_order_acquire);
+		if((kPending == status || kRunning == status) && block >= job.deadline && decide(job, kLate))
+			rt_fprintf(stderr, "DeadlineScheduler: job %d missed its deadline (block %llu, still %s)\n", n, (unsigned long long)job.deadline, kPending == status ? "pending" : "running");
+	}
+}
+
+// Decide whether a job met its deadline, unless this was already done:
+// the worker that completes the job and tick() reaching the deadline race
+// to do it. Misses are counted here, so that each is counted once.
+bool DeadlineScheduler::decide(Job& job, int outcome)
+{
+	int expected = kUndecided;
+	if(!job.outcome.compare_exchange_strong(expected, outcome, std::memory_order_relaxed))
+		return false;
+	if(kLate == outcome)
+		++missedDeadlines;
+	return true;
+}
+
+int DeadlineScheduler::submit(void (*function)(void*), void* arg, uint64_t deadlineBlock)
+{
+	for(unsigned int n = 0; n < jobs.size(); ++n)
+	{
+		int expected = kFree;
+		Job& job = jobs[n];
+		if(!job.status.compare_exchange_strong(expected, kClaimed, std::memory_order_acquire))
+			continue;
+		job.function = function;
+		job.arg = arg;
+		job.deadline = deadlineBlock;
+		job.sequence = nextSequence++;
+		job.outcome.store(kUndecided, std::memory_order_relaxed);
+		job.status.store(kPending, std::memory_order_release);
+#ifdef XENOMAI_SKIN_posix
+		__wrap_sem_post(&sem);
+#endif
+		return n;
+	}
+	return -1;
+}
+
+DeadlineScheduler::JobStatus DeadlineScheduler::getStatus(int job)
+{
+	if(job < 0 || job >= (int)jobs.size())
+		return kFree;
+	return (JobStatus)jobs[job].status.load(std::memory_order_acquire);
+}
+
+bool DeadlineScheduler::isDone(int job)
+{
+	JobStatus status = getStatus(job);
+	return kDone == status || kMissed == status;
+}
+
+bool DeadlineScheduler::isLate(int job)
+{
+	if(job < 0 || job >= (int)jobs.size())
+		return false;
+	return kLate == jobs[job].outcome.load(std::memory_order_relaxed);
+}
+
+int DeadlineScheduler::release(int job)
+{
+	if(!isDone(job))
+		return -1;
+	jobs[job].status.store(kFree, std::memory_order_release);
+	return 0;
+}
+
+// Each successful sem_wait() corresponds to exactly one pending job, so
+// this only fails if another worker is racing us for the same job, in
+// which case we try again with the next earliest one.
+int DeadlineScheduler::claimEarliest()
+{
+	while(!shouldStop)
+	{
+		int earliest = -1;
+		for(unsigned int n = 0; n < jobs.size(); ++n)
+		{
+			Job& job = jobs[n];
+			if(job.status.load(std::memory_order_acquire) != kPending)
+				continue;
+			if(earliest < 0 || job.deadline < jobs[earliest].deadline
+				|| (job.deadline == jobs[earliest].deadline && job.sequence < jobs[earliest].sequence))
+				earliest = n;
+		}
+		if(earliest < 0)
+			return -1;
+		int expected = kPending;
+		if(jobs[earliest].status.compare_exchange_strong(expected, kRunning, std::memory_order_acq_rel))
+			return earliest;
+	}
+	return -1;
+}
+
+void DeadlineScheduler::workerLoop()
+{
+#ifdef XENOMAI_SKIN_posix
+	while(!shouldStop)
+	{
+		__wrap_sem_wait(&sem);
+		if(shouldStop)
+			break;
+		int n = claimEarliest();
+		if(n < 0)
+			continue;
+		Job& job = jobs[n];
+		job.function(job.arg);
+		uint64_t block = currentBlock.load(std::memory_order_relaxed);
+		// tick() may already have decided that it is late
+		bool late = block >= job.deadline;
+		if(decide(job, late ? kLate : kOnTime) && late)
+			rt_fprintf(stderr, "DeadlineScheduler: job %d missed its deadline (block %llu, completed during block %llu)\n", n, (unsigned long long)job.deadline, (unsigned long long)block);
+		if(kLate == job.outcome.load(std::memory_order_relaxed))
+			job.status.store(kMissed, std::memory_order_release);
+		else
+			job.status.store(kDone, std::memory_order_release);
+	}
+#endif
+}
+
+void* DeadlineScheduler::workerFunc(void* ptr)
+{
+	((DeadlineScheduler*)ptr)->workerLoop();
+	return NULL;
+}
+
+#undef NDEBUG
+#include <assert.h>
+#include <vector>
+static volatile bool gTestBlocked;
+static std::vector<int> gTestOrder;
+static void testBlockingJob(void*)
+{
+	while(gTestBlocked)
+		usleep(1000);
+}
+static void testRecordJob(void* arg)
+{
+	gTestOrder.push_back((int)(intptr_t)arg);
+}
+static bool testWaitDone(DeadlineScheduler& scheduler, int job)
+{
+	for(unsigned int n = 0; n < 1000 && !scheduler.isDone(job); ++n)
+		usleep(1000);
+	return scheduler.isDone(job);
+}
+
+bool DeadlineScheduler::test()
+{
+	DeadlineScheduler scheduler;
+	assert(0 == scheduler.setup(1, 0, 4));
+	// keep the only worker busy while we queue up jobs out of order
+	gTestBlocked = true;
+	gTestOrder.clear();
+	int blocker = scheduler.submit(testBlockingJob, NULL, 100);
+	assert(blocker >= 0);
+	while(scheduler.getStatus(blocker) != kRunning)
+		usleep(1000);
+	int a = scheduler.submit(testRecordJob, (void*)5, 5);
+	int b = scheduler.submit(testRecordJob, (void*)2, 2);
+	int c = scheduler.submit(testRecordJob, (void*)9, 9);
+	assert(a >= 0 && b >= 0 && c >= 0);
+	// all slots are in use
+	assert(-1 == scheduler.submit(testRecordJob, NULL, 0));
+	assert(kPending == scheduler.getStatus(a));
+	assert(0 != scheduler.release(a));
+	gTestBlocked = false;
+	assert(testWaitDone(scheduler, a) && testWaitDone(scheduler, b) && testWaitDone(scheduler, c));
+	// earliest deadline first
+	assert(3 == gTestOrder.size());
+	assert(2 == gTestOrder[0] && 5 == gTestOrder[1] && 9 == gTestOrder[2]);
+	assert(kDone == scheduler.getStatus(a));
+	assert(0 == scheduler.getMissedDeadlines());
+	for(int job : {blocker, a, b, c})
+		assert(0 == scheduler.release(job));
+
+	// a job that has not completed is reported as soon as its deadline
+	// is reached, and only once
+	gTestBlocked = true;
+	scheduler.tick(20);
+	int stuck = scheduler.submit(testBlockingJob, NULL, 22);
+	int queued = scheduler.submit(testRecordJob, (void*)23, 23);
+	assert(stuck >= 0 && queued >= 0);
+	while(scheduler.getStatus(stuck) != kRunning)
+		usleep(1000);
+	scheduler.tick(21);
+	assert(!scheduler.isLate(stuck) && 0 == scheduler.getMissedDeadlines());
+	scheduler.tick(22);
+	assert(scheduler.isLate(stuck) && !scheduler.isLate(queued));
+	assert(kRunning == scheduler.getStatus(stuck));
+	assert(1 == scheduler.getMissedDeadlines());
+	scheduler.tick(23);
+	assert(kPending == scheduler.getStatus(queued) && scheduler.isLate(queued));
+	assert(2 == scheduler.getMissedDeadlines());
+	scheduler.tick(24);
+	gTestBlocked = false;
+	assert(testWaitDone(scheduler, stuck) && testWaitDone(scheduler, queued));
+	assert(kMissed == scheduler.getStatus(stuck) && kMissed == scheduler.getStatus(queued));
+	assert(2 == scheduler.getMissedDeadlines());
+	assert(0 == scheduler.release(stuck) && 0 == scheduler.release(queued));
+
+	// a job completing on or after its deadline block is reported
+	scheduler.tick(10);
+	int late = scheduler.submit(testRecordJob, (void*)10, 10);
+	assert(testWaitDone(scheduler, late));
+	assert(kMissed == scheduler.getStatus(late) && scheduler.isLate(late));
+	assert(3 == scheduler.getMissedDeadlines());
+	assert(0 == scheduler.release(late));
+	scheduler.cleanup();
+	return true;
+}
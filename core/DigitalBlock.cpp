@@ -0,0 +1,352 @@
+/***** DigitalBlock.cpp *****/
+#include <DigitalBlock.h>
+#include <string.h>
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define DIGITAL_BLOCK_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define DIGITAL_BLOCK_SSE2
+#endif
+
+// Each group of 8 frames is handled as two 8x8 bit matrices, one per byte
+// of the value half-word. In each 64-bit matrix, byte n is frame n and bit
+// c of it is channel c (or c + 8). After transposing, byte c holds channel
+// c, with bit n being frame n. The transpose is its own inverse.
+static const unsigned int kGroupFrames = 8;
+
+#if defined(DIGITAL_BLOCK_NEON)
+typedef uint64x2_t BitMatrices;
+template <int shift>
+static inline BitMatrices transposeStep(BitMatrices x, uint64_t mask)
+{
+	uint64x2_t t = vandq_u64(veorq_u64(x, vshrq_n_u64(x, shift)), vdupq_n_u64(mask));
+	return veorq_u64(x, veorq_u64(t, vshlq_n_u64(t, shift)));
+}
+#elif defined(DIGITAL_BLOCK_SSE2)
+typedef __m128i BitMatrices;
+template <int shift>
+static inline BitMatrices transposeStep(BitMatrices x, uint64_t mask)
+{
+	__m128i t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, shift)), _mm_set1_epi64x(mask));
+	return _mm_xor_si128(x, _mm_xor_si128(t, _mm_slli_epi64(t, shift)));
+}
+#else
+struct BitMatrices {
+	uint64_t m[2];
+};
+template <int shift>
+static inline BitMatrices transposeStep(BitMatrices x, uint64_t mask)
+{
+	for(unsigned int n = 0; n < 2; ++n)
+	{
+		uint64_t t = (x.m[n] ^ (x.m[n] >> shift)) & mask;
+		x.m[n] ^= t ^ (t << shift);
+	}
+	return x;
+}
+#endif
+
+static inline BitMatrices transpose(BitMatrices x)
+{
+	x = transposeStep<7>(x, 0x00AA00AA00AA00AAULL);
+	x = transposeStep<14>(x, 0x0000CCCC0000CCCCULL);
+	return transposeStep<28>(x, 0x00000000F0F0F0F0ULL);
+}
+
+// Bytes 0-7 are the first matrix, bytes 8-15 the second one.
+static inline BitMatrices loadMatrices(const uint8_t* bytes)
+{
+#if defined(DIGITAL_BLOCK_NEON)
+	return vreinterpretq_u64_u8(vld1q_u8(bytes));
+#elif defined(DIGITAL_BLOCK_SSE2)
+	return _mm_loadu_si128((const __m128i*)bytes);
+#else
+	BitMatrices x;
+	memcpy(x.m, bytes, sizeof(x.m));
+	return x;
+#endif
+}
+
+static inline void storeMatrices(uint8_t* bytes, BitMatrices x)
+{
+#if defined(DIGITAL_BLOCK_NEON)
+	vst1q_u8(bytes, vreinterpretq_u8_u64(x));
+#elif defined(DIGITAL_BLOCK_SSE2)
+	_mm_storeu_si128((__m128i*)bytes, x);
+#else
+	memcpy(bytes, x.m, sizeof(x.m));
+#endif
+}
+
+// Split the value half-words of 8 frames into the two matrices.
+static inline BitMatrices gatherValues(const uint32_t* words)
+{
+#if defined(DIGITAL_BLOCK_NEON)
+	uint16x8_t values = vcombine_u16(vshrn_n_u32(vld1q_u32(words), 16), vshrn_n_u32(vld1q_u32(words + 4), 16));
+	uint8x16_t bytes = vcombine_u8(vmovn_u16(values), vshrn_n_u16(values, 8));
+	return vreinterpretq_u64_u8(bytes);
+#elif defined(DIGITAL_BLOCK_SSE2)
+	// the arithmetic shift sign-extends, so that the signed saturation of
+	// the pack leaves the half-word unchanged
+	__m128i lo = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)words), 16);
+	__m128i hi = _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(words + 4)), 16);
+	__m128i values = _mm_packs_epi32(lo, hi);
+	__m128i lowBytes = _mm_and_si128(values, _mm_set1_epi16(0xff));
+	__m128i highBytes = _mm_srli_epi16(values, 8);
+	__m128i bytes = _mm_packus_epi16(lowBytes, highBytes);
+	return bytes;
+#else
+	uint8_t bytes[2 * kGroupFrames];
+	for(unsigned int n = 0; n < kGroupFrames; ++n)
+	{
+		bytes[n] = words[n] >> 16;
+		bytes[n + kGroupFrames] = words[n] >> 24;
+	}
+	return loadMatrices(bytes);
+#endif
+}
+
+// Replace the values of the channels in mask in 8 frames with those in the
+// transposed matrices.
+static inline void mergeValues(uint32_t* words, BitMatrices x, uint16_t mask)
+{
+#if defined(DIGITAL_BLOCK_NEON)
+	uint8x16_t bytes = vreinterpretq_u8_u64(x);
+	uint8x8x2_t zipped = vzip_u8(vget_low_u8(bytes), vget_high_u8(bytes));
+	uint16x8_t values = vreinterpretq_u16_u8(vcombine_u8(zipped.val[0], zipped.val[1]));
+	const uint32x4_t keep = vdupq_n_u32(~((uint32_t)mask << 16));
+	const uint32x4_t replace = vdupq_n_u32((uint32_t)mask << 16);
+	for(unsigned int n = 0; n < 2; ++n)
+	{
+		uint16x4_t half = n ? vget_high_u16(values) : vget_low_u16(values);
+		uint32x4_t shifted = vshll_n_u16(half, 16);
+		uint32x4_t in = vld1q_u32(words + 4 * n);
+		vst1q_u32(words + 4 * n, vorrq_u32(vandq_u32(in, keep), vandq_u32(shifted, replace)));
+	}
+#elif defined(DIGITAL_BLOCK_SSE2)
+	__m128i values = _mm_unpacklo_epi8(x, _mm_srli_si128(x, 8));
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i keep = _mm_set1_epi32(~((uint32_t)mask << 16));
+	const __m128i replace = _mm_set1_epi32((uint32_t)mask << 16);
+	for(unsigned int n = 0; n < 2; ++n)
+	{
+		__m128i shifted = n ? _mm_unpackhi_epi16(zero, values) : _mm_unpacklo_epi16(zero, values);
+		__m128i in = _mm_loadu_si128((const __m128i*)(words + 4 * n));
+		__m128i out = _mm_or_si128(_mm_and_si128(in, keep), _mm_and_si128(shifted, replace));
+		_mm_storeu_si128((__m128i*)(words + 4 * n), out);
+	}
+#else
+	uint8_t bytes[2 * kGroupFrames];
+	storeMatrices(bytes, x);
+	uint32_t replace = (uint32_t)mask << 16;
+	for(unsigned int n = 0; n < kGroupFrames; ++n)
+	{
+		uint32_t values = ((uint32_t)bytes[n] << 16) | ((uint32_t)bytes[n + kGroupFrames] << 24);
+		words[n] = (words[n] & ~replace) | (values & replace);
+	}
+#endif
+}
+
+void DigitalBlock::toPlanes(const uint32_t* digital, unsigned int frames, Plane* planes)
+{
+	if(frames > kMaxFrames)
+		frames = kMaxFrames;
+	for(unsigned int f = 0; f < frames; f += kGroupFrames)
+	{
+		const uint32_t* words = digital + f;
+		uint32_t padded[kGroupFrames];
+		if(frames - f < kGroupFrames)
+		{
+			memset(padded, 0, sizeof(padded));
+			memcpy(padded, words, (frames - f) * sizeof(words[0]));
+			words = padded;
+		}
+		uint8_t bytes[2 * kGroupFrames];
+		storeMatrices(bytes, transpose(gatherValues(words)));
+		// the planes are little-endian, so byte n holds frames 8n to 8n + 7
+		for(unsigned int c = 0; c < kNumChannels; ++c)
+			((uint8_t*)planes[c])[f / kGroupFrames] = bytes[c];
+	}
+	// clear the rest of the last word
+	unsigned int usedBytes = (frames + kGroupFrames - 1) / kGroupFrames;
+	unsigned int wordBytes = (usedBytes + 3) / 4 * 4;
+	for(unsigned int c = 0; c < kNumChannels; ++c)
+		memset((uint8_t*)planes[c] + usedBytes, 0, wordBytes - usedBytes);
+}
+
+void DigitalBlock::fromPlanes(uint32_t* digital, unsigned int frames, const Plane* planes, uint16_t channels)
+{
+	if(!channels)
+		return;
+	if(frames > kMaxFrames)
+		frames = kMaxFrames;
+	for(unsigned int f = 0; f < frames; f += kGroupFrames)
+	{
+		uint8_t bytes[2 * kGroupFrames];
+		for(unsigned int c = 0; c < kNumChannels; ++c)
+			bytes[c] = ((const uint8_t*)planes[c])[f / kGroupFrames];
+		BitMatrices x = transpose(loadMatrices(bytes));
+		if(frames - f < kGroupFrames)
+		{
+			uint32_t padded[kGroupFrames];
+			memcpy(padded, digital + f, (frames - f) * sizeof(digital[0]));
+			mergeValues(padded, x, channels);
+			memcpy(digital + f, padded, (frames - f) * sizeof(digital[0]));
+		} else {
+			mergeValues(digital + f, x, channels);
+		}
+	}
+}
+
+void DigitalBlock::read(const uint32_t* digital, unsigned int frames)
+{
+	if(frames > kMaxFrames)
+		frames = kMaxFrames;
+	this->frames = frames;
+	outputChannels = 0;
+	changedChannels = 0;
+	if(!frames)
+		return;
+	toPlanes(digital, frames, planes);
+	unsigned int words = (frames + 31) / 32;
+	// bits past the end of the block in the last word
+	uint32_t lastMask = frames % 32 ? (1u << (frames % 32)) - 1 : ~0u;
+	uint16_t firstValues = digital[0] >> 16;
+	uint16_t previousValues = hasLastValues ? lastValues : firstValues;
+	for(unsigned int c = 0; c < kNumChannels; ++c)
+	{
+		uint32_t* plane = planes[c];
+		// each bit is compared to the previous frame
+		uint32_t carry = (previousValues >> c) & 1;
+		uint32_t any = 0;
+		for(unsigned int w = 0; w < words; ++w)
+		{
+			uint32_t edges = plane[w] ^ ((plane[w] << 1) | carry);
+			carry = plane[w] >> 31;
+			if(w == words - 1)
+				edges &= lastMask;
+			edgePlanes[c][w] = edges;
+			any |= edges;
+		}
+		if(any)
+			changedChannels |= 1 << c;
+		memcpy(outputPlanes[c], plane, words * sizeof(plane[0]));
+	}
+	lastValues = digital[frames - 1] >> 16;
+	hasLastValues = true;
+}
+
+unsigned int DigitalBlock::getEdges(unsigned int channel, uint16_t* edgeFrames, unsigned int maxEdges) const
+{
+	unsigned int numEdges = 0;
+	unsigned int words = (frames + 31) / 32;
+	for(unsigned int w = 0; w < words; ++w)
+	{
+		uint32_t edges = edgePlanes[channel][w];
+		while(edges && numEdges < maxEdges)
+		{
+			edgeFrames[numEdges++] = w * 32 + __builtin_ctz(edges);
+			edges &= edges - 1; // clear the lowest bit
+		}
+	}
+	return numEdges;
+}
+
+void DigitalBlock::setPlane(unsigned int channel, const uint32_t* plane)
+{
+	memcpy(outputPlanes[channel], plane, kWords * sizeof(plane[0]));
+	outputChannels |= 1 << channel;
+}
+
+void DigitalBlock::setOutput(unsigned int channel, unsigned int frame, bool value)
+{
+	if(frame >= frames)
+		return;
+	uint32_t* plane = outputPlanes[channel];
+	unsigned int first = frame / 32;
+	// the bits from frame onwards in the first word
+	uint32_t mask = ~0u << (frame % 32);
+	if(value)
+		plane[first] |= mask;
+	else
+		plane[first] &= ~mask;
+	for(unsigned int w = first + 1; w < kWords; ++w)
+		plane[w] = value ? ~0u : 0;
+	outputChannels |= 1 << channel;
+}
+
+void DigitalBlock::write(uint32_t* digital, unsigned int frames)
+{
+	fromPlanes(digital, frames, outputPlanes, outputChannels);
+	outputChannels = 0;
+}
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <vector>
+
+bool DigitalBlock::test()
+{
+	srand(0);
+	DigitalBlock block;
+	std::vector<uint32_t> digital(kMaxFrames);
+	unsigned int previous = 0;
+	bool hasPrevious = false;
+	for(unsigned int frames : { 1, 7, 8, 16, 31, 32, 33, 64, 100, 256 })
+	{
+		for(unsigned int n = 0; n < frames; ++n)
+			digital[n] = ((uint32_t)rand() << 16) ^ rand();
+		// a slow channel, so that not every frame is an edge
+		for(unsigned int n = 0; n < frames; ++n)
+			digital[n] = (digital[n] & ~(1u << 16)) | ((n / 5) & 1) << 16;
+		block.read(digital.data(), frames);
+		for(unsigned int c = 0; c < kNumChannels; ++c)
+			for(unsigned int n = frames; n < (frames + 31) / 32 * 32; ++n)
+				assert(!block.getValue(c, n));
+		uint16_t changed = 0;
+		for(unsigned int c = 0; c < kNumChannels; ++c)
+		{
+			std::vector<uint16_t> expectedEdges;
+			for(unsigned int n = 0; n < frames; ++n)
+			{
+				bool value = (digital[n] >> (16 + c)) & 1;
+				assert(value == block.getValue(c, n));
+				bool before = n ? (digital[n - 1] >> (16 + c)) & 1 : hasPrevious ? (previous >> c) & 1 : value;
+				if(value != before)
+					expectedEdges.push_back(n);
+			}
+			uint16_t edges[kMaxFrames];
+			unsigned int numEdges = block.getEdges(c, edges, kMaxFrames);
+			assert(numEdges == expectedEdges.size());
+			assert(!numEdges || 0 == memcmp(edges, expectedEdges.data(), numEdges * sizeof(edges[0])));
+			if(numEdges)
+				changed |= 1 << c;
+		}
+		assert(changed == block.getChangedChannels());
+		previous = digital[frames - 1] >> 16;
+		hasPrevious = true;
+		assert(previous == block.getLastValues());
+
+		// nothing is written unless requested
+		std::vector<uint32_t> expected(digital);
+		block.write(digital.data(), frames);
+		assert(expected == digital);
+
+		// copy channel 3 to channel 12 and set channel 5 from half-way
+		// through the block, as digitalWrite() would
+		block.setPlane(12, block.getPlane(3));
+		block.setOutput(5, frames / 2, true);
+		for(unsigned int n = 0; n < frames; ++n)
+		{
+			uint32_t value = (expected[n] >> (16 + 3)) & 1;
+			expected[n] = (expected[n] & ~(1u << (16 + 12))) | value << (16 + 12);
+			if(n >= frames / 2)
+				expected[n] |= 1 << (16 + 5);
+		}
+		block.write(digital.data(), frames);
+		assert(expected == digital);
+	}
+	return true;
+}
@@ -0,0 +1,144 @@
+/***** DigitalEdgeCapture.cpp *****/
+#include <DigitalEdgeCapture.h>
+
+int DigitalEdgeCapture::setup(uint16_t channels, unsigned int capacity)
+{
+	if(0 == capacity)
+		return -1;
+	unsigned int size = 1;
+	while(size < capacity)
+		size <<= 1;
+	edges.resize(size);
+	mask = size - 1;
+	writeIdx = 0;
+	readIdx = 0;
+	dropped = 0;
+	hasLastWord = false;
+	this->channels = channels;
+	return 0;
+}
+
+unsigned int DigitalEdgeCapture::process(const uint32_t* digital, unsigned int frames, uint64_t framesElapsed)
+{
+	if(!frames || edges.empty())
+		return 0;
+	if(!hasLastWord)
+	{
+		lastWord = digital[0];
+		hasLastWord = true;
+	}
+	const uint32_t valueMask = (uint32_t)channels << 16;
+	unsigned int w = writeIdx.load(std::memory_order_relaxed);
+	unsigned int free = edges.size() - (w - readIdx.load(std::memory_order_acquire));
+	unsigned int found = 0;
+	uint32_t previous = lastWord;
+	for(unsigned int n = 0; n < frames; ++n)
+	{
+		uint32_t word = digital[n];
+		// one bit set for each watched channel that changed since the
+		// previous frame
+		uint32_t changed = (word ^ previous) & valueMask;
+		previous = word;
+		while(changed)
+		{
+			unsigned int bit = __builtin_ctz(changed);
+			changed &= changed - 1; // clear the lowest bit
+			++found;
+			if(!free)
+			{
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+			Edge& edge = edges[w & mask];
+			edge.frame = framesElapsed + n;
+			edge.channel = bit - 16;
+			edge.rising = (word >> bit) & 1;
+			++w;
+			--free;
+		}
+	}
+	lastWord = previous;
+	writeIdx.store(w, std::memory_order_release);
+	return found;
+}
+
+bool DigitalEdgeCapture::pop(Edge& edge)
+{
+	unsigned int r = readIdx.load(std::memory_order_relaxed);
+	if(r == writeIdx.load(std::memory_order_acquire))
+		return false;
+	edge = edges[r & mask];
+	readIdx.store(r + 1, std::memory_order_release);
+	return true;
+}
+
+unsigned int DigitalEdgeCapture::getAvailable() const
+{
+	return writeIdx.load(std::memory_order_acquire) - readIdx.load(std::memory_order_acquire);
+}
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+
+bool DigitalEdgeCapture::test()
+{
+	srand(0);
+	const unsigned int kFrames = 16;
+	const uint16_t kChannels = (1 << 0) | (1 << 5) | (1 << 15);
+	DigitalEdgeCapture capture;
+	assert(0 == capture.setup(kChannels, 1000));
+	std::vector<uint32_t> digital(kFrames);
+	uint32_t previous = 0;
+	uint64_t framesElapsed = 0;
+	for(unsigned int b = 0; b < 50; ++b)
+	{
+		for(unsigned int n = 0; n < kFrames; ++n)
+		{
+			// slowly changing values, random directions
+			uint32_t values = rand() % 4 ? previous >> 16 : rand();
+			digital[n] = (values << 16) | (rand() & 0xffff);
+			previous = digital[n];
+		}
+		std::vector<Edge> expected;
+		for(unsigned int n = 0; n < kFrames; ++n)
+		{
+			for(unsigned int c = 0; c < kNumChannels; ++c)
+			{
+				if(!(kChannels & (1 << c)) || (!b && !n))
+					continue;
+				uint32_t before = n ? digital[n - 1] : capture.lastWord;
+				bool value = (digital[n] >> (16 + c)) & 1;
+				if(value != ((before >> (16 + c)) & 1))
+					expected.push_back({framesElapsed + n, c, value});
+			}
+		}
+		assert(expected.size() == capture.process(digital.data(), kFrames, framesElapsed));
+		assert(expected.size() == capture.getAvailable());
+		for(auto& e : expected)
+		{
+			Edge edge;
+			assert(capture.pop(edge));
+			assert(edge.frame == e.frame);
+			assert(edge.channel == e.channel);
+			assert(edge.rising == e.rising);
+		}
+		Edge edge;
+		assert(!capture.pop(edge));
+		assert(capture.getLastValues() == digital[kFrames - 1] >> 16);
+		framesElapsed += kFrames;
+	}
+	assert(0 == capture.getDropped());
+
+	// a full queue drops the newest edges
+	assert(0 == capture.setup(1, 2));
+	uint32_t toggle[] = { 0, 1 << 16, 0, 1 << 16, 0 };
+	assert(4 == capture.process(toggle, 5, 100));
+	assert(2 == capture.getAvailable());
+	assert(2 == capture.getDropped());
+	Edge edge;
+	assert(capture.pop(edge) && 101 == edge.frame && edge.rising);
+	assert(capture.pop(edge) && 102 == edge.frame && !edge.rising);
+	assert(!capture.pop(edge));
+	return true;
+}
@@ -0,0 +1,947 @@
+/***** FormatConverter.cpp *****/
+#include <FormatConverter.h>
+#include <string.h>
+#include <stdio.h>
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FORMAT_CONVERTER_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define FORMAT_CONVERTER_SSE2
+#endif
+
+// Scaling a 16-bit value by a power of 2 is exact, so multiplying by the
+// inverse gives the same result as the division in the scalar code.
+static const float kAudioInScale = 1.f / 32768.f;
+static const float kAudioOutScale = 32768.f;
+static const float kAnalogInScale = 1.f / 65536.f;
+static const float kAnalogOutScale = 65536.f;
+static const float kInvertedAnalogInMax = 65535.f / 65536.f;
+static const float kInvertedAnalogOutMax = 0.93f;
+
+// Clipping in the float domain before truncating gives the same result as
+// truncating and then clipping the integer, and it can be vectorised.
+struct AudioSample {
+	typedef int16_t Raw;
+	static float toFloat(int16_t in)
+	{
+		return in * kAudioInScale;
+	}
+	static int16_t fromFloat(float in)
+	{
+		float out = in * kAudioOutScale;
+		if(out < -32768.f)
+			out = -32768.f;
+		else if(out > 32767.f)
+			out = 32767.f;
+		return (int16_t)out;
+	}
+	static void toFloat(float* dst, const int16_t* src, unsigned int n)
+	{
+		unsigned int i = 0;
+#if defined(FORMAT_CONVERTER_NEON)
+		const float32x4_t scale = vdupq_n_f32(kAudioInScale);
+		for(; i + 4 <= n; i += 4)
+		{
+			int32x4_t in = vmovl_s16(vld1_s16(src + i));
+			vst1q_f32(dst + i, vmulq_f32(vcvtq_f32_s32(in), scale));
+		}
+#elif defined(FORMAT_CONVERTER_SSE2)
+		const __m128 scale = _mm_set1_ps(kAudioInScale);
+		for(; i + 4 <= n; i += 4)
+		{
+			__m128i in = _mm_loadl_epi64((const __m128i*)(src + i));
+			// sign-extend to 32 bits
+			in = _mm_srai_epi32(_mm_unpacklo_epi16(in, in), 16);
+			_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(in), scale));
+		}
+#endif
+		for(; i < n; ++i)
+			dst[i] = toFloat(src[i]);
+	}
+	static void fromFloat(int16_t* dst, const float* src, unsigned int n)
+	{
+		unsigned int i = 0;
+#if defined(FORMAT_CONVERTER_NEON)
+		const float32x4_t scale = vdupq_n_f32(kAudioOutScale);
+		const float32x4_t min = vdupq_n_f32(-32768.f);
+		const float32x4_t max = vdupq_n_f32(32767.f);
+		for(; i + 4 <= n; i += 4)
+		{
+			float32x4_t out = vmulq_f32(vld1q_f32(src + i), scale);
+			out = vminq_f32(vmaxq_f32(out, min), max);
+			vst1_s16(dst + i, vmovn_s32(vcvtq_s32_f32(out)));
+		}
+#elif defined(FORMAT_CONVERTER_SSE2)
+		const __m128 scale = _mm_set1_ps(kAudioOutScale);
+		const __m128 min = _mm_set1_ps(-32768.f);
+		const __m128 max = _mm_set1_ps(32767.f);
+		for(; i + 4 <= n; i += 4)
+		{
+			__m128 out = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+			out = _mm_min_ps(_mm_max_ps(out, min), max);
+			__m128i q = _mm_cvttps_epi32(out);
+			_mm_storel_epi64((__m128i*)(dst + i), _mm_packs_epi32(q, q));
+		}
+#endif
+		for(; i < n; ++i)
+			dst[i] = fromFloat(src[i]);
+	}
+};
+
+template <bool invert>
+struct AnalogSample {
+	typedef uint16_t Raw;
+	static float toFloat(uint16_t in)
+	{
+		float out = in * kAnalogInScale;
+		if(invert)
+			out = kInvertedAnalogInMax - out;
+		return out;
+	}
+	static uint16_t fromFloat(float in)
+	{
+		if(invert)
+			in = (1.f - in) * kInvertedAnalogOutMax;
+		float out = in * kAnalogOutScale;
+		if(out < 0.f)
+			out = 0.f;
+		else if(out > 65535.f)
+			out = 65535.f;
+		return (uint16_t)out;
+	}
+	static void toFloat(float* dst, const uint16_t* src, unsigned int n)
+	{
+		unsigned int i = 0;
+#if defined(FORMAT_CONVERTER_NEON)
+		const float32x4_t scale = vdupq_n_f32(kAnalogInScale);
+		const float32x4_t inMax = vdupq_n_f32(kInvertedAnalogInMax);
+		for(; i + 4 <= n; i += 4)
+		{
+			uint32x4_t in = vmovl_u16(vld1_u16(src + i));
+			float32x4_t out = vmulq_f32(vcvtq_f32_u32(in), scale);
+			if(invert)
+				out = vsubq_f32(inMax, out);
+			vst1q_f32(dst + i, out);
+		}
+#elif defined(FORMAT_CONVERTER_SSE2)
+		const __m128 scale = _mm_set1_ps(kAnalogInScale);
+		const __m128 inMax = _mm_set1_ps(kInvertedAnalogInMax);
+		const __m128i zero = _mm_setzero_si128();
+		for(; i + 4 <= n; i += 4)
+		{
+			__m128i in = _mm_loadl_epi64((const __m128i*)(src + i));
+			in = _mm_unpacklo_epi16(in, zero);
+			__m128 out = _mm_mul_ps(_mm_cvtepi32_ps(in), scale);
+			if(invert)
+				out = _mm_sub_ps(inMax, out);
+			_mm_storeu_ps(dst + i, out);
+		}
+#endif
+		for(; i < n; ++i)
+			dst[i] = toFloat(src[i]);
+	}
+	static void fromFloat(uint16_t* dst, const float* src, unsigned int n)
+	{
+		unsigned int i = 0;
+#if defined(FORMAT_CONVERTER_NEON)
+		const float32x4_t scale = vdupq_n_f32(kAnalogOutScale);
+		const float32x4_t one = vdupq_n_f32(1.f);
+		const float32x4_t outMax = vdupq_n_f32(kInvertedAnalogOutMax);
+		const float32x4_t min = vdupq_n_f32(0.f);
+		const float32x4_t max = vdupq_n_f32(65535.f);
+		for(; i + 4 <= n; i += 4)
+		{
+			float32x4_t out = vld1q_f32(src + i);
+			if(invert)
+				out = vmulq_f32(vsubq_f32(one, out), outMax);
+			out = vmulq_f32(out, scale);
+			out = vminq_f32(vmaxq_f32(out, min), max);
+			vst1_u16(dst + i, vmovn_u32(vcvtq_u32_f32(out)));
+		}
+#elif defined(FORMAT_CONVERTER_SSE2)
+		const __m128 scale = _mm_set1_ps(kAnalogOutScale);
+		const __m128 one = _mm_set1_ps(1.f);
+		const __m128 outMax = _mm_set1_ps(kInvertedAnalogOutMax);
+		const __m128 min = _mm_set1_ps(0.f);
+		const __m128 max = _mm_set1_ps(65535.f);
+		const __m128i offset = _mm_set1_epi32(32768);
+		const __m128i flip = _mm_set1_epi16((short)0x8000);
+		for(; i + 4 <= n; i += 4)
+		{
+			__m128 out = _mm_loadu_ps(src + i);
+			if(invert)
+				out = _mm_mul_ps(_mm_sub_ps(one, out), outMax);
+			out = _mm_mul_ps(out, scale);
+			out = _mm_min_ps(_mm_max_ps(out, min), max);
+			// SSE2 can only pack with signed saturation: move to the
+			// signed range and back
+			__m128i q = _mm_sub_epi32(_mm_cvttps_epi32(out), offset);
+			q = _mm_xor_si128(_mm_packs_epi32(q, q), flip);
+			_mm_storel_epi64((__m128i*)(dst + i), q);
+		}
+#endif
+		for(; i < n; ++i)
+			dst[i] = fromFloat(src[i]);
+	}
+};
+
+typedef FormatConverter::AnalogRatio AnalogRatio;
+typedef FormatConverter::AnalogInStages AnalogInStages;
+
+// number of context frames for a given number of hardware frames
+template <AnalogRatio ratio>
+static inline unsigned int contextFrames(unsigned int hardwareFrames)
+{
+	return FormatConverter::kAnalogUpsample == ratio ? hardwareFrames * 2 :
+		FormatConverter::kAnalogDownsample == ratio ? hardwareFrames / 2 : hardwareFrames;
+}
+
+// the hardware frame read for a given context frame
+template <AnalogRatio ratio>
+static inline unsigned int hardwareFrame(unsigned int contextFrame)
+{
+	return FormatConverter::kAnalogUpsample == ratio ? contextFrame / 2 :
+		FormatConverter::kAnalogDownsample == ratio ? contextFrame * 2 : contextFrame;
+}
+
+// the context frame written to a given hardware frame
+template <AnalogRatio ratio>
+static inline unsigned int contextFrame(unsigned int hardwareFrame)
+{
+	return FormatConverter::kAnalogUpsample == ratio ? hardwareFrame * 2 :
+		FormatConverter::kAnalogDownsample == ratio ? hardwareFrame / 2 : hardwareFrame;
+}
+
+// Non-interleaved buffers are converted a tile of kTileFrames frames at a
+// time: the tile is stored interleaved so that it can be converted in one
+// go, and transposed to or from the context buffer. kChannels is the number
+// of channels if known at compile time, so that the transposition can be
+// unrolled, or 0 otherwise.
+static const unsigned int kTileFrames = 4;
+static const unsigned int kMaxTileChannels = 32;
+// Interleaved buffers with AnalogInStages are converted in place, so their
+// tiles can be longer, which saves reloading the filter history.
+static const unsigned int kInterleavedTileFrames = 16;
+
+// Convert context frames [frame, frame + frames) to interleaved floats.
+template <typename Sample, AnalogRatio ratio>
+static inline void convertFrames(float* dst, const typename Sample::Raw* src, unsigned int frame, unsigned int frames, unsigned int channels)
+{
+	if(FormatConverter::kAnalogSame == ratio)
+	{
+		Sample::toFloat(dst, src + frame * channels, frames * channels);
+		return;
+	}
+	for(unsigned int k = 0; k < frames; ++k)
+	{
+		float* out = dst + k * channels;
+		// the second of each pair of upsampled frames is a copy of the first
+		if(FormatConverter::kAnalogUpsample == ratio && ((frame + k) & 1) && k)
+			memcpy(out, out - channels, channels * sizeof(float));
+		else
+			Sample::toFloat(out, src + hardwareFrame<ratio>(frame + k) * channels, channels);
+	}
+}
+
+// Apply the audio expander DC-blocking highpass to interleaved frames. The
+// filter is recursive over time, so it is vectorised across channels. Two
+// groups of 4 channels are filtered together where possible, so that their
+// dependency chains overlap.
+#if defined(FORMAT_CONVERTER_NEON)
+typedef float32x4_t ExpanderVector;
+typedef uint32x4_t ExpanderMask;
+static inline ExpanderMask expanderMask(uint32_t enabled)
+{
+	const uint32_t bits[4] = {
+		enabled & 1 ? ~0u : 0, enabled & 2 ? ~0u : 0,
+		enabled & 4 ? ~0u : 0, enabled & 8 ? ~0u : 0,
+	};
+	return vld1q_u32(bits);
+}
+static inline ExpanderVector expanderLoad(const float* p) { return vld1q_f32(p); }
+static inline void expanderStore(float* p, ExpanderVector v) { vst1q_f32(p, v); }
+static inline ExpanderVector expanderSelect(ExpanderMask mask, ExpanderVector a, ExpanderVector b) { return vbslq_f32(mask, a, b); }
+static inline ExpanderVector expanderSplat(float value) { return vdupq_n_f32(value); }
+// one step of the highpass, returning its output
+static inline ExpanderVector expanderStep(ExpanderVector coeff, ExpanderVector x, ExpanderVector xPrev, ExpanderVector yPrev)
+{
+	return vmulq_f32(coeff, vsubq_f32(vaddq_f32(yPrev, x), xPrev));
+}
+static inline ExpanderVector expanderDouble(ExpanderVector y) { return vaddq_f32(y, y); }
+#elif defined(FORMAT_CONVERTER_SSE2)
+typedef __m128 ExpanderVector;
+typedef __m128 ExpanderMask;
+static inline ExpanderMask expanderMask(uint32_t enabled)
+{
+	return _mm_castsi128_ps(_mm_set_epi32(
+		enabled & 8 ? -1 : 0, enabled & 4 ? -1 : 0,
+		enabled & 2 ? -1 : 0, enabled & 1 ? -1 : 0));
+}
+static inline ExpanderVector expanderLoad(const float* p) { return _mm_loadu_ps(p); }
+static inline void expanderStore(float* p, ExpanderVector v) { _mm_storeu_ps(p, v); }
+static inline ExpanderVector expanderSelect(ExpanderMask mask, ExpanderVector a, ExpanderVector b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+static inline ExpanderVector expanderSplat(float value) { return _mm_set1_ps(value); }
+static inline ExpanderVector expanderStep(ExpanderVector coeff, ExpanderVector x, ExpanderVector xPrev, ExpanderVector yPrev)
+{
+	return _mm_mul_ps(coeff, _mm_sub_ps(_mm_add_ps(yPrev, x), xPrev));
+}
+static inline ExpanderVector expanderDouble(ExpanderVector y) { return _mm_add_ps(y, y); }
+#endif
+
+#if defined(FORMAT_CONVERTER_NEON) || defined(FORMAT_CONVERTER_SSE2)
+// Filter kGroups groups of 4 channels starting at channel c.
+template <unsigned int kGroups>
+static inline void expanderFilterGroups(float* data, unsigned int frames, unsigned int channels, unsigned int c, const AnalogInStages& stages)
+{
+	const ExpanderVector coeff = expanderSplat(stages.expanderCoeff);
+	ExpanderMask mask[kGroups];
+	ExpanderVector xPrev[kGroups];
+	ExpanderVector yPrev[kGroups];
+	for(unsigned int g = 0; g < kGroups; ++g)
+	{
+		mask[g] = expanderMask((stages.expanderChannels >> (c + 4 * g)) & 0xf);
+		xPrev[g] = expanderLoad(stages.expanderInputHistory + c + 4 * g);
+		yPrev[g] = expanderLoad(stages.expanderOutputHistory + c + 4 * g);
+	}
+	for(unsigned int f = 0; f < frames; ++f)
+	{
+		for(unsigned int g = 0; g < kGroups; ++g)
+		{
+			float* p = data + f * channels + c + 4 * g;
+			ExpanderVector x = expanderLoad(p);
+			ExpanderVector y = expanderStep(coeff, x, xPrev[g], yPrev[g]);
+			expanderStore(p, expanderSelect(mask[g], expanderDouble(y), x));
+			// the disabled channels are filtered too, but not used
+			xPrev[g] = x;
+			yPrev[g] = y;
+		}
+	}
+	for(unsigned int g = 0; g < kGroups; ++g)
+	{
+		// disabled channels keep their history
+		float* inHistory = stages.expanderInputHistory + c + 4 * g;
+		float* outHistory = stages.expanderOutputHistory + c + 4 * g;
+		expanderStore(inHistory, expanderSelect(mask[g], xPrev[g], expanderLoad(inHistory)));
+		expanderStore(outHistory, expanderSelect(mask[g], yPrev[g], expanderLoad(outHistory)));
+	}
+}
+#endif
+
+static void expanderFilter(float* data, unsigned int frames, unsigned int channels, const AnalogInStages& stages)
+{
+	unsigned int c = 0;
+#if defined(FORMAT_CONVERTER_NEON) || defined(FORMAT_CONVERTER_SSE2)
+	for(; c + 8 <= channels && c + 8 <= 32; c += 8)
+	{
+		uint32_t enabled = (stages.expanderChannels >> c) & 0xff;
+		if(enabled & 0xf && enabled & 0xf0)
+			expanderFilterGroups<2>(data, frames, channels, c, stages);
+		else if(enabled & 0xf)
+			expanderFilterGroups<1>(data, frames, channels, c, stages);
+		else if(enabled & 0xf0)
+			expanderFilterGroups<1>(data, frames, channels, c + 4, stages);
+	}
+	for(; c + 4 <= channels && c + 4 <= 32; c += 4)
+	{
+		if((stages.expanderChannels >> c) & 0xf)
+			expanderFilterGroups<1>(data, frames, channels, c, stages);
+	}
+#endif
+	for(; c < channels && c < 32; ++c)
+	{
+		if(!(stages.expanderChannels & (1u << c)))
+			continue;
+		float xPrev = stages.expanderInputHistory[c];
+		float yPrev = stages.expanderOutputHistory[c];
+		for(unsigned int f = 0; f < frames; ++f)
+		{
+			float& x = data[f * channels + c];
+			float y = stages.expanderCoeff * (yPrev + x - xPrev);
+			xPrev = x;
+			yPrev = y;
+			x = 2.f * y;
+		}
+		stages.expanderInputHistory[c] = xPrev;
+		stages.expanderOutputHistory[c] = yPrev;
+	}
+}
+
+// Write the hardware frames [begin, end) that fall within the last
+// muxChannels frames of the block to the multiplexer buffer. These are
+// scaled but not inverted or filtered.
+static void muxScatter(const uint16_t* src, unsigned int begin, unsigned int end, unsigned int hardwareFrames, unsigned int channels, const AnalogInStages& stages)
+{
+	if(!stages.muxAnalogIn)
+		return;
+	unsigned int muxChannels = stages.muxChannels;
+	unsigned int first = hardwareFrames > muxChannels ? hardwareFrames - muxChannels : 0;
+	if(begin < first)
+		begin = first;
+	if(begin >= end)
+		return;
+	unsigned int muxChannel = (stages.muxLastChannel + muxChannels - (hardwareFrames - 1 - begin)) % muxChannels;
+	for(unsigned int f = begin; f < end; ++f)
+	{
+		AnalogSample<false>::toFloat(stages.muxAnalogIn + muxChannel * channels, src + f * channels, channels);
+		if(++muxChannel == muxChannels)
+			muxChannel = 0;
+	}
+}
+
+// only analog inputs have stages
+static void muxScatter(const int16_t*, unsigned int, unsigned int, unsigned int, unsigned int, const AnalogInStages&)
+{
+}
+
+template <unsigned int kChannels, unsigned int kFrames>
+static inline void transposeIn(float* dst, const float* tile, unsigned int numChannels, unsigned int numFrames, unsigned int dstFrames)
+{
+	const unsigned int channels = kChannels ? kChannels : numChannels;
+	const unsigned int frames = kFrames ? kFrames : numFrames;
+	for(unsigned int c = 0; c < channels; ++c)
+		for(unsigned int k = 0; k < frames; ++k)
+			dst[c * dstFrames + k] = tile[k * channels + c];
+}
+
+// kStages: whether the optional AnalogInStages are applied. These run on
+// each tile after it is converted, while it is still in cache.
+template <typename Sample, bool interleaved, AnalogRatio ratio, unsigned int kChannels, bool kStages>
+static void convertIn(float* dst, const typename Sample::Raw* src, unsigned int hardwareFrames, unsigned int numChannels, const AnalogInStages* stages)
+{
+	const unsigned int channels = kChannels ? kChannels : numChannels;
+	const unsigned int frames = contextFrames<ratio>(hardwareFrames);
+	if(interleaved && !kStages)
+	{
+		convertFrames<Sample, ratio>(dst, src, 0, frames, channels);
+		return;
+	}
+	if(!interleaved && channels > kMaxTileChannels)
+	{
+		// too many channels for a tile. setup() does not allow this
+		// for the analog inputs, so there are no stages here
+		for(unsigned int f = 0; f < frames; ++f)
+			for(unsigned int c = 0; c < channels; ++c)
+				dst[c * frames + f] = Sample::toFloat(src[hardwareFrame<ratio>(f) * channels + c]);
+		return;
+	}
+	float scratch[kTileFrames * kMaxTileChannels];
+	const unsigned int tileFrames = interleaved ? kInterleavedTileFrames : kTileFrames;
+	for(unsigned int f = 0; f < frames; f += tileFrames)
+	{
+		unsigned int n = frames - f < tileFrames ? frames - f : tileFrames;
+		float* tile = interleaved ? dst + f * channels : scratch;
+		convertFrames<Sample, ratio>(tile, src, f, n, channels);
+		if(kStages)
+		{
+			expanderFilter(tile, n, channels, *stages);
+			unsigned int end = f + n < frames ? hardwareFrame<ratio>(f + n) : hardwareFrames;
+			muxScatter(src, hardwareFrame<ratio>(f), end, hardwareFrames, channels, *stages);
+		}
+		if(!interleaved)
+		{
+			if(kTileFrames == n)
+				transposeIn<kChannels, kTileFrames>(dst + f, tile, channels, n, frames);
+			else
+				transposeIn<kChannels, 0>(dst + f, tile, channels, n, frames);
+		}
+	}
+}
+
+template <typename Sample, bool interleaved, AnalogRatio ratio, unsigned int kChannels>
+static void convertOut(typename Sample::Raw* dst, const float* src, unsigned int hardwareFrames, unsigned int numChannels)
+{
+	typedef typename Sample::Raw Raw;
+	const unsigned int channels = kChannels ? kChannels : numChannels;
+	const unsigned int frames = contextFrames<ratio>(hardwareFrames);
+	if(interleaved)
+	{
+		if(FormatConverter::kAnalogSame == ratio)
+		{
+			Sample::fromFloat(dst, src, frames * channels);
+		}
+		else if(FormatConverter::kAnalogUpsample == ratio)
+		{
+			// only the first of each pair of context frames is output
+			for(unsigned int f = 0; f < hardwareFrames; ++f)
+				Sample::fromFloat(dst + f * channels, src + contextFrame<ratio>(f) * channels, channels);
+		}
+		else
+		{
+			for(unsigned int f = 0; f < frames; ++f)
+			{
+				Raw* out = dst + f * 2 * channels;
+				Sample::fromFloat(out, src + f * channels, channels);
+				memcpy(out + channels, out, channels * sizeof(Raw));
+			}
+		}
+		return;
+	}
+	unsigned int f = 0;
+	if(channels <= kMaxTileChannels)
+	{
+		float tile[kTileFrames * kMaxTileChannels];
+		for(; f + kTileFrames <= hardwareFrames; f += kTileFrames)
+		{
+			for(unsigned int c = 0; c < channels; ++c)
+				for(unsigned int k = 0; k < kTileFrames; ++k)
+					tile[k * channels + c] = src[c * frames + contextFrame<ratio>(f + k)];
+			Sample::fromFloat(dst + f * channels, tile, kTileFrames * channels);
+		}
+	}
+	for(; f < hardwareFrames; ++f)
+		for(unsigned int c = 0; c < channels; ++c)
+			dst[f * channels + c] = Sample::fromFloat(src[c * frames + contextFrame<ratio>(f)]);
+}
+
+// Pick the function for the given layout and channel count. The channel
+// count is only specialised for non-interleaved buffers, where it matters.
+template <typename Sample, bool interleaved, AnalogRatio ratio, bool kStages>
+static void (*pickIn(unsigned int channels))(float*, const typename Sample::Raw*, unsigned int, unsigned int, const AnalogInStages*)
+{
+	if(!interleaved)
+	{
+		switch(channels)
+		{
+		case 2:
+			return convertIn<Sample, interleaved, ratio, 2, kStages>;
+		case 4:
+			return convertIn<Sample, interleaved, ratio, 4, kStages>;
+		case 8:
+			return convertIn<Sample, interleaved, ratio, 8, kStages>;
+		}
+	}
+	return convertIn<Sample, interleaved, ratio, 0, kStages>;
+}
+
+template <typename Sample, bool interleaved, AnalogRatio ratio>
+static void (*pickOut(unsigned int channels))(typename Sample::Raw*, const float*, unsigned int, unsigned int)
+{
+	if(!interleaved)
+	{
+		switch(channels)
+		{
+		case 2:
+			return convertOut<Sample, interleaved, ratio, 2>;
+		case 4:
+			return convertOut<Sample, interleaved, ratio, 4>;
+		case 8:
+			return convertOut<Sample, interleaved, ratio, 8>;
+		}
+	}
+	return convertOut<Sample, interleaved, ratio, 0>;
+}
+
+template <typename Sample, bool interleaved, AnalogRatio ratio, typename In, typename Out>
+static void pickAnalog(In& in, In& inStages, Out& out, unsigned int inChannels, unsigned int outChannels)
+{
+	in = pickIn<Sample, interleaved, ratio, false>(inChannels);
+	inStages = pickIn<Sample, interleaved, ratio, true>(inChannels);
+	out = pickOut<Sample, interleaved, ratio>(outChannels);
+}
+
+template <typename Sample, bool interleaved, typename In, typename Out>
+static int pickAnalog(In& in, In& inStages, Out& out, AnalogRatio ratio, unsigned int inChannels, unsigned int outChannels)
+{
+	switch(ratio)
+	{
+	case FormatConverter::kAnalogUpsample:
+		pickAnalog<Sample, interleaved, FormatConverter::kAnalogUpsample>(in, inStages, out, inChannels, outChannels);
+		return 0;
+	case FormatConverter::kAnalogSame:
+		pickAnalog<Sample, interleaved, FormatConverter::kAnalogSame>(in, inStages, out, inChannels, outChannels);
+		return 0;
+	case FormatConverter::kAnalogDownsample:
+		pickAnalog<Sample, interleaved, FormatConverter::kAnalogDownsample>(in, inStages, out, inChannels, outChannels);
+		return 0;
+	}
+	return -1;
+}
+
+int FormatConverter::setup(bool interleaved, unsigned int audioInChannels, unsigned int audioOutChannels, unsigned int analogInChannels, unsigned int analogOutChannels, AnalogRatio analogRatio, bool invertAnalog)
+{
+	if(analogInChannels > kMaxTileChannels)
+	{
+		fprintf(stderr, "FormatConverter: at most %u analog input channels are supported\n", kMaxTileChannels);
+		return -1;
+	}
+	this->audioInChannels = audioInChannels;
+	this->audioOutChannels = audioOutChannels;
+	this->analogInChannels = analogInChannels;
+	this->analogOutChannels = analogOutChannels;
+	if(interleaved)
+	{
+		audioInFunction = pickIn<AudioSample, true, kAnalogSame, false>(audioInChannels);
+		audioOutFunction = pickOut<AudioSample, true, kAnalogSame>(audioOutChannels);
+		if(invertAnalog)
+			return pickAnalog<AnalogSample<true>, true>(analogInFunction, analogInStagesFunction, analogOutFunction, analogRatio, analogInChannels, analogOutChannels);
+		else
+			return pickAnalog<AnalogSample<false>, true>(analogInFunction, analogInStagesFunction, analogOutFunction, analogRatio, analogInChannels, analogOutChannels);
+	} else {
+		audioInFunction = pickIn<AudioSample, false, kAnalogSame, false>(audioInChannels);
+		audioOutFunction = pickOut<AudioSample, false, kAnalogSame>(audioOutChannels);
+		if(invertAnalog)
+			return pickAnalog<AnalogSample<true>, false>(analogInFunction, analogInStagesFunction, analogOutFunction, analogRatio, analogInChannels, analogOutChannels);
+		else
+			return pickAnalog<AnalogSample<false>, false>(analogInFunction, analogInStagesFunction, analogOutFunction, analogRatio, analogInChannels, analogOutChannels);
+	}
+}
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <vector>
+
+// The reference conversions below are the scalar loops previously used in
+// PRU::loop(), including the separate Salt inversion passes.
+static void referenceAudioIn(bool interleaved, float* audioIn, const int16_t* audioInRaw, unsigned int audioFrames, unsigned int audioInChannels)
+{
+	if(interleaved)
+	{
+		for(unsigned int n = 0; n < audioInChannels * audioFrames; n++)
+			audioIn[n] = (float)audioInRaw[n] / 32768.0f;
+	}
+	else
+	{
+		for(unsigned int f = 0; f < audioFrames; ++f)
+		{
+			for(unsigned int c = 0; c < audioInChannels; ++c)
+			{
+				unsigned int srcIdx = f * audioInChannels + c;
+				unsigned int dstIdx = c * audioFrames + f;
+				audioIn[dstIdx] = (float)audioInRaw[srcIdx] / 32768.0f;
+			}
+		}
+	}
+}
+
+static void referenceAudioOut(bool interleaved, int16_t* audioOutRaw, const float* audioOut, unsigned int audioFrames, unsigned int audioOutChannels)
+{
+	if(interleaved)
+	{
+		for(unsigned int n = 0; n < audioOutChannels * audioFrames; ++n) {
+			int out = audioOut[n] * 32768.0f;
+			if(out < -32768) out = -32768;
+			else if(out > 32767) out = 32767;
+			audioOutRaw[n] = (int16_t)out;
+		}
+	}
+	else
+	{
+		for(unsigned int f = 0; f < audioFrames; ++f)
+		{
+			for(unsigned int c = 0; c < audioOutChannels; ++c)
+			{
+				unsigned int srcIdx = c * audioFrames + f;
+				unsigned int dstIdx = f * audioOutChannels + c;
+				int out = audioOut[srcIdx] * 32768.0f;
+				if(out < -32768) out = -32768;
+				else if(out > 32767) out = 32767;
+				audioOutRaw[dstIdx] = (int16_t)out;
+			}
+		}
+	}
+}
+
+static void referenceAnalogIn(bool interleaved, float analogs_per_audio, bool salt, float* analogIn, const uint16_t* analogInRaw, unsigned int frames, unsigned int channels)
+{
+	unsigned int analogFrames = frames;
+	if(analogs_per_audio == 0.5)
+	{
+		analogFrames = frames * 2;
+		for(unsigned int f = 0; f < frames; ++f)
+		{
+			for(unsigned int c = 0; c < channels; ++c)
+			{
+				float value = (float)analogInRaw[f * channels + c] / 65536.0f;
+				if(interleaved)
+				{
+					int firstFrame = channels * 2 * f + c;
+					analogIn[firstFrame] = value;
+					analogIn[firstFrame + channels] = value;
+				} else {
+					unsigned int dstIdx = frames * c * 2 + f * 2;
+					analogIn[dstIdx] = value;
+					analogIn[dstIdx + 1] = value;
+				}
+			}
+		}
+	}
+	else if(analogs_per_audio == 1)
+	{
+		for(unsigned int f = 0; f < frames; ++f)
+		{
+			for(unsigned int c = 0; c < channels; ++c)
+			{
+				unsigned int srcIdx = channels * f + c;
+				unsigned int dstIdx = interleaved ? srcIdx : frames * c + f;
+				analogIn[dstIdx] = (float)analogInRaw[srcIdx] / 65536.0f;
+			}
+		}
+	}
+	else if(analogs_per_audio == 2)
+	{
+		analogFrames = frames / 2;
+		for(unsigned int f = 0; f < frames; f += 2)
+		{
+			for(unsigned int c = 0; c < channels; ++c)
+			{
+				unsigned int srcIdx = f * channels + c;
+				unsigned int dstIdx = interleaved ? (f / 2) * channels + c : c * (frames / 2) + f / 2;
+				analogIn[dstIdx] = (float)analogInRaw[srcIdx] / 65536.0f;
+			}
+		}
+	}
+	if(salt) {
+		const float analogInMax = 65535.f/65536.f;
+		for(unsigned int n = 0; n < channels * analogFrames; ++n)
+			analogIn[n] = analogInMax - analogIn[n];
+	}
+}
+
+static void referenceAnalogOut(bool interleaved, float analogs_per_audio, bool salt, uint16_t* analogOutRaw, float* analogOut, unsigned int frames, unsigned int channels)
+{
+	if(salt) {
+		unsigned int analogFrames = analogs_per_audio == 0.5 ? frames * 2 : analogs_per_audio == 2 ? frames / 2 : frames;
+		for(unsigned int n = 0; n < channels * analogFrames; n++)
+		{
+			const float analogOutMax = 0.93;
+			analogOut[n] = (1.f - analogOut[n]) * analogOutMax;
+		}
+	}
+	for(unsigned int f = 0; f < frames; f += (analogs_per_audio == 2 ? 2 : 1))
+	{
+		for(unsigned int c = 0; c < channels; ++c)
+		{
+			unsigned int srcIdx;
+			if(analogs_per_audio == 0.5)
+				srcIdx = interleaved ? f * channels * 2 + c : c * frames * 2 + f * 2;
+			else if(analogs_per_audio == 1)
+				srcIdx = interleaved ? f * channels + c : c * frames + f;
+			else
+				srcIdx = interleaved ? f * channels / 2 + c : frames / 2 * c + f / 2;
+			unsigned int dstIdx = f * channels + c;
+			int out = analogOut[srcIdx] * 65536.0f;
+			if(out < 0) out = 0;
+			else if(out > 65535) out = 65535;
+			analogOutRaw[dstIdx] = (uint16_t)out;
+			if(analogs_per_audio == 2)
+				analogOutRaw[dstIdx + channels] = (uint16_t)out;
+		}
+	}
+}
+
+// The audio expander highpass and the multiplexer demultiplexing, as
+// previously done in PRU::loop() after the conversion.
+static void referenceExpander(bool interleaved, float* analogIn, unsigned int analogFrames, unsigned int analogInChannels, uint32_t audioExpanderEnabled, float audio_expander_filter_coeff, float* audio_expander_input_history, float* audio_expander_output_history)
+{
+	for(unsigned int ch = 0; ch < analogInChannels; ch++) {
+		if(audioExpanderEnabled & (1 << ch)) {
+			for(unsigned int n = 0; n < analogFrames; n++) {
+				unsigned int idx = interleaved ? n * analogInChannels + ch : ch * analogFrames + n;
+				float filteredOut = audio_expander_filter_coeff *
+					(audio_expander_output_history[ch] +
+					 analogIn[idx] -
+					 audio_expander_input_history[ch]);
+				audio_expander_input_history[ch] = analogIn[idx];
+				audio_expander_output_history[ch] = filteredOut;
+				analogIn[idx] = 2.0f * filteredOut;
+			}
+		}
+	}
+}
+
+static void referenceMux(float* multiplexerAnalogIn, const uint16_t* analogInRaw, int hardware_analog_frames, unsigned int analogInChannels, unsigned int multiplexerChannels, int multiplexerChannelLastFrame)
+{
+	unsigned int muxChannelCount = 0;
+	int multiplexerChannel = multiplexerChannelLastFrame;
+	for(int n = hardware_analog_frames - 1; n >= 0; n--) {
+		for(unsigned int ch = 0; ch < analogInChannels; ch++) {
+			multiplexerAnalogIn[multiplexerChannel * analogInChannels + ch] =
+				analogInRaw[n * analogInChannels + ch] / 65536.f;
+		}
+		multiplexerChannel--;
+		if(multiplexerChannel < 0)
+			multiplexerChannel = multiplexerChannels - 1;
+		if(++muxChannelCount >= multiplexerChannels)
+			break;
+	}
+}
+
+static float testRandom(float min, float max)
+{
+	return min + (max - min) * (rand() / (float)RAND_MAX);
+}
+
+template <typename T>
+static bool testSame(const std::vector<T>& a, const std::vector<T>& b, const char* what, bool interleaved, unsigned int channels, unsigned int frames)
+{
+	if(a.size() == b.size() && 0 == memcmp(a.data(), b.data(), a.size() * sizeof(T)))
+		return true;
+	fprintf(stderr, "FormatConverter: %s differs from the reference (%s, %u channels, %u frames)\n",
+		what, interleaved ? "interleaved" : "non-interleaved", channels, frames);
+	return false;
+}
+
+bool FormatConverter::test()
+{
+	srand(0);
+	// values that test the rounding and clipping at the edges of the range
+	const float audioEdges[] = { -2.f, -1.f, -32767.5f / 32768.f, -0.5f / 32768.f, 0.f, 0.5f / 32768.f, 32767.f / 32768.f, 32767.9f / 32768.f, 1.f, 2.f };
+	const float analogEdges[] = { -1.f, -0.5f / 65536.f, 0.f, 0.5f / 65536.f, 65535.f / 65536.f, 65535.9f / 65536.f, 1.f, 2.f };
+	const AnalogRatio ratios[] = { kAnalogUpsample, kAnalogSame, kAnalogDownsample };
+	const float analogsPerAudio[] = { 0.5, 1, 2 };
+	{
+		// non-interleaved analog inputs are processed in tiles
+		FormatConverter converter;
+		assert(0 != converter.setup(false, 2, 2, kMaxTileChannels + 1, 2, kAnalogSame, false));
+	}
+	for(bool interleaved : { true, false })
+	for(unsigned int channels : { 1, 2, 3, 4, 8, 10, 40 })
+	for(unsigned int frames : { 2, 4, 6, 8, 14, 16, 64 })
+	{
+		FormatConverter converter;
+		bool testAnalog = channels <= kMaxTileChannels;
+		assert(0 == converter.setup(interleaved, channels, channels, testAnalog ? channels : 0, channels, kAnalogSame, false));
+		unsigned int n = channels * frames;
+		std::vector<int16_t> audioRaw(n);
+		std::vector<float> audio(n);
+		std::vector<float> expected(n);
+		for(unsigned int i = 0; i < n; ++i)
+			audioRaw[i] = rand();
+		audioRaw[0] = -32768;
+		audioRaw[n - 1] = 32767;
+		converter.audioIn(audio.data(), audioRaw.data(), frames);
+		referenceAudioIn(interleaved, expected.data(), audioRaw.data(), frames, channels);
+		assert(testSame(audio, expected, "audio input", interleaved, channels, frames));
+
+		for(unsigned int i = 0; i < n; ++i)
+			audio[i] = i < sizeof(audioEdges) / sizeof(audioEdges[0]) ? audioEdges[i] : testRandom(-1.5, 1.5);
+		std::vector<int16_t> raw(n);
+		std::vector<int16_t> expectedRaw(n);
+		converter.audioOut(raw.data(), audio.data(), frames);
+		referenceAudioOut(interleaved, expectedRaw.data(), audio.data(), frames, channels);
+		assert(testSame(raw, expectedRaw, "audio output", interleaved, channels, frames));
+
+		if(!testAnalog)
+			continue;
+		for(unsigned int r = 0; r < 3; ++r)
+		for(bool invert : { false, true })
+		{
+			assert(0 == converter.setup(interleaved, channels, channels, channels, channels, ratios[r], invert));
+			unsigned int contextN = analogsPerAudio[r] == 0.5 ? n * 2 : analogsPerAudio[r] == 2 ? n / 2 : n;
+			std::vector<uint16_t> analogRaw(n);
+			std::vector<float> analog(contextN);
+			std::vector<float> expectedAnalog(contextN);
+			for(unsigned int i = 0; i < n; ++i)
+				analogRaw[i] = rand();
+			analogRaw[0] = 0;
+			analogRaw[n - 1] = 65535;
+			converter.analogIn(analog.data(), analogRaw.data(), frames);
+			referenceAnalogIn(interleaved, analogsPerAudio[r], invert, expectedAnalog.data(), analogRaw.data(), frames, channels);
+			assert(testSame(analog, expectedAnalog, "analog input", interleaved, channels, frames));
+
+			// the same, with the expander and multiplexer stages, over a
+			// few blocks so that the filter history is carried over
+			AnalogInStages stages;
+			std::vector<float> inHistory(channels);
+			std::vector<float> outHistory(channels);
+			std::vector<float> expectedInHistory(channels);
+			std::vector<float> expectedOutHistory(channels);
+			unsigned int muxChannels = 1 << (rand() % 4); // 1 means no multiplexer
+			std::vector<float> mux(muxChannels * channels);
+			std::vector<float> expectedMux(muxChannels * channels);
+			stages.expanderChannels = rand() & ((1 << channels) - 1);
+			stages.expanderCoeff = 0.9993f;
+			stages.expanderInputHistory = inHistory.data();
+			stages.expanderOutputHistory = outHistory.data();
+			if(muxChannels > 1)
+			{
+				stages.muxAnalogIn = mux.data();
+				stages.muxChannels = muxChannels;
+			}
+			for(unsigned int block = 0; block < 3; ++block)
+			{
+				for(unsigned int i = 0; i < n; ++i)
+					analogRaw[i] = rand();
+				stages.muxLastChannel = rand() % muxChannels;
+				converter.analogIn(analog.data(), analogRaw.data(), frames, stages);
+				referenceAnalogIn(interleaved, analogsPerAudio[r], invert, expectedAnalog.data(), analogRaw.data(), frames, channels);
+				referenceExpander(interleaved, expectedAnalog.data(), contextN / channels, channels, stages.expanderChannels, stages.expanderCoeff, expectedInHistory.data(), expectedOutHistory.data());
+				if(stages.muxAnalogIn)
+					referenceMux(expectedMux.data(), analogRaw.data(), frames, channels, muxChannels, stages.muxLastChannel);
+				assert(testSame(analog, expectedAnalog, "analog input with stages", interleaved, channels, frames));
+				assert(testSame(inHistory, expectedInHistory, "expander input history", interleaved, channels, frames));
+				assert(testSame(outHistory, expectedOutHistory, "expander output history", interleaved, channels, frames));
+				assert(testSame(mux, expectedMux, "multiplexer input", interleaved, channels, frames));
+			}
+
+			for(unsigned int i = 0; i < contextN; ++i)
+				analog[i] = i < sizeof(analogEdges) / sizeof(analogEdges[0]) ? analogEdges[i] : testRandom(-0.5, 1.5);
+			std::vector<uint16_t> rawAnalog(n);
+			std::vector<uint16_t> expectedRawAnalog(n);
+			converter.analogOut(rawAnalog.data(), analog.data(), frames);
+			// the reference inverts in place
+			referenceAnalogOut(interleaved, analogsPerAudio[r], invert, expectedRawAnalog.data(), analog.data(), frames, channels);
+			assert(testSame(rawAnalog, expectedRawAnalog, "analog output", interleaved, channels, frames));
+		}
+	}
+	return true;
+}
+
+#include <time.h>
+
+static double benchmarkNow()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts); // NOWRAP
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+void FormatConverter::benchmark()
+{
+	// 8 analog channels at the audio rate with 16-frame blocks, all
+	// channels through the audio expander, and the multiplexer capelet
+	const unsigned int channels = 8;
+	const unsigned int hardwareFrames = 8;
+	const unsigned int contextN = hardwareFrames * 2 * channels;
+	const unsigned int muxChannels = 8;
+	const unsigned int iterations = 100000;
+	std::vector<uint16_t> raw(hardwareFrames * channels);
+	for(auto& r : raw)
+		r = rand();
+	std::vector<float> analog(contextN);
+	std::vector<float> inHistory(channels);
+	std::vector<float> outHistory(channels);
+	std::vector<float> mux(muxChannels * channels);
+	AnalogInStages stages;
+	stages.expanderChannels = 0xff;
+	stages.expanderCoeff = 0.9993f;
+	stages.expanderInputHistory = inHistory.data();
+	stages.expanderOutputHistory = outHistory.data();
+	stages.muxAnalogIn = mux.data();
+	stages.muxChannels = muxChannels;
+	for(bool interleaved : { true, false })
+	{
+		FormatConverter converter;
+		converter.setup(interleaved, 2, 2, channels, channels, kAnalogUpsample, false);
+		double start = benchmarkNow();
+		for(unsigned int n = 0; n < iterations; ++n)
+		{
+			stages.muxLastChannel = n % muxChannels;
+			converter.analogIn(analog.data(), raw.data(), hardwareFrames, stages);
+		}
+		double fused = benchmarkNow() - start;
+		start = benchmarkNow();
+		for(unsigned int n = 0; n < iterations; ++n)
+		{
+			referenceMux(mux.data(), raw.data(), hardwareFrames, channels, muxChannels, n % muxChannels);
+			referenceAnalogIn(interleaved, 0.5, false, analog.data(), raw.data(), hardwareFrames, channels);
+			referenceExpander(interleaved, analog.data(), contextN / channels, channels, stages.expanderChannels, stages.expanderCoeff, inHistory.data(), outHistory.data());
+		}
+		double separate = benchmarkNow() - start;
+		printf("FormatConverter: %s, %u channels, %u frames: fused %.0fns, separate passes %.0fns per block\n",
+			interleaved ? "interleaved" : "non-interleaved", channels, contextN / channels,
+			fused / iterations * 1e9, separate / iterations * 1e9);
+	}
+}
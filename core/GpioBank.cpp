@@ -0,0 +1,140 @@
+#include "../include/GpioBank.h"
+#include <errno.h>
+#include <string.h>
+
+// Whether the kernel already exposes the pin in sysfs
+static bool isExported(unsigned int pin)
+{
+	char path[64];
+	snprintf(path, sizeof(path), SYSFS_GPIO_DIR "/gpio%u", pin);
+	return 0 == access(path, F_OK);
+}
+
+int GpioBank::open(unsigned int newBank, uint32_t outputs, uint32_t inputs, bool unexport)
+{
+	close();
+	if(newBank >= kNumBanks || (outputs & inputs))
+		return EINVAL;
+	bank = newBank;
+	// as in Gpio::open(), the kernel configures the pins and enables the
+	// clock of the bank, without which its registers cannot be accessed
+	for(unsigned int n = 0; n < kPinsPerBank; ++n)
+	{
+		uint32_t mask = 1 << n;
+		if(!((outputs | inputs) & mask))
+			continue;
+		unsigned int pin = bank * kPinsPerBank + n;
+		// gpio_export() also succeeds for a pin that is already
+		// exported, so check first: such a pin is not ours to unexport
+		if(!isExported(pin) && 0 == gpio_export(pin) && unexport)
+			exported |= mask;
+		if(gpio_set_dir(pin, (outputs & mask) ? OUTPUT_PIN : INPUT_PIN) < 0)
+		{
+			fprintf(stderr, "GpioBank: unable to set the direction of GPIO pin %u\n", pin);
+			close();
+			return EIO;
+		}
+	}
+	int fd = ::open("/dev/mem", O_RDWR | O_SYNC);
+	if(fd < 0)
+	{
+		int ret = errno;
+		fprintf(stderr, "GpioBank: unable to open /dev/mem: (%d) %s\n", ret, strerror(ret));
+		close();
+		return ret;
+	}
+	void* ptr = mmap(0, GPIO_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, GPIO_ADDRESSES[bank]); // NOWRAP
+	::close(fd);
+	if(MAP_FAILED == ptr)
+	{
+		fprintf(stderr, "GpioBank: unable to map GPIO bank %u\n", bank);
+		close();
+		return ENOMEM;
+	}
+	gpio = (volatile uint32_t*)ptr;
+	return 0;
+}
+
+int GpioBank::openSimulated(unsigned int newBank, uint32_t outputs)
+{
+	close();
+	if(newBank >= kNumBanks)
+		return EINVAL;
+	bank = newBank;
+	simulated = true;
+	memset(simulatedRegisters, 0, sizeof(simulatedRegisters));
+	// what the kernel would have done in open()
+	simulatedRegisters[GPIO_OE] = ~outputs;
+	simulatedInputs = 0;
+	gpio = simulatedRegisters;
+	simulate();
+	return 0;
+}
+
+void GpioBank::close()
+{
+	if(!simulated)
+	{
+		if(gpio)
+			munmap((void*)gpio, GPIO_SIZE);
+		for(unsigned int n = 0; n < kPinsPerBank; ++n)
+			if(exported & (1 << n))
+				gpio_unexport(bank * kPinsPerBank + n);
+	}
+	gpio = nullptr;
+	exported = 0;
+	simulated = false;
+}
+
+void GpioBank::setSimulatedInputs(uint32_t values)
+{
+	simulatedInputs = values;
+	simulate();
+}
+
+// What the hardware does after a register is written
+void GpioBank::simulate()
+{
+	uint32_t* regs = simulatedRegisters;
+	regs[GPIO_DATAOUT] = (regs[GPIO_DATAOUT] | regs[GPIO_SETDATAOUT]) & ~regs[GPIO_CLEARDATAOUT];
+	regs[GPIO_SETDATAOUT] = 0;
+	regs[GPIO_CLEARDATAOUT] = 0;
+	regs[GPIO_DATAIN] = (regs[GPIO_DATAOUT] & ~regs[GPIO_OE]) | (simulatedInputs & regs[GPIO_OE]);
+}
+
+#undef NDEBUG
+#include <assert.h>
+
+bool GpioBank::test()
+{
+	GpioBank bank;
+	assert(EINVAL == bank.openSimulated(kNumBanks, 0));
+	assert(!bank.isOpen());
+	assert(0 == bank.openSimulated(1, 0x00000f0f));
+	assert(bank.isOpen());
+	assert(0 == bank.read());
+
+	bank.setSimulatedInputs(0x000000f0);
+	assert(0x000000f0 == bank.read());
+	bank.set(0x00000003);
+	assert(0x00000003 == bank.getOutputValues());
+	assert(0x000000f3 == bank.read());
+	// inputs are not driven by the outputs register, and vice versa
+	bank.write(0x00000fff, 0x00000a0c);
+	assert(0x00000a0c == bank.getOutputValues());
+	assert(0x00000afc == bank.read());
+	bank.setSimulatedInputs(0xffffffff);
+	assert(0xfffffafc == bank.read());
+	bank.setSimulatedInputs(0);
+	assert(0x00000a0c == bank.read());
+	// set and clear only touch the pins in the mask
+	bank.clear(0x00000800);
+	assert(0x0000020c == bank.read());
+	bank.set(0x00000001);
+	assert(0x0000020d == bank.read());
+	bank.clear(0xffffffff);
+	assert(0 == bank.read());
+	bank.close();
+	assert(!bank.isOpen());
+	return true;
+}
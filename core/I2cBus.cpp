@@ -0,0 +1,120 @@
+/***** I2cBus.cpp *****/
+#include <I2cBus.h>
+#include <I2c.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+int I2cDevBus::open(unsigned int bus)
+{
+	close();
+	char name[MAX_BUF_NAME];
+	snprintf(name, sizeof(name), "/dev/i2c-%u", bus);
+	fd = ::open(name, O_RDWR);
+	if(fd < 0)
+	{
+		int ret = errno;
+		fprintf(stderr, "I2cDevBus: unable to open %s: (%d) %s\n", name, ret, strerror(ret));
+		return ret;
+	}
+	return 0;
+}
+
+void I2cDevBus::close()
+{
+	if(fd >= 0)
+		::close(fd);
+	fd = -1;
+}
+
+int I2cDevBus::transfer(Message* messages, unsigned int count)
+{
+	if(fd < 0 || count > kMaxMessages)
+		return EINVAL;
+	struct i2c_msg msgs[kMaxMessages];
+	for(unsigned int n = 0; n < count; ++n)
+	{
+		msgs[n].addr = messages[n].address;
+		msgs[n].flags = messages[n].read ? I2C_M_RD : 0;
+		msgs[n].len = messages[n].length;
+		msgs[n].buf = (decltype(msgs[n].buf))messages[n].data;
+	}
+	struct i2c_rdwr_ioctl_data packets;
+	packets.msgs = msgs;
+	packets.nmsgs = count;
+	if(ioctl(fd, I2C_RDWR, &packets) < 0)
+		return errno;
+	return 0;
+}
+
+FakeI2cBus::Device* FakeI2cBus::findDevice(uint16_t address)
+{
+	for(auto& device : devices)
+		if(device.address == address)
+			return &device;
+	return nullptr;
+}
+
+void FakeI2cBus::addDevice(uint16_t address)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	devices.emplace_back();
+	Device& device = devices.back();
+	device.address = address;
+	device.pointer = 0;
+	memset(device.registers, 0, sizeof(device.registers));
+}
+
+int FakeI2cBus::setRegisters(uint16_t address, uint8_t firstRegister, const uint8_t* data, unsigned int length)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Device* device = findDevice(address);
+	if(!device)
+		return ENODEV;
+	for(unsigned int n = 0; n < length; ++n)
+		device->registers[(uint8_t)(firstRegister + n)] = data[n];
+	return 0;
+}
+
+int FakeI2cBus::getRegisters(uint16_t address, uint8_t firstRegister, uint8_t* data, unsigned int length)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Device* device = findDevice(address);
+	if(!device)
+		return ENODEV;
+	for(unsigned int n = 0; n < length; ++n)
+		data[n] = device->registers[(uint8_t)(firstRegister + n)];
+	return 0;
+}
+
+int FakeI2cBus::transfer(Message* messages, unsigned int count)
+{
+	if(count > kMaxMessages)
+		return EINVAL;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		++transfers;
+		for(unsigned int n = 0; n < count; ++n)
+		{
+			Message& message = messages[n];
+			Device* device = findDevice(message.address);
+			if(!device)
+				return ENXIO; // no acknowledge
+			for(unsigned int b = 0; b < message.length; ++b)
+			{
+				if(message.read)
+					message.data[b] = device->registers[device->pointer++];
+				else if(0 == b)
+					device->pointer = message.data[b];
+				else
+					device->registers[device->pointer++] = message.data[b];
+			}
+		}
+	}
+	if(transferTimeUs)
+	{
+		struct timespec req = { (time_t)(transferTimeUs / 1000000), (long)(transferTimeUs % 1000000) * 1000 };
+		nanosleep(&req, NULL); // NOWRAP
+	}
+	return 0;
+}
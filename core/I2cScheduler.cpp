@@ -0,0 +1,285 @@
+/***** I2cScheduler.cpp *****/
+#include <I2cScheduler.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include "../include/xenomai_wraps.h"
+
+extern unsigned int gAuxiliaryTaskStackSize;
+extern unsigned int gAuxiliaryTaskCpus;
+
+static constexpr unsigned int kNewFlag = 4;
+// the longest the thread sleeps for, so that it notices when it should stop
+static constexpr uint64_t kMaxSleepNs = 10000000;
+
+static uint64_t getTimeNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts); // NOWRAP
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+I2cScheduler::~I2cScheduler()
+{
+	cleanup();
+}
+
+int I2cScheduler::setup(I2cBus* bus, const std::string& name, int priority)
+{
+	cleanup();
+	if(!bus)
+		return EINVAL;
+	this->bus = bus;
+	this->name = name;
+	this->priority = priority;
+	slots.clear();
+	return 0;
+}
+
+int I2cScheduler::addDevice(Device* device, float rate)
+{
+	if(running || !device || rate <= 0)
+		return -EINVAL;
+	unsigned int size = device->getSnapshotSize();
+	if(!size)
+		return -EINVAL;
+	slots.emplace_back(new Slot);
+	Slot& slot = *slots.back();
+	slot.device = device;
+	slot.size = size;
+	slot.buffers.assign(3 * size, 0);
+	slot.front = 0;
+	slot.middle = 1;
+	slot.back = 2;
+	slot.period = 1000000000 / rate;
+	slot.due = 0;
+	slot.polls = 0;
+	slot.errors = 0;
+	slot.latencySum = 0;
+	slot.lastLatency = 0;
+	slot.maxLatency = 0;
+	slot.maxLateness = 0;
+	return slots.size() - 1;
+}
+
+int I2cScheduler::start()
+{
+#ifdef XENOMAI_SKIN_native
+	fprintf(stderr, "I2cScheduler is only supported on the posix skin\n");
+	return -1;
+#endif
+#ifdef XENOMAI_SKIN_posix
+	if(running)
+		return 0;
+	if(!bus || !slots.size())
+	{
+		fprintf(stderr, "I2cScheduler: no devices to poll\n");
+		return EINVAL;
+	}
+	uint64_t now = getTimeNs();
+	for(auto& slot : slots)
+		slot->due = now;
+	shouldStop = false;
+	if(int ret = create_and_start_thread(&thread, name.c_str(), priority, gAuxiliaryTaskStackSize, (pthread_callback_t*)loop, this, hasCpus ? cpus : gAuxiliaryTaskCpus))
+	{
+		fprintf(stderr, "I2cScheduler: unable to create thread %s: (%d) %s\n", name.c_str(), ret, strerror(ret));
+		return ret;
+	}
+	running = true;
+	return 0;
+#endif
+}
+
+void I2cScheduler::cleanup()
+{
+#ifdef XENOMAI_SKIN_posix
+	if(!running)
+		return;
+	shouldStop = true;
+	__wrap_pthread_join(thread, NULL);
+	running = false;
+#endif
+}
+
+int I2cScheduler::setCpus(unsigned int cpus)
+{
+	this->cpus = cpus;
+	hasCpus = true;
+#ifdef XENOMAI_SKIN_posix
+	if(!running)
+		return 0;
+	int ret = set_running_thread_cpus(thread, cpus);
+	if(ret)
+		fprintf(stderr, "I2cScheduler: unable to set the CPUs of %s: (%d) %s\n", name.c_str(), ret, strerror(ret));
+	return ret;
+#else
+	return 0;
+#endif
+}
+
+void* I2cScheduler::loop(void* arg)
+{
+	I2cScheduler* that = (I2cScheduler*)arg;
+	while(!that->shouldStop && !gShouldStop)
+		that->pollNext();
+	return NULL;
+}
+
+void I2cScheduler::pollNext()
+{
+	uint64_t now = getTimeNs();
+	// the device that has been due for the longest. As each poll
+	// moves its device's due time forward, devices that are all late
+	// are served in turn.
+	Slot* slot = nullptr;
+	for(auto& s : slots)
+		if(!slot || s->due < slot->due)
+			slot = s.get();
+	if(slot->due > now)
+	{
+		uint64_t wait = slot->due - now;
+		task_sleep_ns(wait < kMaxSleepNs ? wait : kMaxSleepNs);
+		return;
+	}
+	uint64_t lateness = now - slot->due;
+	int ret = slot->device->poll(*bus, slot->buffers.data() + slot->back * slot->size);
+	uint64_t end = getTimeNs();
+	uint64_t latency = end - now;
+	if(ret) {
+		slot->errors.fetch_add(1, std::memory_order_relaxed);
+	} else {
+		// publish the new snapshot and take the one that is waiting
+		unsigned int old = slot->middle.exchange(slot->back | kNewFlag, std::memory_order_acq_rel);
+		slot->back = old & ~kNewFlag;
+		slot->polls.fetch_add(1, std::memory_order_relaxed);
+	}
+	// this is the only thread writing the stats
+	slot->latencySum.store(slot->latencySum.load(std::memory_order_relaxed) + latency, std::memory_order_relaxed);
+	slot->lastLatency.store(latency, std::memory_order_relaxed);
+	if(latency > slot->maxLatency.load(std::memory_order_relaxed))
+		slot->maxLatency.store(latency, std::memory_order_relaxed);
+	if(lateness > slot->maxLateness.load(std::memory_order_relaxed))
+		slot->maxLateness.store(lateness, std::memory_order_relaxed);
+	slot->due += slot->period;
+	// do not try to catch up with polls missed by more than a period
+	if(slot->due + slot->period < end)
+		slot->due = end;
+}
+
+const uint8_t* I2cScheduler::getSnapshot(int id, bool* isNew)
+{
+	Slot& slot = *slots[id];
+	bool hasNew = slot.middle.load(std::memory_order_relaxed) & kNewFlag;
+	if(hasNew)
+	{
+		unsigned int old = slot.middle.exchange(slot.front, std::memory_order_acq_rel);
+		slot.front = old & ~kNewFlag;
+	}
+	if(isNew)
+		*isNew = hasNew;
+	return slot.buffers.data() + slot.front * slot.size;
+}
+
+I2cScheduler::Stats I2cScheduler::getStats(int id)
+{
+	Slot& slot = *slots[id];
+	Stats stats;
+	stats.polls = slot.polls.load(std::memory_order_relaxed);
+	stats.errors = slot.errors.load(std::memory_order_relaxed);
+	uint64_t count = stats.polls + stats.errors;
+	stats.lastLatency = slot.lastLatency.load(std::memory_order_relaxed) / 1000.f;
+	stats.meanLatency = count ? slot.latencySum.load(std::memory_order_relaxed) / 1000.f / count : 0;
+	stats.maxLatency = slot.maxLatency.load(std::memory_order_relaxed) / 1000.f;
+	stats.maxLateness = slot.maxLateness.load(std::memory_order_relaxed) / 1000.f;
+	return stats;
+}
+
+int I2cRegisterDevice::poll(I2cBus& bus, uint8_t* snapshot)
+{
+	uint8_t reg = firstRegister;
+	I2cBus::Message messages[2] = {
+		{ address, false, 1, &reg },
+		{ address, true, (uint16_t)length, snapshot },
+	};
+	return bus.transfer(messages, 2);
+}
+
+#undef NDEBUG
+#include <assert.h>
+
+bool I2cScheduler::test()
+{
+	const unsigned int kLength = 16;
+	const uint16_t kAddresses[] = { 0x18, 0x19, 0x5a };
+	const float kRates[] = { 1000, 500, 250 };
+	const unsigned int kNumDevices = sizeof(kAddresses) / sizeof(kAddresses[0]);
+	FakeI2cBus bus;
+	bus.setTransferTime(100);
+	std::vector<std::unique_ptr<I2cRegisterDevice>> devices;
+	I2cScheduler scheduler;
+	assert(0 == scheduler.setup(&bus, "bela-i2c-test"));
+	for(unsigned int n = 0; n < kNumDevices; ++n)
+	{
+		bus.addDevice(kAddresses[n]);
+		devices.emplace_back(new I2cRegisterDevice(kAddresses[n], 4, kLength));
+		assert((int)n == scheduler.addDevice(devices[n].get(), kRates[n]));
+	}
+	// nothing answers at this address
+	I2cRegisterDevice missing(0x20, 0, kLength);
+	int missingId = scheduler.addDevice(&missing, 100);
+	assert(missingId == kNumDevices);
+	assert(0 == scheduler.start());
+	assert(scheduler.addDevice(&missing, 100) < 0);
+
+	// change the registers while they are being polled: every
+	// snapshot must be made of a single update
+	uint8_t lastValue[kNumDevices] = {};
+	unsigned int updates = 0;
+	uint64_t start = getTimeNs();
+	for(unsigned int t = 0; t < 2000; ++t)
+	{
+		for(unsigned int n = 0; n < kNumDevices; ++n)
+		{
+			uint8_t values[kLength];
+			memset(values, t & 0xff, sizeof(values));
+			assert(0 == bus.setRegisters(kAddresses[n], 4, values, kLength));
+			bool isNew;
+			const uint8_t* snapshot = scheduler.getSnapshot(n, &isNew);
+			for(unsigned int b = 1; b < kLength; ++b)
+				assert(snapshot[b] == snapshot[0]);
+			if(isNew)
+			{
+				updates += snapshot[0] != lastValue[n];
+				lastValue[n] = snapshot[0];
+			}
+		}
+		usleep(100); // NOWRAP
+	}
+	scheduler.cleanup();
+	float duration = (getTimeNs() - start) / 1000000000.f;
+	assert(updates > 0);
+
+	// the rates are respected, within the timing of the test
+	for(unsigned int n = 0; n < kNumDevices; ++n)
+	{
+		Stats stats = scheduler.getStats(n);
+		float expected = kRates[n] * duration;
+		assert(0 == stats.errors);
+		assert(stats.polls >= expected * 0.5f && stats.polls <= expected * 2.f);
+		assert(stats.meanLatency >= 100 && stats.maxLatency >= stats.meanLatency);
+	}
+	// a device can be late by more than the 4.29s that fit in 32 bits
+	// of nanoseconds, e.g.: if the thread was starved
+	scheduler.slots[0]->due = getTimeNs() - 5000000000ULL;
+	scheduler.pollNext();
+	assert(scheduler.getStats(0).maxLateness >= 5000000);
+
+	Stats stats = scheduler.getStats(missingId);
+	assert(0 == stats.polls && stats.errors > 0);
+	bool isNew;
+	const uint8_t* snapshot = scheduler.getSnapshot(missingId, &isNew);
+	assert(!isNew);
+	for(unsigned int b = 0; b < kLength; ++b)
+		assert(0 == snapshot[b]);
+	return true;
+}
@@ -13,10 +13,46 @@
  */
 
 #include "../include/I2c_Codec.h"
+#include <time.h>
 
 #define TLV320_DSP_MODE
+
+static unsigned long long getTimeNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts); // NOWRAP
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+class I2c_Codec::WriteQueue
+{
+public:
+	WriteQueue(I2c_Codec& codec) : codec(codec)
+	{
+		codec.queueWrites = true;
+	}
+	// the writes that have not been flushed are dropped, so that
+	// returning early on an error does not send them
+	~WriteQueue()
+	{
+		discard();
+		codec.queueWrites = false;
+	}
+	int flush()
+	{
+		return codec.flushWrites();
+	}
+	void discard()
+	{
+		codec.numQueuedWrites = 0;
+	}
+private:
+	I2c_Codec& codec;
+};
+
 I2c_Codec::I2c_Codec(int i2cBus, int i2cAddress, bool isVerbose /*= false*/)
-: dacVolumeHalfDbs(0), adcVolumeHalfDbs(0), hpVolumeHalfDbs(0), running(false)
+: dacVolumeHalfDbs(0), adcVolumeHalfDbs(0), hpVolumeHalfDbs(0), running(false),
+numQueuedWrites(0), queueWrites(false), resetDoneNs(0)
 {
 	setVerbose(isVerbose);
 	initI2C_RW(i2cBus, i2cAddress, -1);
@@ -32,8 +68,10 @@ int I2c_Codec::initCodec()
 		return 1;
 	}
 
-	// Wait for codec to process the reset (for safety)
-	usleep(5000);
+	// Give the codec time to process the reset (for safety). Rather
+	// than waiting here, the next write waits for it, so that the caller
+	// can do something else in the meantime.
+	resetDoneNs = getTimeNs() + 5000000;
 
 	return 0;
 }
@@ -44,6 +82,7 @@ int I2c_Codec::initCodec()
 // it runs at 44.1kHz
 int I2c_Codec::startAudio(int dual_rate)
 {
+	WriteQueue queue(*this);
 	// As a best-practice it's safer not to assume the implementer has issued initCodec()
 	// or has not otherwise modified codec registers since that call.
 	// Explicit Switch to config register page 0:
@@ -117,6 +156,8 @@ int I2c_Codec::startAudio(int dual_rate)
 	
 	// wait for the codec to stabilize before unmuting the HP amp.
 	// this gets rid of the loud pop.
+	if(queue.flush())
+		return 1;
 	usleep(10000);
 	// note : a small click persists, but it is unavoidable
 	// (i.e.: fading in the hpVolumeHalfDbs after it is turned on does not remove it).
@@ -137,6 +178,8 @@ int I2c_Codec::startAudio(int dual_rate)
 
 	if(writeADCVolumeRegisters(false))	// Unmute and set ADC volume
 		return 1;
+	if(queue.flush())
+		return 1;
 
 	running = true;
 	return 0;
@@ -470,10 +513,13 @@ int I2c_Codec::writeHPVolumeRegisters()
 // This tells the codec to stop generating audio and mute the outputs
 int I2c_Codec::stopAudio()
 {
+	WriteQueue queue(*this);
 	if(writeDACVolumeRegisters(true))	// Mute the DACs
 		return 1;
 	if(writeADCVolumeRegisters(true))	// Mute the ADCs
 		return 1;
+	if(queue.flush())
+		return 1;
 
 	usleep(10000);
 
@@ -491,6 +537,8 @@ int I2c_Codec::stopAudio()
 		return 1;
 	if(writeRegister(0x01, 0x80))		// Reset codec to defaults
 		return 1;
+	if(queue.flush())
+		return 1;
 
 	running = false;
 	return 0;
@@ -499,6 +547,16 @@ int I2c_Codec::stopAudio()
 // Write a specific register on the codec
 int I2c_Codec::writeRegister(unsigned int reg, unsigned int value)
 {
+	if(queueWrites)
+	{
+		if(numQueuedWrites == kMaxQueuedWrites && flushWrites())
+			return 1;
+		queuedWrites[numQueuedWrites][0] = reg & 0xFF;
+		queuedWrites[numQueuedWrites][1] = value & 0xFF;
+		++numQueuedWrites;
+		return 0;
+	}
+	waitForReset();
 	char buf[2] = { static_cast<char>(reg & 0xFF), static_cast<char>(value & 0xFF) };
 
 	if(write(i2C_file, buf, 2) != 2)
@@ -510,8 +568,46 @@ int I2c_Codec::writeRegister(unsigned int reg, unsigned int value)
 	return 0;
 }
 
+// Send the queued writes in a single transfer, one message each, in order
+int I2c_Codec::flushWrites()
+{
+	if(!numQueuedWrites)
+		return 0;
+	waitForReset();
+	struct i2c_msg msgs[kMaxQueuedWrites];
+	for(unsigned int n = 0; n < numQueuedWrites; ++n)
+	{
+		msgs[n].addr = i2C_address;
+		msgs[n].flags = 0;
+		msgs[n].len = 2;
+		msgs[n].buf = (decltype(msgs[n].buf))queuedWrites[n];
+	}
+	struct i2c_rdwr_ioctl_data packets;
+	packets.msgs = msgs;
+	packets.nmsgs = numQueuedWrites;
+	unsigned int firstReg = queuedWrites[0][0];
+	numQueuedWrites = 0;
+	if(ioctl(i2C_file, I2C_RDWR, &packets) < 0)
+	{
+		verbose && fprintf(stderr, "Failed to write %u registers from register %d on I2c codec\n", packets.nmsgs, firstReg);
+		return 1;
+	}
+	return 0;
+}
+
+void I2c_Codec::waitForReset()
+{
+	if(!resetDoneNs)
+		return;
+	unsigned long long now = getTimeNs();
+	if(now < resetDoneNs)
+		usleep((resetDoneNs - now) / 1000 + 1);
+	resetDoneNs = 0;
+}
+
 // Put codec to Hi-z (required for CTAG face)
 int I2c_Codec::disable(){
+	WriteQueue queue(*this);
 	if (writeRegister(0x0, 0)) // Select page 0
 		return 1;
 	if(writeRegister(0x01, 0x80)) // Reset codec to defaults
@@ -526,6 +622,8 @@ int I2c_Codec::disable(){
 		return 1;
 	if (writeRegister(0x5E, 0xC0)) // Power fully down left and right DAC
 		return 1;
+	if(queue.flush())
+		return 1;
 
 	return 0;
 }
@@ -0,0 +1,80 @@
+#include <LatencyStats.h>
+#include <math.h>
+
+void LatencyStats::reset()
+{
+	count = 0;
+	min = INT64_MAX;
+	max = INT64_MIN;
+	sum = 0;
+	sumSquares = 0;
+}
+
+void LatencyStats::add(int64_t ns)
+{
+	++count;
+	if(ns < min)
+		min = ns;
+	if(ns > max)
+		max = ns;
+	sum += ns;
+	sumSquares += (double)ns * ns;
+}
+
+double LatencyStats::getMinUs() const
+{
+	return count ? min / 1000.0 : 0;
+}
+
+double LatencyStats::getMaxUs() const
+{
+	return count ? max / 1000.0 : 0;
+}
+
+double LatencyStats::getMeanUs() const
+{
+	return count ? sum / count / 1000.0 : 0;
+}
+
+double LatencyStats::getJitterUs() const
+{
+	if(count < 2)
+		return 0;
+	double mean = sum / count;
+	double variance = sumSquares / count - mean * mean;
+	return variance > 0 ? sqrt(variance) / 1000.0 : 0;
+}
+
+void LatencyStats::printHeader(FILE* file)
+{
+	fprintf(file, "  %-24s %10s %9s %9s %9s %9s\n", "thread (us)", "wakeups", "min", "mean", "max", "jitter");
+}
+
+void LatencyStats::print(FILE* file, const char* name) const
+{
+	fprintf(file, "  %-24s %10llu %9.1f %9.1f %9.1f %9.1f\n", name, (unsigned long long)count,
+		getMinUs(), getMeanUs(), getMaxUs(), getJitterUs());
+}
+
+#undef NDEBUG
+#include <assert.h>
+
+bool LatencyStats::test()
+{
+	LatencyStats stats;
+	assert(0 == stats.getCount());
+	assert(0 == stats.getMeanUs() && 0 == stats.getJitterUs());
+	const int64_t ns[] = { 1000, 3000, -2000, 2000 };
+	for(unsigned int n = 0; n < sizeof(ns) / sizeof(ns[0]); ++n)
+		stats.add(ns[n]);
+	assert(4 == stats.getCount());
+	assert(-2 == stats.getMinUs());
+	assert(3 == stats.getMaxUs());
+	assert(1 == stats.getMeanUs());
+	// variance of 1, 3, -2, 2 is 3.5
+	assert(fabs(stats.getJitterUs() - sqrt(3.5)) < 1e-9);
+	stats.reset();
+	stats.add(5000);
+	assert(5 == stats.getMinUs() && 5 == stats.getMaxUs() && 0 == stats.getJitterUs());
+	return true;
+}
@@ -20,7 +20,9 @@
 #include "../include/GPIOcontrol.h"
 #include "../include/Bela.h"
 #include "../include/Gpio.h"
+#include "../include/GpioBank.h"
 #include "../include/Utilities.h"
+#include "../include/BelaChannelView.h"
 #include "../include/PruArmCommon.h"
 
 #include <iostream>
@@ -75,11 +77,6 @@ static int rtdm_fd_mcasp_to_pru = 0;
 
 using namespace std;
 
-// Select whether to use NEON-based sample conversion
-// (this will probably go away in a future commit once its performance
-//  is verified over extended use)
-#undef USE_NEON_FORMAT_CONVERSION
-
 // PRU memory: PRU0- and PRU1- DATA RAM are 8kB (0x2000) long each
 //             PRU-SHARED RAM is 12kB (0x3000) long
 
@@ -228,16 +225,6 @@ const unsigned int BELA_CAPE_BUTTON_PIN = 115;
 const unsigned int PRU::kPruGPIODACSyncPin = 5;	// GPIO0(5); P9-17
 const unsigned int PRU::kPruGPIOADCSyncPin = 48; // GPIO1(16); P9-15
 
-#ifdef USE_NEON_FORMAT_CONVERSION
-// These four functions are written in assembly in FormatConvert.S
-extern "C" {
-	void int16_to_float_audio(int numSamples, int16_t *inBuffer, float *outBuffer);
-	void int16_to_float_analog(int numSamples, uint16_t *inBuffer, float *outBuffer);
-	void float_to_int16_audio(int numSamples, float *inBuffer, int16_t *outBuffer);
-	void float_to_int16_analog(int numSamples, float *inBuffer, uint16_t *outBuffer);
-}
-#endif /* USE_NEON_FORMAT_CONVERSION */
-
 // Constructor: specify a PRU number (0 or 1)
 PRU::PRU(InternalBelaContext *input_context, AudioCodec *audio_codec)
 : context(input_context),
@@ -272,41 +259,19 @@ PRU::~PRU()
 //If include_led is set,
 // user LED 3 on the BBB is taken over by the PRU
 // to indicate activity
+// The pins are gathered per bank, so that each bank is opened once and the
+// sync pins are set with a single register access.
 int PRU::prepareGPIO(int include_led)
 {
+	uint32_t outputs[GpioBank::kNumBanks] = {0};
+	uint32_t inputs[GpioBank::kNumBanks] = {0};
+	auto addPin = [](uint32_t* masks, unsigned int pin) {
+		masks[pin / GpioBank::kPinsPerBank] |= 1 << (pin % GpioBank::kPinsPerBank);
+	};
 	if(context->analogFrames != 0) {
-		// Prepare DAC CS/ pin: output, high to begin
-		if(gpio_export(kPruGPIODACSyncPin)) {
-			if(gRTAudioVerbose)
-				fprintf(stderr, "Warning: couldn't export DAC sync pin\n");
-		}
-		if(gpio_set_dir(kPruGPIODACSyncPin, OUTPUT_PIN)) {
-			if(gRTAudioVerbose)
-				fprintf(stderr, "Couldn't set direction on DAC sync pin\n");
-			return -1;
-		}
-		if(gpio_set_value(kPruGPIODACSyncPin, HIGH)) {
-			if(gRTAudioVerbose)
-				fprintf(stderr, "Couldn't set value on DAC sync pin\n");
-			return -1;
-		}
-
-		// Prepare ADC CS/ pin: output, high to begin
-		if(gpio_export(kPruGPIOADCSyncPin)) {
-			if(gRTAudioVerbose)
-				fprintf(stderr, "Warning: couldn't export ADC sync pin\n");
-		}
-		if(gpio_set_dir(kPruGPIOADCSyncPin, OUTPUT_PIN)) {
-			if(gRTAudioVerbose)
-				fprintf(stderr, "Couldn't set direction on ADC sync pin\n");
-			return -1;
-		}
-		if(gpio_set_value(kPruGPIOADCSyncPin, HIGH)) {
-			if(gRTAudioVerbose)
-				fprintf(stderr, "Couldn't set value on ADC sync pin\n");
-			return -1;
-		}
-
+		// DAC CS/ and ADC CS/ pins: output, high to begin
+		addPin(outputs, kPruGPIODACSyncPin);
+		addPin(outputs, kPruGPIOADCSyncPin);
 		analog_enabled = true;
 	}
 
@@ -322,19 +287,22 @@ int PRU::prepareGPIO(int include_led)
 				if(gDigitalPins[i] == saltSwitch1Gpio)
 					continue; // leave alone this pin as it is used by bela_button.service
 			}
-			if(gpio_export(gDigitalPins[i])) {
-				if(gRTAudioVerbose)
-					fprintf(stderr,"Warning: couldn't export digital GPIO pin %d\n" , gDigitalPins[i]); // this is left as a warning because if the pin has been exported by somebody else, can still be used
-			}
-			if(gpio_set_dir(gDigitalPins[i], INPUT_PIN)) {
-				if(gRTAudioVerbose)
-					fprintf(stderr,"Error: Couldn't set direction on digital GPIO pin %d\n" , gDigitalPins[i]);
-				return -1;
-			}
+			addPin(inputs, gDigitalPins[i]);
 		}
 		digital_enabled = true;
 	}
 
+	for(unsigned int n = 0; n < GpioBank::kNumBanks; ++n) {
+		if(!(outputs[n] | inputs[n]))
+			continue;
+		if(gpioBanks[n].open(n, outputs[n], inputs[n])) {
+			if(gRTAudioVerbose)
+				fprintf(stderr, "Couldn't prepare the GPIO pins of bank %u\n", n);
+			return -1;
+		}
+		gpioBanks[n].set(outputs[n]);
+	}
+
 	if(include_led) {
 		if(belaHw == BelaHw_BelaMini)
 		{
@@ -360,24 +328,21 @@ void PRU::cleanupGPIO()
 {
 	if(!gpio_enabled)
 		return;
-	if(analog_enabled) {
-		gpio_unexport(kPruGPIODACSyncPin);
-		gpio_unexport(kPruGPIOADCSyncPin);
-	}
 	if(digital_enabled){
+		// turn off any outputs left by the PRU
 		for(unsigned int i = 0; i < context->digitalChannels; i++){
 			if(belaHw == BelaHw_Salt) {
 				if(gDigitalPins[i] == saltSwitch1Gpio)
 					continue; // leave alone this pin as it is used by bela_button.service
 			}
-			if(gpio_unexport(gDigitalPins[i]))
-			{
-				// if unexport fails, we at least turn off the outputs
-				gpio_set_dir(gDigitalPins[i], OUTPUT_PIN);
-				gpio_set_value(gDigitalPins[i], 0);
-			}
+			GpioBank& bank = gpioBanks[gDigitalPins[i] / GpioBank::kPinsPerBank];
+			if(bank.isOpen())
+				bank.clear(1 << (gDigitalPins[i] % GpioBank::kPinsPerBank));
 		}
 	}
+	// unexport the pins that prepareGPIO() exported
+	for(unsigned int n = 0; n < GpioBank::kNumBanks; ++n)
+		gpioBanks[n].close();
 	if(led_enabled) {
 		if(belaHw == BelaHw_BelaMini)
 		{
@@ -457,63 +422,24 @@ int PRU::initialise(BelaHw newBelaHw, int pru_num, bool uniformSampleRate, int m
 	}
 
 	// Allocate audio buffers
-#ifdef USE_NEON_FORMAT_CONVERSION
-	if(belaHw == BelaHw_Salt)
-	{
-		fprintf(stderr, "USE_NEON_FORMAT_CONVERSION is incompatible with Salt\n");
-		return 1;
-	}
-	if(uniform_sample_rate && context->analogFrames != hardaware_analog_frames)
-	{
-		fprintf(stderr, "Error: using uniform_sample_rate is not allowed with USE_NEON_FORMAT_CONVERSION\n");
-		return 1;
-	}
-	if(posix_memalign((void **)&context->audioIn, 16, 2 * context->audioFrames * sizeof(float))) {
-		fprintf(stderr, "Error allocating audio input buffer\n");
-		return 1;
-	}
-	if(posix_memalign((void **)&context->audioOut, 16, 2 * context->audioFrames * sizeof(float))) {
-		fprintf(stderr, "Error allocating audio output buffer\n");
-		return 1;
-	}
-#else
 	context->audioIn = (float *)malloc(context->audioInChannels * context->audioFrames * sizeof(float));
 	context->audioOut = (float *)calloc(1, context->audioOutChannels * context->audioFrames * sizeof(float));
 	if(context->audioIn == 0 || context->audioOut == 0) {
 		fprintf(stderr, "Error: couldn't allocate audio buffers\n");
 		return 1;
 	}
-#endif
 	
 	// Allocate analog buffers
 	if(analog_enabled) {
-#ifdef USE_NEON_FORMAT_CONVERSION
-		if(posix_memalign((void **)&context->analogIn, 16, 
-							context->analogInChannels * context->analogFrames * sizeof(float))) {
-			fprintf(stderr, "Error allocating analog input buffer\n");
-			return 1;
-		}
-		if(posix_memalign((void **)&context->analogOut, 16, 
-							context->analogOutChannels * context->analogFrames * sizeof(float))) {
-			fprintf(stderr, "Error allocating analog output buffer\n");
-			return 1;
-		}
-		last_analog_out_frame = (float *)malloc(context->analogOutChannels * sizeof(float));
-
-		if(last_analog_out_frame == 0) {
-			fprintf(stderr, "Error: couldn't allocate analog persistence buffer\n");
-			return 1;
-		}		
-#else
 		context->analogIn = (float *)malloc(context->analogInChannels * context->analogFrames * sizeof(float));
 		context->analogOut = (float *)calloc(1, context->analogOutChannels * context->analogFrames * sizeof(float));
 		last_analog_out_frame = (float *)calloc(1, context->analogOutChannels * sizeof(float));
+		context->analogOutPending = (BelaAnalogOutPending *)calloc(context->analogOutChannels, sizeof(BelaAnalogOutPending));
 
-		if(context->analogIn == 0 || context->analogOut == 0 || last_analog_out_frame == 0) {
+		if(context->analogIn == 0 || context->analogOut == 0 || last_analog_out_frame == 0 || (context->analogOutChannels && context->analogOutPending == 0)) {
 			fprintf(stderr, "Error: couldn't allocate analog buffers\n");
 			return 1;
 		}
-#endif
 		
 		memset(last_analog_out_frame, 0, context->analogOutChannels * sizeof(float));
 
@@ -582,6 +508,18 @@ int PRU::initialise(BelaHw newBelaHw, int pru_num, bool uniformSampleRate, int m
 		}
 	}
 
+	FormatConverter::AnalogRatio analogRatio = FormatConverter::kAnalogSame;
+	if(uniform_sample_rate && analogs_per_audio == 0.5)
+		analogRatio = FormatConverter::kAnalogUpsample;
+	else if(uniform_sample_rate && analogs_per_audio == 2)
+		analogRatio = FormatConverter::kAnalogDownsample;
+	// on Salt, the analog inputs and outputs are inverted
+	if(formatConverter.setup(context->flags & BELA_FLAG_INTERLEAVED, context->audioInChannels, context->audioOutChannels,
+			context->analogInChannels, context->analogOutChannels, analogRatio, belaHw == BelaHw_Salt)) {
+		fprintf(stderr, "Error: couldn't set up the sample format conversion\n");
+		return 1;
+	}
+
 	initialised = true;
 	return 0;
 }
@@ -881,6 +819,7 @@ void PRU::loop(void *userData, void(*render)(BelaContext*, void*), bool highPerf
 	// directions and output values at something other than defaults.
 
 	if(analog_enabled) {
+		analogWriteFlush((BelaContext *)context);
 		if(context->flags & BELA_FLAG_ANALOG_OUTPUTS_PERSIST) {
 			// Remember the content of the last_analog_out_frame
 			for(unsigned int ch = 0; ch < context->analogOutChannels; ch++){
@@ -957,33 +896,10 @@ void PRU::loop(void *userData, void(*render)(BelaContext*, void*), bool highPerf
 		pruMemory->copyFromPru(pruBufferForArm);
 
 		// Convert short (16-bit) samples to float
-#ifdef USE_NEON_FORMAT_CONVERSION
-		int16_to_float_audio(2 * context->audioFrames, audio_adc_pru_buffer, context->audioIn);
-		// TODO: implement non-interlaved
-#else
-		int audioInChannels = context->audioInChannels;
-		if(interleaved)
-		{
-			for(unsigned int n = 0; n < audioInChannels * context->audioFrames; n++) {
-				context->audioIn[n] = (float)audioInRaw[n] / 32768.0f;
-			}
-		}
-		else
-		{
-			for(unsigned int f = 0; f < context->audioFrames; ++f)
-			{
-				for(unsigned int c = 0; c < audioInChannels; ++c)
-				{
-					unsigned int srcIdx = f * context->audioInChannels + c;
-					unsigned int dstIdx = c * context->audioFrames + f;
-					float value = (float)audioInRaw[srcIdx] / 32768.0f;
-					context->audioIn[dstIdx] = value;
-				}
-			}
-		}
-#endif /* defined USE_NEON_FORMAT_CONVERSION */
+		formatConverter.audioIn(context->audioIn, audioInRaw, context->audioFrames);
 		
 		if(analog_enabled) {
+			FormatConverter::AnalogInStages analogInStages;
 			if(context->multiplexerChannels != 0) {
 				// If multiplexer is enabled, find out which channels we have by pulling out
 				// the place that it ended. Based on the buffer size, we can work out the
@@ -998,191 +914,31 @@ void PRU::loop(void *userData, void(*render)(BelaContext*, void*), bool highPerf
 				// Add 1, wrapping around, to get the starting channel		
 				context->multiplexerStartingChannel = (multiplexerChannelLastFrame + 1) % context->multiplexerChannels;
 				
-				// Write the inputs to the buffer of multiplexed samples
-				if(context->multiplexerAnalogIn != 0) {
-					unsigned int muxChannelCount = 0;
-					int multiplexerChannel = multiplexerChannelLastFrame;
-
-					for(int n = hardware_analog_frames - 1; n >= 0; n--) {
-						for(unsigned int ch = 0; ch < context->analogInChannels; ch++) {
-							 // rather than supporting all possible combinations of (non-)interleavead/(non-)uniform,
-							 // we go back to the raw samples and convert them again.
-							context->multiplexerAnalogIn[multiplexerChannel * context->analogInChannels + ch] =
-								analogInRaw[n * context->analogInChannels + ch] / 65536.f;
-						}
-
-						multiplexerChannel--;
-						if(multiplexerChannel < 0)
-							multiplexerChannel = context->multiplexerChannels - 1;
-						// If we have made a full circle of the multiplexer channels, then
-						// stop here.
-						if(++muxChannelCount >= context->multiplexerChannels)
-							break;
-					}
-				}
-			}
-			
-#ifdef USE_NEON_FORMAT_CONVERSION
-			// TODO: add support for different analogs_per_audio ratios
-			int16_to_float_analog(context->analogInChannels * context->analogFrames, 
-									analogInRaw, context->analogIn);
-#else
-			if(uniform_sample_rate && analogs_per_audio == 0.5)
-			{
-				unsigned int channels = context->analogInChannels;
-				unsigned int frames = hardware_analog_frames;
-				if(interleaved)
-				{
-					for(unsigned int f = 0; f < frames; ++f)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							float value = (float)analogInRaw[f * channels + c] / 65536.0f;
-							int firstFrame = channels * 2 * f + c;
-							context->analogIn[firstFrame] = value;
-							context->analogIn[firstFrame + channels] = value;
-						}
-					}
-				}
-				else
-				{
-					for(unsigned int f = 0; f < frames; ++f)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							unsigned int srcIdx = f * channels + c;
-							unsigned int dstIdx = frames * c * 2 + f * 2;
-							float value = (float)analogInRaw[srcIdx] / 65536.0f;
-							context->analogIn[dstIdx] = value;
-							context->analogIn[dstIdx + 1] = value;
-						}
-					}
-				}
-			}
-			else if (!uniform_sample_rate || analogs_per_audio == 1)
-			{
-				if(interleaved)
-				{
-					for(unsigned int n = 0;
-						n < context->analogInChannels * context->analogFrames;
-						++n)
-					{
-						float value = (float)analogInRaw[n] / 65536.0f;
-						context->analogIn[n] = value;
-					}
-				}
-				else
-				{
-					for(unsigned int f = 0; f < context->analogFrames; ++f)
-					{
-						for(unsigned int c = 0; c < context->analogInChannels; ++c)
-						{
-							unsigned int srcIdx = context->analogInChannels * f + c;
-							unsigned int dstIdx = context->analogFrames * c + f;
-							float value = (float)analogInRaw[srcIdx] / 65536.0f;
-							context->analogIn[dstIdx] = value;
-						}
-					}
-				}
-			}
-			else if (uniform_sample_rate && analogs_per_audio == 2)
-			{
-				unsigned int channels = context->analogInChannels;
-				unsigned int frames = hardware_analog_frames;
-				if(interleaved)
-				{
-					for(unsigned int f = 0; f < frames; f += 2)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							float value = (float)analogInRaw[f * channels + c] / 65536.0f;
-							context->analogIn[(f / 2) * channels + c] = value;
-						}
-					}
-				}
-				else
-				{
-					for(unsigned int f = 0; f < frames; f += 2)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							unsigned int srcIdx = f * channels + c;
-							unsigned int dstIdx = c * (frames / 2) + f / 2;
-							float value = (float)analogInRaw[srcIdx] / 65536.0f;
-							context->analogIn[dstIdx] = value;
-						}
-					}
-				}
+				// The inputs are written to the buffer of multiplexed
+				// samples while converting them below
+				analogInStages.muxAnalogIn = context->multiplexerAnalogIn;
+				analogInStages.muxChannels = context->multiplexerChannels;
+				analogInStages.muxLastChannel = multiplexerChannelLastFrame;
 			}
-			if(belaHw == BelaHw_Salt) {
-				const float analogInMax = 65535.f/65536.f;
-				for(unsigned int n = 0; n < context->analogInChannels * context->analogFrames; ++n)
-				{
-					context->analogIn[n] = analogInMax - context->analogIn[n];
-					// if analogInMax is different from 65535/65536, we should
-					// clip it to avoid reading out of range values:
-					// if(context->analogIn[n] > 1)
-						// context->analogIn[n] = 1;
-				}
-			}
-#endif /* USE_NEON_FORMAT_CONVERSION */
 			
-			if((context->audioExpanderEnabled & 0x0000FFFF) != 0) {
-				// Audio expander enabled on at least one analog input
-				if(interleaved)
-				{
-					for(unsigned int ch = 0; ch < context->analogInChannels; ch++) {
-						if(context->audioExpanderEnabled & (1 << ch)) {
-							// Audio expander enabled on this channel:
-							// apply highpass filter and scale by 2 to get -1 to 1 range
-							// rather than 0-1
-							for(unsigned int n = 0; n < context->analogFrames; n++) {
-								float filteredOut = audio_expander_filter_coeff *
-									(audio_expander_output_history[ch] + 
-									 context->analogIn[n * context->analogInChannels + ch] -
-									 audio_expander_input_history[ch]);
-								
-								audio_expander_input_history[ch] = context->analogIn[n * context->analogInChannels + ch];
-								audio_expander_output_history[ch] = filteredOut;
-								context->analogIn[n * context->analogInChannels + ch] = 2.0f * filteredOut;
-							}
-						}
-					}
-				}
-				else
-				{
-					for(unsigned int ch = 0; ch < context->analogInChannels; ch++) {
-						if(context->audioExpanderEnabled & (1 << ch)) {
-							// Audio expander enabled on this channel:
-							// apply highpass filter and scale by 2 to get -1 to 1 range
-							// rather than 0-1
-							for(unsigned int n = 0; n < context->analogFrames; n++) {
-								float filteredOut = audio_expander_filter_coeff *
-									(audio_expander_output_history[ch] + 
-									 context->analogIn[ch * context->analogFrames + n] -
-									 audio_expander_input_history[ch]);
-								
-								audio_expander_input_history[ch] = context->analogIn[ch * context->analogFrames + n];
-								audio_expander_output_history[ch] = filteredOut;
-								context->analogIn[ch * context->analogFrames + n] = 2.0f * filteredOut;
-							}
-						}
-					}
-				}
+			analogInStages.expanderChannels = context->audioExpanderEnabled & 0x0000FFFF;
+			if(analogInStages.expanderChannels) {
+				// Audio expander enabled on at least one analog input:
+				// apply highpass filter and scale by 2 to get -1 to 1 range
+				// rather than 0-1
+				analogInStages.expanderCoeff = audio_expander_filter_coeff;
+				analogInStages.expanderInputHistory = audio_expander_input_history;
+				analogInStages.expanderOutputHistory = audio_expander_output_history;
 			}
+			// Convert, filter and demultiplex in one pass
+			formatConverter.analogIn(context->analogIn, analogInRaw, hardware_analog_frames, analogInStages);
 			
 			if(context->flags & BELA_FLAG_ANALOG_OUTPUTS_PERSIST) {
-				// Initialize the output buffer with the values that were in the last frame of the previous output
-				if(interleaved)
-				{
-					for(unsigned int ch = 0; ch < context->analogOutChannels; ++ch)
-						analogWrite((BelaContext*)context, 0, ch, last_analog_out_frame[ch]);
-				}
-				else
-				{
-					for(unsigned int ch = 0; ch < context->analogOutChannels; ++ch)
-						analogWriteNI((BelaContext*)context, 0, ch, last_analog_out_frame[ch]);
-				}
+				// Initialize the output buffer with the values that were in the last frame of the previous output.
+				// This is written straight away rather than with analogWrite(), so that render() can
+				// write context->analogOut directly.
+				for(unsigned int ch = 0; ch < context->analogOutChannels; ++ch)
+					analogOutChannel((BelaContext*)context, ch).fill(0, context->analogFrames, last_analog_out_frame[ch]);
 			}
 			else {
 				// Outputs are 0 unless set otherwise
@@ -1217,16 +973,8 @@ void PRU::loop(void *userData, void(*render)(BelaContext*, void*), bool highPerf
 		// ***********************
 
 		if(analog_enabled) {
-			if(belaHw == BelaHw_Salt) {
-				for(unsigned int n = 0; n < context->analogOutChannels * context->analogFrames; n++)
-				{
-					// also rescale it to avoid
-					// headroom problem on the analog outputs with a sagging
-					// 5V USB supply
-					const float analogOutMax = 0.93;
-					context->analogOut[n] = (1.f - context->analogOut[n]) * analogOutMax;
-				}
-			}
+			// Write what analogWrite() left pending to the rest of the block
+			analogWriteFlush((BelaContext *)context);
 			if(context->flags & BELA_FLAG_ANALOG_OUTPUTS_PERSIST) {
 				// Remember the content of the last_analog_out_frame
 				if(interleaved)
@@ -1277,110 +1025,7 @@ void PRU::loop(void *userData, void(*render)(BelaContext*, void*), bool highPerf
 			}
 
 			// Convert float back to short for SPI output
-#ifdef USE_NEON_FORMAT_CONVERSION
-			float_to_int16_analog(context->analogOutChannels * context->analogFrames, 
-								  context->analogOut, dac_pru_buffer);
-#else		
-			if(uniform_sample_rate && analogs_per_audio == 0.5)
-			{
-				unsigned int channels = context->analogOutChannels;
-				unsigned int frames = hardware_analog_frames;
-				if(interleaved)
-				{
-					for(unsigned int f = 0; f < frames; ++f)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							int out = context->analogOut[f * channels * 2 + c] * 65536.0f;
-							if(out < 0) out = 0;
-							else if(out > 65535) out = 65535;
-							analogOutRaw[f * channels + c] = (uint16_t)out;
-						}
-					}
-				}
-				else
-				{
-					for(unsigned int f = 0; f < frames; ++f)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							unsigned int srcIdx = c * frames * 2 + f * 2;
-							unsigned int dstIdx = f * channels + c;
-							int out = context->analogOut[srcIdx] * 65536.0f;
-							if(out < 0) out = 0;
-							else if(out > 65535) out = 65535;
-							analogOutRaw[dstIdx] = (uint16_t)out;
-						}
-					}
-				}
-			}
-			else if(!uniform_sample_rate || analogs_per_audio == 1)
-			{
-				unsigned int frames = context->analogFrames;
-				unsigned int channels = context->analogOutChannels;
-				if(interleaved)
-				{
-					for(unsigned int n = 0; n < frames * channels; ++n)
-					{
-						int out = context->analogOut[n] * 65536.0f;
-						if(out < 0) out = 0;
-						else if(out > 65535) out = 65535;
-						analogOutRaw[n] = (uint16_t)out;
-					}
-				}
-				else
-				{
-					for(unsigned int f = 0; f < frames; ++f)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							unsigned int srcIdx = c * frames + f;
-							unsigned int dstIdx = f * channels + c;
-							int out = context->analogOut[srcIdx] * 65536.0f;
-							if(out < 0) out = 0;
-							else if(out > 65535) out = 65535;
-							analogOutRaw[dstIdx] = (uint16_t)out;
-						}
-					}
-				}
-			}
-			else if(uniform_sample_rate && analogs_per_audio == 2)
-			{
-				unsigned int channels = context->analogOutChannels;
-				unsigned int frames = hardware_analog_frames;
-				if(interleaved)
-				{
-					for(unsigned int f = 0; f < frames; f += 2)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							int out = context->analogOut[f * channels / 2 + c] * 65536.0f;
-							if(out < 0) out = 0;
-							else if(out > 65535) out = 65535;
-							unsigned int firstFrame = f * channels + c;
-							analogOutRaw[firstFrame] = (uint16_t)out;
-							analogOutRaw[firstFrame + channels] = (uint16_t)out;
-						}
-					}
-				}
-				else
-				{
-					for(unsigned int f = 0; f < frames; f += 2)
-					{
-						for(unsigned int c = 0; c < channels; ++c)
-						{
-							unsigned int srcIdx = frames / 2 * c + f / 2;
-							unsigned int dstIdx = f * channels + c;
-							int out = context->analogOut[srcIdx] * 65536.0f;
-							if(out < 0) out = 0;
-							else if(out > 65535) out = 65535;
-							analogOutRaw[dstIdx] = (uint16_t)out;
-							analogOutRaw[dstIdx + channels] = (uint16_t)out;
-						}
-					}
-				}
-			}
-#endif /* USE_NEON_FORMAT_CONVERSION */
+			formatConverter.analogOut(analogOutRaw, context->analogOut, hardware_analog_frames);
 		}
 
 		if(digital_enabled) { // keep track of past digital values
@@ -1400,34 +1045,7 @@ void PRU::loop(void *userData, void(*render)(BelaContext*, void*), bool highPerf
 		}
 
 		// Convert float back to short for audio
-#ifdef USE_NEON_FORMAT_CONVERSION
-		float_to_int16_audio(2 * context->audioFrames, context->audioOut, audio_dac_pru_buffer);
-#else	
-		if(interleaved)
-		{
-			for(unsigned int n = 0; n < context->audioOutChannels * context->audioFrames; ++n) {
-				int out = context->audioOut[n] * 32768.0f;
-				if(out < -32768) out = -32768;
-				else if(out > 32767) out = 32767;
-				audioOutRaw[n] = (int16_t)out;
-			}
-		}
-		else
-		{
-			for(unsigned int f = 0; f < context->audioFrames; ++f)
-			{
-				for(unsigned int c = 0; c < context->audioOutChannels; ++c)
-				{
-					unsigned int srcIdx = c * context->audioFrames + f;
-					unsigned int dstIdx = f * context->audioOutChannels + c;
-					int out = context->audioOut[srcIdx] * 32768.0f;
-					if(out < -32768) out = -32768;
-					else if(out > 32767) out = 32767;
-					audioOutRaw[dstIdx] = (int16_t)out;
-				}
-			}
-		}
-#endif /* USE_NEON_FORMAT_CONVERSION */
+		formatConverter.audioOut(audioOutRaw, context->audioOut, context->audioFrames);
 		pruMemory->copyToPru(pruBufferForArm);
 
 		// Check for underruns by comparing the number of samples reported
@@ -1498,6 +1116,7 @@ void PRU::loop(void *userData, void(*render)(BelaContext*, void*), bool highPerf
 		free(context->analogIn);
 		free(context->analogOut);
 		free(last_analog_out_frame);
+		free(context->analogOutPending);
 		if(context->multiplexerAnalogIn != 0)
 			free(context->multiplexerAnalogIn);
 		if(audio_expander_input_history != 0) {
@@ -1516,6 +1135,7 @@ void PRU::loop(void *userData, void(*render)(BelaContext*, void*), bool highPerf
 
 	context->audioIn = context->audioOut = 0;
 	context->analogIn = context->analogOut = 0;
+	context->analogOutPending = 0;
 	context->digital = 0;
 	context->multiplexerAnalogIn = 0;
 }
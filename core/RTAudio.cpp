@@ -23,11 +23,17 @@
 #include <vector>
 
 #include <sys/mman.h>
+#include <malloc.h>
+#include <errno.h>
+#include <unistd.h>
 
 #include "../include/Bela.h"
 #include "../include/bela_hw_settings.h"
 #include "../include/board_detect.h"
 #include "../include/BelaContextFifo.h"
+#include "../include/BelaContextResampler.h"
+#include "../include/BelaLayout.h"
+#include "../include/LatencyStats.h"
 
 // Xenomai-specific includes
 #if XENOMAI_MAJOR == 3
@@ -188,6 +194,10 @@ static int gAmplifierShouldBeginMuted = 0;
 static bool gHighPerformanceMode = 0;
 static unsigned int gAudioThreadStackSize;
 unsigned int gAuxiliaryTaskStackSize;
+static unsigned int gAudioCpus;
+static unsigned int gFifoCpus;
+unsigned int gAuxiliaryTaskCpus;
+int gReportLatency;
 
 // Context which holds all the audio/sensor data passed to the render routines
 InternalBelaContext gContext;
@@ -199,9 +209,96 @@ void (*gCoreRender)(BelaContext*, void*);
 void (*gUserRender)(BelaContext*, void*);
 void (*gBelaCleanup)(BelaContext*, void*);
 static BelaContextFifo* gBcf = nullptr;
-static double gBlockDurationMs;
+static BelaContextResampler* gBcr = nullptr;
+static double gBlockDurationMs; // of the longest block that render() can be called with
+static uint64_t gFifoFramesElapsed;
+static unsigned int gFifoLastFrames;
+
+// Scheduling latency, measured with --report-latency
+static void (*gMeasuredCoreRender)(BelaContext*, void*);
+static LatencyStats gAudioLatency;
+static LatencyStats gFifoLatency;
+static double gHwBlockDurationNs;
+static uint64_t gLastHwBlockNs;
+static volatile uint64_t gFifoPushNs;
+void Bela_printAuxiliaryTaskLatency(FILE* file);
+
+// Time spent in each stage of the startup, printed in verbose mode
+static const unsigned int kMaxStartupStages = 12;
+static struct {
+	const char* name;
+	unsigned long long durationNs;
+} gStartupStages[kMaxStartupStages];
+static unsigned int gNumStartupStages;
+static unsigned long long gStartupStageStartNs;
+
+static unsigned long long getStartupTimeNs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts); // NOWRAP
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Record the end of a startup stage, or start over when name is NULL
+static void startupStageDone(const char* name)
+{
+	unsigned long long now = getStartupTimeNs();
+	if(!name)
+		gNumStartupStages = 0;
+	else if(gNumStartupStages < kMaxStartupStages)
+	{
+		gStartupStages[gNumStartupStages].name = name;
+		gStartupStages[gNumStartupStages].durationNs = now - gStartupStageStartNs;
+		++gNumStartupStages;
+	}
+	gStartupStageStartNs = now;
+}
+
+static void printStartupStages()
+{
+	unsigned long long total = 0;
+	printf("Startup timing:\n");
+	for(unsigned int n = 0; n < gNumStartupStages; ++n)
+	{
+		printf("  %-28s %8.2f ms\n", gStartupStages[n].name, gStartupStages[n].durationNs / 1000000.0);
+		total += gStartupStages[n].durationNs;
+	}
+	printf("  %-28s %8.2f ms\n", "total", total / 1000000.0);
+}
 
 void fifoRender(BelaContext*, void*);
+void fifoUserRender(BelaContext*);
+void resampleRender(BelaContext*, void*);
+void latencyRender(BelaContext*, void*);
+
+// Lock all the memory of the process in RAM, so that the real-time threads
+// do not incur page faults, and fault in prefaultHeapSize bytes of heap,
+// which malloc() then keeps instead of returning it to the system.
+static int lockMemory(size_t prefaultHeapSize)
+{
+	if(mlockall(MCL_CURRENT | MCL_FUTURE))
+	{
+		fprintf(stderr, "Error: unable to lock memory: %s\n", strerror(errno));
+		return -1;
+	}
+	if(!prefaultHeapSize)
+		return 0;
+	// never trim the top of the heap, and serve large allocations from
+	// the heap instead of mmap()
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	volatile char* heap = (volatile char*)malloc(prefaultHeapSize);
+	if(!heap)
+	{
+		fprintf(stderr, "Error: unable to allocate %zu bytes of heap to prefault\n", prefaultHeapSize);
+		return -1;
+	}
+	long pageSize = sysconf(_SC_PAGESIZE);
+	for(size_t n = 0; n < prefaultHeapSize; n += pageSize)
+		heap[n] = 0;
+	free((void*)heap);
+	return 0;
+}
 
 // initAudio() prepares the infrastructure for running PRU-based real-time
 // audio, but does not actually start the calculations.
@@ -219,6 +316,7 @@ void fifoRender(BelaContext*, void*);
 
 int Bela_initAudio(BelaInitSettings *settings, void *userData)
 {
+	startupStageDone(NULL);
 	// Before we go ahead, let's check if Bela is alreadt running:
 	// check if another real-time thread of the same name is already running.
 	char command[200];
@@ -249,10 +347,23 @@ int Bela_initAudio(BelaInitSettings *settings, void *userData)
 	rt_print_auto_init(1);
 #endif
 
+	startupStageDone("checks and Xenomai init");
 	// reset this, in case it has been set before
 	gShouldStop = 0;
 	gAudioThreadStackSize = settings->audioThreadStackSize;
 	gAuxiliaryTaskStackSize = settings->auxiliaryTaskStackSize;
+	gAudioCpus = settings->audioCpus;
+	gFifoCpus = settings->fifoCpus;
+	gAuxiliaryTaskCpus = settings->auxiliaryTaskCpus;
+	gReportLatency = settings->reportLatency;
+	if(settings->lockMemory)
+	{
+		if(lockMemory(settings->prefaultHeapSize))
+			return -1;
+		startupStageDone("memory locking");
+	} else if(settings->prefaultHeapSize) {
+		fprintf(stderr, "Warning: the heap is only prefaulted together with --lock-memory\n");
+	}
 
 	// First check if there's a Bela program already running on the board.
 	// We can't have more than one instance at a time, but we can tell via
@@ -360,6 +471,7 @@ int Bela_initAudio(BelaInitSettings *settings, void *userData)
                 gSpiCodec = new Spi_Codec(ctagSpidevGpioCs0, ctagSpidevGpioCs1);
         if(belaHw != BelaHw_CtagBeast && belaHw != BelaHw_CtagFace)
                 gI2cCodec = new I2c_Codec(codecI2cBus, codecI2cAddress, gRTAudioVerbose);
+	startupStageDone("hardware detection");
 	BelaHwConfig cfg;
 	if(Bela_getHwConfig(belaHw, &cfg))
 	{
@@ -399,8 +511,24 @@ int Bela_initAudio(BelaInitSettings *settings, void *userData)
 	if(1 > fifoFactor)
 		fifoFactor = 1;
 
+	// when the period size can be changed at runtime, the buffers for
+	// all the factors that may be needed are allocated now
+	unsigned int fifoFactors[BelaContextFifo::kMaxFactors];
+	unsigned int numFifoFactors = 0;
+	for(unsigned int f = fifoFactor; numFifoFactors < BelaContextFifo::kMaxFactors; f *= 2)
+	{
+		if(numFifoFactors && settings->periodSize * (int)(f / fifoFactor) > settings->maxPeriodSize)
+			break;
+		fifoFactors[numFifoFactors++] = f;
+	}
+	bool useFifo = fifoFactor > 1 || numFifoFactors > 1;
+
 	if(gRTAudioVerbose)
+	{
 		printf("fifoFactor: %u\n", fifoFactor);
+		if(numFifoFactors > 1)
+			printf("max fifoFactor: %u\n", fifoFactors[numFifoFactors - 1]);
+	}
 
 	gContext.audioFrames = settings->periodSize / fifoFactor;
 	if(gRTAudioVerbose)
@@ -417,6 +545,14 @@ int Bela_initAudio(BelaInitSettings *settings, void *userData)
 	{
 		cfg.disabledCodec->disable(); // Put unused codec in high impedance state
 	}
+	// The codec settles after the reset while the context and the PRU
+	// are prepared below: the first register access afterwards waits
+	// for whatever is left.
+	if(gAudioCodec->initCodec()) {
+		cerr << "Error: unable to initialise audio codec\n";
+		return 1;
+	}
+	startupStageDone("codec init");
 
 	if(settings->useAnalog && (cfg.analogInChannels || cfg.analogOutChannels)) {
 
@@ -473,10 +609,21 @@ int Bela_initAudio(BelaInitSettings *settings, void *userData)
 	if(settings->detectUnderruns)
 		gContext.flags |= BELA_FLAG_DETECT_UNDERRUNS;
 
-	if(1 < fifoFactor)
+	unsigned int hwSampleRate = lrintf(gContext.audioSampleRate);
+	// with a uniform sample rate, the resampler is also used at the rate
+	// of the hardware, to lowpass filter the analog inputs before they
+	// are decimated
+	bool resample = settings->projectSampleRate > 0
+		&& ((unsigned int)settings->projectSampleRate != hwSampleRate || settings->uniformSampleRate);
+	if(resample && useFifo)
+	{
+		fprintf(stderr, "Error: --sample-rate cannot be used with a period size of %d or a maxPeriodSize\n", settings->periodSize);
+		return 1;
+	}
+	if(useFifo)
 	{
 		gBcf = new BelaContextFifo;
-		if(!(gUserContext = gBcf->setup((BelaContext*)&gContext, fifoFactor)))
+		if(!(gUserContext = gBcf->setup((BelaContext*)&gContext, fifoFactors, numFifoFactors, fifoFactor)))
 		{
 			fprintf(stderr, "Error: unable to initialise BelaContextFifo\n");
 			return 1;
@@ -493,15 +640,26 @@ int Bela_initAudio(BelaInitSettings *settings, void *userData)
 	gPRU = new PRU(&gContext, gAudioCodec);
 
 	// Get the PRU memory buffers ready to go
-	if(gPRU->initialise(belaHw, settings->pruNumber, settings->uniformSampleRate,
+	if(gPRU->initialise(belaHw, settings->pruNumber, settings->uniformSampleRate && !resample,
                                 settings->numMuxChannels, settings->enableCapeButtonMonitoring, settings->enableLED)) {
 		fprintf(stderr, "Error: unable to initialise PRU\n");
 		return 1;
 	}
+	startupStageDone("PRU and GPIO init");
 
-	if(gAudioCodec->initCodec()) {
-		cerr << "Error: unable to initialise audio codec\n";
-		return 1;
+	if(resample)
+	{
+		// this needs the number of analog frames set by the PRU
+		gBcr = new BelaContextResampler;
+		if(!(gUserContext = gBcr->setup((BelaContext*)&gContext, settings->projectSampleRate, gContext.audioFrames, settings->uniformSampleRate)))
+		{
+			fprintf(stderr, "Error: unable to resample from %uHz to %dHz\n", hwSampleRate, settings->projectSampleRate);
+			return 1;
+		}
+		gUserRender = settings->render;
+		gCoreRender = resampleRender;
+		if(gRTAudioVerbose)
+			printf("Resampling from %uHz to %dHz, %.2fms of added latency\n", hwSampleRate, settings->projectSampleRate, gBcr->getLatencyMs());
 	}
 
 	// Set default volume levels
@@ -516,13 +674,46 @@ int Bela_initAudio(BelaInitSettings *settings, void *userData)
 		Bela_setPgaGain(settings->pgaGain[n], n);
 	}
 	Bela_setHeadphoneLevel(settings->headphoneLevel);
+	startupStageDone("codec levels");
+
+	if(gReportLatency)
+	{
+		gMeasuredCoreRender = gCoreRender;
+		gCoreRender = latencyRender;
+		gHwBlockDurationNs = gContext.audioFrames / gContext.audioSampleRate * 1000000000;
+		gLastHwBlockNs = 0;
+		gAudioLatency.reset();
+		gFifoLatency.reset();
+	}
 
 	gBlockDurationMs = gUserContext->audioFrames / gUserContext->audioSampleRate * 1000;
+	if(gBcf)
+		gBlockDurationMs *= fifoFactors[numFifoFactors - 1] / fifoFactor;
+	gFifoFramesElapsed = 0;
+	gFifoLastFrames = gUserContext->audioFrames;
+
+	// the layout that the project is built with when using make
+	// FIXED_LAYOUT=1, which can't be used if the period size can change
+	BelaLayoutInfo layout = BelaLayoutInfo::get(gUserContext);
+	bool variableLayout = numFifoFactors > 1;
+	if(settings->layoutHeader)
+	{
+		if(variableLayout)
+			fprintf(stderr, "Warning: not writing %s, as the period size can change at runtime\n", settings->layoutHeader);
+		else if(layout.writeHeader(settings->layoutHeader) > 0)
+			printf("The layout of the context has changed: rebuild the project to use it in BelaLayout\n");
+	}
+	if(&Bela_fixedLayout && (variableLayout || layout != Bela_fixedLayout))
+	{
+		fprintf(stderr, "Error: the project was built with FIXED_LAYOUT=1 for a different layout of the context. Rebuild it\n");
+		return 1;
+	}
 	// Call the user-defined initialisation function
 	if(settings->setup && !(*settings->setup)(gUserContext, userData)) {
 		fprintf(stderr, "Couldn't initialise audio rendering\n");
 		return 1;
 	}
+	startupStageDone("setup()");
 
 	return 0;
 }
@@ -553,30 +744,81 @@ void audioLoop(void *)
 // It quickly sends the data to the fifo and retrieves data from the fifo.
 void fifoRender(BelaContext* context, void* userData)
 {
+	if(gReportLatency)
+		gFifoPushNs = task_time_ns();
 	gBcf->push(BelaContextFifo::kToLong, context);
+	if(gBcf->isDirect())
+	{
+		// the period size has been switched to the one of the hardware
+		InternalBelaContext* ctx = (InternalBelaContext*)context;
+		uint64_t audioFramesElapsed = ctx->audioFramesElapsed;
+		fifoUserRender(context);
+		ctx->audioFramesElapsed = audioFramesElapsed;
+		ctx->flags &= ~BELA_FLAG_BLOCK_SIZE_CHANGED;
+		return;
+	}
 	const InternalBelaContext* rctx = (InternalBelaContext*)gBcf->pop(BelaContextFifo::kToShort);
 
 	if(rctx) {
 		BelaContextSplitter::contextCopyData(rctx, (InternalBelaContext*)context);
+	} else {
+		// nothing is ready, e.g.: while switching period size
+		memset(context->audioOut, 0, context->audioFrames * context->audioOutChannels * sizeof(context->audioOut[0]));
 	}
 }
 
+// Calls the user-defined render() with contexts of the size set by
+// Bela_setPeriodSize(). This runs in the fifo thread, or in the audio
+// thread when the size is the one of the hardware: BelaContextFifo
+// ensures that the two never overlap.
+void fifoUserRender(BelaContext* context)
+{
+	InternalBelaContext* ctx = (InternalBelaContext*)context;
+	ctx->audioFramesElapsed = gFifoFramesElapsed;
+	if(ctx->audioFrames != gFifoLastFrames)
+		ctx->flags |= BELA_FLAG_BLOCK_SIZE_CHANGED;
+	else
+		ctx->flags &= ~BELA_FLAG_BLOCK_SIZE_CHANGED;
+	gFifoLastFrames = ctx->audioFrames;
+	gUserRender(context, gUserData);
+	analogWriteFlush(context);
+	gFifoFramesElapsed += ctx->audioFrames;
+}
+
+// when resampling, this is called by PRU::loop() and calls the
+// user-defined render() as often as needed
+void resampleRender(BelaContext* context, void* userData)
+{
+	gBcr->process(context, gUserRender, gUserData);
+}
+
+// with --report-latency, this is called by PRU::loop() and measures how far
+// the interval since the previous call is from the duration of a block,
+// before calling the actual core render function
+void latencyRender(BelaContext* context, void* userData)
+{
+	uint64_t now = task_time_ns();
+	if(gLastHwBlockNs)
+		gAudioLatency.add((int64_t)(now - gLastHwBlockNs) - (int64_t)gHwBlockDurationNs);
+	gLastHwBlockNs = now;
+	gMeasuredCoreRender(context, userData);
+}
+
 // when using fifo, this is where the user-defined render() is called
 void fifoLoop(void* userData)
 {
 	if(gRTAudioVerbose)
 		rt_printf("_________________Fifo Thread!\n");
-	uint64_t audioFramesElapsed = 0;
 	while(!gShouldStop)
 	{
 		BelaContext* context = gBcf->pop(BelaContextFifo::kToLong, gBlockDurationMs * 2);
 		if(context)
 		{
-			((InternalBelaContext*)context)->audioFramesElapsed = audioFramesElapsed;
-			gUserRender(context, gUserData);
-			audioFramesElapsed += context->audioFrames;
+			if(gReportLatency)
+				gFifoLatency.add(task_time_ns() - gFifoPushNs);
+			fifoUserRender(context);
 			gBcf->push(BelaContextFifo::kToShort, context);
-		} else {
+		} else if(gBcf->getFactor() > 1) {
 			if(gRTAudioVerbose)
 				rt_fprintf(stderr, "fifoTask did not receive a valid context\n");
 			usleep(1000); // TODO: this  should not be needed, given how the timeout in pop() is for a reasonable amount of time
@@ -589,18 +831,23 @@ void fifoLoop(void* userData)
 static int startAudioInline(){
 	// make sure we have everything
 	assert(gAudioCodec != 0 && gPRU != 0);
+	startupStageDone("until Bela_startAudio()");
 
 	// power up and initialize audio codec
 	if(gAudioCodec->startAudio(0)) {
 		fprintf(stderr, "Error: unable to start I2C audio codec\n");
 		return -1;
 	}
+	startupStageDone("codec start");
 
 	// initialize and run the PRU
 	if(gPRU->start(gPRUFilename)) {
 		fprintf(stderr, "Error: unable to start PRU from %s\n", gPRUFilename[0] ? "embedded binary" : gPRUFilename);
 		return -1;
 	}
+	startupStageDone("PRU start");
+	if(gRTAudioVerbose)
+		printStartupStages();
 
 	if(!gAmplifierShouldBeginMuted) {
 		// First unmute the amplifier
@@ -627,7 +874,7 @@ int Bela_runInSameThread()
 		return ret;
 
 	// turn the current thread into a Xenomai task: we become the audio thread
-	ret = rt_task_shadow(&thisTask, gRTAudioThreadName, BELA_AUDIO_PRIORITY, T_JOINABLE | T_FPU);
+	ret = rt_task_shadow(&thisTask, gRTAudioThreadName, BELA_AUDIO_PRIORITY, T_JOINABLE | T_FPU | cpus_to_task_mode(gAudioCpus));
 	if(ret == -EBUSY){
 	// task already is a Xenomai task:
 	// let's only re-adjust the priority
@@ -664,7 +911,7 @@ int Bela_startAudio()
 	unsigned int stackSize = gAudioThreadStackSize;
 	int ret;
 #ifdef XENOMAI_SKIN_native
-	if(ret = rt_task_create(&gRTAudioThread, gRTAudioThreadName, stackSize, BELA_AUDIO_PRIORITY, T_JOINABLE | T_FPU))
+	if(ret = rt_task_create(&gRTAudioThread, gRTAudioThreadName, stackSize, BELA_AUDIO_PRIORITY, T_JOINABLE | T_FPU | cpus_to_task_mode(gAudioCpus)))
 	{
 		  fprintf(stderr,"Error: unable to create Xenomai audio thread: %s \n" ,strerror(-ret));
 		  return -1;
@@ -695,7 +942,7 @@ int Bela_startAudio()
 		//if there is a fifo, the core audio thread below will need a higher priority
 		audioPriority = BELA_AUDIO_PRIORITY + 1;
 		// and we start an extra thread with usual audio priority in which the user's render() will run
-		ret = create_and_start_thread(&gFifoThread, gFifoThreadName, audioPriority - 1, stackSize, (pthread_callback_t*)fifoLoop, NULL);
+		ret = create_and_start_thread(&gFifoThread, gFifoThreadName, audioPriority - 1, stackSize, (pthread_callback_t*)fifoLoop, NULL, gFifoCpus);
 		if(ret)
 		{
 			fprintf(stderr, "Error: unable to start Xenomai fifo audio thread: %d %s\n", ret, strerror(-ret));
@@ -704,7 +951,7 @@ int Bela_startAudio()
 	} else {
 		audioPriority = BELA_AUDIO_PRIORITY;
 	}
-	ret = create_and_start_thread(&gRTAudioThread, gRTAudioThreadName, audioPriority, stackSize, (pthread_callback_t*)audioLoop, NULL);
+	ret = create_and_start_thread(&gRTAudioThread, gRTAudioThreadName, audioPriority, stackSize, (pthread_callback_t*)audioLoop, NULL, gAudioCpus);
 	if(ret)
 	{
 		fprintf(stderr, "Error: unable to start Xenomai audio thread: %d %s\n", ret, strerror(-ret));
@@ -716,6 +963,17 @@ int Bela_startAudio()
 	return ret;
 }
 
+static void printLatency()
+{
+	printf("Scheduling latency:\n");
+	LatencyStats::printHeader(stdout);
+	gAudioLatency.print(stdout, "bela-audio*");
+	if(gBcf)
+		gFifoLatency.print(stdout, gFifoThreadName);
+	Bela_printAuxiliaryTaskLatency(stdout);
+	printf("  * deviation of the interval between blocks from %.1fus\n", gHwBlockDurationNs / 1000);
+}
+
 // Stop the PRU-based audio from running and wait
 // for the tasks to complete before returning.
 
@@ -747,6 +1005,15 @@ void Bela_stopAudio()
 #endif
 
 	Bela_stopAllAuxiliaryTasks();
+	if(gReportLatency)
+		printLatency();
+}
+
+int Bela_setPeriodSize(unsigned int periodSize)
+{
+	if(!gBcf || periodSize % gContext.audioFrames)
+		return -1;
+	return gBcf->requestFactor(periodSize / gContext.audioFrames);
 }
 
 // Free any resources associated with PRU real-time audio
@@ -772,6 +1039,18 @@ void Bela_cleanupAudio()
 	if(gAudioCodec != 0)
 		delete gAudioCodec;
 	delete gBcf;
+	if(gBcr)
+	{
+		if(gRTAudioVerbose)
+		{
+			BelaContextResampler::Stats stats = gBcr->getStats();
+			printf("Resampler: %llu blocks, %llu underruns, conversion time mean %.1fus, max %.1fus\n",
+				(unsigned long long)stats.blocks, (unsigned long long)stats.underruns,
+				stats.meanConversionUs, stats.maxConversionUs);
+		}
+		delete gBcr;
+		gBcr = nullptr;
+	}
 
 	if(gAmplifierMutePin >= 0)
 		gpio_unexport(gAmplifierMutePin);
@@ -6,6 +6,8 @@
  */
 
 #include <iostream>
+#include <cerrno>
+#include <climits>
 #include <cstdlib>
 #include <cstring>
 #include <vector>
@@ -24,6 +26,14 @@
 #define OPT_UNIFORM_SAMPLE_RATE 1007
 #define OPT_HIGH_PERFORMANCE_MODE 1008
 #define OPT_BOARD 1009
+#define OPT_SAMPLE_RATE 1010
+#define OPT_LAYOUT_HEADER 1011
+#define OPT_AUDIO_CPUS 1012
+#define OPT_FIFO_CPUS 1013
+#define OPT_AUX_CPUS 1014
+#define OPT_LOCK_MEMORY 1015
+#define OPT_PREFAULT_HEAP 1016
+#define OPT_REPORT_LATENCY 1017
 
 
 enum {
@@ -31,6 +41,9 @@ enum {
 };
 
 bool parseAudioExpanderChannels(const char *arg, bool inputChannel, BelaInitSettings *settings);
+bool parseCpus(const char *arg, unsigned int *cpus);
+bool parseKilobytes(const char *arg, unsigned int *bytes);
+bool testCommandLineParsing();
 
 // Default command-line options for RTAudio
 struct option gDefaultLongOptions[] =
@@ -58,6 +71,14 @@ struct option gDefaultLongOptions[] =
 	{"high-performance-mode", 0, NULL, OPT_HIGH_PERFORMANCE_MODE},
 	{"uniform-sample-rate", 0, NULL, OPT_UNIFORM_SAMPLE_RATE},
 	{"board", 1, NULL, OPT_BOARD},
+	{"sample-rate", 1, NULL, OPT_SAMPLE_RATE},
+	{"layout-header", 1, NULL, OPT_LAYOUT_HEADER},
+	{"audio-cpus", 1, NULL, OPT_AUDIO_CPUS},
+	{"fifo-cpus", 1, NULL, OPT_FIFO_CPUS},
+	{"aux-cpus", 1, NULL, OPT_AUX_CPUS},
+	{"lock-memory", 0, NULL, OPT_LOCK_MEMORY},
+	{"prefault-heap", 1, NULL, OPT_PREFAULT_HEAP},
+	{"report-latency", 0, NULL, OPT_REPORT_LATENCY},
 	{NULL, 0, NULL, 0}
 };
 
@@ -125,6 +146,15 @@ void Bela_defaultSettings(BelaInitSettings *settings)
 	settings->cleanup = NULL;
 
 	settings->ampMutePin = kAmplifierMutePin;
+	settings->projectSampleRate = 0;
+	settings->maxPeriodSize = 0;
+	settings->layoutHeader = NULL;
+	settings->audioCpus = 0;
+	settings->fifoCpus = 0;
+	settings->auxiliaryTaskCpus = 0;
+	settings->lockMemory = 0;
+	settings->prefaultHeapSize = 0;
+	settings->reportLatency = 0;
 	if(Bela_userSettings != NULL)
 	{
 		Bela_userSettings(settings);
@@ -307,6 +337,34 @@ int Bela_getopt_long(int argc, char *argv[], const char *customShortOptions, con
 		case OPT_BOARD:
 			settings->board = getBelaHw(std::string(optarg));
 			break;
+		case OPT_SAMPLE_RATE:
+			settings->projectSampleRate = atoi(optarg);
+			break;
+		case OPT_LAYOUT_HEADER:
+			settings->layoutHeader = optarg;
+			break;
+		case OPT_AUDIO_CPUS:
+			if(!parseCpus(optarg, &settings->audioCpus))
+				std::cerr << "Warning: invalid audio CPUs '" << optarg << "'-- ignoring\n";
+			break;
+		case OPT_FIFO_CPUS:
+			if(!parseCpus(optarg, &settings->fifoCpus))
+				std::cerr << "Warning: invalid fifo CPUs '" << optarg << "'-- ignoring\n";
+			break;
+		case OPT_AUX_CPUS:
+			if(!parseCpus(optarg, &settings->auxiliaryTaskCpus))
+				std::cerr << "Warning: invalid auxiliary task CPUs '" << optarg << "'-- ignoring\n";
+			break;
+		case OPT_LOCK_MEMORY:
+			settings->lockMemory = 1;
+			break;
+		case OPT_PREFAULT_HEAP:
+			if(!parseKilobytes(optarg, &settings->prefaultHeapSize))
+				std::cerr << "Warning: invalid heap size '" << optarg << "'-- ignoring\n";
+			break;
+		case OPT_REPORT_LATENCY:
+			settings->reportLatency = 1;
+			break;
 		case '?':
 		default:
 			return c;
@@ -343,6 +401,14 @@ void Bela_usage()
 	std::cerr << "   --high-performance-mode             Gives more CPU to the Bela process. The system may become unresponsive and you will have to use the button on the Bela cape when you want to stop it.\n";
 	std::cerr << "   --uniform-sample-rate               Internally resample the analog channels so that they match the audio sample rate\n";
 	std::cerr << "   --board val:                        Select a different board to work with\n";
+	std::cerr << "   --sample-rate val:                  Resample the audio and analog channels so that render() runs at val Hz. With --uniform-sample-rate, the analog inputs are lowpass filtered before being decimated\n";
+	std::cerr << "   --layout-header file:               Write the layout of the context to file, for make FIXED_LAYOUT=1\n";
+	std::cerr << "   --audio-cpus vals:                  Set the CPUs the audio thread can run on (comma-separated list, default: any)\n";
+	std::cerr << "   --fifo-cpus vals:                   Set the CPUs the thread calling render() can run on, when separate from the audio thread (comma-separated list, default: any)\n";
+	std::cerr << "   --aux-cpus vals:                    Set the CPUs the auxiliary tasks can run on (comma-separated list, default: any)\n";
+	std::cerr << "   --lock-memory                       Lock the memory of the program in RAM, including the stacks of the threads\n";
+	std::cerr << "   --prefault-heap kB:                 With --lock-memory, fault in and keep this much heap at startup\n";
+	std::cerr << "   --report-latency                    Measure the scheduling latency and jitter of the audio, fifo and auxiliary threads and print them on exit\n";
 	std::cerr << "   --verbose [-v]:                     Enable verbose logging information\n";
 }
 
@@ -369,6 +435,33 @@ bool parseCommaSeparatedList(const char *in, std::vector<int>& tokens) {
 	return true;
 }
 
+// Parse a list of CPUs into a bitmask
+bool parseCpus(const char *arg, unsigned int *cpus) {
+	std::vector<int> list;
+
+	if(!parseCommaSeparatedList(arg, list) || list.empty())
+		return false;
+	unsigned int mask = 0;
+	for(unsigned int i = 0; i < list.size(); i++) {
+		if(list[i] < 0 || list[i] >= (int)sizeof(mask) * 8)
+			return false;
+		mask |= (1u << list[i]);
+	}
+	*cpus = mask;
+	return true;
+}
+
+// Parse a non-negative number of kB into bytes
+bool parseKilobytes(const char *arg, unsigned int *bytes) {
+	char *p;
+	errno = 0;
+	long value = strtol(arg, &p, 10);
+	if(p == arg || *p || errno || value < 0 || (unsigned long)value > UINT_MAX / 1024)
+		return false;
+	*bytes = value * 1024;
+	return true;
+}
+
 // Parse the argument for the audio expander channels to enable
 bool parseAudioExpanderChannels(const char *arg, bool inputChannel, BelaInitSettings *settings) {
 	std::vector<int> channels;
@@ -398,4 +491,36 @@ bool parseAudioExpanderChannels(const char *arg, bool inputChannel, BelaInitSett
 	return true;
 }
 
-
+#undef NDEBUG
+#include <assert.h>
+// Check the parsing of the option arguments that do not simply go through
+// atoi(). This is not part of the API: declare it in the test program.
+bool testCommandLineParsing() {
+	unsigned int cpus = 0x1234;
+	assert(parseCpus("0", &cpus) && 1 == cpus);
+	assert(parseCpus("1,3", &cpus) && 0xa == cpus);
+	assert(parseCpus("3,1,3,", &cpus) && 0xa == cpus);
+	assert(parseCpus("31", &cpus) && 0x80000000 == cpus);
+	// invalid lists leave the mask unchanged
+	cpus = 0x1234;
+	assert(!parseCpus("", &cpus));
+	assert(!parseCpus(",", &cpus));
+	assert(!parseCpus("-1", &cpus));
+	assert(!parseCpus("32", &cpus));
+	assert(!parseCpus("1,x", &cpus));
+	assert(!parseCpus("0x1", &cpus));
+	assert(0x1234 == cpus);
+
+	unsigned int bytes = 1;
+	assert(parseKilobytes("0", &bytes) && 0 == bytes);
+	assert(parseKilobytes("64", &bytes) && 65536 == bytes);
+	assert(parseKilobytes("4194303", &bytes) && 4194303u * 1024 == bytes);
+	bytes = 1;
+	assert(!parseKilobytes("", &bytes));
+	assert(!parseKilobytes("-1", &bytes));
+	assert(!parseKilobytes("4194304", &bytes));
+	assert(!parseKilobytes("99999999999999999999", &bytes));
+	assert(!parseKilobytes("12k", &bytes));
+	assert(1 == bytes);
+	return true;
+}
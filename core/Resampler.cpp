@@ -0,0 +1,330 @@
+/***** Resampler.cpp *****/
+#include <Resampler.h>
+#include <algorithm>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+// The hand-written NEON inner product is only used when RESAMPLER_USE_NEON
+// is defined. Otherwise the plain loop is used on ARM, which the compiler
+// vectorises with -ftree-vectorize -ffast-math.
+#if defined(RESAMPLER_USE_NEON) && (defined(__ARM_NEON__) || defined(__ARM_NEON))
+#include <arm_neon.h>
+#define RESAMPLER_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define RESAMPLER_SSE2
+#endif
+
+// the filter length is rounded up to a multiple of this, so that the
+// inner product is made of whole pairs of vectors
+static constexpr unsigned int kTapsMultiple = 8;
+static constexpr unsigned int kMaxL = 4096;
+// the cutoff, as a fraction of the lower of the two rates
+static constexpr double kCutoff = 0.45;
+// about 70dB of stopband attenuation
+static constexpr double kKaiserBeta = 7;
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+	while(b)
+	{
+		unsigned int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// modified Bessel function of the first kind, order 0
+static double besselI0(double x)
+{
+	double sum = 1;
+	double term = 1;
+	for(unsigned int k = 1; k < 50; ++k)
+	{
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if(term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+static inline float dot(const float* a, const float* b, unsigned int n)
+{
+#if defined(RESAMPLER_NEON)
+	float32x4_t acc0 = vdupq_n_f32(0);
+	float32x4_t acc1 = vdupq_n_f32(0);
+	for(unsigned int i = 0; i < n; i += 8)
+	{
+		acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+		acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+	}
+	float32x4_t acc = vaddq_f32(acc0, acc1);
+	float32x2_t sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+	return vget_lane_f32(vpadd_f32(sum, sum), 0);
+#elif defined(RESAMPLER_SSE2)
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+	for(unsigned int i = 0; i < n; i += 8)
+	{
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+	__m128 acc = _mm_add_ps(acc0, acc1);
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+	return _mm_cvtss_f32(acc);
+#else
+	float sum = 0;
+	for(unsigned int i = 0; i < n; ++i)
+		sum += a[i] * b[i];
+	return sum;
+#endif
+}
+
+int Resampler::setup(unsigned int channels, unsigned int inRate, unsigned int outRate, unsigned int maxInputFrames, unsigned int taps)
+{
+	if(!channels || !inRate || !outRate || !maxInputFrames || !taps)
+		return EINVAL;
+	unsigned int g = gcd(inRate, outRate);
+	if(outRate / g > kMaxL)
+	{
+		fprintf(stderr, "Resampler: the ratio between %u and %u is too complex\n", inRate, outRate);
+		return EINVAL;
+	}
+	this->channels = channels;
+	L = outRate / g;
+	M = inRate / g;
+	// the filter is `taps` long at the lower of the two rates, and
+	// `this->taps` long at the input rate
+	double cutoff = kCutoff; // cycles per input sample
+	if(M > L)
+	{
+		taps = (taps * M + L - 1) / L;
+		cutoff = kCutoff * L / M;
+	}
+	this->taps = (taps + kTapsMultiple - 1) / kTapsMultiple * kTapsMultiple;
+	taps = this->taps;
+
+	// the prototype filter runs at L times the input rate
+	unsigned int length = taps * L;
+	std::vector<double> h(length);
+	double center = (length - 1) * 0.5;
+	double sum = 0;
+	for(unsigned int j = 0; j < length; ++j)
+	{
+		double t = (j - center) / L; // in input samples
+		double x = 2 * M_PI * cutoff * t;
+		double sinc = fabs(x) < 1e-9 ? 1 : sin(x) / x;
+		double r = (j - center) / (center + 1);
+		double window = besselI0(kKaiserBeta * sqrt(1 - r * r)) / besselI0(kKaiserBeta);
+		h[j] = 2 * cutoff * sinc * window;
+		sum += h[j];
+	}
+	// each of the L phases has unity gain at DC, on average
+	double gain = L / sum;
+	coefficients.resize(L * taps);
+	for(unsigned int p = 0; p < L; ++p)
+		for(unsigned int u = 0; u < taps; ++u)
+			coefficients[p * taps + u] = h[p + (taps - 1 - u) * L] * gain;
+
+	capacity = maxInputFrames + taps + M / L + 1;
+	buffer.resize(channels * capacity);
+	reset();
+	return 0;
+}
+
+void Resampler::reset()
+{
+	std::fill(buffer.begin(), buffer.end(), 0);
+	// the history before the first input is silence
+	end = taps - 1;
+	pos = taps - 1;
+	phase = 0;
+}
+
+unsigned int Resampler::write(const float* in, unsigned int frames, unsigned int frameStride, unsigned int channelStride)
+{
+	if(end + frames > capacity)
+	{
+		// discard the samples that are no longer needed
+		unsigned int first = pos - (taps - 1);
+		if(first > end)
+			first = end;
+		if(first)
+		{
+			for(unsigned int c = 0; c < channels; ++c)
+			{
+				float* b = buffer.data() + c * capacity;
+				memmove(b, b + first, (end - first) * sizeof(float));
+			}
+			end -= first;
+			pos -= first;
+		}
+	}
+	if(end + frames > capacity)
+		frames = capacity - end;
+	for(unsigned int c = 0; c < channels; ++c)
+	{
+		float* b = buffer.data() + c * capacity + end;
+		const float* src = in + c * channelStride;
+		if(1 == frameStride)
+			memcpy(b, src, frames * sizeof(float));
+		else
+			for(unsigned int n = 0; n < frames; ++n)
+				b[n] = src[n * frameStride];
+	}
+	end += frames;
+	return frames;
+}
+
+unsigned int Resampler::getAvailable() const
+{
+	if(end <= pos)
+		return 0;
+	// outputs k such that pos + (phase + k * M) / L < end
+	return ((end - pos) * L - phase + M - 1) / M;
+}
+
+unsigned int Resampler::read(float* out, unsigned int frames, unsigned int frameStride, unsigned int channelStride)
+{
+	unsigned int available = getAvailable();
+	if(frames > available)
+		frames = available;
+	for(unsigned int n = 0; n < frames; ++n)
+	{
+		const float* coeffs = coefficients.data() + phase * taps;
+		const float* in = buffer.data() + pos - (taps - 1);
+		for(unsigned int c = 0; c < channels; ++c)
+			out[n * frameStride + c * channelStride] = dot(coeffs, in + c * capacity, taps);
+		phase += M;
+		pos += phase / L;
+		phase %= L;
+	}
+	return frames;
+}
+
+#undef NDEBUG
+#include <assert.h>
+
+// the largest difference from a sine wave at the output rate, after the
+// delay of the filter
+static float sineError(unsigned int inRate, unsigned int outRate, float frequency, unsigned int blockIn, unsigned int blockOut, bool interleaved)
+{
+	const unsigned int kChannels = 3;
+	const unsigned int kInFrames = inRate / 4;
+	Resampler resampler;
+	assert(0 == resampler.setup(kChannels, inRate, outRate, blockIn));
+	std::vector<float> in(blockIn * kChannels);
+	std::vector<float> out(blockOut * kChannels);
+	double delay = resampler.getDelay() / inRate; // in seconds
+	unsigned int written = 0;
+	unsigned int produced = 0;
+	float maxError = 0;
+	while(written < kInFrames)
+	{
+		for(unsigned int n = 0; n < blockIn; ++n)
+			for(unsigned int c = 0; c < kChannels; ++c)
+				in[n * kChannels + c] = 0.5f * (c + 1) / kChannels * sin(2 * M_PI * frequency * (written + n) / inRate);
+		assert(blockIn == resampler.write(in.data(), blockIn, kChannels, 1));
+		written += blockIn;
+		while(resampler.getAvailable())
+		{
+			unsigned int frames = resampler.read(out.data(), blockOut, interleaved ? kChannels : 1, interleaved ? 1 : blockOut);
+			assert(frames <= blockOut);
+			for(unsigned int n = 0; n < frames; ++n)
+			{
+				double t = (double)(produced + n) / outRate - delay;
+				// skip the start, where the filter is not full yet
+				if(t < 2 * delay)
+					continue;
+				for(unsigned int c = 0; c < kChannels; ++c)
+				{
+					float expected = 0.5f * (c + 1) / kChannels * sin(2 * M_PI * frequency * t);
+					float actual = out[interleaved ? n * kChannels + c : c * blockOut + n];
+					float error = fabsf(actual - expected);
+					if(error > maxError)
+						maxError = error;
+				}
+			}
+			produced += frames;
+		}
+	}
+	// all the input has been turned into output, up to the filter phase
+	float expectedOut = (float)written * outRate / inRate;
+	assert(fabsf(produced - expectedOut) <= 1);
+	return maxError;
+}
+
+bool Resampler::test()
+{
+	Resampler resampler;
+	assert(0 != resampler.setup(0, 44100, 48000, 16));
+	assert(0 != resampler.setup(1, 44100, 48001, 16));
+	assert(0 == resampler.setup(1, 44100, 48000, 16));
+	assert(160 == resampler.getL() && 147 == resampler.getM());
+	// no more than maxInputFrames are taken
+	float zeros[32] = {0};
+	unsigned int written = resampler.write(zeros, 32, 1, 1);
+	assert(written >= 16 && written < 32);
+	assert(0 == resampler.write(zeros, 1, 1, 1));
+	float out[32];
+	unsigned int available = resampler.getAvailable();
+	assert(available == (written * 160 + 146) / 147);
+	assert(available == resampler.read(out, 32, 1, 1));
+	assert(0 == resampler.getAvailable());
+	assert(16 == resampler.write(zeros, 16, 1, 1));
+
+	// conversion of a sine wave, with blocks that are not in the ratio
+	// of the rates
+	const struct {
+		unsigned int inRate;
+		unsigned int outRate;
+	} rates[] = {
+		{ 44100, 48000 },
+		{ 48000, 44100 },
+		{ 44100, 96000 },
+		{ 96000, 44100 },
+		{ 22050, 48000 },
+		{ 44100, 44100 },
+	};
+	for(auto& r : rates)
+	{
+		for(bool interleaved : { true, false })
+		{
+			float error = sineError(r.inRate, r.outRate, 1000, 16, 7, interleaved);
+			assert(error < 0.001f);
+			error = sineError(r.inRate, r.outRate, 1000, 128, 64, interleaved);
+			assert(error < 0.001f);
+		}
+		// at the top of the passband
+		float lower = r.inRate < r.outRate ? r.inRate : r.outRate;
+		assert(sineError(r.inRate, r.outRate, 0.35f * lower, 64, 64, true) < 0.01f);
+	}
+	// components above the output Nyquist frequency are removed rather
+	// than aliased
+	{
+		Resampler decimator;
+		assert(0 == decimator.setup(1, 48000, 24000, 256));
+		std::vector<float> in(256);
+		float power = 0;
+		unsigned int count = 0;
+		for(unsigned int b = 0; b < 40; ++b)
+		{
+			for(unsigned int n = 0; n < in.size(); ++n)
+				in[n] = sin(2 * M_PI * 15000 * (b * in.size() + n) / 48000.f);
+			decimator.write(in.data(), in.size(), 1, 1);
+			float o[256];
+			unsigned int frames = decimator.read(o, 256, 1, 1);
+			if(b < 2)
+				continue;
+			for(unsigned int n = 0; n < frames; ++n)
+				power += o[n] * o[n];
+			count += frames;
+		}
+		assert(power / count < 1e-6f); // below -60dB
+	}
+	return true;
+}
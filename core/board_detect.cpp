@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include "../include/Bela.h"
 #include <iostream>
 #include <fstream>
@@ -66,7 +67,9 @@ static bool detectTlv32()
 {
 	I2c_Codec codec(codecI2cBus, codecI2cAddress);
 	// I2c_Codec codec(i2cBus, i2cAddress); // get these variable from RTAudio.cpp
-	int ret = codec.initCodec();
+	// Selecting page 0 is acknowledged by the codec if it is there, and
+	// unlike a reset it leaves it ready to be initialised straight away.
+	int ret = codec.writeRegister(0x00, 0x00);
 	if (ret == 0)
 		return true;
 	else
@@ -81,6 +84,10 @@ static bool detectTlv32()
 //	2 if has both master and slave
 static int detectCtag()
 {
+	// Without the spidev device there cannot be a codec on it, and
+	// there is no need to reset the codecs to find that out.
+	if(access(ctagSpidevGpioCs0, F_OK))
+		return 0;
 	Spi_Codec codec(ctagSpidevGpioCs0, ctagSpidevGpioCs1);
 	bool masterDetected = codec.masterIsDetected();
 	if (masterDetected)
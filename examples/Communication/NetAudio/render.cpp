@@ -0,0 +1,72 @@
+/**
+\example NetAudio/render.cpp
+
+Streaming audio between boards
+------------------------------
+
+This example sends the audio inputs to another board over the network and
+plays the audio it receives from it on the audio outputs.
+
+Set `remoteIp` to the address of the other board and run the same project
+on both. To try it on a single board, or between two processes on a
+computer, run a second copy with `localPort` and `remotePort` swapped.
+
+The received audio goes through a jitter buffer, which holds a few blocks
+to absorb the irregular timing of the network. Its statistics are printed
+every few seconds: `lost` blocks never arrived, `late` ones arrived after
+they were due and `underruns` are the times the buffer ran empty. Each
+underrun makes the buffer one block deeper.
+*/
+
+#include <Bela.h>
+#include <libraries/NetAudio/NetAudio.h>
+#include <vector>
+
+NetAudio netAudio;
+int localPort = 7570;
+int remotePort = 7571;
+const char* remoteIp = "127.0.0.1";
+
+std::vector<float> gIn;
+std::vector<float> gOut;
+unsigned int gStatsInterval;
+unsigned int gStatsCount;
+
+bool setup(BelaContext *context, void *userData)
+{
+	if(netAudio.setupSend(remoteIp, remotePort, context->audioInChannels, context->audioFrames, NetAudio::kInt24))
+		return false;
+	if(netAudio.setupReceive(localPort, context->audioOutChannels, context->audioFrames))
+		return false;
+	gIn.resize(context->audioInChannels * context->audioFrames);
+	gOut.resize(context->audioOutChannels * context->audioFrames);
+	gStatsInterval = 5 * context->audioSampleRate / context->audioFrames;
+	return true;
+}
+
+void render(BelaContext *context, void *userData)
+{
+	// NetAudio uses interleaved blocks
+	for(unsigned int n = 0; n < context->audioFrames; ++n)
+		for(unsigned int c = 0; c < context->audioInChannels; ++c)
+			gIn[n * context->audioInChannels + c] = audioRead(context, n, c);
+	netAudio.send(gIn.data());
+
+	netAudio.receive(gOut.data());
+	for(unsigned int n = 0; n < context->audioFrames; ++n)
+		for(unsigned int c = 0; c < context->audioOutChannels; ++c)
+			audioWrite(context, n, c, gOut[n * context->audioOutChannels + c]);
+
+	if(++gStatsCount >= gStatsInterval)
+	{
+		gStatsCount = 0;
+		NetAudio::Stats stats = netAudio.getStats();
+		rt_printf("received: %u, lost: %u, late: %u, underruns: %u, depth: %u/%u blocks\n",
+			stats.received, stats.lost, stats.late, stats.underruns, stats.depth, stats.targetDepth);
+	}
+}
+
+void cleanup(BelaContext *context, void *userData)
+{
+
+}
@@ -0,0 +1,60 @@
+/**
+\example shared-memory/render.cpp
+
+Exchanging audio with another program
+-------------------------------------
+
+This example sends each block of audio input to an external program through
+shared memory, and plays the blocks that the program sends back.
+
+Build and start the reference client on the board while this is running:
+```
+cd /root/Bela/resources/tools/shm-client && make
+./shm-client bela-audio --echo
+```
+With `--echo` the client sends each block back unchanged, so the inputs come
+out of the outputs with a short delay. Any program using
+`libraries/ShmChannel/ShmChannelClient.h` can take its place.
+
+Until the client connects, or whenever it doesn't keep up, the outputs are
+silent.
+*/
+
+#include <Bela.h>
+#include <libraries/ShmChannel/ShmChannel.h>
+#include <algorithm>
+
+ShmChannel channel;
+
+bool setup(BelaContext *context, void *userData)
+{
+	size_t blockBytes = context->audioFrames * context->audioInChannels * sizeof(float);
+	return 0 == channel.setup("bela-audio", 4, blockBytes);
+}
+
+void render(BelaContext *context, void *userData)
+{
+	// write the inputs straight into the shared memory, interleaved
+	float* out = (float*)channel.reserve();
+	if(out)
+	{
+		for(unsigned int n = 0; n < context->audioFrames; ++n)
+			for(unsigned int c = 0; c < context->audioInChannels; ++c)
+				out[n * context->audioInChannels + c] = audioRead(context, n, c);
+		channel.commit(context->audioFrames * context->audioInChannels * sizeof(float));
+	}
+
+	size_t size;
+	const float* in = (const float*)channel.read(size);
+	unsigned int channels = std::min(context->audioInChannels, context->audioOutChannels);
+	for(unsigned int n = 0; n < context->audioFrames; ++n)
+		for(unsigned int c = 0; c < context->audioOutChannels; ++c)
+			audioWrite(context, n, c, in && c < channels ? in[n * context->audioInChannels + c] : 0);
+	if(in)
+		channel.release();
+}
+
+void cleanup(BelaContext *context, void *userData)
+{
+
+}
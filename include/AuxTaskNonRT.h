@@ -33,8 +33,23 @@ class AuxTaskNonRT{
 		int schedule(const char* str);
 		int schedule();
 		
+		/**
+		 * Set the CPUs that the task may run on, instead of
+		 * BelaInitSettings::auxiliaryTaskCpus. With the native skin, this
+		 * has to be called before create().
+		 *
+		 * @param cpus bitmask of the CPUs, with bit n set for CPU n, or 0
+		 * for any CPU.
+		 * @return 0 on success, an error number otherwise.
+		 */
+		int setCpus(unsigned int cpus);
+		
 	private:
 		bool lShouldStop = false;
+		bool started = false;
+		bool hasCpus = false;
+		unsigned int cpus = 0;
+		unsigned int getCpus();
 		bool shouldStop();
 		void cleanup();
 		
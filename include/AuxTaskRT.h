@@ -37,8 +37,23 @@ class AuxTaskRT{
 		void schedule(const char* str);
 		void schedule();
 		
+		/**
+		 * Set the CPUs that the task may run on, instead of
+		 * BelaInitSettings::auxiliaryTaskCpus. With the native skin, this
+		 * has to be called before create().
+		 *
+		 * @param cpus bitmask of the CPUs, with bit n set for CPU n, or 0
+		 * for any CPU.
+		 * @return 0 on success, an error number otherwise.
+		 */
+		int setCpus(unsigned int cpus);
+		
 	private:
 		bool lShouldStop = false;
+		bool started = false;
+		bool hasCpus = false;
+		unsigned int cpus = 0;
+		unsigned int getCpus();
 		bool shouldStop();
 		void cleanup();
 		
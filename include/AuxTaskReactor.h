@@ -0,0 +1,169 @@
+/***** AuxTaskReactor.h *****/
+#ifndef __AuxTaskReactor_H_INCLUDED__
+#define __AuxTaskReactor_H_INCLUDED__
+
+#ifdef XENOMAI_SKIN_native
+#include <native/pipe.h>
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <functional>
+
+/**
+ * A single non-RT thread which waits (via epoll) on any number of event
+ * sources and calls the matching callback when one of them becomes ready.
+ *
+ * Libraries that would otherwise spawn a thread just to sleep in a
+ * `read()`, `select()` or `usleep()` loop can register with the shared
+ * reactor instead, so that one thread serves all of them and only wakes up
+ * when there is actually something to do.
+ *
+ * Three kinds of sources can be registered:
+ * - file descriptors (sockets, pipes, devices, ...), see addFd()
+ * - periodic timers, see addTimer()
+ * - doorbells, which can be rung from the audio thread to wake up a
+ *   callback in the reactor thread, see addDoorbell() and ring().
+ *
+ * Callbacks are executed in the reactor thread, one at a time, so they
+ * should not block for long periods.
+ */
+class AuxTaskReactor{
+	public:
+		typedef std::function<void(int fd, uint32_t events)> FdCallback;
+		typedef std::function<void()> Callback;
+
+		AuxTaskReactor();
+		~AuxTaskReactor(){ cleanup(); }
+
+		/**
+		 * Create the epoll instance and start the reactor thread.
+		 *
+		 * @return 0 on success, an error code otherwise.
+		 */
+		int setup();
+		/**
+		 * Stop the reactor thread and release all the registered sources.
+		 */
+		void cleanup();
+
+		/**
+		 * Call @p callback whenever @p fd becomes ready.
+		 *
+		 * The file descriptor remains owned by the caller and it is not
+		 * closed when it is removed from the reactor.
+		 *
+		 * @param fd the file descriptor to watch.
+		 * @param events an epoll events mask (e.g.: `EPOLLIN`).
+		 * @param callback the function to call. It receives the file
+		 * descriptor and the events that were triggered.
+		 * @return an identifier to be passed to remove(), or a negative
+		 * value on error.
+		 */
+		int addFd(int fd, uint32_t events, FdCallback callback);
+		/**
+		 * Call @p callback every @p periodMs milliseconds.
+		 *
+		 * If the reactor thread falls behind, missed expirations are
+		 * coalesced into a single call.
+		 *
+		 * @return an identifier to be passed to remove(), or a negative
+		 * value on error.
+		 */
+		int addTimer(unsigned int periodMs, Callback callback);
+		/**
+		 * Create a doorbell that can be rung from the audio thread.
+		 *
+		 * Rings that happen while the callback is pending are coalesced
+		 * into a single call.
+		 *
+		 * @param name a name for the underlying Xenomai pipe. It must be
+		 * unique across the system.
+		 * @param callback the function to call in the reactor thread.
+		 * @return an identifier to be passed to ring() and remove(), or a
+		 * negative value on error.
+		 */
+		int addDoorbell(std::string name, Callback callback);
+		/**
+		 * Wake up the callback associated with a doorbell. This is safe
+		 * to call from the audio thread.
+		 *
+		 * @param id the identifier returned by addDoorbell()
+		 * @return 0 on success, a negative error code otherwise.
+		 */
+		int ring(int id);
+		/**
+		 * Stop watching a source. Once this returns, the callback of the
+		 * source is not running and will not be called again, and ring()
+		 * is no longer using the doorbell, so that the caller can free
+		 * any state they use.
+		 *
+		 * It is safe to call this from within a callback, including the
+		 * callback of the source being removed. In that case it cannot
+		 * wait for the calling callback to return, but no other callback
+		 * can be running.
+		 *
+		 * @param id the identifier returned by addFd(), addTimer() or
+		 * addDoorbell()
+		 * @return 0 on success, a negative error code otherwise.
+		 */
+		int remove(int id);
+
+		/**
+		 * Get a reactor shared by the whole program. It is started on the
+		 * first call.
+		 */
+		static AuxTaskReactor& get();
+
+		static bool test();
+	private:
+		enum SourceType {
+			kFd,
+			kTimer,
+			kDoorbell,
+		};
+		struct Source {
+			SourceType type;
+			int id;
+			int fd; // the descriptor watched by epoll
+			FdCallback fdCallback;
+			Callback callback;
+			bool removed;
+			std::string name;
+#ifdef XENOMAI_SKIN_native
+			RT_PIPE pipe;
+#endif
+			int pipeSocket; // RT end of a doorbell
+		};
+		int add(Source* source, uint32_t events);
+		Source* findSource(int id);
+		bool dispatch(Source* source, uint32_t events);
+		void releaseSource(Source* source);
+		void collectRemoved();
+		void loop();
+		static void* thread_func(void* ptr);
+
+		int epollFd = -1;
+		int wakeFd = -1;
+		int nextId = 0;
+		volatile bool lShouldStop = false;
+		bool started = false;
+		pthread_t thread;
+		pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+		// signalled when a callback returns, for remove()
+		pthread_cond_t dispatchDone = PTHREAD_COND_INITIALIZER;
+		Source* dispatching = NULL; // whose callback is running
+		std::vector<Source*> sources;
+		// lock-free lookup table for ring(), which is called from the
+		// audio thread. ring() counts itself in ringing[] while using a
+		// slot, so that remove() can wait for it to be done.
+		static const unsigned int kMaxDoorbells = 64;
+		std::atomic<int> doorbellIds[kMaxDoorbells];
+		std::atomic<int> ringing[kMaxDoorbells];
+		Source* doorbells[kMaxDoorbells];
+};
+
+#endif
@@ -0,0 +1,203 @@
+/***** AuxTaskRing.h *****/
+#pragma once
+
+#include <AuxTaskReactor.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <functional>
+
+/**
+ * The parts of AuxTaskRing that do not depend on its type.
+ */
+class AuxTaskRingBase{
+	public:
+		static bool test();
+};
+
+/**
+ * Pass objects of type T from the audio thread to a non-RT callback without
+ * copying them.
+ *
+ * AuxTaskNonRT::schedule() copies the payload into a pipe and then again
+ * out of it. Here the payload lives in a fixed number of slots, allocated
+ * once in setup(). The producer fills a slot in place:
+ *
+ *     Frame* frame = ring.reserve();
+ *     if(frame) {
+ *         fillFrame(*frame);
+ *         ring.commit();
+ *     }
+ *
+ * and the consumer callback receives a reference to the same slot. The slot
+ * is recycled when the callback returns.
+ *
+ * There must be only one producer thread and one consumer thread. The
+ * consumer is the thread of the AuxTaskReactor, unless setup() is called
+ * with an empty name, in which case the consumer has to call process()
+ * itself.
+ */
+template <typename T>
+class AuxTaskRing : public AuxTaskRingBase{
+	public:
+		AuxTaskRing(){}
+		AuxTaskRing(std::string name, unsigned int numSlots, std::function<void(T&)> callback, const T& prototype = T()){
+			setup(name, numSlots, callback, prototype);
+		}
+		~AuxTaskRing(){ cleanup(); }
+
+		/**
+		 * Allocate the slots and register with the shared AuxTaskReactor.
+		 *
+		 * This allocates memory, so it should not be called from the
+		 * audio thread.
+		 *
+		 * @param name a name for the doorbell, unique across the system.
+		 * If empty, no doorbell is created and the consumer has to call
+		 * process().
+		 * @param numSlots the number of objects that can be in flight at
+		 * any time. This is rounded up to a power of 2.
+		 * @param callback the function that processes one object.
+		 * @param prototype each slot is initialised as a copy of this.
+		 * Use it to pre-allocate storage in the slots (e.g.: a
+		 * `std::vector` of the appropriate size).
+		 * @return 0 on success, an error code otherwise.
+		 */
+		int setup(std::string name, unsigned int numSlots, std::function<void(T&)> callback, const T& prototype = T())
+		{
+			this->callback = callback;
+			batchCallback = nullptr;
+			return init(name, numSlots, prototype);
+		}
+
+		/**
+		 * Same as setup(), except that the callback receives up to
+		 * @p maxBatch committed slots at once, e.g.: to process them
+		 * with a single system call. The slots are recycled when it
+		 * returns.
+		 */
+		int setup(std::string name, unsigned int numSlots, unsigned int maxBatch, std::function<void(T* const* items, unsigned int count)> batchCallback, const T& prototype = T())
+		{
+			callback = nullptr;
+			this->batchCallback = batchCallback;
+			batch.resize(maxBatch ? maxBatch : 1);
+			return init(name, numSlots, prototype);
+		}
+
+		/**
+		 * Get the next free slot. Call commit() once it has been filled.
+		 * This is safe to call from the audio thread.
+		 *
+		 * @return a pointer to the slot, or NULL if all slots are
+		 * currently in use by the consumer.
+		 */
+		T* reserve()
+		{
+			unsigned int w = writeIdx.load(std::memory_order_relaxed);
+			if(w - readIdx.load(std::memory_order_acquire) >= slots.size())
+				return NULL;
+			return &slots[w & mask];
+		}
+
+		/**
+		 * Hand the slot obtained from reserve() over to the consumer.
+		 * This is safe to call from the audio thread.
+		 *
+		 * @return 0 on success, an error code otherwise.
+		 */
+		int commit()
+		{
+			writeIdx.store(writeIdx.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+			if(doorbell >= 0)
+				return AuxTaskReactor::get().ring(doorbell);
+			return 0;
+		}
+
+		/**
+		 * Run the callback on all the committed slots. This is called
+		 * automatically when a doorbell is in use.
+		 *
+		 * @return the number of slots processed.
+		 */
+		unsigned int process()
+		{
+			unsigned int count = 0;
+			unsigned int r = readIdx.load(std::memory_order_relaxed);
+			unsigned int w;
+			while(r != (w = writeIdx.load(std::memory_order_acquire)))
+			{
+				if(batchCallback)
+				{
+					unsigned int n = 0;
+					for(; n < batch.size() && r + n != w; ++n)
+						batch[n] = &slots[(r + n) & mask];
+					batchCallback(batch.data(), n);
+					r += n;
+					count += n;
+				} else {
+					callback(slots[r & mask]);
+					++r;
+					++count;
+				}
+				readIdx.store(r, std::memory_order_release);
+			}
+			return count;
+		}
+
+		/**
+		 * @return the number of slots committed and not yet processed.
+		 */
+		unsigned int pending()
+		{
+			return writeIdx.load(std::memory_order_acquire) - readIdx.load(std::memory_order_acquire);
+		}
+
+		/**
+		 * Stop processing and detach from the AuxTaskReactor. If the
+		 * callback is running on the reactor thread, this waits for it to
+		 * return, so that the slots can be safely destroyed afterwards.
+		 *
+		 * This is also called by the destructor, which must therefore
+		 * not be invoked from within the callback of the same ring.
+		 */
+		void cleanup()
+		{
+			if(doorbell >= 0)
+				AuxTaskReactor::get().remove(doorbell);
+			doorbell = -1;
+		}
+
+	private:
+		int init(std::string name, unsigned int numSlots, const T& prototype)
+		{
+			cleanup();
+			if(0 == numSlots)
+				return -1;
+			unsigned int size = 1;
+			while(size < numSlots)
+				size <<= 1;
+			slots.assign(size, prototype);
+			mask = size - 1;
+			writeIdx = 0;
+			readIdx = 0;
+			doorbell = -1;
+			if(name.size())
+			{
+				doorbell = AuxTaskReactor::get().addDoorbell(name, [this]() { process(); });
+				if(doorbell < 0)
+					return doorbell;
+			}
+			return 0;
+		}
+
+		std::vector<T> slots;
+		std::function<void(T&)> callback;
+		std::function<void(T* const* items, unsigned int count)> batchCallback;
+		std::vector<T*> batch;
+		unsigned int mask = 0;
+		// these are never wrapped around explicitly: unsigned overflow
+		// is harmless as the number of slots is a power of 2
+		std::atomic<unsigned int> writeIdx{0};
+		std::atomic<unsigned int> readIdx{0};
+		int doorbell = -1;
+};
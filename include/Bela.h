@@ -28,10 +28,20 @@
 #ifndef BELA_H_
 #define BELA_H_
 #define BELA_MAJOR_VERSION 1
-#define BELA_MINOR_VERSION 5
-#define BELA_BUGFIX_VERSION 1
+#define BELA_MINOR_VERSION 7
+#define BELA_BUGFIX_VERSION 0
 
 // Version history / changelog:
+// 1.7.0
+// - added to BelaInitSettings audioCpus, fifoCpus, auxiliaryTaskCpus,
+// lockMemory, prefaultHeapSize, reportLatency
+// - added Bela_setAuxiliaryTaskCpus()
+// 1.6.0
+// - added to BelaContext analogOutPending: analogWrite() fills the rest of
+// the block after render() returns
+// - added to BelaInitSettings projectSampleRate, maxPeriodSize
+// - added Bela_setPeriodSize() and BELA_FLAG_BLOCK_SIZE_CHANGED
+// - added to BelaInitSettings layoutHeader, set with --layout-header
 // 1.5.0
 // - in BelaInitSettings, renamed unused members, preserving binary compatibility
 // 1.5.0
@@ -55,6 +65,7 @@ extern "C"
 {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <stdbool.h>
@@ -85,7 +96,9 @@ typedef enum
 
 /** \cond PRIVATE */
 #define MAX_PRU_FILENAME_LENGTH 256
-#define MAX_UNUSED2_LENGTH 256
+// the members added to BelaInitSettings since 1.5.1 are taken from unused2,
+// so that its layout stays the same
+#define MAX_UNUSED2_LENGTH (256 - sizeof(const char*) - 6 * sizeof(int))
 #define MAX_PROJECTNAME_LENGTH 256
 /** \endcond */
 
@@ -140,9 +153,28 @@ typedef enum
  * Flag for BelaContext. If set, indicates the user will be warned if an underrun occurs
  */
 #define BELA_FLAG_DETECT_UNDERRUNS	(1 << 2)	// Set if the user will be displayed a message when an underrun occurs
+/**
+ * Flag for BelaContext. If set, indicates that the number of frames of the
+ * context has changed since the previous call to render(), after a call to
+ * Bela_setPeriodSize().
+ */
+#define BELA_FLAG_BLOCK_SIZE_CHANGED	(1 << 3)	// Set on the first render() after the period size changed
 
 struct option;
 
+/** \cond PRIVATE */
+/**
+ * \brief A value written with analogWrite() that has yet to be copied to the
+ * following frames of the block.
+ */
+typedef struct {
+	/// The first frame that has yet to be written, or 0 if there is none.
+	uint32_t frame;
+	/// The value to write to it and to the rest of the block.
+	float value;
+} BelaAnalogOutPending;
+/** \endcond */
+
 /**
  * \ingroup render
  * \brief Structure holding audio and sensor settings and pointers to I/O data buffers.
@@ -339,6 +371,15 @@ typedef struct {
 	/// Name of running project.
 	char projectName[MAX_PROJECTNAME_LENGTH];
 
+	/// \brief One element for each analog output, used by analogWrite().
+	///
+	/// analogWrite() only writes the frame it is given and records here the
+	/// value that the following frames have to take. These are written by
+	/// the next write to the same channel or, at the latest, by
+	/// analogWriteFlush() when render() returns. This is null for contexts
+	/// not created by Bela, in which case analogWrite() writes all the
+	/// following frames straight away.
+	BelaAnalogOutPending * const analogOutPending;
 } BelaContext;
 
 /**
@@ -436,8 +477,47 @@ typedef struct {
 
 	/// Pin where amplifier mute can be found
 	int ampMutePin;
-	int unused0;
-	int unused1;
+	/// \brief The audio sample rate that render() should run at. If
+	/// non-zero and different from the one of the hardware, the context
+	/// passed to render() is resampled from and to the hardware.
+	/// Together with uniformSampleRate, the analog channels are
+	/// resampled to the audio rate with a lowpass filter, also when
+	/// this is the rate of the hardware.
+	///
+	/// Digital channels and the multiplexer capelet are not available
+	/// in a resampled context.
+	int projectSampleRate;
+	/// \brief The largest period size that Bela_setPeriodSize() can
+	/// switch to at runtime. If larger than periodSize, the buffers for
+	/// periodSize times each power of two up to this are allocated by
+	/// Bela_initAudio(). Ignored otherwise.
+	int maxPeriodSize;
+	/// \brief The CPUs that the audio thread may run on: bit n is set for
+	/// CPU n. 0, the default, means any CPU.
+	unsigned int audioCpus;
+	/// \brief The CPUs that the thread calling render() may run on when
+	/// it is separate from the audio thread, i.e.: when periodSize is
+	/// larger than the hardware period or maxPeriodSize is set. 0 means any
+	/// CPU.
+	unsigned int fifoCpus;
+	/// \brief The CPUs that auxiliary tasks may run on, unless set
+	/// otherwise with Bela_setAuxiliaryTaskCpus(). 0 means any CPU.
+	unsigned int auxiliaryTaskCpus;
+	/// \brief If set, the layout of the context passed to render() is
+	/// written to this file, for projects built with
+	/// `make FIXED_LAYOUT=1`. See BelaLayout.h.
+	const char* layoutHeader;
+	/// \brief Whether to lock the memory of the process in RAM, including
+	/// that allocated later, so that it is never paged out and the
+	/// stacks of the threads are faulted in when they are created.
+	int lockMemory;
+	/// \brief With lockMemory, the number of bytes of heap to fault in
+	/// and keep, so that later allocations up to that size do not cause
+	/// page faults.
+	unsigned int prefaultHeapSize;
+	/// \brief Whether to measure the scheduling latency and jitter of the
+	/// audio, fifo and auxiliary threads, and print them when audio stops.
+	int reportLatency;
 	char unused2[MAX_UNUSED2_LENGTH];
 
 	/// User selected board to work with (as opposed to detected hardware).
@@ -448,6 +528,14 @@ typedef struct {
 
 } BelaInitSettings;
 
+#ifdef __cplusplus
+// unused0, unused1 and unused2 used to take 264 bytes between ampMutePin and
+// board, so this keeps the offsets of the members after them and the size
+// of the structure. The members that replaced them are ordered so that there
+// is no padding between them, also with 8-byte pointers.
+static_assert(offsetof(BelaInitSettings, board) == offsetof(BelaInitSettings, ampMutePin) + sizeof(int) + 264, "BelaInitSettings must keep the same layout");
+#endif
+
 /** \ingroup auxtask
  *
  * Auxiliary task variable. Auxiliary tasks are created using createAuxiliaryTask() and
@@ -693,6 +781,24 @@ void Bela_stopAudio();
  */
 void Bela_cleanupAudio();
 
+/**
+ * \brief Change the number of frames passed to render() while running.
+ *
+ * The change takes effect at the end of the current block: the blocks
+ * already rendered at the old size are played out first and the inputs
+ * received meanwhile are discarded, after which render() is called with
+ * BELA_FLAG_BLOCK_SIZE_CHANGED set in the context flags. There is a gap
+ * in the output of about one period at the new size, instead of the one
+ * of restarting the program.
+ *
+ * \param periodSize the new period size. This has to be
+ * BelaInitSettings::periodSize times a power of two, no larger than
+ * BelaInitSettings::maxPeriodSize.
+ *
+ * \return 0 on success, or nonzero if the period size is not available.
+ */
+int Bela_setPeriodSize(unsigned int periodSize);
+
 /** @} */
 
 /**
@@ -846,6 +952,18 @@ AuxiliaryTask Bela_createAuxiliaryTask(void (*callback)(void*), int priority, co
  */
 int Bela_scheduleAuxiliaryTask(AuxiliaryTask task);
 
+/**
+ * \brief Set the CPUs that an auxiliary task may run on.
+ *
+ * This overrides BelaInitSettings::auxiliaryTaskCpus for one task. It
+ * can be called at any time after the task is created.
+ *
+ * \param task Task created with Bela_createAuxiliaryTask().
+ * \param cpus Bitmask of the CPUs, with bit n set for CPU n, or 0 for any CPU.
+ * \return 0 on success, an error number otherwise.
+ */
+int Bela_setAuxiliaryTaskCpus(AuxiliaryTask task, unsigned int cpus);
+
 /**
  * \brief Initialize an auxiliary task so that it can be scheduled.
  *
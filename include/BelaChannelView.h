@@ -0,0 +1,139 @@
+#pragma once
+
+#include <Bela.h>
+
+/**
+ * Operations on blocks of samples spaced by a stride, i.e.: one channel of
+ * an interleaved buffer (the stride is the number of channels) or of a
+ * non-interleaved one (the stride is 1). They are vectorised with NEON on
+ * ARM and SSE2 on x86 for a stride of 1 and, for copies, also for a stride
+ * of 2, which is that of the interleaved stereo audio.
+ */
+struct BelaChannelOps {
+	/**
+	 * Copy @p count samples from @p src to @p dst.
+	 */
+	static void copy(float* dst, unsigned int dstStride, const float* src, unsigned int srcStride, unsigned int count);
+	/**
+	 * Set @p count samples to @p value.
+	 */
+	static void fill(float* dst, unsigned int stride, unsigned int count, float value);
+	/**
+	 * Write @p count samples going linearly from @p from to @p to. The
+	 * first sample is one step after @p from and the last one is @p to, so
+	 * that a ramp that starts from the value where the previous one ended
+	 * does not repeat it.
+	 */
+	static void ramp(float* dst, unsigned int stride, unsigned int count, float from, float to);
+	static bool test();
+	static void benchmark();
+};
+
+/**
+ * \brief A view of one channel of one of the buffers in a BelaContext, which
+ * hides whether the buffer is interleaved.
+ *
+ * Get one with audioInChannel(), audioOutChannel(), analogInChannel() or
+ * analogOutChannel(), then either access individual frames with [] or
+ * process a range of frames at once:
+ *
+ *     BelaChannelView out = audioOutChannel(context, 0);
+ *     out.write(0, buffer, context->audioFrames);
+ *     analogOutChannel(context, 1).ramp(0, context->analogFrames, previous, target);
+ *
+ * As with the functions in Utilities.h, the frames and channels are not
+ * checked against the size of the context.
+ */
+template <typename T>
+class BelaChannelViewT {
+public:
+	BelaChannelViewT(T* data, unsigned int frames, unsigned int stride) :
+		ptr(data), frames(frames), stride(stride) {}
+	T& operator[](unsigned int frame) const { return ptr[frame * stride]; }
+	/// @return the number of frames in the block.
+	unsigned int size() const { return frames; }
+	/// @return the distance between consecutive frames, in samples.
+	unsigned int getStride() const { return stride; }
+	T* data() const { return ptr; }
+	/**
+	 * Copy @p count frames, starting at @p frame, to the contiguous @p dst.
+	 */
+	void read(float* dst, unsigned int frame, unsigned int count) const
+	{
+		BelaChannelOps::copy(dst, 1, ptr + frame * stride, stride, count);
+	}
+	/**
+	 * Copy @p count frames from @p src to the frames starting at @p frame.
+	 */
+	void write(unsigned int frame, const float* src, unsigned int count) const
+	{
+		BelaChannelOps::copy(ptr + frame * stride, stride, src, 1, count);
+	}
+	/**
+	 * Copy @p count frames from another channel.
+	 */
+	template <typename U>
+	void write(unsigned int frame, const BelaChannelViewT<U>& src, unsigned int srcFrame, unsigned int count) const
+	{
+		BelaChannelOps::copy(ptr + frame * stride, stride, src.data() + srcFrame * src.getStride(), src.getStride(), count);
+	}
+	/**
+	 * Set @p count frames starting at @p frame to @p value.
+	 */
+	void fill(unsigned int frame, unsigned int count, float value) const
+	{
+		BelaChannelOps::fill(ptr + frame * stride, stride, count, value);
+	}
+	/**
+	 * Write @p count frames starting at @p frame going linearly from @p from
+	 * to @p to, as in BelaChannelOps::ramp().
+	 */
+	void ramp(unsigned int frame, unsigned int count, float from, float to) const
+	{
+		BelaChannelOps::ramp(ptr + frame * stride, stride, count, from, to);
+	}
+private:
+	T* ptr;
+	unsigned int frames;
+	unsigned int stride;
+};
+
+typedef BelaChannelViewT<float> BelaChannelView;
+typedef BelaChannelViewT<const float> BelaConstChannelView;
+
+static inline BelaConstChannelView audioInChannel(const BelaContext* context, unsigned int channel)
+{
+	if(context->flags & BELA_FLAG_INTERLEAVED)
+		return BelaConstChannelView(context->audioIn + channel, context->audioFrames, context->audioInChannels);
+	return BelaConstChannelView(context->audioIn + channel * context->audioFrames, context->audioFrames, 1);
+}
+
+static inline BelaChannelView audioOutChannel(BelaContext* context, unsigned int channel)
+{
+	if(context->flags & BELA_FLAG_INTERLEAVED)
+		return BelaChannelView(context->audioOut + channel, context->audioFrames, context->audioOutChannels);
+	return BelaChannelView(context->audioOut + channel * context->audioFrames, context->audioFrames, 1);
+}
+
+static inline BelaConstChannelView analogInChannel(const BelaContext* context, unsigned int channel)
+{
+	if(context->flags & BELA_FLAG_INTERLEAVED)
+		return BelaConstChannelView(context->analogIn + channel, context->analogFrames, context->analogInChannels);
+	return BelaConstChannelView(context->analogIn + channel * context->analogFrames, context->analogFrames, 1);
+}
+
+/**
+ * Any value left pending by analogWrite() on the channel is written first,
+ * so that the writes made through the view are not overwritten.
+ */
+static inline BelaChannelView analogOutChannel(BelaContext* context, unsigned int channel)
+{
+	if(context->analogOutPending)
+	{
+		analogWritePending(context, channel, context->analogFrames);
+		context->analogOutPending[channel].frame = 0;
+	}
+	if(context->flags & BELA_FLAG_INTERLEAVED)
+		return BelaChannelView(context->analogOut + channel, context->analogFrames, context->analogOutChannels);
+	return BelaChannelView(context->analogOut + channel * context->analogFrames, context->analogFrames, 1);
+}
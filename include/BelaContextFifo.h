@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <atomic>
 #include <BelaContextSplitter.h>
 #include <DataFifo.h>
 
@@ -20,10 +21,28 @@ public:
 	 *
 	 * @param context a template of the input contexts that will be sent
 	 * with push()
-	 * @param factor the number of 
+	 * @param factor the number of input contexts that make up one of
+	 * the long contexts.
 	 *
 	 */
 	BelaContext* setup(const BelaContext* context, unsigned int factor);
+	/**
+	 * Initialize the object with several factors that can be switched
+	 * between with requestFactor(). The buffers for all of them are
+	 * allocated here.
+	 *
+	 * @param context a template of the input contexts that will be sent
+	 * with push()
+	 * @param factors the factors that can be used. A factor of 1 means
+	 * that the input contexts are not sent through the fifos, see
+	 * isDirect().
+	 * @param numFactors the number of elements in @p factors, up to
+	 * kMaxFactors.
+	 * @param initialFactor the factor to start with, one of @p factors.
+	 *
+	 * @return the first long context of @p initialFactor, or NULL on error.
+	 */
+	BelaContext* setup(const BelaContext* context, const unsigned int* factors, unsigned int numFactors, unsigned int initialFactor);
 	/**
 	 * Send in a context.
 	 *
@@ -38,12 +57,45 @@ public:
 	 * @return the context, or NULL if no context is ready to be retrieved.
 	 */
 	BelaContext* pop(fifo_id_t fifo, double timeoutMs = 100);
+	/**
+	 * Ask to switch to a different factor. This can be called from any
+	 * thread. The switch happens in push(kToLong) once the current long
+	 * context is complete and all the long contexts sent so far have
+	 * come back: until then, the input contexts are discarded.
+	 *
+	 * @return 0 on success, or an error if @p factor was not passed to
+	 * setup().
+	 */
+	int requestFactor(unsigned int factor);
+	/**
+	 * @return the factor in use.
+	 */
+	unsigned int getFactor() const { return factors[current]; }
+	/**
+	 * @return whether the factor in use is 1, in which case the input
+	 * contexts should be processed directly instead of being sent
+	 * through the fifos.
+	 */
+	bool isDirect() const { return 1 == factors[current] && !draining; }
 	static constexpr unsigned int kNumBuffers = 2;
+	static constexpr unsigned int kMaxFactors = 8;
 	static bool test();
 private:
-	unsigned int getCurrentBuffer(fifo_id_t fifo);
-	std::array<std::array<BelaContextSplitter, kNumBuffers>, kNumFifos> bcss;
+	struct Mode {
+		std::array<std::array<BelaContextSplitter, kNumBuffers>, kNumFifos> bcss;
+		std::array<unsigned int, kNumFifos> counts;
+	};
+	unsigned int getCurrentBuffer(fifo_id_t fifo, unsigned int mode);
+	unsigned int findMode(unsigned int factor);
+	std::array<Mode, kMaxFactors> modes;
+	std::array<unsigned int, kMaxFactors> factors;
 	std::array<DataFifo, kNumFifos> dfs;
-	std::array<unsigned int, kNumFifos> counts;
-	unsigned int factor;
+	unsigned int numFactors = 0;
+	unsigned int shortFrames = 0;
+	// accessed by the thread that calls push(kToLong) and pop(kToShort)
+	std::atomic<unsigned int> current{0};
+	std::atomic<bool> draining{false};
+	unsigned int pushedInLong = 0; // short contexts pushed into the current long context
+	unsigned int outstanding = 0; // short contexts pushed but not popped yet
+	std::atomic<unsigned int> requested{0};
 };
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <Bela.h>
+#include <PRU.h> // InternalBelaContext
+#include <Resampler.h>
+#include <vector>
+
+/**
+ * Run render() at a sample rate other than the one of the hardware.
+ *
+ * The audio and analog inputs of each hardware context are resampled to
+ * the requested rate, and render() is called whenever a whole block of
+ * them is available, which may be zero, one or more times per hardware
+ * block. The outputs of render() are resampled back to the hardware rate.
+ * This allows code written for, e.g.: 48kHz to run unchanged, at the cost
+ * of about one block of each size and one filter length of latency.
+ *
+ * The analog channels keep the ratio of their sample rate to the audio
+ * one, or, with `uniformSampleRate`, are resampled to the audio rate. As
+ * the resampler lowpass filters them first, this is the way to decimate
+ * the analog inputs without aliasing, at the cost of the latency of the
+ * filter. The digital channels and the multiplexer capelet are not
+ * available in the resampled context.
+ */
+class BelaContextResampler {
+public:
+	struct Stats {
+		uint64_t blocks; ///< the number of hardware blocks processed
+		uint64_t underruns; ///< the number of hardware blocks whose outputs were not all ready
+		float lastConversionUs; ///< time spent resampling in the last hardware block, in microseconds
+		float meanConversionUs; ///< mean time spent resampling per hardware block, in microseconds
+		float maxConversionUs; ///< longest time spent resampling in a hardware block, in microseconds
+	};
+	BelaContextResampler() {}
+	/**
+	 * @param context a template of the hardware contexts that will be
+	 * passed to process()
+	 * @param sampleRate the audio sample rate of the resampled context
+	 * @param frames the number of audio frames of the resampled context
+	 * @param uniformSampleRate whether the analog channels of the
+	 * resampled context run at the audio rate. The hardware context
+	 * should then have been set up without a uniform sample rate.
+	 *
+	 * @return the context that will be passed to render(), or NULL on
+	 * error.
+	 */
+	BelaContext* setup(const BelaContext* context, unsigned int sampleRate, unsigned int frames, bool uniformSampleRate = false);
+	/**
+	 * Process a hardware context, calling render() as needed.
+	 */
+	void process(BelaContext* context, void (*render)(BelaContext*, void*), void* userData);
+	/**
+	 * @return the statistics so far.
+	 */
+	Stats getStats() const;
+	/**
+	 * @return the latency added by the resampling, in milliseconds.
+	 */
+	float getLatencyMs() const { return latencyMs; }
+	static bool test();
+private:
+	InternalBelaContext userContext;
+	std::vector<float> audioIn;
+	std::vector<float> audioOut;
+	std::vector<float> analogIn;
+	std::vector<float> analogOut;
+	std::vector<BelaAnalogOutPending> analogOutPending;
+	Resampler audioInResampler;
+	Resampler audioOutResampler;
+	Resampler analogInResampler;
+	Resampler analogOutResampler;
+	float latencyMs = 0;
+	uint64_t blocks = 0;
+	uint64_t underruns = 0;
+	uint64_t conversionNsSum = 0;
+	uint32_t lastConversionNs = 0;
+	uint32_t maxConversionNs = 0;
+};
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <Bela.h>
+#include <stdint.h>
+
+/**
+ * The sizes and interleaving of the buffers in a BelaContext.
+ */
+struct BelaLayoutInfo {
+	uint32_t audioFrames;
+	uint32_t audioInChannels;
+	uint32_t audioOutChannels;
+	uint32_t analogFrames;
+	uint32_t analogInChannels;
+	uint32_t analogOutChannels;
+	uint32_t digitalFrames;
+	uint32_t digitalChannels;
+	uint32_t interleaved;
+	/**
+	 * @return the layout of @p context.
+	 */
+	static BelaLayoutInfo get(const BelaContext* context);
+	bool operator==(const BelaLayoutInfo& other) const;
+	bool operator!=(const BelaLayoutInfo& other) const { return !(*this == other); }
+	/**
+	 * Write the header that `make FIXED_LAYOUT=1` builds the project
+	 * with. The file is left untouched if it already holds this layout,
+	 * so that the project is only rebuilt when the layout changes.
+	 *
+	 * @return 0 if the file was already up to date, 1 if it was
+	 * written, or a negative value on error.
+	 */
+	int writeHeader(const char* path) const;
+	static bool test();
+	static void benchmark();
+};
+
+/**
+ * The layout that the project was built for with `make FIXED_LAYOUT=1`.
+ * It is only defined in that case, and Bela_initAudio() then refuses to
+ * start with a context that does not match it.
+ */
+extern "C" const BelaLayoutInfo Bela_fixedLayout;
+#pragma weak Bela_fixedLayout
+
+/**
+ * Sizes read from the BelaContext at run time.
+ */
+struct BelaRuntimeDims {
+	static unsigned int audioFrames(const BelaContext* context) { return context->audioFrames; }
+	static unsigned int audioInChannels(const BelaContext* context) { return context->audioInChannels; }
+	static unsigned int audioOutChannels(const BelaContext* context) { return context->audioOutChannels; }
+	static unsigned int analogFrames(const BelaContext* context) { return context->analogFrames; }
+	static unsigned int analogInChannels(const BelaContext* context) { return context->analogInChannels; }
+	static unsigned int analogOutChannels(const BelaContext* context) { return context->analogOutChannels; }
+	static unsigned int digitalFrames(const BelaContext* context) { return context->digitalFrames; }
+	static unsigned int digitalChannels(const BelaContext* context) { return context->digitalChannels; }
+	static bool interleaved(const BelaContext* context) { return context->flags & BELA_FLAG_INTERLEAVED; }
+};
+
+/**
+ * Sizes known at compile time. The context is ignored.
+ */
+template <unsigned int kAudioFrames, unsigned int kAudioInChannels, unsigned int kAudioOutChannels,
+	unsigned int kAnalogFrames, unsigned int kAnalogInChannels, unsigned int kAnalogOutChannels,
+	unsigned int kDigitalFrames, unsigned int kDigitalChannels, bool kInterleaved>
+struct BelaFixedDims {
+	static constexpr unsigned int audioFrames(const BelaContext*) { return kAudioFrames; }
+	static constexpr unsigned int audioInChannels(const BelaContext*) { return kAudioInChannels; }
+	static constexpr unsigned int audioOutChannels(const BelaContext*) { return kAudioOutChannels; }
+	static constexpr unsigned int analogFrames(const BelaContext*) { return kAnalogFrames; }
+	static constexpr unsigned int analogInChannels(const BelaContext*) { return kAnalogInChannels; }
+	static constexpr unsigned int analogOutChannels(const BelaContext*) { return kAnalogOutChannels; }
+	static constexpr unsigned int digitalFrames(const BelaContext*) { return kDigitalFrames; }
+	static constexpr unsigned int digitalChannels(const BelaContext*) { return kDigitalChannels; }
+	static constexpr bool interleaved(const BelaContext*) { return kInterleaved; }
+};
+
+/**
+ * \brief Accessors for the buffers of a BelaContext, equivalent to those in
+ * Utilities.h, for either layout above.
+ *
+ * Use BelaLayout in render() for the sizes as well as for the accessors:
+ *
+ *     for(unsigned int n = 0; n < BelaLayout::audioFrames(context); ++n)
+ *         for(unsigned int c = 0; c < BelaLayout::audioOutChannels(context); ++c)
+ *             BelaLayout::audioWrite(context, n, c, BelaLayout::audioRead(context, n, c));
+ *
+ * By default, the sizes are read from the context like in Utilities.h, except
+ * that the interleaving is also taken into account. When the project is built with
+ * `make FIXED_LAYOUT=1`, each run writes the layout of its context into the
+ * project's build folder, and the next build uses it as constants: the loops
+ * above then have constant bounds and strides, which the compiler can unroll
+ * and vectorise. If the project then runs with a different layout, e.g.:
+ * with a different period size, Bela_initAudio() fails and the next build
+ * uses the new layout. Run `make clean` after building without
+ * FIXED_LAYOUT=1 again.
+ */
+template <class Dims>
+struct BelaLayoutT : public Dims {
+	using Dims::audioFrames;
+	using Dims::audioInChannels;
+	using Dims::audioOutChannels;
+	using Dims::analogFrames;
+	using Dims::analogInChannels;
+	using Dims::analogOutChannels;
+	using Dims::interleaved;
+	static float audioRead(const BelaContext* context, unsigned int frame, unsigned int channel)
+	{
+		return context->audioIn[interleaved(context) ? frame * audioInChannels(context) + channel : channel * audioFrames(context) + frame];
+	}
+	static void audioWrite(BelaContext* context, unsigned int frame, unsigned int channel, float value)
+	{
+		context->audioOut[interleaved(context) ? frame * audioOutChannels(context) + channel : channel * audioFrames(context) + frame] = value;
+	}
+	static float analogRead(const BelaContext* context, unsigned int frame, unsigned int channel)
+	{
+		return context->analogIn[interleaved(context) ? frame * analogInChannels(context) + channel : channel * analogFrames(context) + frame];
+	}
+	static void analogWriteOnce(BelaContext* context, unsigned int frame, unsigned int channel, float value)
+	{
+		analogWritePending(context, channel, frame + 1);
+		analogOut(context, frame, channel) = value;
+	}
+	/**
+	 * Write @p value from @p frame to the end of the block, like
+	 * analogWrite() in Utilities.h, which also defers writing the following
+	 * frames.
+	 */
+	static void analogWrite(BelaContext* context, unsigned int frame, unsigned int channel, float value)
+	{
+		if(!context->analogOutPending)
+		{
+			for(unsigned int f = frame; f < analogFrames(context); ++f)
+				analogOut(context, f, channel) = value;
+			return;
+		}
+		if(frame >= analogFrames(context))
+			return;
+		analogWritePending(context, channel, frame);
+		analogOut(context, frame, channel) = value;
+		context->analogOutPending[channel].frame = frame + 1;
+		context->analogOutPending[channel].value = value;
+	}
+	static int digitalRead(const BelaContext* context, unsigned int frame, unsigned int channel)
+	{
+		return getBit(context->digital[frame], channel + 16);
+	}
+private:
+	static float& analogOut(BelaContext* context, unsigned int frame, unsigned int channel)
+	{
+		return context->analogOut[interleaved(context) ? frame * analogOutChannels(context) + channel : channel * analogFrames(context) + frame];
+	}
+};
+
+#ifdef BELA_LAYOUT_AUDIO_FRAMES
+// the header generated by `make FIXED_LAYOUT=1` has been included
+typedef BelaLayoutT<BelaFixedDims<BELA_LAYOUT_AUDIO_FRAMES, BELA_LAYOUT_AUDIO_IN_CHANNELS, BELA_LAYOUT_AUDIO_OUT_CHANNELS,
+	BELA_LAYOUT_ANALOG_FRAMES, BELA_LAYOUT_ANALOG_IN_CHANNELS, BELA_LAYOUT_ANALOG_OUT_CHANNELS,
+	BELA_LAYOUT_DIGITAL_FRAMES, BELA_LAYOUT_DIGITAL_CHANNELS, BELA_LAYOUT_INTERLEAVED>> BelaLayout;
+const BelaLayoutInfo Bela_fixedLayout = {
+	BELA_LAYOUT_AUDIO_FRAMES, BELA_LAYOUT_AUDIO_IN_CHANNELS, BELA_LAYOUT_AUDIO_OUT_CHANNELS,
+	BELA_LAYOUT_ANALOG_FRAMES, BELA_LAYOUT_ANALOG_IN_CHANNELS, BELA_LAYOUT_ANALOG_OUT_CHANNELS,
+	BELA_LAYOUT_DIGITAL_FRAMES, BELA_LAYOUT_DIGITAL_CHANNELS, BELA_LAYOUT_INTERLEAVED,
+};
+#else
+typedef BelaLayoutT<BelaRuntimeDims> BelaLayout;
+#endif
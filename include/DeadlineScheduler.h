@@ -0,0 +1,167 @@
+/***** DeadlineScheduler.h *****/
+#pragma once
+
+#include <Bela.h>
+#ifdef XENOMAI_SKIN_posix
+#include <pthread.h>
+#include <semaphore.h>
+#endif
+#include <atomic>
+#include <vector>
+
+/**
+ * Run jobs on a pool of auxiliary threads, in earliest-deadline-first order.
+ *
+ * A job is submitted from render() together with the audio block by which
+ * its result is needed. Workers always pick the pending job with the
+ * earliest deadline, so that e.g.: an FFT needed in two blocks is not
+ * delayed by a low-priority analysis needed in a second's time.
+ *
+ * render() can check whether a job is done without blocking. A job that
+ * has not completed by its deadline is reported as missed as soon as
+ * tick() reaches the deadline block, even if it is still running:
+ *
+ *     void render(BelaContext* context, void*)
+ *     {
+ *         gScheduler.tick(context);
+ *         if(gJob < 0)
+ *             gJob = gScheduler.submit(computeFft, &gFftData,
+ *                 gScheduler.getCurrentBlock() + 2);
+ *         if(gScheduler.isDone(gJob)) {
+ *             useFft(&gFftData);
+ *             gScheduler.release(gJob);
+ *             gJob = -1;
+ *         }
+ *     }
+ */
+class DeadlineScheduler
+{
+public:
+	typedef enum {
+		kFree, ///< the job slot is not in use
+		kClaimed, ///< the job is being submitted
+		kPending, ///< the job is waiting for a worker
+		kRunning, ///< the job is being executed
+		kDone, ///< the job completed on time
+		kMissed, ///< the job completed after its deadline
+	} JobStatus;
+
+	DeadlineScheduler() {};
+	DeadlineScheduler(unsigned int numWorkers, int priority = BELA_AUDIO_PRIORITY - 5, unsigned int maxJobs = 64);
+	~DeadlineScheduler();
+	/**
+	 * Start the worker threads.
+	 *
+	 * @param numWorkers the number of worker threads
+	 * @param priority the priority of the worker threads. This should be
+	 * lower than \ref BELA_AUDIO_PRIORITY.
+	 * @param maxJobs the maximum number of jobs that can be submitted
+	 * and not yet released at any time.
+	 *
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int setup(unsigned int numWorkers, int priority = BELA_AUDIO_PRIORITY - 5, unsigned int maxJobs = 64);
+	/**
+	 * Stop and join the worker threads. Pending jobs are discarded.
+	 */
+	void cleanup();
+	/**
+	 * Set the CPUs that the worker threads may run on, instead of
+	 * BelaInitSettings::auxiliaryTaskCpus. This can be called before or
+	 * after setup().
+	 *
+	 * @param cpus bitmask of the CPUs, with bit n set for CPU n, or 0 for
+	 * any CPU.
+	 * @return 0 on success, an error number otherwise.
+	 */
+	int setCpus(unsigned int cpus);
+
+	/**
+	 * Advance the current block, and report the jobs whose deadline
+	 * this is and that have not completed. Call this once at the
+	 * beginning of each call to render().
+	 */
+	void tick(BelaContext* context);
+	/**
+	 * Set the current block explicitly. Use this instead of
+	 * tick(BelaContext*) when the scheduler is not driven once per
+	 * render().
+	 */
+	void tick(uint64_t block);
+	/**
+	 * @return the index of the current block, as set by tick().
+	 */
+	uint64_t getCurrentBlock() { return currentBlock.load(std::memory_order_relaxed); }
+	/**
+	 * Submit a job. This is safe to call from the audio thread.
+	 *
+	 * @param function the function to run on a worker thread.
+	 * @param arg the argument passed to @p function
+	 * @param deadlineBlock the index of the block that needs the result
+	 * of the job: the job should complete before tick() is called for
+	 * this block.
+	 *
+	 * @return a handle to the job, or -1 if there are already
+	 * `maxJobs` jobs in use.
+	 */
+	int submit(void (*function)(void*), void* arg, uint64_t deadlineBlock);
+	/**
+	 * @return the status of a job. This does not block.
+	 */
+	JobStatus getStatus(int job);
+	/**
+	 * @return whether a job has completed, regardless of whether it met
+	 * its deadline. This does not block.
+	 */
+	bool isDone(int job);
+	/**
+	 * @return whether a job has missed its deadline, whether or not it
+	 * has completed since. This does not block.
+	 */
+	bool isLate(int job);
+	/**
+	 * Free the slot used by a job that has completed. The handle should
+	 * not be used after this.
+	 *
+	 * @return 0 on success, an error code if the job has not completed.
+	 */
+	int release(int job);
+	/**
+	 * @return the number of jobs that did not complete before their
+	 * deadline, including those that are still pending or running.
+	 */
+	unsigned int getMissedDeadlines() { return missedDeadlines.load(std::memory_order_relaxed); }
+	static bool test();
+private:
+	struct Job {
+		std::atomic<int> status;
+		std::atomic<int> outcome; // decided once, by the worker or by tick()
+		void (*function)(void*);
+		void* arg;
+		uint64_t deadline;
+		uint64_t sequence;
+	};
+	enum {
+		kUndecided,
+		kOnTime,
+		kLate,
+	};
+	bool decide(Job& job, int outcome);
+	int claimEarliest();
+	void workerLoop();
+	static void* workerFunc(void* ptr);
+
+	std::vector<Job> jobs;
+	std::atomic<uint64_t> currentBlock{0};
+	std::atomic<uint64_t> nextSequence{0};
+	std::atomic<unsigned int> missedDeadlines{0};
+	volatile bool shouldStop = false;
+	bool hasCpus = false;
+	unsigned int cpus = 0;
+#ifdef XENOMAI_SKIN_posix
+	std::vector<pthread_t> workers;
+	// counts the pending jobs
+	sem_t sem;
+#endif
+	bool inited = false;
+};
@@ -0,0 +1,136 @@
+/***** DigitalBlock.h *****/
+#pragma once
+
+#include <Bela.h>
+#include <stdint.h>
+
+/**
+ * \brief Read and write the 16 digital channels a block at a time.
+ *
+ * context->digital holds one word per frame, with the direction of each
+ * channel in the low half-word and its value in the high half-word. Going
+ * through it with digitalRead() and digitalWrite() one frame and one
+ * channel at a time spends most of the time on bit manipulation.
+ *
+ * DigitalBlock transposes the block into one bitplane per channel: a
+ * bitmask where bit `n % 32` of word `n / 32` is the value of the channel
+ * at frame `n`. A channel can then be inspected for a whole block with a
+ * few word operations, and its edges are found without looking at every
+ * frame:
+ *
+ *     DigitalBlock gDigital;
+ *
+ *     void render(BelaContext* context, void*)
+ *     {
+ *         gDigital.read(context);
+ *         uint16_t edges[DigitalBlock::kMaxFrames];
+ *         unsigned int numEdges = gDigital.getEdges(0, edges, DigitalBlock::kMaxFrames);
+ *         for(unsigned int n = 0; n < numEdges; ++n)
+ *             gCount += gDigital.getValue(0, edges[n]); // count rising edges
+ *         // copy channel 0 to channel 1, a block at a time
+ *         gDigital.setPlane(1, gDigital.getPlane(0));
+ *         gDigital.write(context);
+ *     }
+ *
+ * The transposition is done 8 frames at a time, with an 8x8 bit matrix
+ * transpose for each half of the value half-word, using NEON on ARM and
+ * SSE2 on x86.
+ */
+class DigitalBlock
+{
+public:
+	static constexpr unsigned int kNumChannels = 16;
+	static constexpr unsigned int kMaxFrames = 256;
+	static constexpr unsigned int kWords = kMaxFrames / 32;
+	typedef uint32_t Plane[kWords];
+
+	/**
+	 * Transpose the values of a block to bitplanes and find their edges.
+	 * The edges at the start of the block are found by comparing to the
+	 * last frame of the previous call to read().
+	 */
+	void read(BelaContext* context) { read(context->digital, context->digitalFrames); }
+	/**
+	 * @param digital the digital words, as in context->digital
+	 * @param frames the number of frames. Only the first kMaxFrames are
+	 * used.
+	 */
+	void read(const uint32_t* digital, unsigned int frames);
+	/**
+	 * @return the values of a channel in the last block passed to
+	 * read(). This includes the values of the channels set as output.
+	 */
+	const uint32_t* getPlane(unsigned int channel) const { return planes[channel]; }
+	/**
+	 * @return a bitplane that has a bit set for each frame where the value
+	 * of the channel is different from the previous frame.
+	 */
+	const uint32_t* getEdgePlane(unsigned int channel) const { return edgePlanes[channel]; }
+	/**
+	 * @return the value of a channel at a frame of the last block.
+	 */
+	bool getValue(unsigned int channel, unsigned int frame) const
+	{
+		return (planes[channel][frame / 32] >> (frame % 32)) & 1;
+	}
+	/**
+	 * Get the frames where a channel changed value.
+	 *
+	 * @param channel the channel
+	 * @param frames filled with the frames of the edges, in order. Use
+	 * getValue() to know whether an edge is rising or falling.
+	 * @param maxEdges the size of @p frames
+	 *
+	 * @return the number of edges written to @p frames.
+	 */
+	unsigned int getEdges(unsigned int channel, uint16_t* frames, unsigned int maxEdges) const;
+	/**
+	 * @return a bitmask of the channels that have at least one edge in
+	 * the last block.
+	 */
+	uint16_t getChangedChannels() const { return changedChannels; }
+	/**
+	 * @return the values of all channels at the last frame of the last
+	 * block, one bit per channel.
+	 */
+	uint16_t getLastValues() const { return lastValues; }
+
+	/**
+	 * Replace the output values of a channel for the current block.
+	 * They are written by the next call to write().
+	 */
+	void setPlane(unsigned int channel, const uint32_t* plane);
+	/**
+	 * Set the output value of a channel for the given frame and all the
+	 * following frames in the block, as digitalWrite(). The earlier frames
+	 * keep the values passed to read().
+	 */
+	void setOutput(unsigned int channel, unsigned int frame, bool value);
+	/**
+	 * Write the channels set by setPlane() or setOutput() since the last
+	 * call to write(). Only their values are changed: their direction and
+	 * the other channels are left as they are.
+	 */
+	void write(BelaContext* context) { write(context->digital, context->digitalFrames); }
+	void write(uint32_t* digital, unsigned int frames);
+
+	/**
+	 * Transpose the values in @p digital to one bitplane per channel.
+	 */
+	static void toPlanes(const uint32_t* digital, unsigned int frames, Plane* planes);
+	/**
+	 * Replace the values of the channels in the bitmask @p channels in
+	 * @p digital with those in their bitplanes.
+	 */
+	static void fromPlanes(uint32_t* digital, unsigned int frames, const Plane* planes, uint16_t channels);
+	static bool test();
+private:
+	Plane planes[kNumChannels];
+	Plane edgePlanes[kNumChannels];
+	Plane outputPlanes[kNumChannels];
+	unsigned int frames = 0;
+	uint16_t changedChannels = 0;
+	uint16_t lastValues = 0;
+	bool hasLastValues = false;
+	uint16_t outputChannels = 0;
+};
@@ -0,0 +1,122 @@
+/***** DigitalEdgeCapture.h *****/
+#pragma once
+
+#include <Bela.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+/**
+ * \brief Timestamp the edges on a set of digital channels.
+ *
+ * Looking for transitions with digitalRead() costs a read for every frame
+ * of every block on every pin being watched. Here the packed words in
+ * context->digital are XORed with the previous frame, so that all the
+ * subscribed channels are checked at once with one word operation per
+ * frame, and only the frames that actually have an edge are looked at
+ * more closely.
+ *
+ * Each edge is stored with the absolute frame at which it happened in a
+ * lock-free queue. There must be only one producer thread (the one calling
+ * process(), normally the audio thread) and one consumer thread (the one
+ * calling pop()), which can be the same:
+ *
+ *     DigitalEdgeCapture gCapture;
+ *
+ *     bool setup(BelaContext* context, void*)
+ *     {
+ *         pinMode(context, 0, 0, INPUT);
+ *         pinMode(context, 0, 1, INPUT);
+ *         return 0 == gCapture.setup((1 << 0) | (1 << 1), 64);
+ *     }
+ *
+ *     void render(BelaContext* context, void*)
+ *     {
+ *         gCapture.process(context);
+ *         DigitalEdgeCapture::Edge edge;
+ *         while(gCapture.pop(edge))
+ *             handleEdge(edge.channel, edge.rising, edge.frame);
+ *     }
+ */
+class DigitalEdgeCapture
+{
+public:
+	static constexpr unsigned int kNumChannels = 16;
+	struct Edge {
+		uint64_t frame; ///< the absolute frame of the first sample with the new value
+		unsigned int channel; ///< the digital channel
+		bool rising; ///< whether the new value is high
+	};
+	DigitalEdgeCapture() {}
+	DigitalEdgeCapture(uint16_t channels, unsigned int capacity) { setup(channels, capacity); }
+	/**
+	 * Allocate the queue.
+	 *
+	 * This allocates memory, so it should not be called from the audio
+	 * thread.
+	 *
+	 * @param channels bitmask of the channels to watch.
+	 * @param capacity the number of edges that can be waiting in the
+	 * queue. This is rounded up to a power of 2.
+	 *
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int setup(uint16_t channels, unsigned int capacity);
+	/**
+	 * Change the channels being watched. This is safe to call from the
+	 * producer thread.
+	 */
+	void setChannels(uint16_t channels) { this->channels = channels; }
+	uint16_t getChannels() const { return channels; }
+	/**
+	 * Find the edges in the current block and add them to the queue.
+	 * The first frame of the block is compared to the last frame of the
+	 * block passed to the previous call. On the first call, there is no
+	 * edge on the first frame.
+	 *
+	 * @return the number of edges found.
+	 */
+	unsigned int process(BelaContext* context)
+	{
+		return process(context->digital, context->digitalFrames, context->audioFramesElapsed);
+	}
+	/**
+	 * @param digital the digital words, as in context->digital
+	 * @param frames the number of frames
+	 * @param framesElapsed the absolute frame of `digital[0]`.
+	 */
+	unsigned int process(const uint32_t* digital, unsigned int frames, uint64_t framesElapsed);
+	/**
+	 * Get the oldest edge in the queue. This is safe to call from the
+	 * audio thread.
+	 *
+	 * @return whether there was an edge in the queue.
+	 */
+	bool pop(Edge& edge);
+	/**
+	 * @return the number of edges in the queue.
+	 */
+	unsigned int getAvailable() const;
+	/**
+	 * @return the number of edges that have been discarded because the
+	 * queue was full.
+	 */
+	unsigned int getDropped() const { return dropped.load(std::memory_order_relaxed); }
+	/**
+	 * @return the values of all the channels at the last frame passed to
+	 * process(), one bit per channel.
+	 */
+	uint16_t getLastValues() const { return lastWord >> 16; }
+	static bool test();
+private:
+	std::vector<Edge> edges;
+	unsigned int mask = 0;
+	// these are never wrapped around explicitly: unsigned overflow
+	// is harmless as the size of the queue is a power of 2
+	std::atomic<unsigned int> writeIdx{0};
+	std::atomic<unsigned int> readIdx{0};
+	std::atomic<unsigned int> dropped{0};
+	uint32_t lastWord = 0;
+	bool hasLastWord = false;
+	uint16_t channels = 0;
+};
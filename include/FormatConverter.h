@@ -0,0 +1,129 @@
+/***** FormatConverter.h *****/
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * Convert samples between the buffers exchanged with the PRU and the float
+ * buffers in BelaContext.
+ *
+ * The PRU always uses interleaved 16-bit samples, with `hardwareFrames`
+ * analog frames per block. The context buffers can be interleaved or not,
+ * and, when using a uniform sample rate, have twice as many, or half as
+ * many analog frames as the hardware.
+ *
+ * The audio expander highpass and the multiplexer capelet demultiplexing
+ * can be applied to the analog inputs in the same pass as the conversion.
+ *
+ * A conversion function for each combination of layout, analog rate ratio,
+ * Salt inversion and common channel counts is generated at compile time.
+ * setup() picks the ones in use, so that the audio thread does not branch
+ * on them. The sample conversion is vectorised with NEON on ARM and SSE2 on
+ * x86, and gives the same results as the plain scalar conversion.
+ */
+class FormatConverter
+{
+public:
+	typedef enum {
+		kAnalogUpsample, ///< two context frames for each hardware frame (analogs_per_audio 0.5)
+		kAnalogSame, ///< one context frame for each hardware frame
+		kAnalogDownsample, ///< one context frame every two hardware frames (analogs_per_audio 2)
+	} AnalogRatio;
+
+	/**
+	 * Further processing of the analog inputs, applied in the same pass
+	 * as the conversion.
+	 */
+	struct AnalogInStages {
+		/// bitmask of the channels that go through the audio expander
+		/// highpass. The output of the filter is scaled by 2.
+		uint32_t expanderChannels = 0;
+		/// coefficient of the audio expander highpass
+		float expanderCoeff = 0;
+		/// the previous input and output of the highpass, one per
+		/// channel. They are updated for the enabled channels.
+		float* expanderInputHistory = nullptr;
+		float* expanderOutputHistory = nullptr;
+		/// if not NULL, the last `muxChannels` hardware frames are
+		/// written here, indexed by their multiplexer channel. These
+		/// values are scaled, but not inverted or filtered.
+		float* muxAnalogIn = nullptr;
+		unsigned int muxChannels = 0;
+		/// the multiplexer channel of the last hardware frame
+		unsigned int muxLastChannel = 0;
+	};
+
+	/**
+	 * Select the conversion functions.
+	 *
+	 * @param interleaved whether the context buffers are interleaved
+	 * @param audioInChannels number of audio input channels
+	 * @param audioOutChannels number of audio output channels
+	 * @param analogInChannels number of analog input channels
+	 * @param analogOutChannels number of analog output channels
+	 * @param analogRatio how the context analog frames relate to the
+	 * hardware analog frames.
+	 * @param invertAnalog whether the analog inputs and outputs are
+	 * inverted in hardware, as on Salt. The outputs are also scaled by
+	 * 0.93 to avoid a headroom problem with a sagging 5V USB supply.
+	 *
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int setup(bool interleaved, unsigned int audioInChannels, unsigned int audioOutChannels, unsigned int analogInChannels, unsigned int analogOutChannels, AnalogRatio analogRatio, bool invertAnalog);
+	/**
+	 * Convert `frames` frames of audio input, scaling them to -1 to 1.
+	 */
+	void audioIn(float* dst, const int16_t* src, unsigned int frames)
+	{
+		audioInFunction(dst, src, frames, audioInChannels, nullptr);
+	}
+	/**
+	 * Convert `frames` frames of audio output, clipping them to the
+	 * range of the DAC.
+	 */
+	void audioOut(int16_t* dst, const float* src, unsigned int frames)
+	{
+		audioOutFunction(dst, src, frames, audioOutChannels);
+	}
+	/**
+	 * Convert `hardwareFrames` frames of analog input, scaling them to 0
+	 * to 1.
+	 */
+	void analogIn(float* dst, const uint16_t* src, unsigned int hardwareFrames)
+	{
+		analogInFunction(dst, src, hardwareFrames, analogInChannels, nullptr);
+	}
+	/**
+	 * Convert `hardwareFrames` frames of analog input and apply @p stages
+	 * to them.
+	 */
+	void analogIn(float* dst, const uint16_t* src, unsigned int hardwareFrames, const AnalogInStages& stages)
+	{
+		analogInStagesFunction(dst, src, hardwareFrames, analogInChannels, &stages);
+	}
+	/**
+	 * Convert `hardwareFrames` frames of analog output, clipping them to
+	 * the range of the DAC.
+	 */
+	void analogOut(uint16_t* dst, const float* src, unsigned int hardwareFrames)
+	{
+		analogOutFunction(dst, src, hardwareFrames, analogOutChannels);
+	}
+	static bool test();
+	/**
+	 * Time the analog input conversion with the audio expander and
+	 * multiplexer stages, fused and as separate passes, and print the
+	 * results.
+	 */
+	static void benchmark();
+private:
+	void (*audioInFunction)(float*, const int16_t*, unsigned int, unsigned int, const AnalogInStages*) = nullptr;
+	void (*audioOutFunction)(int16_t*, const float*, unsigned int, unsigned int) = nullptr;
+	void (*analogInFunction)(float*, const uint16_t*, unsigned int, unsigned int, const AnalogInStages*) = nullptr;
+	void (*analogInStagesFunction)(float*, const uint16_t*, unsigned int, unsigned int, const AnalogInStages*) = nullptr;
+	void (*analogOutFunction)(uint16_t*, const float*, unsigned int, unsigned int) = nullptr;
+	unsigned int audioInChannels = 0;
+	unsigned int audioOutChannels = 0;
+	unsigned int analogInChannels = 0;
+	unsigned int analogOutChannels = 0;
+};
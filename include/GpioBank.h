@@ -0,0 +1,103 @@
+/***** GpioBank.h *****/
+#pragma once
+
+#include <stdint.h>
+#include "Gpio.h"
+
+/**
+ * Access several pins of a bank of 32 GPIO pins through its memory-mapped
+ * registers.
+ *
+ * As with Gpio, the pins are exported and their direction is set through
+ * sysfs when the bank is opened, so that the kernel keeps ownership of the
+ * pin configuration and of the clock of the bank. After that, reading and
+ * writing the pins is a single register access, and it applies to any
+ * number of pins of the bank at once:
+ *
+ *     GpioBank bank;
+ *     bank.open(1, (1 << 12) | (1 << 13), 1 << 14); // 12 and 13 outputs, 14 input
+ *     bank.set((1 << 12) | (1 << 13));
+ *     bank.clear(1 << 12);
+ *     bool pin14 = bank.read() & (1 << 14);
+ *
+ * Setting and clearing outputs goes through the SETDATAOUT and CLEARDATAOUT
+ * registers, so it is atomic with respect to other users of the bank, the
+ * PRU included. The direction registers are never written through the
+ * mapping.
+ *
+ * The bank can also be backed by a simulated register file, so that code
+ * using it can be tested away from the board.
+ */
+class GpioBank
+{
+public:
+	static constexpr unsigned int kNumBanks = 4;
+	static constexpr unsigned int kPinsPerBank = 32;
+
+	GpioBank() {}
+	~GpioBank() { close(); }
+	/**
+	 * Export the pins and set their direction through sysfs, then map
+	 * the registers of the bank.
+	 *
+	 * @param bank the bank, between 0 and kNumBanks - 1: pin `n` is
+	 * in bank `n / kPinsPerBank`.
+	 * @param outputs the pins of the bank to use as outputs.
+	 * @param inputs the pins of the bank to use as inputs.
+	 * @param unexport whether to unexport on close() the pins that were
+	 * exported here. Pins that were already exported are left alone.
+	 *
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int open(unsigned int bank, uint32_t outputs, uint32_t inputs, bool unexport = true);
+	/**
+	 * Use a simulated register file instead of the hardware. The pins in
+	 * `outputs` start as outputs, reading low, all the others as inputs.
+	 */
+	int openSimulated(unsigned int bank, uint32_t outputs);
+	void close();
+	bool isOpen() const { return gpio; }
+	/**
+	 * @return the level of all the pins of the bank.
+	 */
+	uint32_t read() const { return gpio[GPIO_DATAIN]; }
+	/**
+	 * @return the values written to the outputs.
+	 */
+	uint32_t getOutputValues() const { return gpio[GPIO_DATAOUT]; }
+	/**
+	 * Set the outputs in `mask` high.
+	 */
+	void set(uint32_t mask) { writeRegister(GPIO_SETDATAOUT, mask); }
+	/**
+	 * Set the outputs in `mask` low.
+	 */
+	void clear(uint32_t mask) { writeRegister(GPIO_CLEARDATAOUT, mask); }
+	/**
+	 * Set the outputs in `mask` to the corresponding bits of `values`.
+	 */
+	void write(uint32_t mask, uint32_t values)
+	{
+		set(mask & values);
+		clear(mask & ~values);
+	}
+	/**
+	 * Set the external level of the inputs of a simulated bank.
+	 */
+	void setSimulatedInputs(uint32_t values);
+	static bool test();
+private:
+	void writeRegister(unsigned int reg, uint32_t value)
+	{
+		gpio[reg] = value;
+		if(simulated)
+			simulate();
+	}
+	void simulate();
+	volatile uint32_t* gpio = nullptr;
+	unsigned int bank = 0;
+	uint32_t exported = 0;
+	bool simulated = false;
+	uint32_t simulatedRegisters[GPIO_SIZE / 4];
+	uint32_t simulatedInputs;
+};
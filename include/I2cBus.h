@@ -0,0 +1,109 @@
+/***** I2cBus.h *****/
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+
+/**
+ * An I2C bus that can run combined transactions: several messages, to one
+ * or more devices, separated by repeated starts instead of stop
+ * conditions. Writing a register address and reading back from it is then
+ * a single transfer, without the sleep that is otherwise needed for the
+ * device to see the write before the read.
+ */
+class I2cBus
+{
+public:
+	struct Message {
+		uint16_t address; ///< 7-bit address of the device
+		bool read; ///< whether data is read from the device or written to it
+		uint16_t length; ///< the number of bytes in `data`
+		uint8_t* data;
+	};
+	static constexpr unsigned int kMaxMessages = 8;
+	virtual ~I2cBus() {}
+	/**
+	 * Run @p messages as one combined transaction.
+	 *
+	 * @param messages the messages
+	 * @param count the number of messages, up to kMaxMessages
+	 *
+	 * @return 0 on success, an error code otherwise.
+	 */
+	virtual int transfer(Message* messages, unsigned int count) = 0;
+};
+
+/**
+ * A bus from the kernel I2C driver, on which transfers use the I2C_RDWR
+ * ioctl.
+ */
+class I2cDevBus : public I2cBus
+{
+public:
+	I2cDevBus() {}
+	I2cDevBus(unsigned int bus) { open(bus); }
+	~I2cDevBus() { close(); }
+	/**
+	 * Open /dev/i2c-`bus`.
+	 *
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int open(unsigned int bus);
+	void close();
+	int transfer(Message* messages, unsigned int count) override;
+private:
+	int fd = -1;
+};
+
+/**
+ * A bus that simulates register-based devices, for testing without
+ * hardware.
+ *
+ * Each device has 256 8-bit registers and a register pointer. A write
+ * message sets the pointer to its first byte and writes any following
+ * bytes to consecutive registers. A read message returns consecutive
+ * registers starting from the pointer. This is how Trill, MPR121 and most
+ * I2C sensors behave.
+ */
+class FakeI2cBus : public I2cBus
+{
+public:
+	/**
+	 * Add a device. This should be done before the bus is in use.
+	 */
+	void addDevice(uint16_t address);
+	/**
+	 * Change the registers of a device, as the device itself would. This
+	 * is safe to call while a transfer is in progress.
+	 *
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int setRegisters(uint16_t address, uint8_t firstRegister, const uint8_t* data, unsigned int length);
+	/**
+	 * Read the registers of a device, without changing its pointer.
+	 *
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int getRegisters(uint16_t address, uint8_t firstRegister, uint8_t* data, unsigned int length);
+	/**
+	 * Make each transfer take at least this long, as a real bus would.
+	 */
+	void setTransferTime(unsigned int us) { transferTimeUs = us; }
+	/**
+	 * @return the number of transfers so far.
+	 */
+	unsigned int getTransfers() { return transfers; }
+	int transfer(Message* messages, unsigned int count) override;
+private:
+	struct Device {
+		uint16_t address;
+		uint8_t pointer;
+		uint8_t registers[256];
+	};
+	Device* findDevice(uint16_t address);
+	std::vector<Device> devices;
+	std::mutex mutex;
+	unsigned int transferTimeUs = 0;
+	unsigned int transfers = 0;
+};
@@ -0,0 +1,202 @@
+/***** I2cScheduler.h *****/
+#pragma once
+
+#include <Bela.h>
+#include <I2cBus.h>
+#ifdef XENOMAI_SKIN_posix
+#include <pthread.h>
+#endif
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Poll several I2C devices on one bus from a single thread.
+ *
+ * Each device is read at its own rate, with one combined transaction per
+ * read, in round-robin order when more than one is due. The latest data
+ * of each device is published to the audio thread through a lock-free
+ * triple buffer, so render() never waits on the bus and always sees a
+ * complete snapshot:
+ *
+ *     I2cDevBus gBus;
+ *     I2cScheduler gScheduler;
+ *     Trill gTrills[4];
+ *     int gIds[4];
+ *
+ *     bool setup(BelaContext* context, void*)
+ *     {
+ *         gBus.open(1);
+ *         gScheduler.setup(&gBus);
+ *         for(unsigned int n = 0; n < 4; ++n) {
+ *             gTrills[n].setup(1, 0x30 + n, Trill::NORMAL);
+ *             gIds[n] = gScheduler.addDevice(&gTrills[n], 200);
+ *         }
+ *         return 0 == gScheduler.start();
+ *     }
+ *
+ *     void render(BelaContext* context, void*)
+ *     {
+ *         for(unsigned int n = 0; n < 4; ++n) {
+ *             bool isNew;
+ *             const uint8_t* snapshot = gScheduler.getSnapshot(gIds[n], &isNew);
+ *             if(isNew)
+ *                 gTrills[n].readSnapshot(snapshot);
+ *         }
+ *         ...
+ *     }
+ */
+class I2cScheduler
+{
+public:
+	/**
+	 * A device that can be polled by the scheduler.
+	 */
+	class Device
+	{
+	public:
+		virtual ~Device() {}
+		/**
+		 * @return the maximum size of a snapshot, in bytes.
+		 */
+		virtual unsigned int getSnapshotSize() = 0;
+		/**
+		 * Read the device. This is called from the scheduler
+		 * thread, and should use a single transfer.
+		 *
+		 * @param bus the bus
+		 * @param snapshot where to store the data read, of
+		 * getSnapshotSize() bytes.
+		 *
+		 * @return 0 on success, an error code otherwise.
+		 */
+		virtual int poll(I2cBus& bus, uint8_t* snapshot) = 0;
+	};
+
+	struct Stats {
+		uint64_t polls; ///< the number of successful polls
+		uint64_t errors; ///< the number of failed polls
+		float lastLatency; ///< duration of the last poll, in microseconds
+		float meanLatency; ///< mean duration of a poll, in microseconds
+		float maxLatency; ///< maximum duration of a poll, in microseconds
+		float maxLateness; ///< maximum delay of the start of a poll from when it was due, in microseconds
+	};
+
+	I2cScheduler() {}
+	~I2cScheduler();
+	/**
+	 * @param bus the bus the devices are on. It is only used from the
+	 * scheduler thread once start() is called.
+	 * @param name the name of the scheduler thread
+	 * @param priority the priority of the scheduler thread. This should
+	 * be lower than \ref BELA_AUDIO_PRIORITY.
+	 *
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int setup(I2cBus* bus, const std::string& name = "bela-i2c", int priority = 50);
+	/**
+	 * Add a device to poll. This allocates memory, so it should not be
+	 * called from the audio thread, nor once the scheduler is started.
+	 *
+	 * @param device the device. It must not be destroyed before the
+	 * scheduler is stopped.
+	 * @param rate how many times per second the device should be polled.
+	 *
+	 * @return an id for the device, or a negative error code.
+	 */
+	int addDevice(Device* device, float rate);
+	/**
+	 * Start the scheduler thread.
+	 *
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int start();
+	/**
+	 * Stop and join the scheduler thread.
+	 */
+	void cleanup();
+	/**
+	 * Set the CPUs that the scheduler thread may run on, instead of
+	 * BelaInitSettings::auxiliaryTaskCpus. This can be called before or
+	 * after start().
+	 *
+	 * @param cpus bitmask of the CPUs, with bit n set for CPU n, or 0 for
+	 * any CPU.
+	 * @return 0 on success, an error number otherwise.
+	 */
+	int setCpus(unsigned int cpus);
+
+	/**
+	 * Get the latest snapshot of a device. This is safe to call from the
+	 * audio thread. There must be only one thread calling this for a
+	 * given device.
+	 *
+	 * @param id the device id returned by addDevice().
+	 * @param isNew if not NULL, this is set to whether the snapshot is
+	 * more recent than the one returned by the previous call.
+	 *
+	 * @return the snapshot, which stays valid until the next call for
+	 * the same device. Before the first successful poll, it is filled
+	 * with zeros.
+	 */
+	const uint8_t* getSnapshot(int id, bool* isNew = nullptr);
+	/**
+	 * @return the statistics of a device. This is safe to call from any
+	 * thread.
+	 */
+	Stats getStats(int id);
+	static bool test();
+private:
+	// The three buffers of a device are in turn being written by the
+	// scheduler ("back"), read by the audio thread ("front") and waiting
+	// to be picked up ("middle"). Buffers are only ever exchanged with
+	// the middle one, atomically.
+	struct Slot {
+		Device* device;
+		unsigned int size;
+		std::vector<uint8_t> buffers;
+		unsigned int back;
+		unsigned int front;
+		std::atomic<unsigned int> middle;
+		uint64_t period;
+		uint64_t due;
+		std::atomic<uint64_t> polls;
+		std::atomic<uint64_t> errors;
+		std::atomic<uint64_t> latencySum;
+		std::atomic<uint64_t> lastLatency;
+		std::atomic<uint64_t> maxLatency;
+		std::atomic<uint64_t> maxLateness;
+	};
+	static void* loop(void* arg);
+	void pollNext();
+	std::vector<std::unique_ptr<Slot>> slots;
+	I2cBus* bus = nullptr;
+	std::string name;
+	int priority = 0;
+	bool hasCpus = false;
+	unsigned int cpus = 0;
+#ifdef XENOMAI_SKIN_posix
+	pthread_t thread;
+#endif
+	bool running = false;
+	std::atomic<bool> shouldStop{false};
+};
+
+/**
+ * A device read by writing the address of its first register and then
+ * reading a number of consecutive registers, e.g.: the touch status and
+ * filtered data of an MPR121.
+ */
+class I2cRegisterDevice : public I2cScheduler::Device
+{
+public:
+	I2cRegisterDevice(uint16_t address, uint8_t firstRegister, unsigned int length) :
+		address(address), firstRegister(firstRegister), length(length) {}
+	unsigned int getSnapshotSize() override { return length; }
+	int poll(I2cBus& bus, uint8_t* snapshot) override;
+private:
+	uint16_t address;
+	uint8_t firstRegister;
+	unsigned int length;
+};
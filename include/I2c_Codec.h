@@ -62,12 +62,23 @@ public:
 	~I2c_Codec();
 
 private:
+	// Queues the register writes made while it is in scope, so that
+	// they are sent in as few transfers as possible. They are only sent
+	// by flush().
+	class WriteQueue;
+	int flushWrites();
+	void waitForReset();
 	int configureDCRemovalIIR(); //called by startAudio()
 	int dacVolumeHalfDbs;
 	int adcVolumeHalfDbs;
 	int hpVolumeHalfDbs;
 	bool running;
 	bool verbose;
+	static constexpr unsigned int kMaxQueuedWrites = 32;
+	unsigned char queuedWrites[kMaxQueuedWrites][2];
+	unsigned int numQueuedWrites;
+	bool queueWrites;
+	unsigned long long resetDoneNs; // when the codec will be ready after a reset
 };
 
 
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Statistics of the scheduling latency of a thread: how long after the
+ * event that should wake it up it actually starts running, or how much the
+ * interval between its wakeups deviates from the expected one.
+ *
+ * add() is real-time safe. It is meant to be called from a single thread,
+ * with the other methods called once that thread has stopped.
+ */
+class LatencyStats {
+public:
+	LatencyStats() { reset(); }
+	void reset();
+	/**
+	 * Add a measurement, in nanoseconds. It can be negative for a
+	 * deviation from an expected interval.
+	 */
+	void add(int64_t ns);
+	uint64_t getCount() const { return count; }
+	double getMinUs() const;
+	double getMaxUs() const;
+	double getMeanUs() const;
+	/**
+	 * @return the standard deviation of the measurements, in microseconds.
+	 */
+	double getJitterUs() const;
+	/**
+	 * Print the header of the table that print() adds a row to.
+	 */
+	static void printHeader(FILE* file);
+	/**
+	 * Print a row with the statistics, under printHeader().
+	 */
+	void print(FILE* file, const char* name) const;
+	static bool test();
+private:
+	uint64_t count;
+	int64_t min;
+	int64_t max;
+	double sum;
+	double sumSquares;
+};
@@ -11,7 +11,9 @@
 #include <stdint.h>
 #include "Bela.h"
 #include "Gpio.h"
+#include "GpioBank.h"
 #include "AudioCodec.h"
+#include "FormatConverter.h"
 
 /**
  * Internal version of the BelaContext struct which does not have const
@@ -140,6 +142,8 @@ typedef struct {
 
 	/// Name of running project.
 	char projectName[MAX_PROJECTNAME_LENGTH];
+
+	BelaAnalogOutPending* analogOutPending;
 	operator BelaContext () {return *(BelaContext*)this;}
 } InternalBelaContext;
 
@@ -210,9 +214,11 @@ private:
 	float audio_expander_filter_coeff;
 	bool pruUsesMcaspIrq;
 	BelaHw belaHw;
+	FormatConverter formatConverter; // Conversion between the PRU and the context buffers
 
 	Gpio belaCapeButton; // Monitoring the bela cape button
 	Gpio underrunLed; // Flashing an LED upon underrun
+	GpioBank gpioBanks[GpioBank::kNumBanks]; // The GPIO pins used by the PRU
 	AudioCodec *codec; // Required to hard reset audio codec from loop
 };
 
@@ -0,0 +1,91 @@
+/***** Resampler.h *****/
+#pragma once
+
+#include <vector>
+
+/**
+ * Convert a multichannel stream between two sample rates with a
+ * polyphase windowed-sinc filter.
+ *
+ * The ratio between the rates is reduced to L/M: conceptually the input
+ * is upsampled by L, lowpass filtered and decimated by M, but only the
+ * filter phase needed for each output sample is computed. The filter
+ * cuts off below the lower of the two Nyquist frequencies, so that this
+ * works for interpolation as well as for decimation.
+ *
+ * The resampler is a stream: frames are written in as they come and read
+ * out once enough input is available to compute them, so that the number
+ * of frames in and out of each block need not be in the ratio of the
+ * rates:
+ *
+ *     Resampler resampler;
+ *     resampler.setup(2, 44100, 48000, 128);
+ *     ...
+ *     resampler.write(in, 128, 2, 1); // interleaved
+ *     while(resampler.getAvailable() >= 64)
+ *         resampler.read(out, 64, 1, 64); // non-interleaved
+ *
+ * The inner products are vectorised with NEON on ARM and SSE2 on x86.
+ * write() and read() do not allocate memory, so they can be called from
+ * the audio thread.
+ */
+class Resampler
+{
+public:
+	Resampler() {}
+	/**
+	 * @param channels the number of channels
+	 * @param inRate the sample rate of the input
+	 * @param outRate the sample rate of the output
+	 * @param maxInputFrames the most frames that will be written without
+	 * reading the outputs they make available.
+	 * @param taps the length of the filter, in samples of the lower of
+	 * the two rates. Longer filters have a sharper cutoff, a longer delay
+	 * and a higher cost.
+	 *
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int setup(unsigned int channels, unsigned int inRate, unsigned int outRate, unsigned int maxInputFrames, unsigned int taps = 32);
+	/**
+	 * Forget the input received so far.
+	 */
+	void reset();
+	/**
+	 * Write input frames. Sample `c` of frame `n` is at
+	 * `in[n * frameStride + c * channelStride]`.
+	 *
+	 * @return the number of frames written, which is less than `frames`
+	 * if more than `maxInputFrames` are pending.
+	 */
+	unsigned int write(const float* in, unsigned int frames, unsigned int frameStride, unsigned int channelStride);
+	/**
+	 * @return the number of output frames that can be read.
+	 */
+	unsigned int getAvailable() const;
+	/**
+	 * Read output frames. Sample `c` of frame `n` is written to
+	 * `out[n * frameStride + c * channelStride]`.
+	 *
+	 * @return the number of frames read, which is less than `frames` if
+	 * not enough input is available.
+	 */
+	unsigned int read(float* out, unsigned int frames, unsigned int frameStride, unsigned int channelStride);
+	/**
+	 * @return the delay of the filter, in input frames.
+	 */
+	float getDelay() const { return (taps * L - 1) * 0.5f / L; }
+	unsigned int getL() const { return L; }
+	unsigned int getM() const { return M; }
+	static bool test();
+private:
+	std::vector<float> coefficients; // L phases of `taps` coefficients, oldest input first
+	std::vector<float> buffer; // `capacity` input samples per channel
+	unsigned int channels = 0;
+	unsigned int L = 1;
+	unsigned int M = 1;
+	unsigned int taps = 0;
+	unsigned int capacity = 0;
+	unsigned int end = 0; // one past the newest input sample in the buffer
+	unsigned int pos = 0; // the newest input sample used by the next output
+	unsigned int phase = 0; // the filter phase of the next output
+};
@@ -142,6 +142,12 @@ static inline float analogReadNI(BelaContext *context, int frame, int channel);
  * The value written will persist for all future frames if BELA_FLAG_ANALOG_OUTPUTS_PERSIST
  * is set in context->flags. This is the default behaviour.
  *
+ * Only the frame specified is written straight away: the following frames are
+ * written by the next call to analogWrite() or analogWriteOnce() on the same
+ * channel, or once render() returns. Calling it for every frame therefore
+ * costs the same as calling analogWriteOnce(). Call analogWriteFlush() before
+ * reading back context->analogOut or writing to it directly.
+ *
  * \param context The I/O data structure which is passed by Bela to render().
  * \param frame Which frame (i.e. what time) to write the analog output. Valid values range
  * from 0 to (context->analogFrames - 1).
@@ -182,6 +188,17 @@ static inline void analogWriteOnce(BelaContext *context, int frame, int channel,
  */
 static inline void analogWriteOnceNI(BelaContext *context, int frame, int channel, float value);
 
+/**
+ * \brief Write the values set with analogWrite() to the rest of the block.
+ *
+ * Bela calls this once render() returns, so this is only needed before
+ * reading context->analogOut, or writing to it without using the functions
+ * above, on channels written with analogWrite() in the same block.
+ *
+ * \param context The I/O data structure which is passed by Bela to render().
+ */
+static inline void analogWriteFlush(BelaContext *context);
+
 /**
  * \brief Read a digital input, specifying the frame number (when to read) and the pin.
  *
@@ -417,33 +434,94 @@ static inline float analogReadNI(BelaContext *context, int frame, int channel) {
 	return context->analogIn[channel * context->analogFrames + frame];
 }
 
+// analogWritePending()
+//
+// Writes the value last set with analogWrite() on the given channel to the frames before
+// the given one that have yet to be written. The pending value is written in the layout of
+// the context, as analogWrite() only leaves it pending when called with that layout.
+static inline void analogWritePending(BelaContext *context, int channel, unsigned int frame) {
+	BelaAnalogOutPending *pending;
+	unsigned int f;
+	unsigned int stride;
+	float *out;
+	if(!context->analogOutPending)
+		return;
+	pending = &context->analogOutPending[channel];
+	if(!pending->frame || pending->frame >= frame)
+		return;
+	if(context->flags & BELA_FLAG_INTERLEAVED) {
+		stride = context->analogOutChannels;
+		out = context->analogOut + channel;
+	} else {
+		stride = 1;
+		out = context->analogOut + channel * context->analogFrames;
+	}
+	for(f = pending->frame; f < frame; f++)
+		out[f * stride] = pending->value;
+	pending->frame = frame;
+}
+
 // analogWriteOnce()
 //
 // Sets a given channel to a value for only the current frame
 static inline void analogWriteOnce(BelaContext *context, int frame, int channel, float value) {
+	analogWritePending(context, channel, frame + 1);
 	context->analogOut[frame * context->analogOutChannels + channel] = value;
 }
 
 static inline void analogWriteOnceNI(BelaContext *context, int frame, int channel, float value) {
+	analogWritePending(context, channel, frame + 1);
 	context->analogOut[channel * context->analogFrames + frame] = value;
 }
 
 // analogWrite()
 //
 // Sets a given analog output channel to a value for the current frame and, if persistent outputs are
-// enabled, for all subsequent frames
+// enabled, for all subsequent frames. Those are written lazily, so that writing every frame
+// does not take time proportional to the square of the number of frames.
 static inline void analogWrite(BelaContext *context, int frame, int channel, float value) {
 	unsigned int f;
+	if(context->analogOutPending && (context->flags & BELA_FLAG_INTERLEAVED)) {
+		if((unsigned int)frame >= context->analogFrames)
+			return;
+		analogWritePending(context, channel, frame);
+		context->analogOut[frame * context->analogOutChannels + channel] = value;
+		context->analogOutPending[channel].frame = frame + 1;
+		context->analogOutPending[channel].value = value;
+		return;
+	}
 	for(f = frame; f < context->analogFrames; f++)
 		analogWriteOnce(context, f, channel, value);
 }
 
 static inline void analogWriteNI(BelaContext *context, int frame, int channel, float value) {
 	unsigned int f;
+	if(context->analogOutPending && !(context->flags & BELA_FLAG_INTERLEAVED)) {
+		if((unsigned int)frame >= context->analogFrames)
+			return;
+		analogWritePending(context, channel, frame);
+		context->analogOut[channel * context->analogFrames + frame] = value;
+		context->analogOutPending[channel].frame = frame + 1;
+		context->analogOutPending[channel].value = value;
+		return;
+	}
 	for(f = frame; f < context->analogFrames; f++)
 		analogWriteOnceNI(context, f, channel, value);
 }
 
+// analogWriteFlush()
+//
+// Writes the values left pending by analogWrite() up to the end of the block
+static inline void analogWriteFlush(BelaContext *context) {
+	unsigned int ch;
+	if(!context->analogOutPending)
+		return;
+	for(ch = 0; ch < context->analogOutChannels; ch++) {
+		analogWritePending(context, ch, context->analogFrames);
+		context->analogOutPending[ch].frame = 0;
+	}
+}
+
 // digitalRead()
 //
 // Returns the value of a given digital input at the given frame number
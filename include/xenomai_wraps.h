@@ -18,12 +18,16 @@ extern "C" {
 #endif
 #ifdef XENOMAI_SKIN_posix
 #include <pthread.h>
+#include <sched.h>
 #include <mqueue.h>
+#include <semaphore.h>
 #include <sys/socket.h>
 
 // Forward declare __wrap_ versions of POSIX calls.
 // At link time, Xenomai will provide implementations for these
 int __wrap_nanosleep(const struct timespec *req, struct timespec *rem);
+int __wrap_clock_nanosleep(clockid_t clock_id, int flags, const struct timespec *request, struct timespec *remain);
+int __wrap_clock_gettime(clockid_t clock_id, struct timespec *tp);
 int __wrap_pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine) (void *), void *arg);
 int __wrap_pthread_setschedparam(pthread_t thread, int policy, const struct sched_param *param);
 int __wrap_pthread_getschedparam(pthread_t thread, int *policy, struct sched_param *param);
@@ -40,6 +44,11 @@ int __wrap_pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *att
 int __wrap_pthread_cond_signal(pthread_cond_t *cond);
 int __wrap_pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
 
+int __wrap_sem_init(sem_t *sem, int pshared, unsigned int value);
+int __wrap_sem_destroy(sem_t *sem);
+int __wrap_sem_post(sem_t *sem);
+int __wrap_sem_wait(sem_t *sem);
+
 int __wrap_socket(int protocol_family, int socket_type, int protocol);
 int __wrap_setsockopt(int fd, int level, int optname, const void *optval, socklen_t optlen);
 int __wrap_bind(int fd, const struct sockaddr *my_addr, socklen_t addrlen);
@@ -54,8 +63,11 @@ int __wrap_mq_unlink(const char *name);
 // Handle difference between posix API of Xenomai 2.6 and Xenomai 3
 // Some functions are not wrapped by Xenomai 2.6, so we redefine the __wrap
 // to the actual POSIX service for Xenomai 2.6 while we simply forward declare
-// the __wrap_ version for Xenomai 3
-#if XENOMAI_MAJOR == 2
+// the __wrap_ version for Xenomai 3.
+// XENOMAI_MAJOR 0 is plain Linux, for tools that also run without Xenomai:
+// the program itself defines the __wrap_ functions it uses, forwarding them to
+// the POSIX services.
+#if XENOMAI_MAJOR == 2 || XENOMAI_MAJOR == 0
 #define __wrap_pthread_join(a,b) pthread_join(a,b) // NOWRAP
 #define __wrap_pthread_attr_init(a) pthread_attr_init(a) // NOWRAP
 #define __wrap_sched_get_priority_max(a) sched_get_priority_max(a) // NOWRAP
@@ -69,12 +81,22 @@ int __wrap_sched_get_priority_max(int policy);
 
 #ifdef XENOMAI_SKIN_native
 #include <native/task.h>
+#include <native/timer.h>
 typedef RTIME time_ns_t;
+// the rt_task_create() mode for a bitmask of CPUs, or 0 for any
+inline int cpus_to_task_mode(unsigned int cpus)
+{
+	int mode = 0;
+	for(unsigned int n = 0; n < 8; ++n)
+		if(cpus & (1u << n))
+			mode |= T_CPU(n);
+	return mode;
+}
 #endif
 #ifdef XENOMAI_SKIN_posix
 #if XENOMAI_MAJOR == 3
 #include <rtdm/ipc.h>
-#else
+#elif XENOMAI_MAJOR == 2
 #include <rtdm/rtipc.h>
 #endif
 typedef long long int time_ns_t;
@@ -94,6 +116,19 @@ inline int task_sleep_ns(long long int timens)
 #endif
 }
 
+// monotonic time in nanoseconds, safe to read from real-time threads
+inline unsigned long long task_time_ns()
+{
+#ifdef XENOMAI_SKIN_native
+	return rt_timer_ticks2ns(rt_timer_read());
+#endif
+#ifdef XENOMAI_SKIN_posix
+	struct timespec ts;
+	__wrap_clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
 #ifdef XENOMAI_SKIN_posix
 #include <error.h>
 //void error(int exitCode, int errno, char* message)
@@ -140,7 +175,43 @@ inline int set_thread_stack_and_priority(pthread_attr_t *attr, int stackSize, in
 	setup_sched_parameters(attr, prio);
 	return 0;
 }
-inline int create_and_start_thread(pthread_t* task, const char* taskName, int priority, int stackSize, pthread_callback_t* callback, void* arg)
+
+// cpus is a bitmask of the CPUs the thread may run on, or 0 for any
+inline void cpus_to_cpu_set(unsigned int cpus, cpu_set_t* set)
+{
+	CPU_ZERO(set);
+	for(unsigned int n = 0; n < sizeof(cpus) * 8; ++n)
+		if(cpus & (1u << n))
+			CPU_SET(n, set);
+}
+
+inline int set_thread_cpus(pthread_attr_t *attr, unsigned int cpus)
+{
+	if(!cpus)
+		return 0;
+	cpu_set_t set;
+	cpus_to_cpu_set(cpus, &set);
+	if(int ret = pthread_attr_setaffinity_np(attr, sizeof(set), &set))
+	{
+		fprintf(stderr, "Error: unable to set the CPU affinity to 0x%x: %s\n", cpus, strerror(ret));
+		return ret;
+	}
+	return 0;
+}
+
+// Cobalt threads follow the affinity of their Linux counterpart, so this
+// can be called on a running thread. Here 0 means all the CPUs.
+inline int set_running_thread_cpus(pthread_t thread, unsigned int cpus)
+{
+	cpu_set_t set;
+	cpus_to_cpu_set(cpus, &set);
+	if(!cpus)
+		for(unsigned int n = 0; n < CPU_SETSIZE; ++n)
+			CPU_SET(n, &set);
+	return pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+inline int create_and_start_thread(pthread_t* task, const char* taskName, int priority, int stackSize, pthread_callback_t* callback, void* arg, unsigned int cpus = 0)
 {
 	pthread_attr_t attr;
 	if(__wrap_pthread_attr_init(&attr))
@@ -152,6 +223,10 @@ inline int create_and_start_thread(pthread_t* task, const char* taskName, int pr
 	{
 		return ret;
 	}
+	if(int ret = set_thread_cpus(&attr, cpus))
+	{
+		return ret;
+	}
 	if(int ret = __wrap_pthread_create(task, &attr, callback, arg))
 	{
 		return ret;
@@ -164,6 +239,9 @@ inline int create_and_start_thread(pthread_t* task, const char* taskName, int pr
 #endif
 #if XENOMAI_MAJOR == 3
 	__wrap_pthread_setname_np(*task, taskName);
+#endif
+#if XENOMAI_MAJOR == 0
+	pthread_setname_np(*task, taskName); // NOWRAP
 #endif
 	// check that effective parameters match the ones we requested
 	//pthread_attr_t actualAttr;
@@ -175,6 +253,7 @@ inline int create_and_start_thread(pthread_t* task, const char* taskName, int pr
 	pthread_attr_destroy(&attr);
 	return 0;
 }
+#if XENOMAI_MAJOR > 0
 // from xenomai-3/demo/posix/cobalt/xddp-echo.c
 inline int createXenomaiPipe(const char* portName, int poolsz)
 {
@@ -234,6 +313,7 @@ inline int createXenomaiPipe(const char* portName, int poolsz)
 	}
 	return s;
 }
+#endif /* XENOMAI_MAJOR > 0 */
 #endif /* XENOMAI_SKIN_posix */
 
 #ifdef __cplusplus
@@ -0,0 +1,490 @@
+/***** Convolver.cpp *****/
+#include "Convolver.h"
+#include <libraries/ne10/NE10.h>
+#include <libraries/sndfile/sndfile.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+// Uniformly-partitioned overlap-save convolution of one section of the IR.
+// Each call to process() takes one partition worth of input and returns one
+// partition worth of output.
+class ConvolverSegment
+{
+public:
+	ConvolverSegment(const float* ir, unsigned int length, unsigned int partitionSize);
+	~ConvolverSegment();
+	void process(float* out, const float* in);
+	void reset();
+private:
+	unsigned int partitionSize;
+	unsigned int fftSize;
+	unsigned int numBins;
+	unsigned int numPartitions;
+	unsigned int fdlPos = 0;
+	ne10_fft_r2c_cfg_float32_t cfg;
+	ne10_float32_t* inputBuffer;
+	ne10_float32_t* fftIn;
+	ne10_float32_t* fftOut;
+	ne10_fft_cpx_float32_t* irSpectra;
+	ne10_fft_cpx_float32_t* fdl; // frequency-domain delay line
+	ne10_fft_cpx_float32_t* accumulator;
+};
+
+ConvolverSegment::ConvolverSegment(const float* ir, unsigned int length, unsigned int partitionSize) :
+	partitionSize(partitionSize),
+	fftSize(2 * partitionSize),
+	numBins(partitionSize + 1),
+	numPartitions((length + partitionSize - 1) / partitionSize)
+{
+	cfg = ne10_fft_alloc_r2c_float32(fftSize);
+	inputBuffer = (ne10_float32_t*)NE10_MALLOC(fftSize * sizeof(ne10_float32_t));
+	fftIn = (ne10_float32_t*)NE10_MALLOC(fftSize * sizeof(ne10_float32_t));
+	fftOut = (ne10_float32_t*)NE10_MALLOC(fftSize * sizeof(ne10_float32_t));
+	irSpectra = (ne10_fft_cpx_float32_t*)NE10_MALLOC(numPartitions * numBins * sizeof(ne10_fft_cpx_float32_t));
+	fdl = (ne10_fft_cpx_float32_t*)NE10_MALLOC(numPartitions * numBins * sizeof(ne10_fft_cpx_float32_t));
+	accumulator = (ne10_fft_cpx_float32_t*)NE10_MALLOC(numBins * sizeof(ne10_fft_cpx_float32_t));
+	for(unsigned int p = 0; p < numPartitions; ++p)
+	{
+		unsigned int start = p * partitionSize;
+		unsigned int count = std::min(partitionSize, length - start);
+		memset(fftIn, 0, fftSize * sizeof(ne10_float32_t));
+		memcpy(fftIn, ir + start, count * sizeof(float));
+		ne10_fft_r2c_1d_float32_neon(irSpectra + p * numBins, fftIn, cfg);
+	}
+	memset(inputBuffer, 0, fftSize * sizeof(ne10_float32_t));
+	memset(fdl, 0, numPartitions * numBins * sizeof(ne10_fft_cpx_float32_t));
+}
+
+ConvolverSegment::~ConvolverSegment()
+{
+	NE10_FREE(inputBuffer);
+	NE10_FREE(fftIn);
+	NE10_FREE(fftOut);
+	NE10_FREE(irSpectra);
+	NE10_FREE(fdl);
+	NE10_FREE(accumulator);
+	NE10_FREE(cfg);
+}
+
+// Forget all the past input, as if it had been silent
+void ConvolverSegment::reset()
+{
+	memset(inputBuffer, 0, fftSize * sizeof(ne10_float32_t));
+	memset(fdl, 0, numPartitions * numBins * sizeof(ne10_fft_cpx_float32_t));
+}
+
+void ConvolverSegment::process(float* out, const float* in)
+{
+	// slide the input window by one partition and transform it
+	memmove(inputBuffer, inputBuffer + partitionSize, partitionSize * sizeof(ne10_float32_t));
+	memcpy(inputBuffer + partitionSize, in, partitionSize * sizeof(ne10_float32_t));
+	memcpy(fftIn, inputBuffer, fftSize * sizeof(ne10_float32_t));
+	ne10_fft_cpx_float32_t* current = fdl + fdlPos * numBins;
+	ne10_fft_r2c_1d_float32_neon(current, fftIn, cfg);
+
+	// multiply-accumulate the delay line with the IR partitions
+	memset(accumulator, 0, numBins * sizeof(ne10_fft_cpx_float32_t));
+	unsigned int slot = fdlPos;
+	for(unsigned int p = 0; p < numPartitions; ++p)
+	{
+		const ne10_fft_cpx_float32_t* x = fdl + slot * numBins;
+		const ne10_fft_cpx_float32_t* h = irSpectra + p * numBins;
+		for(unsigned int k = 0; k < numBins; ++k)
+		{
+			accumulator[k].r += x[k].r * h[k].r - x[k].i * h[k].i;
+			accumulator[k].i += x[k].r * h[k].i + x[k].i * h[k].r;
+		}
+		slot = slot ? slot - 1 : numPartitions - 1;
+	}
+	if(++fdlPos >= numPartitions)
+		fdlPos = 0;
+
+	// ne10's inverse transform is already scaled by 1/fftSize
+	ne10_fft_c2r_1d_float32_neon(fftOut, accumulator, cfg);
+	// overlap-save: only the second half is free from circular aliasing
+	memcpy(out, fftOut + partitionSize, partitionSize * sizeof(float));
+}
+
+struct ConvolverTailStage
+{
+	ConvolverSegment* segment;
+	unsigned int partitionSize;
+	// the last few input partitions, written by process()
+	std::vector<float> inRing;
+	// the last few output partitions, written by the job
+	std::vector<float> outRing;
+	uint64_t ready = 0; // number of complete input partitions
+	uint64_t done = 0; // number of processed partitions
+	uint64_t validFrom = 0; // partitions before this were dropped
+	uint64_t jobPartition = 0;
+	bool resync = false; // the job has to reset the segment first
+	int job = -1;
+	bool playing = false;
+	uint64_t playingPartition = 0;
+	static constexpr unsigned int kInSlots = 4;
+	static constexpr unsigned int kOutSlots = 3;
+};
+
+Convolver::Convolver() {}
+
+Convolver::~Convolver()
+{
+	cleanup();
+}
+
+static bool isPowerOfTwo(unsigned int n)
+{
+	return n && !(n & (n - 1));
+}
+
+int Convolver::setup(const std::vector<float>& ir, unsigned int newBlockSize, DeadlineScheduler* newScheduler, unsigned int maxPartitionSize, unsigned int partitionRatio)
+{
+	cleanup();
+	if(!ir.size() || !isPowerOfTwo(newBlockSize) || !isPowerOfTwo(maxPartitionSize) || !isPowerOfTwo(partitionRatio) || partitionRatio < 2)
+	{
+		fprintf(stderr, "Convolver: invalid parameters\n");
+		return -1;
+	}
+	blockSize = newBlockSize;
+	irLength = ir.size();
+	frame = 0;
+	block = 0;
+	missedDeadlines = 0;
+	if(maxPartitionSize < blockSize)
+		maxPartitionSize = blockSize;
+
+	// direct-form head
+	directIr.assign(ir.begin(), ir.begin() + std::min(blockSize, irLength));
+	directHistory.assign(2 * blockSize, 0);
+	headOut.assign(blockSize, 0);
+	scratch.assign(blockSize, 0);
+
+	// uniformly-partitioned head, up to the start of the first tail stage
+	unsigned int partitionSize = std::min(blockSize * partitionRatio, maxPartitionSize);
+	unsigned int headEnd = partitionSize > blockSize ? std::min(irLength, 2 * partitionSize) : irLength;
+	if(headEnd > blockSize)
+		head = new ConvolverSegment(ir.data() + blockSize, headEnd - blockSize, blockSize);
+
+	// background stages
+	unsigned int offset = headEnd;
+	while(offset < irLength)
+	{
+		unsigned int nextPartitionSize = std::min(partitionSize * partitionRatio, maxPartitionSize);
+		unsigned int end = nextPartitionSize > partitionSize ? std::min(irLength, 2 * nextPartitionSize) : irLength;
+		ConvolverTailStage* stage = new ConvolverTailStage;
+		stage->segment = new ConvolverSegment(ir.data() + offset, end - offset, partitionSize);
+		stage->partitionSize = partitionSize;
+		stage->inRing.assign(ConvolverTailStage::kInSlots * partitionSize, 0);
+		stage->outRing.assign(ConvolverTailStage::kOutSlots * partitionSize, 0);
+		tail.push_back(stage);
+		offset = end;
+		partitionSize = nextPartitionSize;
+	}
+
+	if(tail.size())
+	{
+		if(newScheduler)
+		{
+			scheduler = newScheduler;
+		} else {
+			scheduler = new DeadlineScheduler;
+			ownsScheduler = true;
+			if(int ret = scheduler->setup(1))
+			{
+				fprintf(stderr, "Convolver: unable to start the background scheduler\n");
+				cleanup();
+				return ret;
+			}
+		}
+	}
+	return 0;
+}
+
+int Convolver::setup(const std::string& filename, unsigned int channel, unsigned int newBlockSize, DeadlineScheduler* newScheduler, unsigned int maxPartitionSize, unsigned int partitionRatio)
+{
+	std::vector<float> ir = loadFile(filename, channel);
+	if(!ir.size())
+		return -1;
+	return setup(ir, newBlockSize, newScheduler, maxPartitionSize, partitionRatio);
+}
+
+void Convolver::cleanup()
+{
+	// wait for any job that may still be using the stages
+	for(auto stage : tail)
+	{
+		if(stage->job >= 0)
+		{
+			while(!scheduler->isDone(stage->job))
+				usleep(1000);
+			scheduler->release(stage->job);
+		}
+	}
+	if(ownsScheduler)
+		delete scheduler;
+	ownsScheduler = false;
+	scheduler = NULL;
+	for(auto stage : tail)
+	{
+		delete stage->segment;
+		delete stage;
+	}
+	tail.clear();
+	delete head;
+	head = NULL;
+}
+
+std::vector<float> Convolver::loadFile(const std::string& filename, unsigned int channel)
+{
+	std::vector<float> samples;
+	SF_INFO sfinfo;
+	sfinfo.format = 0;
+	SNDFILE* sndfile = sf_open(filename.c_str(), SFM_READ, &sfinfo);
+	if(!sndfile)
+	{
+		fprintf(stderr, "Convolver: couldn't open file %s: %s\n", filename.c_str(), sf_strerror(sndfile));
+		return samples;
+	}
+	if(channel >= (unsigned int)sfinfo.channels)
+	{
+		fprintf(stderr, "Convolver: file %s doesn't contain channel %u\n", filename.c_str(), channel);
+		sf_close(sndfile);
+		return samples;
+	}
+	std::vector<float> interleaved(sfinfo.frames * sfinfo.channels);
+	sf_count_t frames = sf_readf_float(sndfile, interleaved.data(), sfinfo.frames);
+	sf_close(sndfile);
+	samples.resize(frames);
+	for(sf_count_t n = 0; n < frames; ++n)
+		samples[n] = interleaved[n * sfinfo.channels + channel];
+	return samples;
+}
+
+void Convolver::tailJob(void* arg)
+{
+	ConvolverTailStage* stage = (ConvolverTailStage*)arg;
+	unsigned int P = stage->partitionSize;
+	if(stage->resync)
+	{
+		stage->segment->reset();
+		stage->resync = false;
+	}
+	stage->segment->process(
+		&stage->outRing[(stage->jobPartition % ConvolverTailStage::kOutSlots) * P],
+		&stage->inRing[(stage->jobPartition % ConvolverTailStage::kInSlots) * P]);
+}
+
+// The output of the stage for input partition m covers frames
+// [(m + 2) * P, (m + 3) * P), so its job has to be done by the time we get
+// there.
+void Convolver::processTailStage(ConvolverTailStage& stage, const float* in, float* out)
+{
+	unsigned int P = stage.partitionSize;
+	if(stage.job >= 0 && scheduler->isDone(stage.job))
+	{
+		scheduler->release(stage.job);
+		stage.job = -1;
+		stage.done = stage.jobPartition + 1;
+	}
+
+	unsigned int inOffset = frame % (ConvolverTailStage::kInSlots * P);
+	memcpy(&stage.inRing[inOffset], in, blockSize * sizeof(float));
+	if(0 == (frame + blockSize) % P)
+		stage.ready = (frame + blockSize) / P;
+
+	if(stage.job < 0 && stage.done < stage.ready)
+	{
+		if(stage.ready - stage.done >= ConvolverTailStage::kInSlots - 1)
+		{
+			// we have fallen so far behind that the input has been
+			// overwritten: resume from the most recent partition.
+			// The delay line and the overlap still hold the input
+			// from before the partitions that are skipped, so the
+			// segment starts again from silence
+			stage.done = stage.ready - 1;
+			stage.validFrom = stage.done;
+			stage.resync = true;
+		}
+		stage.jobPartition = stage.done;
+		uint64_t deadline = scheduler->getCurrentBlock() + ((stage.jobPartition + 2) * P - frame) / blockSize;
+		stage.job = scheduler->submit(tailJob, &stage, deadline);
+	}
+
+	if(0 == frame % P)
+	{
+		int64_t partition = (int64_t)(frame / P) - 2;
+		stage.playing = partition >= (int64_t)stage.validFrom && partition < (int64_t)stage.done;
+		stage.playingPartition = partition;
+		if(partition >= 0 && !stage.playing)
+			++missedDeadlines;
+	}
+	if(stage.playing)
+	{
+		const float* src = &stage.outRing[(stage.playingPartition % ConvolverTailStage::kOutSlots) * P + frame % P];
+		for(unsigned int n = 0; n < blockSize; ++n)
+			out[n] += src[n];
+	}
+}
+
+void Convolver::process(float* out, const float* in)
+{
+	if(ownsScheduler)
+		scheduler->tick(block);
+	// keep a copy of the input, so that in and out can be the same buffer
+	float* current = directHistory.data() + blockSize;
+	memcpy(current, in, blockSize * sizeof(float));
+
+	unsigned int numTaps = directIr.size();
+	for(unsigned int n = 0; n < blockSize; ++n)
+	{
+		float acc = headOut[n];
+		for(unsigned int k = 0; k < numTaps; ++k)
+			acc += directIr[k] * current[(int)n - (int)k];
+		scratch[n] = acc;
+	}
+	if(head)
+		head->process(headOut.data(), current);
+	for(auto stage : tail)
+		processTailStage(*stage, current, scratch.data());
+
+	memcpy(out, scratch.data(), blockSize * sizeof(float));
+	memcpy(directHistory.data(), current, blockSize * sizeof(float));
+	frame += blockSize;
+	++block;
+}
+
+#undef NDEBUG
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <atomic>
+
+bool Convolver::test()
+{
+	// the output is compared with a direct convolution for IRs that end
+	// in the FIR head, in the uniform head and in the background stages
+	const unsigned int kFrames = 8192;
+	std::vector<float> in(kFrames);
+	srand(1);
+	for(auto& x : in)
+		x = rand() / (float)RAND_MAX - 0.5f;
+	for(unsigned int blockSize : { 16, 64 })
+	for(unsigned int irLength : { 5u, blockSize * 3, 3000u })
+	for(bool inPlace : { false, true })
+	{
+		std::vector<float> ir(irLength);
+		for(unsigned int n = 0; n < irLength; ++n)
+			ir[n] = sinf(n * 0.37f) * expf(-(float)n / 800.f);
+		Convolver convolver;
+		assert(0 == convolver.setup(ir, blockSize, NULL, 256, 4));
+		assert(irLength == convolver.getIrLength());
+		std::vector<float> out(kFrames);
+		for(unsigned int b = 0; b < kFrames / blockSize; ++b)
+		{
+			// the background stages get as long as they need, so
+			// that this does not depend on the load of the machine
+			for(auto stage : convolver.tail)
+				while(stage->job >= 0 && !convolver.scheduler->isDone(stage->job))
+					usleep(100);
+			float* dst = &out[b * blockSize];
+			if(inPlace)
+			{
+				memcpy(dst, &in[b * blockSize], blockSize * sizeof(float));
+				convolver.process(dst, dst);
+			} else
+				convolver.process(dst, &in[b * blockSize]);
+		}
+		assert(0 == convolver.getMissedDeadlines());
+		for(unsigned int n = 0; n < kFrames; ++n)
+		{
+			double expected = 0;
+			for(unsigned int k = 0; k < irLength && k <= n; ++k)
+				expected += ir[k] * in[n - k];
+			assert(fabs(out[n] - expected) < 1e-4);
+		}
+	}
+	// a stage that falls too far behind skips some of the input and
+	// starts again from silence, in step with the rest of the IR
+	{
+		const unsigned int blockSize = 16;
+		const unsigned int irLength = 3000;
+		std::vector<float> ir(irLength);
+		for(unsigned int n = 0; n < irLength; ++n)
+			ir[n] = sinf(n * 0.37f) * expf(-(float)n / 800.f);
+		DeadlineScheduler scheduler;
+		assert(0 == scheduler.setup(1));
+		Convolver convolver;
+		assert(0 == convolver.setup(ir, blockSize, &scheduler, 256, 4));
+		assert(2 == convolver.tail.size());
+		// keep the only worker busy for a while
+		const unsigned int kStallStart = 64;
+		const unsigned int kStallEnd = kStallStart + 128;
+		std::atomic<bool> hold(true);
+		int stall = -1;
+		std::vector<float> out(kFrames);
+		for(unsigned int b = 0; b < kFrames / blockSize; ++b)
+		{
+			scheduler.tick(b);
+			if(kStallStart == b)
+			{
+				stall = scheduler.submit([](void* arg) {
+					while(*(std::atomic<bool>*)arg)
+						usleep(100);
+				}, &hold, b + kFrames);
+				assert(stall >= 0);
+			}
+			if(kStallEnd == b)
+			{
+				hold = false;
+				while(!scheduler.isDone(stall))
+					usleep(100);
+				scheduler.release(stall);
+			}
+			if(b < kStallStart || b >= kStallEnd)
+				for(auto stage : convolver.tail)
+					while(stage->job >= 0 && !scheduler.isDone(stage->job))
+						usleep(100);
+			convolver.process(&out[b * blockSize], &in[b * blockSize]);
+		}
+		assert(convolver.getMissedDeadlines() > 0);
+		// the taps of each stage and the first input frame they apply to
+		struct Skip {
+			unsigned int begin;
+			unsigned int end;
+			uint64_t fromFrame;
+		};
+		std::vector<Skip> skips;
+		unsigned int start = 0;
+		for(unsigned int s = 0; s < convolver.tail.size(); ++s)
+		{
+			const ConvolverTailStage* stage = convolver.tail[s];
+			unsigned int P = stage->partitionSize;
+			assert(stage->validFrom > 0);
+			unsigned int end = s + 1 < convolver.tail.size() ? 2 * convolver.tail[s + 1]->partitionSize : irLength;
+			skips.push_back({ 2 * P, end, stage->validFrom * P });
+			start = std::max(start, (unsigned int)(stage->validFrom + 2) * P);
+		}
+		assert(start + 1024 < kFrames);
+		for(unsigned int n = start; n < kFrames; ++n)
+		{
+			double expected = 0;
+			for(unsigned int k = 0; k < irLength && k <= n; ++k)
+			{
+				bool skipped = false;
+				for(auto& skip : skips)
+					skipped |= k >= skip.begin && k < skip.end && n - k < skip.fromFrame;
+				if(!skipped)
+					expected += ir[k] * in[n - k];
+			}
+			assert(fabs(out[n] - expected) < 1e-4);
+		}
+	}
+	// invalid block and partition sizes
+	Convolver convolver;
+	std::vector<float> ir(100, 1);
+	assert(convolver.setup(ir, 0));
+	assert(convolver.setup(ir, 24));
+	assert(convolver.setup(ir, 16, NULL, 1000));
+	return true;
+}
@@ -0,0 +1,113 @@
+/***** Convolver.h *****/
+#pragma once
+
+#include <vector>
+#include <string>
+#include <DeadlineScheduler.h>
+
+class ConvolverSegment;
+struct ConvolverTailStage;
+
+/**
+ * \brief Low-latency convolution with long impulse responses.
+ *
+ * The impulse response (IR) is split into sections of increasing length:
+ * - the first `blockSize` taps are applied as a direct-form FIR
+ * - the following taps, up to twice the size of the first background
+ *   partition, are applied with a uniformly-partitioned FFT convolution
+ *   whose partitions are `blockSize` long.
+ *
+ * Both of these are computed in process(), so the output has no latency.
+ *
+ * The rest of the IR is applied by non-uniformly partitioned stages: each
+ * stage uses partitions `partitionRatio` times longer than the previous
+ * one (up to `maxPartitionSize`) and runs in the background on a
+ * DeadlineScheduler. A stage with partitions of length P starts 2P taps
+ * into the IR, which gives its job P samples of slack to complete. If a
+ * job misses its deadline, that stage is silent for P samples and the miss
+ * is counted in getMissedDeadlines(). If a stage falls so far behind that
+ * it has to skip some of its input, it starts again from the most recent
+ * partition, and its output is the tail of the input from there on only.
+ *
+ * Multi-second reverb IRs can therefore be applied with a `blockSize` as
+ * low as 16 frames.
+ */
+class Convolver
+{
+public:
+	Convolver();
+	~Convolver();
+	/**
+	 * Set up the convolver with an impulse response.
+	 *
+	 * @param ir the impulse response.
+	 * @param blockSize the number of frames passed to each call to
+	 * process(). Must be a power of 2.
+	 * @param scheduler the DeadlineScheduler that runs the background
+	 * stages. If this is NULL, a scheduler with one worker thread is
+	 * created for this object. A shared scheduler must be tick()ed once
+	 * per block, before calling process().
+	 * @param maxPartitionSize the longest partition used by the
+	 * background stages. Must be a power of 2.
+	 * @param partitionRatio the ratio between the partition lengths of
+	 * successive stages. Must be a power of 2.
+	 *
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int setup(const std::vector<float>& ir, unsigned int blockSize, DeadlineScheduler* scheduler = NULL, unsigned int maxPartitionSize = 8192, unsigned int partitionRatio = 8);
+	/**
+	 * Set up the convolver with an impulse response loaded from an audio
+	 * file.
+	 *
+	 * @param filename the path to the audio file
+	 * @param channel the channel of the file to use as impulse response
+	 *
+	 * See setup(const std::vector<float>&, ...) for the other
+	 * parameters.
+	 */
+	int setup(const std::string& filename, unsigned int channel, unsigned int blockSize, DeadlineScheduler* scheduler = NULL, unsigned int maxPartitionSize = 8192, unsigned int partitionRatio = 8);
+	void cleanup();
+	/**
+	 * Convolve a block of `blockSize` frames.
+	 *
+	 * @param out the output buffer. It can be the same as @p in.
+	 * @param in the input buffer.
+	 */
+	void process(float* out, const float* in);
+	/**
+	 * Load one channel of an audio file.
+	 *
+	 * @return the samples, or an empty vector in case of error.
+	 */
+	static std::vector<float> loadFile(const std::string& filename, unsigned int channel = 0);
+	/**
+	 * @return the number of times a background stage was not ready in
+	 * time.
+	 */
+	unsigned int getMissedDeadlines() { return missedDeadlines; }
+	/**
+	 * @return the number of taps of the current impulse response.
+	 */
+	unsigned int getIrLength() { return irLength; }
+	static bool test();
+private:
+	void processTailStage(ConvolverTailStage& stage, const float* in, float* out);
+	static void tailJob(void* arg);
+
+	unsigned int blockSize = 0;
+	unsigned int irLength = 0;
+	uint64_t frame = 0;
+	uint64_t block = 0;
+	unsigned int missedDeadlines = 0;
+	// direct-form head
+	std::vector<float> directIr;
+	std::vector<float> directHistory;
+	// uniformly-partitioned head, computed in process()
+	ConvolverSegment* head = NULL;
+	std::vector<float> headOut;
+	std::vector<float> scratch;
+	// non-uniformly partitioned tail, computed in the background
+	std::vector<ConvolverTailStage*> tail;
+	DeadlineScheduler* scheduler = NULL;
+	bool ownsScheduler = false;
+};
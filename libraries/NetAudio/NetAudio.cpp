@@ -0,0 +1,689 @@
+/***** NetAudio.cpp *****/
+#include "NetAudio.h"
+#include <libraries/UdpClient/UdpClient.h>
+#include <libraries/UdpServer/UdpServer.h>
+#include <AuxTaskReactor.h>
+#include <AuxTaskRing.h>
+#include <algorithm>
+#include <math.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// magic, version, sequence number, channels, format, block size
+static const size_t kHeaderSize = 12;
+static const char kMagic[] = { 'B', 'N', 'A' };
+static const char kVersion = 1;
+// the largest payload of a UDP packet
+static const size_t kMaxPacketSize = 65507;
+// blocks after which the jitter buffer may shrink
+static const unsigned int kAdaptBlocks = 1000;
+
+// the network byte order is big-endian
+static void writeUint32(char* dest, uint32_t value)
+{
+	dest[0] = value >> 24;
+	dest[1] = value >> 16;
+	dest[2] = value >> 8;
+	dest[3] = value;
+}
+
+static uint32_t readUint32(const char* src)
+{
+	const uint8_t* s = (const uint8_t*)src;
+	return (uint32_t)s[0] << 24 | (uint32_t)s[1] << 16 | (uint32_t)s[2] << 8 | s[3];
+}
+
+static int32_t toInt(float sample, float scale)
+{
+	return lrintf(std::min(1.f, std::max(-1.f, sample)) * scale);
+}
+
+struct NetAudio::SendBatch {
+	std::vector<char> buffers;
+	size_t packetSize;
+	struct iovec iovecs[NETAUDIO_MAX_DATAGRAMS];
+	struct mmsghdr headers[NETAUDIO_MAX_DATAGRAMS];
+};
+
+struct NetAudio::ReceiveBatch {
+	std::vector<char> buffers;
+	size_t packetSize;
+	struct iovec iovecs[NETAUDIO_MAX_DATAGRAMS];
+	struct mmsghdr headers[NETAUDIO_MAX_DATAGRAMS];
+};
+
+NetAudio::NetAudio()
+{
+	memset(&stats, 0, sizeof(stats));
+}
+
+NetAudio::~NetAudio()
+{
+	// these wait for onSocketReady() and sendBlocks() to return
+	if(reactorId >= 0)
+		AuxTaskReactor::get().remove(reactorId);
+	if(toNetwork)
+	{
+		toNetwork->cleanup();
+		toNetwork->process();
+	}
+}
+
+size_t NetAudio::packetSize(unsigned int numSamples, Format format)
+{
+	size_t bytes = kFloat32 == format ? 4 : kInt24 == format ? 3 : 2;
+	return kHeaderSize + numSamples * bytes;
+}
+
+size_t NetAudio::encode(char* dest, uint32_t seq, unsigned int numChannels, unsigned int blockSize, Format format, const float* data)
+{
+	memcpy(dest, kMagic, sizeof(kMagic));
+	dest[3] = kVersion;
+	writeUint32(dest + 4, seq);
+	dest[8] = numChannels;
+	dest[9] = format;
+	dest[10] = blockSize >> 8;
+	dest[11] = blockSize;
+	unsigned int numSamples = numChannels * blockSize;
+	char* d = dest + kHeaderSize;
+	switch(format)
+	{
+	case kInt16:
+		for(unsigned int n = 0; n < numSamples; ++n, d += 2)
+		{
+			int32_t value = toInt(data[n], 32767);
+			d[0] = value >> 8;
+			d[1] = value;
+		}
+		break;
+	case kInt24:
+		for(unsigned int n = 0; n < numSamples; ++n, d += 3)
+		{
+			int32_t value = toInt(data[n], 8388607);
+			d[0] = value >> 16;
+			d[1] = value >> 8;
+			d[2] = value;
+		}
+		break;
+	case kFloat32:
+		for(unsigned int n = 0; n < numSamples; ++n, d += 4)
+		{
+			uint32_t value;
+			memcpy(&value, &data[n], sizeof(value));
+			writeUint32(d, value);
+		}
+		break;
+	}
+	return d - dest;
+}
+
+int NetAudio::decode(const char* src, size_t size, unsigned int numChannels, unsigned int blockSize, uint32_t& seq, float* data)
+{
+	if(size < kHeaderSize || memcmp(src, kMagic, sizeof(kMagic)) || kVersion != src[3])
+		return -1;
+	const uint8_t* s = (const uint8_t*)src;
+	Format format = (Format)s[9];
+	if(numChannels != s[8] || blockSize != ((unsigned int)s[10] << 8 | s[11]) || format > kFloat32)
+		return -1;
+	unsigned int numSamples = numChannels * blockSize;
+	if(size != packetSize(numSamples, format))
+		return -1;
+	seq = readUint32(src + 4);
+	s += kHeaderSize;
+	switch(format)
+	{
+	case kInt16:
+		for(unsigned int n = 0; n < numSamples; ++n, s += 2)
+			data[n] = (int16_t)(s[0] << 8 | s[1]) * (1.f / 32767);
+		break;
+	case kInt24:
+		for(unsigned int n = 0; n < numSamples; ++n, s += 3)
+		{
+			// sign-extend from 24 bits
+			int32_t value = (int32_t)((uint32_t)s[0] << 24 | (uint32_t)s[1] << 16 | (uint32_t)s[2] << 8) >> 8;
+			data[n] = value * (1.f / 8388607);
+		}
+		break;
+	case kFloat32:
+		for(unsigned int n = 0; n < numSamples; ++n, s += 4)
+		{
+			uint32_t value = readUint32((const char*)s);
+			memcpy(&data[n], &value, sizeof(value));
+		}
+		break;
+	}
+	return 0;
+}
+
+int NetAudio::setupSend(const char* address, int port, unsigned int numChannels, unsigned int blockSize, Format format)
+{
+	size_t size = packetSize(numChannels * blockSize, format);
+	if(!numChannels || numChannels > 255 || !blockSize || blockSize > 65535 || size > kMaxPacketSize)
+	{
+		fprintf(stderr, "NetAudio: %u channels of %u frames do not fit in a packet\n", numChannels, blockSize);
+		return -1;
+	}
+	sendSocket = std::unique_ptr<UdpClient>(new UdpClient);
+	if(!sendSocket->setup(port, address))
+	{
+		fprintf(stderr, "NetAudio: Unable to initialise UDP socket: %d %s\n", errno, strerror(errno));
+		return -1;
+	}
+	sendChannels = numChannels;
+	sendBlockSize = blockSize;
+	sendFormat = format;
+	sendSeq = 0;
+	sendDropped = 0;
+	sendBatch = std::unique_ptr<SendBatch>(new SendBatch);
+	sendBatch->packetSize = size;
+	sendBatch->buffers.resize(NETAUDIO_MAX_DATAGRAMS * size);
+
+	Block prototype;
+	prototype.seq = 0;
+	prototype.data.resize(numChannels * blockSize);
+	toNetwork = std::unique_ptr<AuxTaskRing<Block>>(new AuxTaskRing<Block>);
+	toNetworkHasDoorbell = !toNetwork->setup(std::string("NetAudioSend_") + std::to_string(port), NETAUDIO_NUM_PACKETS, NETAUDIO_MAX_DATAGRAMS, [this](Block* const* blocks, unsigned int count) { sendBlocks(blocks, count); }, prototype);
+	if(!toNetworkHasDoorbell)
+		fprintf(stderr, "NetAudio: unable to set up the send task\n");
+	return 0;
+}
+
+int NetAudio::setupReceive(int port, unsigned int numChannels, unsigned int blockSize, unsigned int minDepth, unsigned int maxDepth)
+{
+	if(!numChannels || numChannels > 255 || !blockSize || blockSize > 65535 || packetSize(numChannels * blockSize, kFloat32) > kMaxPacketSize)
+	{
+		fprintf(stderr, "NetAudio: %u channels of %u frames do not fit in a packet\n", numChannels, blockSize);
+		return -1;
+	}
+	receiveSocket = std::unique_ptr<UdpServer>(new UdpServer);
+	if(!receiveSocket->setup(port))
+	{
+		fprintf(stderr, "NetAudio: Unable to initialise UDP socket: %d %s\n", errno, strerror(errno));
+		return -1;
+	}
+	receiveChannels = numChannels;
+	receiveBlockSize = blockSize;
+	this->maxDepth = std::max(1u, std::min(maxDepth, (unsigned int)NETAUDIO_MAX_DEPTH));
+	this->minDepth = std::max(1u, std::min(minDepth, this->maxDepth));
+	targetDepth = this->minDepth;
+	receiveBatch = std::unique_ptr<ReceiveBatch>(new ReceiveBatch);
+	// the sender may use any format, and anything larger is discarded
+	receiveBatch->packetSize = packetSize(numChannels * blockSize, kFloat32);
+	receiveBatch->buffers.resize(NETAUDIO_MAX_DATAGRAMS * receiveBatch->packetSize);
+
+	Block prototype;
+	prototype.seq = 0;
+	prototype.data.resize(numChannels * blockSize);
+	// twice the largest depth, so that blocks can arrive out of order
+	unsigned int size = 1;
+	while(size < 2 * this->maxDepth)
+		size <<= 1;
+	jitter.assign(size, prototype);
+	jitterValid.assign(size, false);
+	lastBlock.assign(numChannels * blockSize, 0);
+	concealGain = 0;
+	playing = false;
+	blocksSinceAdapt = 0;
+	minSpare = this->maxDepth;
+	memset(&stats, 0, sizeof(stats));
+
+	toAudio = std::unique_ptr<AuxTaskRing<Block>>(new AuxTaskRing<Block>);
+	// no doorbell: the audio thread processes them in receive()
+	toAudio->setup("", NETAUDIO_NUM_PACKETS, [this](Block& block) { blockArrived(block); }, prototype);
+	reactorId = AuxTaskReactor::get().addFd(receiveSocket->getSocket(), EPOLLIN, [this](int, uint32_t) { onSocketReady(); });
+	if(reactorId < 0)
+	{
+		fprintf(stderr, "NetAudio: unable to watch the UDP socket: %d\n", reactorId);
+		return reactorId;
+	}
+	return 0;
+}
+
+int NetAudio::send(const float* data)
+{
+	if(!toNetwork)
+		return -1;
+	// the sequence number advances anyway, so that the receiver knows
+	// that a block is missing
+	uint32_t seq = sendSeq++;
+	Block* block = toNetwork->reserve();
+	if(!block)
+	{
+		++sendDropped;
+		return -1;
+	}
+	block->seq = seq;
+	std::copy(data, data + block->data.size(), block->data.begin());
+	return toNetwork->commit();
+}
+
+void NetAudio::sendBlocks(Block* const* blocks, unsigned int count)
+{
+	SendBatch& b = *sendBatch;
+	const struct sockaddr_in& destination = sendSocket->getDestination();
+	for(unsigned int n = 0; n < count; ++n)
+	{
+		char* buffer = b.buffers.data() + n * b.packetSize;
+		b.iovecs[n].iov_base = buffer;
+		b.iovecs[n].iov_len = encode(buffer, blocks[n]->seq, sendChannels, sendBlockSize, sendFormat, blocks[n]->data.data());
+		memset(&b.headers[n], 0, sizeof(b.headers[n]));
+		b.headers[n].msg_hdr.msg_name = (void*)&destination;
+		b.headers[n].msg_hdr.msg_namelen = sizeof(destination);
+		b.headers[n].msg_hdr.msg_iov = &b.iovecs[n];
+		b.headers[n].msg_hdr.msg_iovlen = 1;
+	}
+	unsigned int sent = 0;
+	while(sent < count)
+	{
+		int ret = sendmmsg(sendSocket->getSocket(), b.headers + sent, count - sent, 0);
+		if(ret < 0)
+		{
+			if(EINTR == errno)
+				continue;
+			fprintf(stderr, "NetAudio: Error sending UDP packet: %d %s\n", errno, strerror(errno));
+			break;
+		}
+		sent += ret;
+	}
+}
+
+void NetAudio::onSocketReady()
+{
+	ReceiveBatch& b = *receiveBatch;
+	int num;
+	do {
+		for(unsigned int n = 0; n < NETAUDIO_MAX_DATAGRAMS; ++n)
+		{
+			b.iovecs[n].iov_base = b.buffers.data() + n * b.packetSize;
+			b.iovecs[n].iov_len = b.packetSize;
+			memset(&b.headers[n], 0, sizeof(b.headers[n]));
+			b.headers[n].msg_hdr.msg_iov = &b.iovecs[n];
+			b.headers[n].msg_hdr.msg_iovlen = 1;
+		}
+		num = recvmmsg(receiveSocket->getSocket(), b.headers, NETAUDIO_MAX_DATAGRAMS, MSG_DONTWAIT, NULL);
+		if(num < 0)
+		{
+			if(EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno)
+				fprintf(stderr, "NetAudio: Error reading UDP socket: %d %s\n", errno, strerror(errno));
+			break;
+		}
+		for(int n = 0; n < num; ++n)
+		{
+			Block* block = toAudio->reserve();
+			if(!block)
+			{
+				++receiveDropped;
+				continue;
+			}
+			if(b.headers[n].msg_hdr.msg_flags & MSG_TRUNC
+				|| decode((const char*)b.iovecs[n].iov_base, b.headers[n].msg_len, receiveChannels, receiveBlockSize, block->seq, block->data.data()))
+			{
+				fprintf(stderr, "NetAudio: discarding an invalid packet of %u bytes\n", b.headers[n].msg_len);
+				continue;
+			}
+			toAudio->commit();
+		}
+		// a full batch means there may be more waiting
+	} while(NETAUDIO_MAX_DATAGRAMS == num);
+}
+
+// runs in the audio thread, from receive()
+void NetAudio::blockArrived(Block& block)
+{
+	++stats.received;
+	unsigned int mask = jitter.size() - 1;
+	if(1 == stats.received)
+		nextSeq = newestSeq = block.seq;
+	int32_t ahead = block.seq - nextSeq;
+	int32_t behind = newestSeq - block.seq;
+	if(ahead > (int32_t)mask || behind > (int32_t)mask)
+	{
+		// too far from what we have to be reordered or late: the
+		// sender probably restarted, so start again from this one
+		jitterValid.assign(jitterValid.size(), false);
+		nextSeq = newestSeq = block.seq;
+		playing = false;
+		blocksSinceAdapt = 0;
+		minSpare = maxDepth;
+	} else if(ahead < 0) {
+		if(playing)
+		{
+			++stats.late;
+			return;
+		}
+		// still buffering: start from the earliest one
+		nextSeq = block.seq;
+	}
+	unsigned int slot = block.seq & mask;
+	std::swap(jitter[slot].data, block.data);
+	jitter[slot].seq = block.seq;
+	jitterValid[slot] = true;
+	if((int32_t)(block.seq - newestSeq) > 0)
+		newestSeq = block.seq;
+}
+
+void NetAudio::conceal(float* data)
+{
+	// repeat the last block, fading out
+	unsigned int numSamples = lastBlock.size();
+	float gain = concealGain;
+	float step = -0.5f * concealGain / receiveBlockSize;
+	for(unsigned int n = 0; n < numSamples; n += receiveChannels)
+	{
+		for(unsigned int c = 0; c < receiveChannels; ++c)
+			data[n + c] = lastBlock[n + c] * gain;
+		gain += step;
+	}
+	concealGain *= 0.5f;
+}
+
+void NetAudio::receive(float* data)
+{
+	unsigned int numSamples = receiveChannels * receiveBlockSize;
+	if(!toAudio)
+		return;
+	toAudio->process();
+	unsigned int mask = jitter.size() - 1;
+	int32_t diff = newestSeq - nextSeq + 1;
+	unsigned int depth = stats.received ? std::max(0, (int)diff) : 0;
+	if(!playing)
+	{
+		if(depth < targetDepth)
+		{
+			std::fill(data, data + numSamples, 0);
+			return;
+		}
+		playing = true;
+	}
+	if(depth > maxDepth)
+	{
+		// the sender is running faster than us: catch up
+		while(depth > targetDepth)
+		{
+			jitterValid[nextSeq & mask] = false;
+			++nextSeq;
+			--depth;
+			++stats.skipped;
+		}
+	}
+	unsigned int slot = nextSeq & mask;
+	if(jitterValid[slot] && jitter[slot].seq == nextSeq)
+	{
+		std::copy(jitter[slot].data.begin(), jitter[slot].data.end(), data);
+		std::copy(data, data + numSamples, lastBlock.begin());
+		concealGain = 1;
+		jitterValid[slot] = false;
+		++nextSeq;
+	} else if(depth > targetDepth) {
+		// later blocks are waiting: this one is lost
+		++stats.lost;
+		conceal(data);
+		++nextSeq;
+	} else {
+		// nothing to play: wait for more blocks to come in, with a
+		// deeper buffer
+		++stats.underruns;
+		conceal(data);
+		targetDepth = std::min(targetDepth + 1, maxDepth);
+		playing = false;
+		blocksSinceAdapt = 0;
+		minSpare = maxDepth;
+		return;
+	}
+	// if there have been spare blocks all along, the buffer is deeper
+	// than it needs to be: drop one block
+	minSpare = std::min(minSpare, depth - 1);
+	if(++blocksSinceAdapt >= kAdaptBlocks)
+	{
+		if(minSpare > 0 && targetDepth > minDepth)
+		{
+			--targetDepth;
+			jitterValid[nextSeq & mask] = false;
+			++nextSeq;
+		}
+		blocksSinceAdapt = 0;
+		minSpare = maxDepth;
+	}
+}
+
+NetAudio::Stats NetAudio::getStats() const
+{
+	Stats s = stats;
+	int32_t diff = newestSeq - nextSeq + 1;
+	s.depth = stats.received ? std::max(0, (int)diff) : 0;
+	s.targetDepth = targetDepth;
+	s.dropped += sendDropped + receiveDropped;
+	return s;
+}
+
+#undef NDEBUG
+#include <assert.h>
+
+// a recognisable value for each sample of each block
+static float testSample(uint32_t seq, unsigned int n)
+{
+	return ((seq % 128) * 64 + n % 64) / 8192.f - 0.5f;
+}
+
+bool NetAudio::test()
+{
+	const unsigned int kChannels = 2;
+	const unsigned int kBlockSize = 16;
+	const unsigned int kNumSamples = kChannels * kBlockSize;
+	std::vector<float> in(kNumSamples);
+	std::vector<float> out(kNumSamples);
+	std::vector<char> packet(packetSize(kNumSamples, kFloat32));
+	uint32_t seq;
+
+	// encoding
+	for(unsigned int n = 0; n < kNumSamples; ++n)
+		in[n] = testSample(3, n);
+	in[0] = 2; // clipped
+	in[1] = -1;
+	const struct {
+		Format format;
+		float tolerance;
+	} formats[] = {
+		{ kInt16, 1.f / 32767 },
+		{ kInt24, 1.f / 8388607 },
+		{ kFloat32, 0 },
+	};
+	for(auto& f : formats)
+	{
+		size_t size = encode(packet.data(), 3, kChannels, kBlockSize, f.format, in.data());
+		assert(size == packetSize(kNumSamples, f.format));
+		assert(0 == decode(packet.data(), size, kChannels, kBlockSize, seq, out.data()));
+		assert(3 == seq);
+		assert(1 == out[0] || kFloat32 == f.format);
+		for(unsigned int n = 1; n < kNumSamples; ++n)
+			assert(fabsf(out[n] - in[n]) <= f.tolerance);
+		assert(decode(packet.data(), size - 1, kChannels, kBlockSize, seq, out.data()));
+		assert(decode(packet.data(), size, kChannels + 1, kBlockSize, seq, out.data()));
+	}
+
+	// a stream over loopback between two processes. This runs before
+	// anything in this process uses the AuxTaskReactor, so that each
+	// child starts its own. The receiver signals through a pipe when it
+	// is ready and when it has played each block, and the sender waits
+	// for that before sending the next one.
+	const int kPort = 7566;
+	const uint32_t kNumBlocks = 50;
+	int handshake[2];
+	assert(0 == pipe(handshake));
+	pid_t receiverPid = fork();
+	assert(receiverPid >= 0);
+	if(0 == receiverPid)
+	{
+		close(handshake[0]);
+		{
+			NetAudio receiver;
+			assert(0 == receiver.setupReceive(kPort, kChannels, kBlockSize));
+			assert(1 == write(handshake[1], "r", 1));
+			unsigned int played = 0;
+			for(uint32_t s = 0; s < kNumBlocks; ++s)
+			{
+				for(unsigned int n = 0; n < 10000 && !receiver.toAudio->pending(); ++n)
+					usleep(100);
+				assert(1 == receiver.toAudio->pending());
+				receiver.receive(out.data());
+				assert(1 == write(handshake[1], "a", 1));
+				if(s + 1 < receiver.minDepth)
+				{
+					assert(0 == out[0]);
+					continue;
+				}
+				// the blocks come out in order, after the jitter buffer
+				for(unsigned int n = 0; n < kNumSamples; ++n)
+					assert(fabsf(out[n] - testSample(played, n)) <= 1.f / 8388607);
+				++played;
+			}
+			Stats stats = receiver.getStats();
+			assert(kNumBlocks == stats.received && 0 == stats.lost && 0 == stats.underruns);
+			assert(0 == stats.dropped && 0 == stats.skipped);
+			assert(receiver.minDepth - 1 == stats.depth);
+		}
+		_exit(0);
+	}
+	pid_t senderPid = fork();
+	assert(senderPid >= 0);
+	if(0 == senderPid)
+	{
+		close(handshake[1]);
+		{
+			char c;
+			assert(1 == read(handshake[0], &c, 1));
+			NetAudio sender;
+			assert(0 == sender.setupSend("127.0.0.1", kPort, kChannels, kBlockSize, kInt24));
+			for(uint32_t s = 0; s < kNumBlocks; ++s)
+			{
+				for(unsigned int n = 0; n < kNumSamples; ++n)
+					in[n] = testSample(s, n);
+				assert(0 == sender.send(in.data()));
+				if(!sender.toNetworkHasDoorbell)
+					sender.toNetwork->process();
+				assert(1 == read(handshake[0], &c, 1));
+			}
+		}
+		_exit(0);
+	}
+	close(handshake[0]);
+	close(handshake[1]);
+	const pid_t pids[] = { receiverPid, senderPid };
+	for(auto pid : pids)
+	{
+		int status;
+		assert(pid == waitpid(pid, &status, 0));
+		assert(WIFEXITED(status) && 0 == WEXITSTATUS(status));
+	}
+
+	// out of order, lost and late packets, with the jitter buffer
+	// starting from scratch
+	NetAudio jittery;
+	assert(0 == jittery.setupReceive(kPort + 1, kChannels, kBlockSize, 2));
+	int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+	assert(fd >= 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(kPort + 1);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	auto sendBlock = [&](uint32_t s) {
+		for(unsigned int n = 0; n < kNumSamples; ++n)
+			in[n] = testSample(s, n);
+		size_t size = encode(packet.data(), s, kChannels, kBlockSize, kInt16, in.data());
+		unsigned int pending = jittery.toAudio->pending();
+		assert((ssize_t)size == sendto(fd, packet.data(), size, 0, (struct sockaddr*)&addr, sizeof(addr)));
+		for(unsigned int n = 0; n < 1000 && jittery.toAudio->pending() == pending; ++n)
+			usleep(100);
+		assert(jittery.toAudio->pending() == pending + 1);
+	};
+	auto played = [&](uint32_t s) {
+		for(unsigned int n = 0; n < kNumSamples; ++n)
+			if(fabsf(out[n] - testSample(s, n)) > 1.f / 32767)
+				return false;
+		return true;
+	};
+	// block 4 arrives after block 5, and block 6 never arrives
+	const uint32_t order[] = { 0, 1, 2, 3, 5, 4, 7, 8, 9, 10 };
+	const int expected[] = { -1, 0, 1, 2, 3, 4, 5, -2, 7, 8 };
+	for(unsigned int n = 0; n < sizeof(order) / sizeof(order[0]); ++n)
+	{
+		sendBlock(order[n]);
+		jittery.receive(out.data());
+		if(-1 == expected[n])
+			assert(0 == out[0]);
+		else if(-2 == expected[n]) {
+			// the last block, fading out
+			for(unsigned int s = 0; s < kNumSamples; ++s)
+				assert(fabsf(out[s]) <= fabsf(testSample(5, s)) + 1.f / 32767);
+			assert(!played(5));
+		} else
+			assert(played(expected[n]));
+	}
+	// now block 6 is too late
+	sendBlock(6);
+	jittery.receive(out.data());
+	assert(played(9));
+	jittery.receive(out.data());
+	assert(played(10));
+	Stats stats = jittery.getStats();
+	assert(1 == stats.lost && 1 == stats.late && 0 == stats.underruns);
+	// running out makes the buffer deeper
+	jittery.receive(out.data());
+	stats = jittery.getStats();
+	assert(1 == stats.underruns && 3 == stats.targetDepth);
+	uint32_t s = 11;
+	for(; s < 11 + 3; ++s)
+		sendBlock(s);
+	jittery.receive(out.data());
+	assert(played(11));
+	// and it shrinks back when there are spare blocks for long enough
+	for(unsigned int n = 0; n < kAdaptBlocks; ++n, ++s)
+	{
+		sendBlock(s);
+		jittery.receive(out.data());
+	}
+	stats = jittery.getStats();
+	assert(2 == stats.targetDepth && 1 == stats.underruns && 1 == stats.lost);
+	assert(0 == stats.skipped && 0 == stats.dropped);
+	// blocks piling up beyond the largest depth are skipped, not dropped
+	for(unsigned int n = 0; n < jittery.maxDepth + 2; ++n, ++s)
+		sendBlock(s);
+	jittery.receive(out.data());
+	stats = jittery.getStats();
+	assert(stats.skipped > 0 && 0 == stats.dropped);
+	assert(stats.targetDepth - 1 == stats.depth);
+	assert(played(s - stats.targetDepth));
+	// a sender that restarts from 0 is followed, both while playing and
+	// while rebuffering after an underrun
+	for(unsigned int restart = 0; restart < 2; ++restart)
+	{
+		stats = jittery.getStats();
+		uint32_t newest = s - 1;
+		unsigned int late = stats.late;
+		unsigned int underruns = stats.underruns;
+		unsigned int skipped = stats.skipped;
+		unsigned int targetDepth = stats.targetDepth;
+		for(s = 0; s < 100; ++s)
+		{
+			sendBlock(s);
+			jittery.receive(out.data());
+			if(s + 1 < targetDepth)
+				assert(0 == out[0]);
+			else
+				assert(played(s + 1 - targetDepth));
+		}
+		assert(newest > jittery.jitter.size());
+		stats = jittery.getStats();
+		assert(late == stats.late && underruns == stats.underruns);
+		assert(skipped == stats.skipped && targetDepth == stats.targetDepth);
+		// empty the buffer and underrun
+		for(unsigned int n = 0; n < targetDepth; ++n)
+			jittery.receive(out.data());
+		assert(jittery.getStats().underruns == underruns + 1);
+	}
+	close(fd);
+	return true;
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+// forward declarations to speed up compilation
+class UdpClient;
+class UdpServer;
+template <typename T> class AuxTaskRing;
+
+#define NETAUDIO_NUM_PACKETS 32
+#define NETAUDIO_MAX_DATAGRAMS 8
+#define NETAUDIO_MAX_DEPTH 64
+
+/**
+ * \brief NetAudio streams blocks of multi-channel audio over UDP.
+ *
+ * Each instance can send a stream, receive one, or both. On the sending
+ * side, send() is called from render() with one block of interleaved
+ * audio. The block is copied into a preallocated ring and it is then
+ * encoded and sent off the audio thread, up to #NETAUDIO_MAX_DATAGRAMS
+ * packets with each system call.
+ *
+ * On the receiving side, packets are read by the shared AuxTaskReactor as
+ * soon as they arrive and passed to the audio thread, where receive() puts
+ * them back in order in a jitter buffer. The depth of the jitter buffer
+ * grows by one block every time a block arrives too late to be played, and
+ * shrinks by one block when there have been spare blocks for a while.
+ * Missing blocks are concealed by repeating the last block received with a
+ * decaying gain.
+ *
+ * Samples can be sent as 16-bit or 24-bit integers to save bandwidth, or as
+ * 32-bit floats.
+ *
+ * The sender and the receiver must agree on the number of channels and on
+ * the block size.
+ */
+class NetAudio {
+public:
+	typedef enum {
+		kInt16,
+		kInt24,
+		kFloat32,
+	} Format;
+	struct Stats {
+		unsigned int received; ///< packets received
+		unsigned int late; ///< packets that arrived after their block was played
+		unsigned int lost; ///< blocks that never arrived
+		unsigned int underruns; ///< times the jitter buffer ran empty
+		unsigned int dropped; ///< packets dropped because a ring was full
+		unsigned int skipped; ///< blocks skipped to catch up with a sender that runs faster than us
+		unsigned int depth; ///< blocks currently in the jitter buffer
+		unsigned int targetDepth; ///< the depth the jitter buffer is aiming for
+	};
+	NetAudio();
+	~NetAudio();
+	/**
+	 * Set up the sending side.
+	 *
+	 * @param address the IP address to send to.
+	 * @param port the UDP port to send to.
+	 * @param numChannels the number of channels of each block.
+	 * @param blockSize the number of frames of each block.
+	 * @param format the format of the samples in the packets.
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int setupSend(const char* address, int port, unsigned int numChannels, unsigned int blockSize, Format format = kInt16);
+	/**
+	 * Set up the receiving side.
+	 *
+	 * @param port the UDP port to listen on.
+	 * @param numChannels the number of channels of each block.
+	 * @param blockSize the number of frames of each block.
+	 * @param minDepth the smallest number of blocks the jitter buffer
+	 * holds before playing. A larger value gives fewer dropouts at
+	 * the cost of latency.
+	 * @param maxDepth the largest number of blocks the jitter buffer can
+	 * grow to, up to #NETAUDIO_MAX_DEPTH.
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int setupReceive(int port, unsigned int numChannels, unsigned int blockSize, unsigned int minDepth = 2, unsigned int maxDepth = 16);
+	/**
+	 * Send a block. This is safe to call from the audio thread.
+	 *
+	 * @param data blockSize frames of interleaved audio.
+	 * @return 0 on success, or an error if the block was dropped because
+	 * too many blocks are waiting to be sent.
+	 */
+	int send(const float* data);
+	/**
+	 * Get the next block. This is safe to call from the audio thread and
+	 * should be called once per block.
+	 *
+	 * @param data where to store blockSize frames of interleaved audio.
+	 * This is silence until enough blocks have been received.
+	 */
+	void receive(float* data);
+	/**
+	 * Get the statistics of the receiving side. This should be called
+	 * from the audio thread.
+	 */
+	Stats getStats() const;
+	static bool test();
+
+private:
+	struct Block {
+		uint32_t seq;
+		std::vector<float> data;
+	};
+	struct SendBatch;
+	struct ReceiveBatch;
+	void sendBlocks(Block* const* blocks, unsigned int count);
+	void onSocketReady();
+	void blockArrived(Block& block);
+	void conceal(float* data);
+	static size_t packetSize(unsigned int numSamples, Format format);
+	static size_t encode(char* dest, uint32_t seq, unsigned int numChannels, unsigned int blockSize, Format format, const float* data);
+	static int decode(const char* src, size_t size, unsigned int numChannels, unsigned int blockSize, uint32_t& seq, float* data);
+
+	// sending side
+	std::unique_ptr<UdpClient> sendSocket;
+	std::unique_ptr<AuxTaskRing<Block>> toNetwork;
+	std::unique_ptr<SendBatch> sendBatch;
+	bool toNetworkHasDoorbell = false;
+	unsigned int sendChannels = 0;
+	unsigned int sendBlockSize = 0;
+	Format sendFormat = kInt16;
+	uint32_t sendSeq = 0;
+	unsigned int sendDropped = 0;
+
+	// receiving side
+	std::unique_ptr<UdpServer> receiveSocket;
+	std::unique_ptr<AuxTaskRing<Block>> toAudio;
+	std::unique_ptr<ReceiveBatch> receiveBatch;
+	int reactorId = -1;
+	std::atomic<unsigned int> receiveDropped{0};
+	unsigned int receiveChannels = 0;
+	unsigned int receiveBlockSize = 0;
+	// owned by the audio thread
+	std::vector<Block> jitter; // indexed by seq % size
+	std::vector<bool> jitterValid;
+	std::vector<float> lastBlock;
+	float concealGain = 0;
+	bool playing = false;
+	uint32_t nextSeq = 0;
+	uint32_t newestSeq = 0;
+	unsigned int minDepth = 0;
+	unsigned int maxDepth = 0;
+	unsigned int targetDepth = 0;
+	unsigned int blocksSinceAdapt = 0;
+	unsigned int minSpare = 0;
+	Stats stats;
+};
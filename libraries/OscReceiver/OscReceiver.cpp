@@ -1,65 +1,295 @@
 #include "OscReceiver.h"
-#include <Bela.h> // gShouldStop
-#include <AuxTaskNonRT.h>
+#include <AuxTaskReactor.h>
+#include <AuxTaskRing.h>
 #include <libraries/UdpServer/UdpServer.h>
+#include <algorithm>
+#include <atomic>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <xenomai_wraps.h>
+
+// OSC timetags count seconds since 1900, in 32.32 fixed point
+static const uint64_t kNtpUnixOffset = 2208988800ULL;
+
+static uint64_t timespecToTimeTag(const struct timespec& ts)
+{
+	return ((ts.tv_sec + kNtpUnixOffset) << 32) | (uint64_t)(ts.tv_nsec * 4.294967296);
+}
+
+// buffers for reading several datagrams with one recvmmsg()
+struct OscReceiver::Batch {
+	std::vector<char> buffers;
+	struct iovec iovecs[OSCRECEIVER_MAX_DATAGRAMS];
+	struct mmsghdr headers[OSCRECEIVER_MAX_DATAGRAMS];
+};
 
 OscReceiver::OscReceiver(){}
 OscReceiver::OscReceiver(int port, std::function<void(oscpkt::Message* msg, void* arg)> on_receive, void* callbackArg){
 	setup(port, on_receive, callbackArg);
 }
 OscReceiver::~OscReceiver(){
-	lShouldStop = true;
-	// allow in-progress read to complete before destructing
-	while(waitingForMessage){
-		usleep(OSCRECEIVER_POLL_US/2);
+	if(reactorId >= 0)
+		AuxTaskReactor::get().remove(reactorId); // waits for onSocketReady() to return
+	// free the messages that are still scheduled
+	onScheduled = nullptr;
+	if(toAudio)
+		toAudio->process();
+	for(unsigned int n = 0; n < numPending; ++n)
+		delete pending[n].msg;
+	if(fromAudio)
+	{
+		fromAudio->cleanup();
+		fromAudio->process();
 	}
 }
 
-void OscReceiver::receive_task_func(){
-	OscReceiver* instance = this;
-	while(!gShouldStop && !instance->lShouldStop){
-		instance->waitingForMessage = true;
-		instance->waitForMessage(0);
-		instance->waitingForMessage = false;
-		usleep(OSCRECEIVER_POLL_US);
-	}
+void OscReceiver::setScheduledCallback(std::function<void(oscpkt::Message* msg, unsigned int frame, void* arg)> _onScheduled, unsigned int maxScheduled){
+	onScheduled = _onScheduled;
+	pending.resize(maxScheduled);
+	numPending = 0;
 }
 
 void OscReceiver::setup(int port, std::function<void(oscpkt::Message* msg, void* arg)> _on_receive, void* callbackArg){
-    
+
     onReceiveArg = callbackArg;
     on_receive = _on_receive;
     pr = std::unique_ptr<oscpkt::PacketReader>(new oscpkt::PacketReader());
-    
+
     socket = std::unique_ptr<UdpServer>(new UdpServer());
     if(!socket->setup(port)){
         fprintf(stderr, "OscReceiver: Unable to initialise UDP socket: %d %s\n", errno, strerror(errno));
         return;
     }
-	
-	receive_task = std::unique_ptr<AuxTaskNonRT>(new AuxTaskNonRT());
-	receive_task->create(std::string("OscReceiverTask_") + std::to_string(port), [this](){receive_task_func(); });
 
-    receive_task->schedule();
+	batch = std::unique_ptr<Batch>(new Batch);
+	batch->buffers.resize(OSCRECEIVER_MAX_DATAGRAMS * OSCRECEIVER_BUFFERSIZE);
+
+	if(onScheduled && pending.size())
+	{
+		// messages go to the audio thread through toAudio, and come
+		// back through fromAudio to be freed
+		toAudio = std::unique_ptr<AuxTaskRing<Scheduled>>(new AuxTaskRing<Scheduled>);
+		toAudio->setup("", pending.size(), [this](Scheduled& s) { scheduledArrived(s); });
+		fromAudio = std::unique_ptr<AuxTaskRing<oscpkt::Message*>>(new AuxTaskRing<oscpkt::Message*>);
+		if(fromAudio->setup(std::string("OscReceiverFree_") + std::to_string(port), pending.size() * 2, [](oscpkt::Message*& msg) { delete msg; }))
+			fprintf(stderr, "OscReceiver: unable to set up the scheduled messages\n");
+	}
+
+	reactorId = AuxTaskReactor::get().addFd(socket->getSocket(), EPOLLIN, [this](int, uint32_t) { onSocketReady(); });
+	if(reactorId < 0)
+		fprintf(stderr, "OscReceiver: unable to watch the UDP socket: %d\n", reactorId);
+}
+
+void OscReceiver::onSocketReady(){
+	Batch& b = *batch;
+	int num;
+	do {
+		for(unsigned int n = 0; n < OSCRECEIVER_MAX_DATAGRAMS; ++n)
+		{
+			b.iovecs[n].iov_base = b.buffers.data() + n * OSCRECEIVER_BUFFERSIZE;
+			b.iovecs[n].iov_len = OSCRECEIVER_BUFFERSIZE;
+			memset(&b.headers[n], 0, sizeof(b.headers[n]));
+			b.headers[n].msg_hdr.msg_iov = &b.iovecs[n];
+			b.headers[n].msg_hdr.msg_iovlen = 1;
+		}
+		num = recvmmsg(socket->getSocket(), b.headers, OSCRECEIVER_MAX_DATAGRAMS, MSG_DONTWAIT, NULL);
+		if(num < 0)
+		{
+			if(EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno)
+				fprintf(stderr, "OscReceiver: Error reading UDP socket: %d %s\n", errno, strerror(errno));
+			break;
+		}
+		for(int n = 0; n < num; ++n)
+		{
+			if(b.headers[n].msg_hdr.msg_flags & MSG_TRUNC)
+			{
+				fprintf(stderr, "OscReceiver: discarding a datagram larger than %d bytes\n", OSCRECEIVER_BUFFERSIZE);
+				continue;
+			}
+			dispatchPacket((const char*)b.iovecs[n].iov_base, b.headers[n].msg_len);
+		}
+		// a full batch means there may be more waiting
+	} while(OSCRECEIVER_MAX_DATAGRAMS == num);
+}
+
+void OscReceiver::dispatchPacket(const char* data, size_t size){
+	pr->init(data, size);
+	if (!pr->isOk()){
+		fprintf(stderr, "OscReceiver: oscpkt error parsing received message: %i\n", pr->getErr());
+		return;
+	}
+	oscpkt::Message* msg;
+	while((msg = pr->popMessage()))
+	{
+		if(toAudio && msg->timeTag() != oscpkt::TimeTag::immediate())
+			schedule(msg);
+		else
+			on_receive(msg, onReceiveArg);
+	}
+}
+
+void OscReceiver::schedule(oscpkt::Message* msg){
+	Scheduled* s = toAudio->reserve();
+	if(!s)
+	{
+		fprintf(stderr, "OscReceiver: too many scheduled messages, dropping %s\n", msg->addressPattern().c_str());
+		return;
+	}
+	s->time = msg->timeTag();
+	s->msg = new oscpkt::Message(msg);
+	toAudio->commit();
 }
 
-int OscReceiver::waitForMessage(int timeout){
-	int ret = socket->waitUntilReady(true, timeout);
-	if (ret == -1){
-		fprintf(stderr, "OscReceiver: Error polling UDP socket: %d %s\n", errno, strerror(errno));
-		return -1;
-	} else if(ret == 1){
-		int msgLength = socket->read(&inBuffer, OSCRECEIVER_BUFFERSIZE, false);
-		if (msgLength < 0){
-			fprintf(stderr, "OscReceiver: Error reading UDP socket: %d %s\n", errno, strerror(errno));
-			return -1;
-        }
-        pr->init(inBuffer, msgLength);
-        if (!pr->isOk()){
-        	fprintf(stderr, "OscReceiver: oscpkt error parsing received message: %i", pr->getErr());
-        	return -1;
-        }
-		on_receive(pr->popMessage(), onReceiveArg);
+// runs in the audio thread, from processScheduled()
+void OscReceiver::scheduledArrived(Scheduled& s){
+	if(!onScheduled)
+	{
+		delete s.msg;
+		return;
+	}
+	if(numPending == pending.size())
+	{
+		// no room: deliver the earliest one now rather than losing it
+		onScheduled(pending[0].msg, 0, onReceiveArg);
+		release(pending[0].msg);
+		std::copy(pending.begin() + 1, pending.begin() + numPending, pending.begin());
+		--numPending;
+	}
+	// keep them sorted, with the ones with the same time in the order
+	// they were sent
+	unsigned int n = numPending;
+	while(n > 0 && pending[n - 1].time > s.time)
+	{
+		pending[n] = pending[n - 1];
+		--n;
+	}
+	pending[n] = s;
+	++numPending;
+}
+
+void OscReceiver::release(oscpkt::Message* msg){
+	oscpkt::Message** slot = fromAudio->reserve();
+	// there is room for all the messages that can be in flight, so
+	// this never fails
+	if(slot)
+	{
+		*slot = msg;
+		fromAudio->commit();
+	}
+}
+
+void OscReceiver::processScheduled(BelaContext* context){
+	if(!toAudio)
+		return;
+	toAudio->process();
+	if(!numPending)
+		return;
+	struct timespec ts;
+	__wrap_clock_gettime(CLOCK_REALTIME, &ts);
+	uint64_t now = timespecToTimeTag(ts);
+	uint64_t blockLength = ((uint64_t)context->audioFrames << 32) / context->audioSampleRate;
+	unsigned int n;
+	for(n = 0; n < numPending; ++n)
+	{
+		int64_t offset = pending[n].time - now;
+		if(offset >= (int64_t)blockLength)
+			break;
+		unsigned int frame = 0;
+		if(offset > 0)
+			frame = std::min(context->audioFrames - 1, (unsigned int)(offset * (double)context->audioSampleRate / 4294967296.0));
+		onScheduled(pending[n].msg, frame, onReceiveArg);
+		release(pending[n].msg);
+	}
+	std::copy(pending.begin() + n, pending.begin() + numPending, pending.begin());
+	numPending -= n;
+}
+
+#undef NDEBUG
+#include <assert.h>
+#include <PRU.h> // InternalBelaContext
+#include <arpa/inet.h>
+
+static void sendPacket(int fd, int port, oscpkt::PacketWriter& pw)
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	assert((ssize_t)pw.packetSize() == sendto(fd, pw.packetData(), pw.packetSize(), 0, (struct sockaddr*)&addr, sizeof(addr)));
+}
+
+bool OscReceiver::test()
+{
+	const int kPort = 7563;
+	std::vector<std::string> received;
+	std::vector<std::string> scheduled;
+	std::vector<unsigned int> frames;
+	std::atomic<unsigned int> numReceived{0};
+	OscReceiver receiver;
+	receiver.setScheduledCallback([&](oscpkt::Message* msg, unsigned int frame, void*) {
+		scheduled.push_back(msg->addressPattern());
+		frames.push_back(frame);
+	});
+	receiver.setup(kPort, [&](oscpkt::Message* msg, void*) {
+		received.push_back(msg->addressPattern());
+		++numReceived;
+	});
+	assert(receiver.reactorId >= 0);
+
+	int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+	assert(fd >= 0);
+	// all the messages of a bundle are delivered
+	oscpkt::PacketWriter pw;
+	pw.startBundle();
+	pw.addMessage(oscpkt::Message("/a").pushFloat(1));
+	pw.addMessage(oscpkt::Message("/b").pushFloat(2));
+	pw.startBundle().addMessage(oscpkt::Message("/c")).endBundle();
+	pw.endBundle();
+	sendPacket(fd, kPort, pw);
+	// as are datagrams sent in a burst
+	const unsigned int kBurst = 3 * OSCRECEIVER_MAX_DATAGRAMS;
+	for(unsigned int n = 0; n < kBurst; ++n)
+	{
+		pw.init().addMessage(oscpkt::Message("/burst").pushInt32(n));
+		sendPacket(fd, kPort, pw);
+	}
+	// a bundle to be delivered from the audio thread in 20ms
+	struct timespec ts;
+	__wrap_clock_gettime(CLOCK_REALTIME, &ts);
+	uint64_t sent = timespecToTimeTag(ts);
+	uint64_t due = sent + (20ULL << 32) / 1000;
+	pw.init().startBundle(oscpkt::TimeTag(due));
+	pw.addMessage(oscpkt::Message("/d"));
+	pw.addMessage(oscpkt::Message("/e"));
+	pw.endBundle();
+	sendPacket(fd, kPort, pw);
+	close(fd);
+
+	for(unsigned int n = 0; n < 1000 && numReceived < 3 + kBurst; ++n)
+		usleep(1000);
+	assert(3 + kBurst == numReceived);
+	assert("/a" == received[0] && "/b" == received[1] && "/c" == received[2]);
+	for(unsigned int n = 0; n < kBurst; ++n)
+		assert("/burst" == received[3 + n]);
+
+	// the audio thread
+	InternalBelaContext context;
+	memset((void*)&context, 0, sizeof(context));
+	context.audioFrames = 16;
+	context.audioSampleRate = 44100;
+	unsigned int blockUs = 1000000 * context.audioFrames / context.audioSampleRate;
+	for(unsigned int n = 0; n < 1000000 / blockUs && scheduled.size() < 2; ++n)
+	{
+		receiver.processScheduled((BelaContext*)&context);
+		if(scheduled.empty())
+			usleep(blockUs);
 	}
-	return ret;
+	__wrap_clock_gettime(CLOCK_REALTIME, &ts);
+	assert(2 == scheduled.size());
+	assert("/d" == scheduled[0] && "/e" == scheduled[1]);
+	assert(frames[0] == frames[1] && frames[0] < context.audioFrames);
+	// not delivered early
+	assert(timespecToTimeTag(ts) + ((uint64_t)context.audioFrames << 32) / context.audioSampleRate >= due);
+	return true;
 }
@@ -1,24 +1,36 @@
 #pragma once
 
+#include <Bela.h>
+#include <functional>
 #include <memory>
+#include <vector>
 #include <oscpkt.hh>	// neccesary for definition of oscpkt::Message in callback
 
 // forward declarations to speed up compilation
-class AuxTaskNonRT;
 class UdpServer;
+template <typename T> class AuxTaskRing;
 
-#define OSCRECEIVER_POLL_US 5000
 #define OSCRECEIVER_BUFFERSIZE 65536
+#define OSCRECEIVER_MAX_DATAGRAMS 8
 
 /**
  * \brief OscReceiver provides functions for receiving OSC messages in Bela.
  *
- * When an OSC message is received over UDP on the port number passed to 
+ * When an OSC message is received over UDP on the port number passed to
  * OscReceiver::setup() it is passed in the form of an oscpkt::Message
  * to the onreceive callback. This callback, which must be passed to
- * OscReceiver::setup() by the user, is run off the audio thread at 
+ * OscReceiver::setup() by the user, is run off the audio thread at
  * non-realtime priority.
  *
+ * The socket is watched by the shared AuxTaskReactor, so that messages are
+ * handled as soon as they arrive. Up to #OSCRECEIVER_MAX_DATAGRAMS datagrams
+ * are read with each system call and every message of every bundle is
+ * passed to the callback.
+ *
+ * Messages in bundles with a timetag other than "immediately" can instead
+ * be delivered from the audio thread at the frame they are due, see
+ * setScheduledCallback().
+ *
  * For documentation of oscpkt see http://gruntthepeon.free.fr/oscpkt/
  */
 class OscReceiver{
@@ -26,7 +38,7 @@ class OscReceiver{
         OscReceiver();
         OscReceiver(int port, std::function<void(oscpkt::Message* msg, void* arg)> on_receive, void* callbackArg = nullptr);
         ~OscReceiver();
-	
+
         /**
 		 * \brief Initiliases OscReceiver
 		 *
@@ -38,21 +50,57 @@ class OscReceiver{
 		 *
 		 */
         void setup(int port, std::function<void(oscpkt::Message* msg, void* arg)> on_receive, void* callbackArg = nullptr);
-        
+        /**
+		 * \brief Deliver timetagged messages from the audio thread
+		 *
+		 * Once this is set, the messages of bundles with a timetag other
+		 * than "immediately" are passed to @p onScheduled from within
+		 * processScheduled(), in the block that contains their timetag,
+		 * together with the frame within that block. Late messages are
+		 * delivered at frame 0 of the next block. Other messages still
+		 * go to the callback passed to setup().
+		 *
+		 * Must be called before setup().
+		 *
+		 * @param onScheduled the callback. It runs in the audio thread,
+		 * so it should not allocate memory or block.
+		 * @param maxScheduled the largest number of messages that can be
+		 * waiting to be delivered. Further ones are dropped.
+		 */
+        void setScheduledCallback(std::function<void(oscpkt::Message* msg, unsigned int frame, void* arg)> onScheduled, unsigned int maxScheduled = 256);
+        /**
+		 * \brief Deliver the scheduled messages due in the current block
+		 *
+		 * Call this once per block from render().
+		 */
+        void processScheduled(BelaContext* context);
+        static bool test();
+
     private:
-    	bool lShouldStop = false;
-    	
-    	volatile bool waitingForMessage = false;
-    	int waitForMessage(int timeout_ms);
-    	
+    	struct Batch;
+    	struct Scheduled {
+    		uint64_t time;
+    		oscpkt::Message* msg;
+    	};
+    	void onSocketReady();
+    	void dispatchPacket(const char* data, size_t size);
+    	void schedule(oscpkt::Message* msg);
+    	void scheduledArrived(Scheduled& s);
+    	void release(oscpkt::Message* msg);
+
+    	int reactorId = -1;
+
         std::unique_ptr<UdpServer> socket;
+        std::unique_ptr<Batch> batch;
 
-        std::unique_ptr<AuxTaskNonRT> receive_task;
-        void receive_task_func();
-		
         std::unique_ptr<oscpkt::PacketReader> pr;
-        char* inBuffer[OSCRECEIVER_BUFFERSIZE];
-        
+
         std::function<void(oscpkt::Message* msg, void* arg)> on_receive;
         void* onReceiveArg = nullptr;
+
+        std::function<void(oscpkt::Message* msg, unsigned int frame, void* arg)> onScheduled;
+        std::unique_ptr<AuxTaskRing<Scheduled>> toAudio;
+        std::unique_ptr<AuxTaskRing<oscpkt::Message*>> fromAudio;
+        std::vector<Scheduled> pending; // sorted by time, owned by the audio thread
+        unsigned int numPending = 0;
 };
@@ -1,64 +1,410 @@
 /***** OscSender.cpp *****/
 #include "OscSender.h"
-#include <Bela.h>
 #include <libraries/UdpClient/UdpClient.h>
-#include <oscpkt.hh>
-#include <AuxTaskNonRT.h>
+#include <AuxTaskRing.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// "#bundle\0" followed by the timetag
+static const size_t kBundleHeaderSize = 16;
 
-#define OSCSENDER_MAX_ARGS 1024
-#define OSCSENDER_MAX_BYTES 65536
+static size_t pad4(size_t size)
+{
+	return (size + 3) & ~3;
+}
+
+// OSC is big-endian
+static void writeInt32(char* dest, uint32_t value)
+{
+	dest[0] = value >> 24;
+	dest[1] = value >> 16;
+	dest[2] = value >> 8;
+	dest[3] = value;
+}
+
+// headers for sending several packets with one sendmmsg()
+struct OscSender::Batch {
+	struct iovec iovecs[OSCSENDER_MAX_DATAGRAMS];
+	struct mmsghdr headers[OSCSENDER_MAX_DATAGRAMS];
+};
 
 OscSender::OscSender(){}
 OscSender::OscSender(int port, std::string ip_address){
 	setup(port, ip_address);
 }
-OscSender::~OscSender(){}
-
-void OscSender::send_task_func(void* buf, int size){
-	OscSender* instance = this;
-	instance->socket->send(buf, size);
+OscSender::~OscSender(){
+	if(!ring)
+		return;
+	// send what is left
+	flush();
+	// waits for sendPackets() to return
+	ring->cleanup();
+	ring->process();
 }
 
-void OscSender::setup(int port, std::string ip_address){
+int OscSender::setup(int port, std::string ip_address, unsigned int numPackets, unsigned int packetBytes){
+	ring.reset();
+	this->packetBytes = packetBytes;
+	address.resize(packetBytes);
+	tags.resize(OSCSENDER_MAX_ARGS);
+	args.resize(packetBytes);
+	overflow = true;
+	bundle = nullptr;
 
-    pw = std::unique_ptr<oscpkt::PacketWriter>(new oscpkt::PacketWriter());
-    msg = std::unique_ptr<oscpkt::Message>(new oscpkt::Message());
-    msg->reserve(OSCSENDER_MAX_ARGS, OSCSENDER_MAX_BYTES);
-    
-    socket = std::unique_ptr<UdpClient>(new UdpClient());
-	socket->setup(port, ip_address.c_str());
-	
-	send_task = std::unique_ptr<AuxTaskNonRT>(new AuxTaskNonRT());
-	send_task->create(std::string("OscSenderTask_") + std::to_string(port), [this](void* buf, int size){send_task_func(buf, size); });
+	socket = std::unique_ptr<UdpClient>(new UdpClient());
+	if(!socket->setup(port, ip_address.c_str()))
+	{
+		fprintf(stderr, "OscSender: Unable to initialise UDP socket: %d %s\n", errno, strerror(errno));
+		return -1;
+	}
+
+	batch = std::unique_ptr<Batch>(new Batch);
+	Packet prototype;
+	prototype.data.resize(packetBytes);
+	prototype.size = 0;
+	ring = std::unique_ptr<AuxTaskRing<Packet>>(new AuxTaskRing<Packet>);
+	if(ring->setup(std::string("OscSenderTask_") + std::to_string(port), numPackets, OSCSENDER_MAX_DATAGRAMS, [this](Packet* const* packets, unsigned int count) { sendPackets(packets, count); }, prototype))
+	{
+		// nothing would ever send the packets
+		fprintf(stderr, "OscSender: unable to set up the send task\n");
+		ring.reset();
+		return -1;
+	}
+	return 0;
 }
 
-OscSender &OscSender::newMessage(std::string address){
-	msg->init(address);
+OscSender &OscSender::newMessage(const char* address){
+	size_t size = strlen(address);
+	overflow = size >= this->address.size();
+	if(!overflow)
+		memcpy(this->address.data(), address, size);
+	addressSize = size;
+	numTags = 0;
+	argsSize = 0;
 	return *this;
 }
 
+char* OscSender::addArg(char tag, size_t size){
+	if(overflow || numTags >= tags.size() || argsSize + size > args.size())
+	{
+		overflow = true;
+		return nullptr;
+	}
+	tags[numTags++] = tag;
+	char* dest = args.data() + argsSize;
+	// so that the padding is zeroed
+	memset(dest, 0, size);
+	argsSize += size;
+	return dest;
+}
+
 OscSender &OscSender::add(int payload){
-	msg->pushInt32(payload);
+	char* dest = addArg('i', 4);
+	if(dest)
+		writeInt32(dest, payload);
 	return *this;
 }
 OscSender &OscSender::add(float payload){
-	msg->pushFloat(payload);
+	char* dest = addArg('f', 4);
+	if(dest)
+	{
+		uint32_t value;
+		memcpy(&value, &payload, sizeof(value));
+		writeInt32(dest, value);
+	}
 	return *this;
 }
-OscSender &OscSender::add(std::string payload){
-	msg->pushStr(payload);
+OscSender &OscSender::add(const char* payload){
+	size_t size = strlen(payload);
+	char* dest = addArg('s', pad4(size + 1));
+	if(dest)
+		memcpy(dest, payload, size);
 	return *this;
 }
 OscSender &OscSender::add(bool payload){
-	msg->pushBool(payload);
+	addArg(payload ? 'T' : 'F', 0);
 	return *this;
 }
-OscSender &OscSender::add(void *ptr, size_t num_bytes){
-	msg->pushBlob(ptr, num_bytes);
+OscSender &OscSender::add(const void *ptr, size_t num_bytes){
+	char* dest = addArg('b', 4 + pad4(num_bytes));
+	if(dest)
+	{
+		writeInt32(dest, num_bytes);
+		memcpy(dest + 4, ptr, num_bytes);
+	}
 	return *this;
 }
 
+size_t OscSender::messageSize() const {
+	if(overflow)
+		return 0;
+	// the type tags start with ',' and end with '\0'
+	return pad4(addressSize + 1) + pad4(numTags + 2) + argsSize;
+}
+
+void OscSender::writeMessage(char* dest) const {
+	size_t size = pad4(addressSize + 1);
+	memset(dest + addressSize, 0, size - addressSize);
+	memcpy(dest, address.data(), addressSize);
+	dest += size;
+	size = pad4(numTags + 2);
+	memset(dest + numTags + 1, 0, size - numTags - 1);
+	dest[0] = ',';
+	memcpy(dest + 1, tags.data(), numTags);
+	dest += size;
+	memcpy(dest, args.data(), argsSize);
+}
+
 void OscSender::send(){
-	pw->init().addMessage(*msg);
-	send_task->schedule(pw->packetData(), pw->packetSize());
+	if(!ring)
+	{
+		++numDropped;
+		return;
+	}
+	// keep the messages in the order they were sent
+	commitBundle();
+	size_t size = messageSize();
+	Packet* packet = ring->reserve();
+	if(!size || size > packetBytes || !packet)
+	{
+		++numDropped;
+		return;
+	}
+	writeMessage(packet->data.data());
+	packet->size = size;
+	ring->commit();
+}
+
+void OscSender::send(const BelaContext* context){
+	if(!ring)
+	{
+		++numDropped;
+		return;
+	}
+	size_t size = messageSize();
+	if(!size || kBundleHeaderSize + 4 + size > packetBytes)
+	{
+		++numDropped;
+		return;
+	}
+	if(bundle && (bundleFrame != context->audioFramesElapsed || bundle->size + 4 + size > packetBytes))
+		commitBundle();
+	if(!bundle)
+	{
+		bundle = ring->reserve();
+		if(!bundle)
+		{
+			++numDropped;
+			return;
+		}
+		char* dest = bundle->data.data();
+		memcpy(dest, "#bundle", 8);
+		// the timetag 1 means "immediately"
+		writeInt32(dest + 8, 0);
+		writeInt32(dest + 12, 1);
+		bundle->size = kBundleHeaderSize;
+		bundleFrame = context->audioFramesElapsed;
+	}
+	char* dest = bundle->data.data() + bundle->size;
+	writeInt32(dest, size);
+	writeMessage(dest + 4);
+	bundle->size += 4 + size;
+}
+
+void OscSender::flush(){
+	if(ring)
+		commitBundle();
+}
+
+void OscSender::commitBundle(){
+	if(!bundle)
+		return;
+	ring->commit();
+	bundle = nullptr;
+}
+
+void OscSender::sendPackets(Packet* const* packets, unsigned int count){
+	Batch& b = *batch;
+	const struct sockaddr_in& destination = socket->getDestination();
+	for(unsigned int n = 0; n < count; ++n)
+	{
+		b.iovecs[n].iov_base = packets[n]->data.data();
+		b.iovecs[n].iov_len = packets[n]->size;
+		memset(&b.headers[n], 0, sizeof(b.headers[n]));
+		b.headers[n].msg_hdr.msg_name = (void*)&destination;
+		b.headers[n].msg_hdr.msg_namelen = sizeof(destination);
+		b.headers[n].msg_hdr.msg_iov = &b.iovecs[n];
+		b.headers[n].msg_hdr.msg_iovlen = 1;
+	}
+	unsigned int sent = 0;
+	while(sent < count)
+	{
+		int ret = sendmmsg(socket->getSocket(), b.headers + sent, count - sent, 0);
+		if(ret < 0)
+		{
+			if(EINTR == errno)
+				continue;
+			fprintf(stderr, "OscSender: Error sending UDP packet: %d %s\n", errno, strerror(errno));
+			break;
+		}
+		sent += ret;
+	}
+}
+
+#undef NDEBUG
+#include <assert.h>
+#include <PRU.h> // InternalBelaContext
+#include <oscpkt.hh>
+#include <time.h>
+
+static size_t receivePacket(int fd, std::vector<char>& buffer)
+{
+	ssize_t ret = recv(fd, buffer.data(), buffer.size(), 0);
+	assert(ret > 0);
+	return ret;
+}
+
+bool OscSender::test()
+{
+	const int kPort = 7564;
+	int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+	assert(fd >= 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(kPort);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	assert(0 == bind(fd, (struct sockaddr*)&addr, sizeof(addr)));
+	struct timeval timeout = { 1, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	std::vector<char> buffer(65536);
+	oscpkt::PacketReader pr;
+	oscpkt::Message* msg;
+
+	const unsigned int kNumPackets = 4;
+	const unsigned int kPacketBytes = 256;
+	OscSender sender;
+	assert(0 == sender.setup(kPort, "127.0.0.1", kNumPackets, kPacketBytes));
+
+	// all argument types, decoded by oscpkt
+	const char blob[] = { 1, 2, 3, 4, 5 };
+	sender.newMessage("/args").add(42).add(1.5f).add("hello").add(std::string("world")).add(true).add(false).add(blob, sizeof(blob)).send();
+	pr.init(buffer.data(), receivePacket(fd, buffer));
+	assert(pr.isOk());
+	msg = pr.popMessage();
+	assert(msg && "/args" == msg->addressPattern());
+	int i;
+	float f;
+	std::string s1, s2;
+	bool b1, b2;
+	std::vector<char> blobOut;
+	assert(msg->arg().popInt32(i).popFloat(f).popStr(s1).popStr(s2).popBool(b1).popBool(b2).popBlob(blobOut).isOkNoMoreArgs());
+	assert(42 == i && 1.5f == f && "hello" == s1 && "world" == s2 && b1 && !b2);
+	assert(blobOut == std::vector<char>(blob, blob + sizeof(blob)));
+	assert(!pr.popMessage());
+
+	// messages sent with a context are bundled per block
+	InternalBelaContext context;
+	memset((void*)&context, 0, sizeof(context));
+	context.audioFrames = 16;
+	for(int n = 0; n < 3; ++n)
+		sender.newMessage("/block0").add(n).send((BelaContext*)&context);
+	// the bundle is still open, so nothing has been sent
+	usleep(1000);
+	assert(recv(fd, buffer.data(), buffer.size(), MSG_DONTWAIT) < 0);
+	context.audioFramesElapsed += context.audioFrames;
+	sender.newMessage("/block1").send((BelaContext*)&context);
+	pr.init(buffer.data(), receivePacket(fd, buffer));
+	assert(pr.isOk());
+	for(int n = 0; n < 3; ++n)
+	{
+		msg = pr.popMessage();
+		assert(msg && msg->timeTag() == oscpkt::TimeTag::immediate());
+		assert(msg->match("/block0").popInt32(i).isOkNoMoreArgs() && n == i);
+	}
+	assert(!pr.popMessage());
+	// send() goes after the bundle that is open
+	sender.newMessage("/single").send();
+	sender.flush();
+	pr.init(buffer.data(), receivePacket(fd, buffer));
+	msg = pr.popMessage();
+	assert(msg && msg->match("/block1").isOkNoMoreArgs());
+	assert(!pr.popMessage());
+	pr.init(buffer.data(), receivePacket(fd, buffer));
+	msg = pr.popMessage();
+	assert(msg && msg->match("/single").isOkNoMoreArgs());
+
+	// a full bundle is sent and a new one started
+	unsigned int perBundle = (kPacketBytes - kBundleHeaderSize) / (4 + 16);
+	context.audioFramesElapsed += context.audioFrames;
+	for(unsigned int n = 0; n < perBundle + 1; ++n)
+		sender.newMessage("/full").add(1.f).send((BelaContext*)&context);
+	for(unsigned int expected : { perBundle, 1u })
+	{
+		if(1 == expected)
+			sender.flush();
+		pr.init(buffer.data(), receivePacket(fd, buffer));
+		unsigned int count = 0;
+		while(pr.popMessage())
+			++count;
+		assert(expected == count);
+	}
+
+	// too large, or no room
+	assert(0 == sender.getNumDropped());
+	std::vector<char> large(kPacketBytes);
+	sender.newMessage("/large").add(large.data(), large.size()).send();
+	assert(1 == sender.getNumDropped());
+	// a sender that is not set up drops everything
+	OscSender unset;
+	unset.newMessage("/unset").send();
+	unset.newMessage("/unset").send((BelaContext*)&context);
+	assert(2 == unset.getNumDropped());
+	close(fd);
+	return true;
+}
+
+void OscSender::benchmark()
+{
+	const unsigned int kBlocks = 1000;
+	const unsigned int kMessagesPerBlock = 32;
+	OscSender sender;
+	sender.setup(7565, "127.0.0.1");
+	// wait for the packets to be sent by the reactor
+	auto drain = [&sender]() {
+		while(sender.ring && sender.ring->pending())
+			usleep(100);
+	};
+	InternalBelaContext context;
+	memset((void*)&context, 0, sizeof(context));
+	context.audioFrames = 16;
+	for(bool bundled : { false, true })
+	{
+		double elapsed = 0;
+		unsigned int dropped = sender.getNumDropped();
+		for(unsigned int n = 0; n < kBlocks; ++n)
+		{
+			// the time spent in render()
+			struct timespec start, end;
+			clock_gettime(CLOCK_MONOTONIC, &start); // NOWRAP
+			for(unsigned int m = 0; m < kMessagesPerBlock; ++m)
+			{
+				sender.newMessage("/bench").add((int)m).add(0.5f).add(0.25f);
+				if(bundled)
+					sender.send((BelaContext*)&context);
+				else
+					sender.send();
+			}
+			sender.flush();
+			clock_gettime(CLOCK_MONOTONIC, &end); // NOWRAP
+			elapsed += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+			context.audioFramesElapsed += context.audioFrames;
+			drain();
+		}
+		printf("OscSender: %s: %.0f messages per second from render() (%u dropped)\n",
+				bundled ? "bundled" : "one packet per message",
+				kBlocks * kMessagesPerBlock / elapsed, sender.getNumDropped() - dropped);
+	}
 }
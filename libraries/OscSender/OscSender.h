@@ -1,30 +1,43 @@
 #pragma once
 
+#include <Bela.h>
 #include <memory>
+#include <string>
 #include <vector>
 
 class UdpClient;
-class AuxTaskNonRT;
-namespace oscpkt{
-	class Message;
-	class PacketWriter;
-}
+template <typename T> class AuxTaskRing;
+
+#define OSCSENDER_MAX_ARGS 1024
+#define OSCSENDER_NUM_PACKETS 32
+#define OSCSENDER_PACKET_BYTES 16384
+#define OSCSENDER_MAX_DATAGRAMS 8
 
 /**
  * \brief OscSender provides functions for sending OSC messages from Bela.
  *
- * Functionality is provided for sending messages with int, float, bool, 
- * std::string and binary blob arguments. Sending a stream of floats is
+ * Functionality is provided for sending messages with int, float, bool,
+ * string and binary blob arguments. Sending a stream of floats is
  * also supported.
  *
- * Uses oscpkt (http://gruntthepeon.free.fr/oscpkt/) underneath
+ * Messages are encoded straight into buffers that are allocated in setup(),
+ * so that building and sending them does not allocate memory and is safe
+ * from the audio thread. A message that does not fit in a packet (see
+ * setup()) or that is sent while all the packets are still waiting to go
+ * out is dropped, see getNumDropped().
+ *
+ * The packets are sent off the audio thread, up to #OSCSENDER_MAX_DATAGRAMS
+ * with each system call.
+ *
+ * The OSC encoding is compatible with oscpkt
+ * (http://gruntthepeon.free.fr/oscpkt/)
  */
 class OscSender{
 	public:
 		OscSender();
 		OscSender(int port, std::string ip_address=std::string("127.0.0.1"));
 		~OscSender();
-		
+
         /**
 		 * \brief Initialises OscSender
 		 *
@@ -34,17 +47,25 @@ class OscSender{
 		 *
 		 * @param port the UDP port number used to send OSC messages
 		 * @param address the IP address OSC messages are sent to (defaults to 127.0.0.1)
-		 *
+		 * @param numPackets the number of packets that can be waiting to
+		 * be sent at any time
+		 * @param packetBytes the largest packet that can be sent. This
+		 * is also the largest message or bundle.
+		 *
+		 * @return 0 on success, or -1 if the socket or the task that
+		 * sends the packets could not be set up, in which case all
+		 * messages are dropped.
 		 */
-		void setup(int port, std::string ip_address=std::string("127.0.0.1"));
-		
+		int setup(int port, std::string ip_address=std::string("127.0.0.1"), unsigned int numPackets = OSCSENDER_NUM_PACKETS, unsigned int packetBytes = OSCSENDER_PACKET_BYTES);
+
 		/**
 		 * \brief Creates a new OSC message
 		 *
 		 * @param address the address which the OSC message will be sent to
 		 *
 		 */
-		OscSender &newMessage(std::string address);
+		OscSender &newMessage(const char* address);
+		OscSender &newMessage(const std::string& address) { return newMessage(address.c_str()); }
 		/**
 		 * \brief Adds an int argument to a message
 		 *
@@ -71,7 +92,8 @@ class OscSender{
 		 *
 		 * @param payload the argument to be added to the message
 		 */
-		OscSender &add(std::string payload);
+		OscSender &add(const char* payload);
+		OscSender &add(const std::string& payload) { return add(payload.c_str()); }
 		/**
 		 * \brief Adds a boolean argument to a message
 		 *
@@ -91,22 +113,71 @@ class OscSender{
 		 * @param ptr pointer to the data to be sent
 		 * @param num_bytes the number of bytes to be sent
 		 */
-		OscSender &add(void *ptr, size_t num_bytes);
+		OscSender &add(const void *ptr, size_t num_bytes);
 		/**
 		 * \brief Sends the message
 		 *
 		 * After creating a message with newMessage() and adding arguments to it
-		 * with add(), the message is sent with this function. It is safe to call
-		 * from the audio thread.
+		 * with add(), the message is sent with this function in a packet
+		 * of its own. It is safe to call from the audio thread.
 		 *
 		 */
 		void send();
+		/**
+		 * \brief Sends the message as part of the bundle of the current block
+		 *
+		 * All the messages sent with this function during the same block
+		 * go out in a single bundle with an "immediately" timetag, which
+		 * is sent when flush() is called, when a message is sent from a
+		 * later block, or when the bundle is full. It is safe to call from
+		 * the audio thread.
+		 *
+		 * @param context the context of the block the message belongs to.
+		 */
+		void send(const BelaContext* context);
+		/**
+		 * \brief Sends the bundle started by send(const BelaContext*)
+		 *
+		 * Call this at the end of render() so that the bundle of the
+		 * current block does not wait for the next one.
+		 */
+		void flush();
+		/**
+		 * @return the number of messages dropped so far because they
+		 * did not fit in a packet or no packet was available.
+		 */
+		unsigned int getNumDropped() const { return numDropped; }
+		static bool test();
+		static void benchmark();
+
+	private:
+		struct Packet {
+			std::vector<char> data;
+			size_t size;
+		};
+		struct Batch;
+		char* addArg(char tag, size_t size);
+		size_t messageSize() const;
+		void writeMessage(char* dest) const;
+		void commitBundle();
+		void sendPackets(Packet* const* packets, unsigned int count);
+
+		std::unique_ptr<UdpClient> socket;
+		std::unique_ptr<AuxTaskRing<Packet>> ring;
+		std::unique_ptr<Batch> batch;
+		unsigned int packetBytes = 0;
 
-        	std::unique_ptr<UdpClient> socket;
-        
-        	std::unique_ptr<oscpkt::Message> msg;
-        	std::unique_ptr<oscpkt::PacketWriter> pw;
+		// the message being built
+		std::vector<char> address;
+		std::vector<char> tags;
+		std::vector<char> args;
+		size_t addressSize = 0;
+		size_t numTags = 0;
+		size_t argsSize = 0;
+		bool overflow = false;
 
-		std::unique_ptr<AuxTaskNonRT> send_task;
-		void send_task_func(void* buf, int size);
+		// the bundle being built, reserved from ring but not committed yet
+		Packet* bundle = nullptr;
+		uint64_t bundleFrame = 0;
+		unsigned int numDropped = 0;
 };
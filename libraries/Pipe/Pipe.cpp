@@ -84,8 +84,12 @@ void Pipe::setTimeoutMsNonRt(double timeoutMs)
 
 void Pipe::cleanup()
 {
-	close(fd);
-	__wrap_close(pipeSocket);
+	if(fd >= 0)
+		close(fd);
+	if(pipeSocket >= 0)
+		__wrap_close(pipeSocket);
+	fd = -1;
+	pipeSocket = -1;
 }
 
 bool Pipe::_writeNonRt(void* ptr, size_t size)
@@ -135,6 +139,347 @@ ssize_t Pipe::_readNonRt(void* ptr, size_t size)
 	return read(fd, ptr, size);
 }
 
+// each message starts with its size, or with kWrapMarker if it continues
+// from the start of the buffer
+static const uint32_t kWrapMarker = 0xFFFFFFFF;
+static const size_t kMessageHeaderSize = 8;
+
+static size_t messageSpace(size_t size)
+{
+	return kMessageHeaderSize + ((size + 7) & ~(size_t)7);
+}
+
+void Pipe::MessageQueue::setup(size_t size)
+{
+	size_t bytes = 64;
+	while(bytes < size)
+		bytes <<= 1;
+	buffer.assign(bytes / sizeof(buffer[0]), 0);
+	mask = bytes - 1;
+	reserved = false;
+	readCursor = 0;
+	writeIdx = 0;
+	readIdx = 0;
+}
+
+void* Pipe::MessageQueue::reserve(size_t size)
+{
+	if(!isSetup() || size >= kWrapMarker)
+		return NULL;
+	size_t capacity = mask + 1;
+	size_t w = writeIdx.load(std::memory_order_relaxed);
+	size_t available = capacity - (w - readIdx.load(std::memory_order_acquire));
+	size_t needed = messageSpace(size);
+	size_t start = w;
+	// messages are contiguous: skip the end of the buffer if it
+	// doesn't fit there
+	size_t untilEnd = capacity - (w & mask);
+	if(needed > untilEnd)
+	{
+		start += untilEnd;
+		needed += untilEnd;
+	}
+	if(needed > available)
+		return NULL;
+	reserved = true;
+	reservedStart = start;
+	reservedSize = size;
+	return getData() + (start & mask) + kMessageHeaderSize;
+}
+
+bool Pipe::MessageQueue::commit(size_t size)
+{
+	if(kReserved == size)
+		size = reservedSize;
+	if(!reserved || size > reservedSize)
+		return false;
+	size_t w = writeIdx.load(std::memory_order_relaxed);
+	if(reservedStart != w)
+		*(uint32_t*)(getData() + (w & mask)) = kWrapMarker;
+	*(uint32_t*)(getData() + (reservedStart & mask)) = size;
+	writeIdx.store(reservedStart + messageSpace(size), std::memory_order_release);
+	reserved = false;
+	return true;
+}
+
+bool Pipe::MessageQueue::read(Message& msg)
+{
+	size_t r = readCursor;
+	if(!isSetup() || r == writeIdx.load(std::memory_order_acquire))
+		return false;
+	uint32_t size = *(uint32_t*)(getData() + (r & mask));
+	if(kWrapMarker == size)
+	{
+		r += mask + 1 - (r & mask);
+		size = *(uint32_t*)(getData() + (r & mask));
+	}
+	msg.data = getData() + (r & mask) + kMessageHeaderSize;
+	msg.size = size;
+	readCursor = r + messageSpace(size);
+	return true;
+}
+
+void Pipe::MessageQueue::release()
+{
+	readIdx.store(readCursor, std::memory_order_release);
+}
+
+bool Pipe::setupMessages(size_t size)
+{
+	toNonRt.setup(size);
+	toRt.setup(size);
+	return true;
+}
+
+bool Pipe::commitRt(size_t size)
+{
+	if(!toNonRt.commit(size))
+		return false;
+	// wake up a reader waiting in readMessageNonRt()
+	if(blockingNonRt && pipeSocket >= 0)
+	{
+		char token = 0;
+		__wrap_send(pipeSocket, &token, sizeof(token), 0);
+	}
+	return true;
+}
+
+bool Pipe::commitNonRt(size_t size)
+{
+	if(!toRt.commit(size))
+		return false;
+	// wake up a reader waiting in readMessageRt()
+	if(blockingRt && fd >= 0)
+	{
+		char token = 0;
+		write(fd, &token, sizeof(token));
+	}
+	return true;
+}
+
+bool Pipe::waitNonRt()
+{
+	if(fd < 0)
+		return false;
+	fd_set fdSet;
+	FD_ZERO(&fdSet);
+	FD_SET(fd, &fdSet);
+	struct timeval tv;
+	tv.tv_sec = ((unsigned int)timeoutMsNonRt) / 1000;
+	tv.tv_usec = (timeoutMsNonRt - tv.tv_sec * 1000.f) * 1000.f;
+	if(1 != select(fd + 1, &fdSet, NULL, NULL, timeoutMsNonRt > 0 ? &tv : NULL))
+		return false;
+	// the tokens only tell us that something was committed
+	char tokens[64];
+	read(fd, tokens, sizeof(tokens));
+	return true;
+}
+
+bool Pipe::waitRt()
+{
+	if(pipeSocket < 0)
+		return false;
+	fd_set fdSet;
+	FD_ZERO(&fdSet);
+	FD_SET(pipeSocket, &fdSet);
+	struct timeval tv;
+	tv.tv_sec = ((unsigned int)timeoutMsRt) / 1000;
+	tv.tv_usec = (timeoutMsRt - tv.tv_sec * 1000.f) * 1000.f;
+	if(1 != __wrap_select(pipeSocket + 1, &fdSet, NULL, NULL, &tv))
+		return false;
+	char tokens[64];
+	__wrap_recv(pipeSocket, tokens, sizeof(tokens), 0);
+	return true;
+}
+
+bool Pipe::readMessageNonRt(Message& msg)
+{
+	while(!toNonRt.read(msg))
+	{
+		if(!blockingNonRt || !waitNonRt())
+			return false;
+	}
+	return true;
+}
+
+size_t Pipe::readMessagesNonRt(Message* msgs, size_t maxCount)
+{
+	size_t n = 0;
+	while(n < maxCount && toNonRt.read(msgs[n]))
+		++n;
+	return n;
+}
+
+void Pipe::releaseNonRt()
+{
+	toNonRt.release();
+}
+
+bool Pipe::readMessageRt(Message& msg)
+{
+	while(!toRt.read(msg))
+	{
+		if(!blockingRt || !waitRt())
+			return false;
+	}
+	return true;
+}
+
+size_t Pipe::readMessagesRt(Message* msgs, size_t maxCount)
+{
+	size_t n = 0;
+	while(n < maxCount && toRt.read(msgs[n]))
+		++n;
+	return n;
+}
+
+void Pipe::releaseRt()
+{
+	toRt.release();
+}
+
+#undef NDEBUG
+#include <assert.h>
+#include <time.h>
+
+bool Pipe::test()
+{
+	// only the message queues, which don't need Xenomai
+	Pipe pipe;
+	const size_t kSize = 256;
+	pipe.setupMessages(kSize);
+	Message msgs[8];
+
+	// in place, typed, and shorter than reserved
+	assert(!pipe.commitRt());
+	float* floats = pipe.reserveRt<float>(10);
+	assert(floats);
+	for(unsigned int n = 0; n < 10; ++n)
+		floats[n] = n;
+	assert(pipe.commitRt());
+	int* ints = pipe.reserveRt<int>(3);
+	assert(ints);
+	ints[0] = 42;
+	ints[1] = 43;
+	assert(!pipe.commitRt(4 * sizeof(int)));
+	assert(pipe.commitRt(2 * sizeof(int)));
+	assert(!pipe.readMessagesRt(msgs, 8));
+	assert(2 == pipe.readMessagesNonRt(msgs, 8));
+	assert(10 == msgs[0].count<float>() && 9 == msgs[0].get<float>()[9]);
+	assert(2 == msgs[1].count<int>() && 43 == msgs[1].get<int>()[1]);
+	pipe.releaseNonRt();
+	assert(!pipe.readMessageNonRt(msgs[0]));
+	assert(!pipe.reserveRt<char>(kSize));
+
+	// variable lengths, in both directions, with the buffer wrapping
+	// around many times
+	for(unsigned int dir = 0; dir < 2; ++dir)
+	{
+		unsigned int written = 0;
+		unsigned int read = 0;
+		for(unsigned int n = 0; n < 200; ++n)
+		{
+			// fill it up
+			while(1)
+			{
+				unsigned int count = written % 37;
+				int* dest = dir ? pipe.reserveNonRt<int>(count) : pipe.reserveRt<int>(count);
+				if(!dest)
+					break;
+				for(unsigned int c = 0; c < count; ++c)
+					dest[c] = written + c;
+				assert(dir ? pipe.commitNonRt() : pipe.commitRt());
+				++written;
+			}
+			// empty it in batches
+			unsigned int count;
+			while((count = dir ? pipe.readMessagesRt(msgs, 3) : pipe.readMessagesNonRt(msgs, 3)))
+			{
+				for(unsigned int m = 0; m < count; ++m, ++read)
+				{
+					assert(read % 37 == msgs[m].count<int>());
+					for(unsigned int c = 0; c < msgs[m].count<int>(); ++c)
+						assert((int)(read + c) == msgs[m].get<int>()[c]);
+				}
+				dir ? pipe.releaseRt() : pipe.releaseNonRt();
+			}
+			assert(read == written);
+		}
+		// the largest message that always fits
+		for(unsigned int n = 0; n < 10; ++n)
+		{
+			unsigned int size = kSize / 2 - kMessageHeaderSize - n * 8;
+			assert(dir ? pipe.reserveNonRt<char>(size) : pipe.reserveRt<char>(size));
+			assert(dir ? pipe.commitNonRt() : pipe.commitRt());
+			assert(dir ? pipe.readMessageRt(msgs[0]) : pipe.readMessageNonRt(msgs[0]));
+			assert(size == msgs[0].size);
+			dir ? pipe.releaseRt() : pipe.releaseNonRt();
+		}
+	}
+	return true;
+}
+
+void Pipe::benchmark()
+{
+	const unsigned int kIterations = 20000;
+	const unsigned int kMaxCount = 1024;
+	Pipe pipe("PipeBenchmark", 65536 * 16, false, false);
+	pipe.setupMessages(65536 * 16);
+	std::vector<float> frame(kMaxCount);
+	std::vector<float> received(kMaxCount);
+	for(unsigned int mode = 0; mode < 3; ++mode)
+	{
+		struct timespec start, end;
+		size_t bytes = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start); // NOWRAP
+		for(unsigned int n = 0; n < kIterations; n += 8)
+		{
+			// a few frames of variable length are written from the
+			// audio thread and then read by a disk writer
+			for(unsigned int m = 0; m < 8; ++m)
+			{
+				unsigned int count = 16 + (n + m) * 97 % (kMaxCount - 16);
+				bytes += count * sizeof(float);
+				if(0 == mode)
+				{
+					// analysis into a local buffer, then
+					// copied into the pipe with a length
+					for(unsigned int c = 0; c < count; ++c)
+						frame[c] = c;
+					pipe.writeRt(count);
+					pipe.writeRt(frame.data(), count);
+				} else {
+					float* dest = pipe.reserveRt<float>(count);
+					for(unsigned int c = 0; c < count; ++c)
+						dest[c] = c;
+					pipe.commitRt();
+				}
+			}
+			if(0 == mode)
+			{
+				unsigned int count;
+				while(1 == pipe.readNonRt(count))
+				{
+					if((ssize_t)count != pipe.readNonRt(received.data(), count))
+						break;
+				}
+			} else if(1 == mode) {
+				Message msg;
+				while(pipe.readMessageNonRt(msg))
+					pipe.releaseNonRt();
+			} else {
+				Message msgs[8];
+				while(pipe.readMessagesNonRt(msgs, 8))
+					pipe.releaseNonRt();
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end); // NOWRAP
+		double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		const char* names[] = { "writeRt()/readNonRt()", "reserveRt()/readMessageNonRt()", "reserveRt()/readMessagesNonRt()" };
+		printf("Pipe: %s: %.0f frames/s, %.1f MB/s\n", names[mode], kIterations / elapsed, bytes / elapsed / 1e6);
+	}
+}
+
 #if 0
 // tests
 #include <stdlib.h>
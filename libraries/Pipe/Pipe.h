@@ -1,14 +1,36 @@
 #pragma once
+#include <atomic>
+#include <stdint.h>
 #include <string>
+#include <string.h>
+#include <vector>
 
 /**
  * 
  * A bi-directional pipe to exchange data between a RT and a non-RT thread.
+ *
+ * Besides the stream of bytes of writeRt()/readNonRt() and
+ * writeNonRt()/readRt(), a Pipe can carry messages of variable length, see
+ * setupMessages(). The writer of a message gets a pointer to write it in
+ * place with reserveRt()/reserveNonRt() and the reader gets a view of it
+ * with readMessageNonRt()/readMessageRt(), so that it is never copied. Use
+ * either the byte or the message functions in each direction, not both.
  * 
  */
 class Pipe
 {
 public:
+	/**
+	 * A view of a message received with readMessageRt() or
+	 * readMessageNonRt(). It stays valid until the next call to
+	 * releaseRt() or releaseNonRt(), respectively.
+	 */
+	struct Message {
+		const void* data = nullptr;
+		size_t size = 0;
+		template <typename T> const T* get() const { return (const T*)data; }
+		template <typename T> size_t count() const { return size / sizeof(T); }
+	};
 	Pipe() {};
 	Pipe(const std::string& pipeName, size_t size = 65536 * 128, bool newBlockingRt = false, bool newBlockingNonRt = false);
 	~Pipe() {cleanup();}
@@ -71,7 +93,119 @@ public:
 	 * Read data from the RT side.
 	 */
 	template<typename T> ssize_t readRt(T* dest, size_t count);
+	/**
+	 * Allocate the buffers for messages. This can be called before or
+	 * after setup(), but not from the audio thread.
+	 *
+	 * @param size the size of the buffer in each direction, rounded up to
+	 * a power of 2. Each message takes up its size rounded up to 8 bytes,
+	 * plus 8 bytes. Messages that take up to half the buffer always fit
+	 * once the reader has caught up.
+	 */
+	bool setupMessages(size_t size = 65536 * 16);
+	/**
+	 * Get space for a message to the non-RT side. Write it in place and
+	 * then send it with commitRt().
+	 *
+	 * @return a pointer to space for @p count objects, or NULL if there
+	 * isn't enough room.
+	 */
+	template<typename T> T* reserveRt(size_t count = 1);
+	/**
+	 * Send the message obtained from reserveRt().
+	 *
+	 * @param size the size of the message in bytes, if smaller than what
+	 * was reserved.
+	 */
+	bool commitRt(size_t size = kReserved);
+	/**
+	 * Copy @p count objects into a message to the non-RT side.
+	 */
+	template<typename T> bool writeMessageRt(const T* ptr, size_t count);
+	/**
+	 * Get space for a message to the RT side. Write it in place and
+	 * then send it with commitNonRt().
+	 *
+	 * @return a pointer to space for @p count objects, or NULL if there
+	 * isn't enough room.
+	 */
+	template<typename T> T* reserveNonRt(size_t count = 1);
+	/**
+	 * Send the message obtained from reserveNonRt().
+	 *
+	 * @param size the size of the message in bytes, if smaller than what
+	 * was reserved.
+	 */
+	bool commitNonRt(size_t size = kReserved);
+	/**
+	 * Copy @p count objects into a message to the RT side.
+	 */
+	template<typename T> bool writeMessageNonRt(const T* ptr, size_t count);
+	/**
+	 * Read the next message from the RT side. This waits for one if
+	 * reads at the non-RT side are blocking.
+	 *
+	 * @return whether a message was read.
+	 */
+	bool readMessageNonRt(Message& msg);
+	/**
+	 * Read up to @p maxCount messages from the RT side, without waiting.
+	 *
+	 * @return the number of messages read.
+	 */
+	size_t readMessagesNonRt(Message* msgs, size_t maxCount);
+	/**
+	 * Give back the space of all the messages read so far at the
+	 * non-RT side.
+	 */
+	void releaseNonRt();
+	/**
+	 * Read the next message from the non-RT side. This waits for one if
+	 * reads at the RT side are blocking.
+	 *
+	 * @return whether a message was read.
+	 */
+	bool readMessageRt(Message& msg);
+	/**
+	 * Read up to @p maxCount messages from the non-RT side, without
+	 * waiting.
+	 *
+	 * @return the number of messages read.
+	 */
+	size_t readMessagesRt(Message* msgs, size_t maxCount);
+	/**
+	 * Give back the space of all the messages read so far at the RT side.
+	 */
+	void releaseRt();
+	static bool test();
+	static void benchmark();
+	static constexpr size_t kReserved = ~(size_t)0;
 private:
+	// a single-producer, single-consumer queue of messages
+	class MessageQueue {
+	public:
+		void setup(size_t size);
+		void* reserve(size_t size);
+		bool commit(size_t size);
+		bool read(Message& msg);
+		void release();
+		bool isSetup() const { return buffer.size(); }
+	private:
+		char* getData() { return (char*)buffer.data(); }
+		std::vector<uint64_t> buffer; // for the alignment
+		size_t mask = 0;
+		// owned by the writer
+		bool reserved = false;
+		size_t reservedStart = 0;
+		size_t reservedSize = 0;
+		size_t readCursor = 0; // owned by the reader
+		std::atomic<size_t> writeIdx{0};
+		std::atomic<size_t> readIdx{0};
+	};
+	bool waitNonRt();
+	bool waitRt();
+	MessageQueue toNonRt;
+	MessageQueue toRt;
 	bool _writeNonRt(void* ptr, size_t size);
 	bool _writeRt(void* ptr, size_t size);
 	ssize_t _readNonRt(void* ptr, size_t size);
@@ -79,8 +213,8 @@ private:
 	static std::string defaultName;
 	std::string name;
 	std::string path;
-	int pipeSocket;
-	int fd;
+	int pipeSocket = -1;
+	int fd = -1;
 	int pipeSize;
 	double timeoutMsRt = 0;
 	double timeoutMsNonRt = 0;
@@ -137,3 +271,31 @@ template<typename T> ssize_t Pipe::readNonRt(T* dest, size_t count)
 	else
 		return ret;
 }
+
+template<typename T> T* Pipe::reserveRt(size_t count)
+{
+	return (T*)toNonRt.reserve(count * sizeof(T));
+}
+
+template<typename T> bool Pipe::writeMessageRt(const T* ptr, size_t count)
+{
+	T* dest = reserveRt<T>(count);
+	if(!dest)
+		return false;
+	memcpy((void*)dest, (const void*)ptr, count * sizeof(T));
+	return commitRt();
+}
+
+template<typename T> T* Pipe::reserveNonRt(size_t count)
+{
+	return (T*)toRt.reserve(count * sizeof(T));
+}
+
+template<typename T> bool Pipe::writeMessageNonRt(const T* ptr, size_t count)
+{
+	T* dest = reserveNonRt<T>(count);
+	if(!dest)
+		return false;
+	memcpy((void*)dest, (const void*)ptr, count * sizeof(T));
+	return commitNonRt();
+}
@@ -4,7 +4,9 @@ void PulseIn::setup(BelaContext* context, unsigned int digitalInput, int directi
 	_digitalInput = digitalInput;
 	_pulseIsOn = false;
 	_pulseOnState = direction == 1 ? 1 : 0;
-	_array.resize(context->digitalFrames);
+	// each frame has at most one edge on our input
+	_capture.setup(1 << digitalInput, context->digitalFrames);
+	_pulses.reserve(context->digitalFrames);
 	_lastContext = (uint64_t)-1;
 	pinMode(context, 0, digitalInput, INPUT); //context is used to allocate the number of elements in the array
 }
@@ -13,18 +15,27 @@ void PulseIn::check(BelaContext* context){
 	if(_digitalInput == -1){ //must be setup'ed before calling check();
 		throw(1);
 	}
-	for(unsigned int n = 0; n < context->digitalFrames; n++){
-		_array[n] = 0; //maybe a few of these will be overwritten below
+	_pulses.clear();
+	_nextPulse = 0;
+	if(_lastContext == (uint64_t)-1 && context->digitalFrames){
+		// the capture does not report the initial state as an edge
+		if(digitalRead(context, 0, _digitalInput) == _pulseOnState){
+			_pulseStart = context->audioFramesElapsed;
+			_pulseIsOn = true;
+		}
 	}
-	for(unsigned int n = 0; n < context->digitalFrames; n++){
+	_capture.process(context);
+	DigitalEdgeCapture::Edge edge;
+	while(_capture.pop(edge)){
 		if(_pulseIsOn == false){ // look for start edge
-			if(digitalRead(context, n, _digitalInput) == _pulseOnState){
-				_pulseStart = context->audioFramesElapsed + n; // store location of start edge
+			if(edge.rising == _pulseOnState){
+				_pulseStart = edge.frame; // store location of start edge
 				_pulseIsOn = true;
 			}
 		} else { // _pulseIsOn == true;
-			if(digitalRead(context, n, _digitalInput) == !_pulseOnState){ // look for stop edge
-				_array[n] = context->audioFramesElapsed + n - _pulseStart; // compute and store pulse duration
+			if(edge.rising == !_pulseOnState){ // look for stop edge
+				// compute and store pulse duration
+				_pulses.push_back({(unsigned int)(edge.frame - context->audioFramesElapsed), (int)(edge.frame - _pulseStart)});
 				_pulseIsOn = false;
 			}
 		}
@@ -37,3 +48,97 @@ PulseIn::~PulseIn() {
 }
 void PulseIn::cleanup(){};
 
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <PRU.h> // InternalBelaContext
+
+namespace {
+// The implementation before DigitalEdgeCapture, which reads every frame
+class PulseInReference {
+public:
+	PulseInReference(BelaContext* context, unsigned int digitalInput, int direction)
+	{
+		_digitalInput = digitalInput;
+		_pulseIsOn = false;
+		_pulseOnState = direction == 1 ? 1 : 0;
+		_array.resize(context->digitalFrames);
+	}
+	void check(BelaContext* context)
+	{
+		for(unsigned int n = 0; n < context->digitalFrames; n++){
+			_array[n] = 0;
+		}
+		for(unsigned int n = 0; n < context->digitalFrames; n++){
+			if(_pulseIsOn == false){
+				if(digitalRead(context, n, _digitalInput) == _pulseOnState){
+					_pulseStart = context->audioFramesElapsed + n;
+					_pulseIsOn = true;
+				}
+			} else {
+				if(digitalRead(context, n, _digitalInput) == !_pulseOnState){
+					_array[n] = context->audioFramesElapsed + n - _pulseStart;
+					_pulseIsOn = false;
+				}
+			}
+		}
+	}
+	int hasPulsed(unsigned int frame) { return _array[frame]; }
+private:
+	std::vector<int> _array;
+	int _pulseOnState;
+	int _digitalInput;
+	bool _pulseIsOn;
+	uint64_t _pulseStart;
+};
+}
+
+bool PulseIn::test()
+{
+	srand(1);
+	for(unsigned int frames : { 1, 2, 16, 64 })
+	for(int direction : { 1, -1 })
+	for(unsigned int toggleOneIn : { 2, 7, 50 })
+	{
+		std::vector<uint32_t> digital(frames);
+		InternalBelaContext context;
+		memset((void*)&context, 0, sizeof(context));
+		context.audioFrames = frames;
+		context.digitalFrames = frames;
+		context.digitalChannels = 16;
+		context.digital = digital.data();
+		const unsigned int kPin = 5;
+		PulseIn pulseIn((BelaContext*)&context, kPin, direction);
+		PulseInReference reference((BelaContext*)&context, kPin, direction);
+		// random input on all pins, starting high half of the time,
+		// with the other pins toggling independently of ours
+		uint32_t word = rand() & 0xffff0000;
+		unsigned int pulses = 0;
+		for(unsigned int b = 0; b < 4000 / frames; ++b)
+		{
+			for(unsigned int n = 0; n < frames; ++n)
+			{
+				if(0 == rand() % toggleOneIn)
+					word ^= 1 << (16 + kPin);
+				if(0 == rand() % toggleOneIn)
+					word ^= (rand() & 0xffff) << 16 & ~(1 << (16 + kPin));
+				digital[n] = word | (rand() & 0xffff);
+			}
+			reference.check((BelaContext*)&context);
+			for(unsigned int n = 0; n < frames; ++n)
+			{
+				int length = pulseIn.hasPulsed((BelaContext*)&context, n);
+				assert(reference.hasPulsed(n) == length);
+				pulses += length > 0;
+			}
+			// and in any order
+			for(unsigned int n = frames; n-- > 0; )
+				assert(reference.hasPulsed(n) == pulseIn.hasPulsed((BelaContext*)&context, n));
+			context.audioFramesElapsed += frames;
+		}
+		assert(pulses > 0);
+	}
+	return true;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <Bela.h>
+#include <DigitalEdgeCapture.h>
 #include <vector>
 
 /**
@@ -8,10 +9,19 @@
  *
  * This can be used to measure distance in conjunction with an ultrasonic
  * ranging sensor (e.g.: HC-SR04).
+ *
+ * The edges are found with a DigitalEdgeCapture, so the cost of check()
+ * depends on the number of pulses, not on the number of frames.
  */
 class PulseIn {
 private:
-	std::vector<int> _array;
+	struct Pulse {
+		unsigned int frame;
+		int length;
+	};
+	DigitalEdgeCapture _capture;
+	std::vector<Pulse> _pulses; // the pulses that ended in the current block
+	unsigned int _nextPulse; // the first one at or after the last frame asked for
 	int _pulseOnState;
 	int _digitalInput;
 	bool _pulseIsOn;
@@ -71,8 +81,17 @@ public:
 		if(_lastContext != context->audioFramesElapsed){ // check for pulses in the whole context and cache the result
 			check(context);
 		}
-		return _array[frame];
+		// frames are usually asked for in order, so carry on from the
+		// previous call, and start over only when going backwards
+		if(_nextPulse > 0 && _pulses[_nextPulse - 1].frame >= frame)
+			_nextPulse = 0;
+		while(_nextPulse < _pulses.size() && _pulses[_nextPulse].frame < frame)
+			++_nextPulse;
+		if(_nextPulse < _pulses.size() && _pulses[_nextPulse].frame == frame)
+			return _pulses[_nextPulse].length;
+		return 0;
 	}
 	void cleanup();
 	virtual ~PulseIn();
+	static bool test();
 };
@@ -0,0 +1,199 @@
+#include "ShmChannel.h"
+#include <AuxTaskReactor.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <new>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+int ShmChannel::setup(const std::string& name, unsigned int numSlots, size_t slotSize, mode_t mode)
+{
+	cleanup();
+	if(!numSlots || slotSize > UINT32_MAX)
+		return -EINVAL;
+	unsigned int size = 1;
+	while(size < numSlots)
+		size <<= 1;
+	numSlots = size;
+	path = "/" + name;
+	// a leftover from a previous run would have the wrong size
+	shm_unlink(path.c_str());
+	int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, mode);
+	if(fd < 0)
+	{
+		int err = errno;
+		fprintf(stderr, "ShmChannel: unable to create %s: (%d) %s\n", path.c_str(), err, strerror(err));
+		path.clear();
+		return -err;
+	}
+	memorySize = ShmChannelQueue::getMemorySize(numSlots, slotSize);
+	int ret = 0;
+	if(ftruncate(fd, memorySize))
+		ret = -errno;
+	else {
+		// populated and locked, so that the audio thread never takes
+		// a page fault on it
+		memory = mmap(NULL, memorySize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+		if(MAP_FAILED == memory)
+		{
+			memory = nullptr;
+			ret = -errno;
+		}
+	}
+	close(fd);
+	if(ret)
+	{
+		fprintf(stderr, "ShmChannel: unable to map %s: (%d) %s\n", path.c_str(), -ret, strerror(-ret));
+		cleanup();
+		return ret;
+	}
+	mlock(memory, memorySize);
+
+	ShmChannelHeader* header = new (memory) ShmChannelHeader;
+	header->numSlots = numSlots;
+	header->slotSize = slotSize;
+	header->stride = ShmChannelQueue::getStride(slotSize);
+	for(auto& queue : header->queues)
+	{
+		queue.writeIdx = 0;
+		queue.readIdx = 0;
+	}
+	header->version = kShmChannelVersion;
+	// written last, so that a client never sees a partial header
+	std::atomic_thread_fence(std::memory_order_release);
+	header->magic = kShmChannelMagic;
+	toClient.init(header, ShmChannelHeader::kToClient);
+	fromClient.init(header, ShmChannelHeader::kFromClient);
+
+	doorbell = AuxTaskReactor::get().addDoorbell("ShmChannel_" + name, [this]() { wakeClient(); });
+	if(doorbell < 0)
+	{
+		int ret = doorbell;
+		fprintf(stderr, "ShmChannel: unable to create the doorbell for %s\n", path.c_str());
+		cleanup();
+		return ret;
+	}
+	return 0;
+}
+
+void ShmChannel::cleanup()
+{
+	if(doorbell >= 0)
+		AuxTaskReactor::get().remove(doorbell);
+	doorbell = -1;
+	if(memory)
+		munmap(memory, memorySize);
+	memory = nullptr;
+	if(path.size())
+		shm_unlink(path.c_str());
+	path.clear();
+}
+
+int ShmChannel::commit(size_t size)
+{
+	int ret = toClient.commit(size);
+	if(ret)
+		return ret;
+	// the client is woken up by the reactor
+	if(doorbell >= 0)
+		return AuxTaskReactor::get().ring(doorbell);
+	return 0;
+}
+
+void ShmChannel::wakeClient()
+{
+	syscall(SYS_futex, toClient.getFutex(), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+#undef NDEBUG
+#include <assert.h>
+#include "ShmChannelClient.h"
+#include <thread>
+#include <vector>
+
+bool ShmChannel::test()
+{
+	const std::string kName = "ShmChannelTest";
+	const unsigned int kNumSlots = 4;
+	const size_t kSlotSize = 16 * 32 * sizeof(float);
+	ShmChannel channel;
+	ShmChannelClient client;
+	assert(-ENOENT == client.setup(kName));
+	assert(0 == channel.setup(kName, kNumSlots - 1, kSlotSize));
+	assert(0 == client.setup(kName));
+	assert(kSlotSize == channel.getSlotSize() && kSlotSize == client.getSlotSize());
+
+	// in place, both ways
+	size_t size;
+	assert(!client.read(size, 0));
+	std::vector<float> block(kSlotSize / sizeof(float));
+	for(unsigned int n = 0; n < block.size(); ++n)
+		block[n] = n;
+	for(unsigned int n = 0; n < kNumSlots; ++n)
+	{
+		block[0] = n;
+		assert(0 == channel.write(block.data(), block.size()));
+	}
+	assert(-1 == channel.write(block.data(), block.size()));
+	for(unsigned int n = 0; n < kNumSlots; ++n)
+	{
+		const float* msg = (const float*)client.read(size, 0);
+		assert(msg && kSlotSize == size && n == msg[0] && block.back() == msg[block.size() - 1]);
+		float* dest = (float*)client.reserve();
+		assert(dest);
+		dest[0] = -msg[0];
+		client.release();
+		assert(0 == client.commit(sizeof(float)));
+	}
+	assert(!client.reserve());
+	for(unsigned int n = 0; n < kNumSlots; ++n)
+	{
+		const float* msg = (const float*)channel.read(size);
+		assert(msg && sizeof(float) == size && -(float)n == msg[0]);
+		channel.release();
+	}
+	assert(!channel.read(size));
+	assert(!client.read(size, 10));
+
+	// invalid sizes and indices written by the client are not used
+	char* dest = (char*)client.reserve();
+	assert(dest && 0 == client.commit(sizeof(float)));
+	uint32_t* sizeField = (uint32_t*)(dest - kShmChannelDataOffset);
+	*sizeField = kSlotSize + 1;
+	assert(!channel.read(size));
+	*sizeField = kSlotSize;
+	assert(channel.read(size) && kSlotSize == size);
+	ShmChannelQueueState& state = ((ShmChannelHeader*)channel.memory)->queues[ShmChannelHeader::kFromClient];
+	uint32_t w = state.writeIdx;
+	state.writeIdx = w + kNumSlots;
+	assert(!channel.read(size));
+	state.writeIdx = w;
+	channel.release();
+	assert(!channel.read(size));
+
+	// the client waits on the futex until it is woken up
+	std::thread reader([&client]() {
+		size_t size;
+		for(unsigned int n = 0; n < 100; ++n)
+		{
+			const int* msg = (const int*)client.read(size, 1000);
+			assert(msg && (int)n == *msg);
+			client.release();
+		}
+	});
+	for(int n = 0; n < 100; ++n)
+	{
+		while(channel.write(&n, 1))
+			usleep(100);
+	}
+	reader.join();
+
+	// the channel can't be connected to once it is gone
+	channel.cleanup();
+	assert(-ENOENT == client.setup(kName));
+	return true;
+}
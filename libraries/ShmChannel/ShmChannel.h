@@ -0,0 +1,99 @@
+#pragma once
+
+#include "ShmChannelQueue.h"
+#include <string>
+#include <string.h>
+#include <sys/types.h>
+
+/**
+ * \brief Exchange data between render() and an external process through
+ * shared memory.
+ *
+ * setup() creates a POSIX shared memory object holding two queues of
+ * fixed-size slots: one towards the external process and one from it. The
+ * external process connects to it with ShmChannelClient. Messages are
+ * written and read in place in the shared memory, so there is no copy and
+ * no network stack involved.
+ *
+ * The audio thread never makes system calls: the client is woken up by the
+ * shared AuxTaskReactor, which waits on a futex in the shared memory
+ * when a message is committed, and the messages from the client are polled
+ * with read(), e.g.: once per block.
+ *
+ * A typical use is sending a block of audio to the client in each
+ * render() call and getting the processed block back a block later.
+ */
+class ShmChannel {
+public:
+	ShmChannel() {}
+	~ShmChannel() { cleanup(); }
+	/**
+	 * Create the shared memory and register with the AuxTaskReactor.
+	 *
+	 * @param name the name of the channel, which the client uses to
+	 * connect. It appears in /dev/shm.
+	 * @param numSlots the number of messages that can be waiting in each
+	 * direction. This is rounded up to a power of 2.
+	 * @param slotSize the largest message, in bytes.
+	 * @param mode the permissions of the shared memory. By default, only
+	 * processes of the same user can connect.
+	 * @return 0 on success, or an error code.
+	 */
+	int setup(const std::string& name, unsigned int numSlots, size_t slotSize, mode_t mode = 0600);
+	/**
+	 * Remove the shared memory. Connected clients keep their mapping,
+	 * but the channel can't be connected to anymore.
+	 */
+	void cleanup();
+	/**
+	 * @return where to write a message of up to getSlotSize() bytes, or
+	 * NULL if the client has not read enough messages. This is safe to
+	 * call from the audio thread.
+	 */
+	void* reserve() { return toClient.reserve(); }
+	/**
+	 * Send the message written in the slot returned by reserve(). This is
+	 * safe to call from the audio thread.
+	 *
+	 * @return 0 on success, or an error code.
+	 */
+	int commit(size_t size);
+	/**
+	 * Copy a message into a slot and send it. This is safe to call from
+	 * the audio thread.
+	 *
+	 * @return 0 on success, or an error code.
+	 */
+	template <typename T> int write(const T* data, size_t count);
+	/**
+	 * @return the oldest message from the client, or NULL if there is
+	 * none or if the client has written an invalid one. It stays valid
+	 * until release() is called. This is safe to call from the audio
+	 * thread.
+	 */
+	const void* read(size_t& size) { return fromClient.peek(size); }
+	/**
+	 * Give back the message returned by read().
+	 */
+	void release() { fromClient.release(); }
+	size_t getSlotSize() const { return toClient.getSlotSize(); }
+	static bool test();
+private:
+	void wakeClient();
+	std::string path;
+	void* memory = nullptr;
+	size_t memorySize = 0;
+	ShmChannelQueue toClient;
+	ShmChannelQueue fromClient;
+	int doorbell = -1;
+};
+
+template <typename T> int ShmChannel::write(const T* data, size_t count)
+{
+	size_t size = count * sizeof(*data);
+	char* dest = (char*)reserve();
+	if(!dest || size > getSlotSize())
+		return -1;
+	memcpy(dest, data, size);
+	return commit(size);
+}
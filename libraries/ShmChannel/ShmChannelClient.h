@@ -0,0 +1,124 @@
+#pragma once
+
+#include "ShmChannelQueue.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * \brief The other end of a ShmChannel, for use in external processes.
+ *
+ * This header does not depend on Bela: copy it together with
+ * ShmChannelQueue.h into a program that is built on its own, or include it
+ * from a Bela project. See resources/tools/shm-client for an example.
+ *
+ * There must be only one client for each channel, and read() and write()
+ * must be called from one thread at a time.
+ */
+class ShmChannelClient {
+public:
+	ShmChannelClient() {}
+	~ShmChannelClient() { cleanup(); }
+	/**
+	 * Connect to a channel created by ShmChannel::setup().
+	 *
+	 * @param name the name passed to ShmChannel::setup().
+	 * @return 0 on success, or an error code.
+	 */
+	int setup(const std::string& name)
+	{
+		cleanup();
+		int fd = shm_open(("/" + name).c_str(), O_RDWR, 0);
+		if(fd < 0)
+			return -errno;
+		struct stat st;
+		int ret = 0;
+		if(fstat(fd, &st) || (size_t)st.st_size < sizeof(ShmChannelHeader))
+			ret = -EINVAL;
+		else {
+			memory = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if(MAP_FAILED == memory)
+			{
+				memory = NULL;
+				ret = -errno;
+			}
+		}
+		close(fd);
+		if(ret)
+			return ret;
+		memorySize = st.st_size;
+		ShmChannelHeader* header = (ShmChannelHeader*)memory;
+		if(kShmChannelMagic != header->magic || kShmChannelVersion != header->version
+			|| ShmChannelQueue::getMemorySize(header->numSlots, header->slotSize) > memorySize)
+		{
+			cleanup();
+			return -EINVAL;
+		}
+		fromBela.init(header, ShmChannelHeader::kToClient);
+		toBela.init(header, ShmChannelHeader::kFromClient);
+		return 0;
+	}
+	void cleanup()
+	{
+		if(memory)
+			munmap(memory, memorySize);
+		memory = NULL;
+	}
+	/**
+	 * Wait for a message from Bela. The message stays valid until
+	 * release() is called.
+	 *
+	 * @param size the size of the message
+	 * @param timeoutMs how long to wait for, or -1 to wait forever.
+	 * @return the message, or NULL on timeout.
+	 */
+	const void* read(size_t& size, int timeoutMs = -1)
+	{
+		if(!memory)
+			return NULL;
+		struct timespec timeout;
+		timeout.tv_sec = timeoutMs / 1000;
+		timeout.tv_nsec = (timeoutMs % 1000) * 1000000;
+		uint32_t* futex = fromBela.getFutex();
+		while(1)
+		{
+			// the value is read before checking for messages, so that
+			// the wait returns straight away if a message is committed
+			// in between
+			uint32_t seen = __atomic_load_n(futex, __ATOMIC_ACQUIRE);
+			const void* msg = fromBela.peek(size);
+			if(msg)
+				return msg;
+			if(syscall(SYS_futex, futex, FUTEX_WAIT, seen, timeoutMs < 0 ? NULL : &timeout, NULL, 0)
+				&& ETIMEDOUT == errno)
+				return fromBela.peek(size);
+		}
+	}
+	/**
+	 * Give back the message returned by read().
+	 */
+	void release() { fromBela.release(); }
+	/**
+	 * @return where to write a message of up to getSlotSize() bytes
+	 * for Bela, or NULL if its queue is full.
+	 */
+	void* reserve() { return memory ? toBela.reserve() : NULL; }
+	/**
+	 * Send the message written in the slot returned by reserve(). Bela
+	 * polls for messages, so this does not make any system call.
+	 */
+	int commit(size_t size) { return toBela.commit(size); }
+	size_t getSlotSize() const { return toBela.getSlotSize(); }
+private:
+	void* memory = NULL;
+	size_t memorySize = 0;
+	ShmChannelQueue fromBela;
+	ShmChannelQueue toBela;
+};
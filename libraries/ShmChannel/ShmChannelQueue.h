@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The layout of the shared memory used by ShmChannel and
+ * ShmChannelClient. This header only depends on the C++ standard library so
+ * that it can be used by programs that are not built against Bela.
+ *
+ * The memory starts with a ShmChannelHeader, followed by the slots of the
+ * queue towards the client and then by those of the queue from the client.
+ * Each slot starts with the size of the message it holds, followed by the
+ * message.
+ */
+enum {
+	kShmChannelMagic = 0x42534843, // "BSHC"
+	kShmChannelVersion = 1,
+	kShmChannelCacheLine = 64,
+	kShmChannelDataOffset = 16, // from the start of a slot
+};
+
+struct ShmChannelQueueState {
+	// on different cache lines, as they are written by different
+	// processes. writeIdx is also the futex that readers wait on.
+	alignas(kShmChannelCacheLine) std::atomic<uint32_t> writeIdx;
+	alignas(kShmChannelCacheLine) std::atomic<uint32_t> readIdx;
+};
+
+struct ShmChannelHeader {
+	enum {
+		kToClient,
+		kFromClient,
+		kNumQueues,
+	};
+	uint32_t magic;
+	uint32_t version;
+	uint32_t numSlots; // in each queue, a power of 2
+	uint32_t slotSize; // the largest message
+	uint32_t stride; // the distance between slots
+	alignas(kShmChannelCacheLine) ShmChannelQueueState queues[kNumQueues];
+};
+
+/**
+ * One direction of a channel. There must be only one writer and one reader
+ * for each queue. None of the methods block or make system calls.
+ *
+ * The indices and sizes in the shared memory can be written by the other
+ * process at any time, so they are checked before use and a queue that holds
+ * invalid ones appears empty or full.
+ */
+class ShmChannelQueue {
+public:
+	static size_t getStride(size_t slotSize)
+	{
+		return (kShmChannelDataOffset + slotSize + kShmChannelCacheLine - 1) & ~(size_t)(kShmChannelCacheLine - 1);
+	}
+	static size_t getMemorySize(unsigned int numSlots, size_t slotSize)
+	{
+		return sizeof(ShmChannelHeader) + ShmChannelHeader::kNumQueues * numSlots * getStride(slotSize);
+	}
+	void init(ShmChannelHeader* header, unsigned int queue)
+	{
+		state = &header->queues[queue];
+		slots = (char*)(header + 1) + queue * header->numSlots * header->stride;
+		mask = header->numSlots - 1;
+		stride = header->stride;
+		slotSize = header->slotSize;
+	}
+	/**
+	 * @return where to write a message of up to getSlotSize() bytes, or
+	 * NULL if the queue is full.
+	 */
+	void* reserve()
+	{
+		uint32_t w = state->writeIdx.load(std::memory_order_relaxed);
+		if(w - state->readIdx.load(std::memory_order_acquire) > mask)
+			return NULL;
+		return getSlot(w) + kShmChannelDataOffset;
+	}
+	/**
+	 * Make the message written in the slot returned by reserve()
+	 * available to the reader.
+	 */
+	int commit(size_t size)
+	{
+		if(size > slotSize)
+			return -1;
+		uint32_t w = state->writeIdx.load(std::memory_order_relaxed);
+		*(uint32_t*)getSlot(w) = size;
+		state->writeIdx.store(w + 1, std::memory_order_release);
+		return 0;
+	}
+	/**
+	 * @return the oldest message, or NULL if there is none or if the
+	 * writer has corrupted the queue. It stays valid until release() is
+	 * called.
+	 */
+	const void* peek(size_t& size)
+	{
+		uint32_t r = state->readIdx.load(std::memory_order_relaxed);
+		uint32_t w = state->writeIdx.load(std::memory_order_acquire);
+		// more than numSlots messages can't have been written
+		if(r == w || w - r > mask + 1)
+			return NULL;
+		const char* slot = getSlot(r);
+		// read it only once, as it could change between the check and
+		// its use
+		uint32_t s = *(const volatile uint32_t*)slot;
+		if(s > slotSize)
+			return NULL;
+		size = s;
+		return slot + kShmChannelDataOffset;
+	}
+	/**
+	 * Give back the slot of the message returned by peek().
+	 */
+	void release()
+	{
+		state->readIdx.store(state->readIdx.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+	/**
+	 * @return the number of messages waiting to be read.
+	 */
+	unsigned int pending() const
+	{
+		return state->writeIdx.load(std::memory_order_acquire) - state->readIdx.load(std::memory_order_acquire);
+	}
+	size_t getSlotSize() const { return slotSize; }
+	/**
+	 * @return the futex that the reader can wait on, which changes every
+	 * time a message is committed.
+	 */
+	uint32_t* getFutex() { return (uint32_t*)&state->writeIdx; }
+private:
+	char* getSlot(uint32_t idx) { return slots + (idx & mask) * stride; }
+	ShmChannelQueueState* state = nullptr;
+	char* slots = nullptr;
+	uint32_t mask = 0;
+	size_t stride = 0;
+	size_t slotSize = 0;
+};
@@ -0,0 +1,460 @@
+/***** Stft.cpp *****/
+#include "Stft.h"
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__ARM_NEON__) && !defined(STFT_NO_NE10)
+#define STFT_USE_NE10
+#endif
+
+#ifdef STFT_USE_NE10
+#include <libraries/ne10/NE10.h>
+static_assert(sizeof(StftComplex) == sizeof(ne10_fft_cpx_float32_t), "StftComplex must match ne10_fft_cpx_float32_t");
+#endif
+
+// Real-input FFT of a power-of-2 size. The forward transform returns
+// size / 2 + 1 bins, the inverse transform is scaled by 1 / size.
+class StftFft
+{
+public:
+	StftFft(unsigned int size);
+	~StftFft();
+	void forward(StftComplex* out, float* in);
+	void inverse(float* out, StftComplex* in);
+private:
+	unsigned int size;
+#ifdef STFT_USE_NE10
+	ne10_fft_r2c_cfg_float32_t cfg;
+#else
+	// iterative radix-2 complex FFT, applied to the real signal
+	void transform(bool inverse);
+	std::vector<float> re;
+	std::vector<float> im;
+	std::vector<float> cosTable;
+	std::vector<float> sinTable;
+	std::vector<unsigned int> bitReverse;
+#endif
+};
+
+#ifdef STFT_USE_NE10
+StftFft::StftFft(unsigned int size) :
+	size(size)
+{
+	cfg = ne10_fft_alloc_r2c_float32(size);
+}
+
+StftFft::~StftFft()
+{
+	NE10_FREE(cfg);
+}
+
+void StftFft::forward(StftComplex* out, float* in)
+{
+	ne10_fft_r2c_1d_float32_neon((ne10_fft_cpx_float32_t*)out, in, cfg);
+}
+
+void StftFft::inverse(float* out, StftComplex* in)
+{
+	// ne10's inverse transform is already scaled by 1/size
+	ne10_fft_c2r_1d_float32_neon(out, (ne10_fft_cpx_float32_t*)in, cfg);
+}
+#else /* STFT_USE_NE10 */
+StftFft::StftFft(unsigned int size) :
+	size(size),
+	re(size),
+	im(size),
+	cosTable(size / 2),
+	sinTable(size / 2),
+	bitReverse(size)
+{
+	unsigned int bits = 0;
+	while((1u << bits) < size)
+		++bits;
+	for(unsigned int n = 0; n < size; ++n)
+	{
+		unsigned int r = 0;
+		for(unsigned int b = 0; b < bits; ++b)
+			r |= ((n >> b) & 1) << (bits - 1 - b);
+		bitReverse[n] = r;
+	}
+	for(unsigned int n = 0; n < size / 2; ++n)
+	{
+		cosTable[n] = cosf(2.f * (float)M_PI * n / size);
+		sinTable[n] = sinf(2.f * (float)M_PI * n / size);
+	}
+}
+
+StftFft::~StftFft() {}
+
+void StftFft::transform(bool inverse)
+{
+	for(unsigned int n = 0; n < size; ++n)
+	{
+		unsigned int r = bitReverse[n];
+		if(r > n)
+		{
+			std::swap(re[n], re[r]);
+			std::swap(im[n], im[r]);
+		}
+	}
+	float sign = inverse ? 1.f : -1.f;
+	for(unsigned int length = 2; length <= size; length <<= 1)
+	{
+		unsigned int half = length / 2;
+		unsigned int step = size / length;
+		for(unsigned int start = 0; start < size; start += length)
+		{
+			for(unsigned int k = 0; k < half; ++k)
+			{
+				float wr = cosTable[k * step];
+				float wi = sign * sinTable[k * step];
+				unsigned int a = start + k;
+				unsigned int b = a + half;
+				float tr = re[b] * wr - im[b] * wi;
+				float ti = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+}
+
+void StftFft::forward(StftComplex* out, float* in)
+{
+	for(unsigned int n = 0; n < size; ++n)
+	{
+		re[n] = in[n];
+		im[n] = 0;
+	}
+	transform(false);
+	for(unsigned int n = 0; n <= size / 2; ++n)
+	{
+		out[n].r = re[n];
+		out[n].i = im[n];
+	}
+}
+
+void StftFft::inverse(float* out, StftComplex* in)
+{
+	// rebuild the full, Hermitian-symmetric spectrum
+	for(unsigned int n = 0; n <= size / 2; ++n)
+	{
+		re[n] = in[n].r;
+		im[n] = in[n].i;
+	}
+	for(unsigned int n = size / 2 + 1; n < size; ++n)
+	{
+		re[n] = in[size - n].r;
+		im[n] = -in[size - n].i;
+	}
+	transform(true);
+	float scale = 1.f / size;
+	for(unsigned int n = 0; n < size; ++n)
+		out[n] = re[n] * scale;
+}
+#endif /* STFT_USE_NE10 */
+
+Stft::Stft() {}
+
+Stft::~Stft()
+{
+	cleanup();
+}
+
+void Stft::hann(std::vector<float>& window, unsigned int length)
+{
+	window.resize(length);
+	for(unsigned int n = 0; n < length; ++n)
+		window[n] = 0.5f * (1.f - cosf(2.f * (float)M_PI * n / length));
+}
+
+int Stft::setup(unsigned int newFftSize, unsigned int newHopSize, Callback newCallback, DeadlineScheduler* newScheduler)
+{
+	std::vector<float> window;
+	hann(window, newFftSize);
+	return setup(newFftSize, newHopSize, window, window, newCallback, newScheduler);
+}
+
+static unsigned int nextPowerOfTwo(unsigned int n)
+{
+	unsigned int p = 1;
+	while(p < n)
+		p <<= 1;
+	return p;
+}
+
+int Stft::setup(unsigned int newFftSize, unsigned int newHopSize, const std::vector<float>& newAnalysisWindow, const std::vector<float>& newSynthesisWindow, Callback newCallback, DeadlineScheduler* newScheduler)
+{
+	cleanup();
+	if(newFftSize < 2 || nextPowerOfTwo(newFftSize) != newFftSize || !newHopSize || newHopSize > newFftSize
+		|| newAnalysisWindow.size() != newFftSize
+		|| (newSynthesisWindow.size() && newSynthesisWindow.size() != newFftSize))
+	{
+		fprintf(stderr, "Stft: invalid parameters\n");
+		return -1;
+	}
+	fftSize = newFftSize;
+	hopSize = newHopSize;
+	callback = newCallback;
+	scheduler = newScheduler;
+	analysisWindow = newAnalysisWindow;
+	synthesisWindow = newSynthesisWindow;
+	if(!synthesisWindow.size())
+		synthesisWindow.assign(fftSize, 1);
+
+	// normalise the overlap-add gain
+	float sum = 0;
+	for(unsigned int n = 0; n < fftSize; ++n)
+		sum += analysisWindow[n] * synthesisWindow[n];
+	float scale = sum > 0 ? hopSize / sum : 1;
+	for(auto& s : synthesisWindow)
+		s *= scale;
+
+	latency = scheduler ? fftSize + hopSize : fftSize;
+	inBuffer.assign(fftSize, 0);
+	inMask = fftSize - 1;
+	outBuffer.assign(nextPowerOfTwo(fftSize + latency), 0);
+	outMask = outBuffer.size() - 1;
+	unsigned int numFrames = scheduler ? kNumFrames : 1;
+	for(unsigned int n = 0; n < numFrames; ++n)
+	{
+		Frame& frame = frames[n];
+		frame.stft = this;
+		frame.fft = new StftFft(fftSize);
+		frame.data.assign(fftSize, 0);
+		frame.spectrum.assign(fftSize / 2 + 1, StftComplex());
+		frame.job = -1;
+	}
+	sample = 0;
+	hopCounter = 0;
+	nextFrame = 0;
+	missedFrames = 0;
+	return 0;
+}
+
+void Stft::cleanup()
+{
+	for(auto& frame : frames)
+	{
+		if(frame.job >= 0)
+		{
+			while(!scheduler->isDone(frame.job))
+				usleep(1000);
+			scheduler->release(frame.job);
+			frame.job = -1;
+		}
+		delete frame.fft;
+		frame.fft = NULL;
+	}
+}
+
+void Stft::processFrame(Frame& frame)
+{
+	frame.fft->forward(frame.spectrum.data(), frame.data.data());
+	callback(frame.spectrum.data(), frame.spectrum.size());
+	frame.fft->inverse(frame.data.data(), frame.spectrum.data());
+	for(unsigned int n = 0; n < fftSize; ++n)
+		frame.data[n] *= synthesisWindow[n];
+}
+
+void Stft::frameJob(void* arg)
+{
+	Frame* frame = (Frame*)arg;
+	frame->stft->processFrame(*frame);
+}
+
+void Stft::overlapAdd(const float* data, uint64_t start)
+{
+	for(unsigned int n = 0; n < fftSize; ++n)
+		outBuffer[(start + n) & outMask] += data[n];
+}
+
+// Called when the output of a background frame is about to be needed.
+void Stft::collectFrame(Frame& frame)
+{
+	if(scheduler->isDone(frame.job))
+		overlapAdd(frame.data.data(), frame.outputStart);
+	else
+		++missedFrames;
+	// if the job is still running, its slot will be reclaimed by
+	// newFrame() once it is done
+}
+
+// Called when the last sample of a frame has been received, that is at
+// sample T: the frame covers [T - fftSize, T) and its output goes to
+// [T - fftSize + latency, T + latency)
+void Stft::newFrame()
+{
+	Frame& frame = frames[nextFrame];
+	if(scheduler)
+	{
+		if(frame.job >= 0)
+		{
+			if(!scheduler->isDone(frame.job))
+			{
+				// the worker is still busy with the frame that used
+				// this slot last time
+				++missedFrames;
+				return;
+			}
+			scheduler->release(frame.job);
+			frame.job = -1;
+		}
+		nextFrame = (nextFrame + 1) % kNumFrames;
+	}
+	for(unsigned int n = 0; n < fftSize; ++n)
+		frame.data[n] = inBuffer[(sample + n) & inMask] * analysisWindow[n];
+	frame.outputStart = sample - fftSize + latency;
+	if(!scheduler)
+	{
+		processFrame(frame);
+		overlapAdd(frame.data.data(), frame.outputStart);
+		return;
+	}
+	// the frame has to be ready before the block that contains its
+	// first output sample
+	uint64_t deadline = scheduler->getCurrentBlock() + (frame.outputStart - blockStart) / blockSize;
+	frame.job = scheduler->submit(frameJob, &frame, deadline);
+	if(frame.job < 0)
+		++missedFrames;
+}
+
+void Stft::process(float* out, const float* in, unsigned int length)
+{
+	blockStart = sample;
+	blockSize = length;
+	for(unsigned int n = 0; n < length; ++n)
+	{
+		if(scheduler)
+		{
+			for(auto& frame : frames)
+			{
+				if(frame.job >= 0 && frame.outputStart == sample)
+				{
+					collectFrame(frame);
+					if(scheduler->isDone(frame.job))
+					{
+						scheduler->release(frame.job);
+						frame.job = -1;
+					}
+				}
+			}
+		}
+		inBuffer[sample & inMask] = in[n];
+		unsigned int idx = sample & outMask;
+		out[n] = outBuffer[idx];
+		outBuffer[idx] = 0;
+		++sample;
+		if(++hopCounter >= hopSize)
+		{
+			hopCounter = 0;
+			newFrame();
+		}
+	}
+}
+
+#undef NDEBUG
+#include <assert.h>
+#include <atomic>
+bool Stft::test()
+{
+	const unsigned int fftSize = 64;
+	const unsigned int hopSize = 16;
+	const unsigned int blockSize = 8;
+	const unsigned int length = 1024;
+	std::vector<float> in(length);
+	std::vector<float> out(length);
+	for(unsigned int n = 0; n < length; ++n)
+		in[n] = sinf(n * 0.1f) + 0.3f * cosf(n * 0.77f);
+
+	// an unmodified spectrum gives back the delayed input
+	unsigned int calls = 0;
+	Stft stft;
+	assert(0 == stft.setup(fftSize, hopSize, [&calls](StftComplex* spectrum, unsigned int numBins) {
+		assert(fftSize / 2 + 1 == numBins);
+		++calls;
+	}));
+	assert(fftSize == stft.getLatency());
+	for(unsigned int n = 0; n < length; n += blockSize)
+		stft.process(&out[n], &in[n], blockSize);
+	assert(length / hopSize == calls);
+	unsigned int latency = stft.getLatency();
+	for(unsigned int n = latency + fftSize; n < length; ++n)
+		assert(fabsf(out[n] - in[n - latency]) < 1e-4);
+
+	// zeroing the spectrum silences the output
+	stft.setup(fftSize, hopSize, [](StftComplex* spectrum, unsigned int numBins) {
+		memset(spectrum, 0, numBins * sizeof(spectrum[0]));
+	});
+	for(unsigned int n = 0; n < length; n += blockSize)
+		stft.process(&out[n], &in[n], blockSize);
+	for(unsigned int n = 0; n < length; ++n)
+		assert(fabsf(out[n]) < 1e-6);
+	assert(0 == stft.getMissedFrames());
+
+	// in the background, two STFTs share a scheduler. The latency grows
+	// by a hop, and the overlap-add still gives back the delayed input
+	DeadlineScheduler scheduler;
+	assert(0 == scheduler.setup(2, 0));
+	Stft stfts[2];
+	std::vector<float> outs[2];
+	const float gains[2] = { 1, 0.5 };
+	std::atomic<unsigned int> backgroundCalls{0};
+	for(unsigned int k = 0; k < 2; ++k)
+	{
+		float gain = gains[k];
+		assert(0 == stfts[k].setup(fftSize, hopSize, [gain, &backgroundCalls](StftComplex* spectrum, unsigned int numBins) {
+			for(unsigned int n = 0; n < numBins; ++n)
+			{
+				spectrum[n].r *= gain;
+				spectrum[n].i *= gain;
+			}
+			++backgroundCalls;
+		}, &scheduler));
+		assert(fftSize + hopSize == stfts[k].getLatency());
+		outs[k].resize(length);
+	}
+	for(unsigned int n = 0, block = 0; n < length; n += blockSize, ++block)
+	{
+		scheduler.tick(block);
+		for(unsigned int k = 0; k < 2; ++k)
+		{
+			// the workers get as long as they need, so that this
+			// does not depend on the load of the machine
+			for(auto& frame : stfts[k].frames)
+				while(frame.job >= 0 && !scheduler.isDone(frame.job))
+					usleep(100);
+			stfts[k].process(&outs[k][n], &in[n], blockSize);
+		}
+	}
+	for(auto& stft : stfts)
+		for(auto& frame : stft.frames)
+			while(frame.job >= 0 && !scheduler.isDone(frame.job))
+				usleep(100);
+	assert(2 * length / hopSize == backgroundCalls);
+	latency = fftSize + hopSize;
+	for(unsigned int k = 0; k < 2; ++k)
+	{
+		assert(0 == stfts[k].getMissedFrames());
+		for(unsigned int n = latency + fftSize; n < length; ++n)
+			assert(fabsf(outs[k][n] - gains[k] * in[n - latency]) < 1e-4);
+	}
+
+	// a frame that is not ready in time is dropped and counted
+	stfts[0].setup(fftSize, hopSize, [](StftComplex* spectrum, unsigned int numBins) {
+		usleep(20000);
+	}, &scheduler);
+	for(unsigned int n = 0, block = 0; n < length; n += blockSize, ++block)
+	{
+		scheduler.tick(block);
+		stfts[0].process(&outs[0][n], &in[n], blockSize);
+	}
+	assert(stfts[0].getMissedFrames() > 0);
+	stfts[0].cleanup();
+	stfts[1].cleanup();
+	scheduler.cleanup();
+	return true;
+}
@@ -0,0 +1,142 @@
+/***** Stft.h *****/
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <DeadlineScheduler.h>
+
+/**
+ * A complex frequency bin. This has the same layout as
+ * ne10_fft_cpx_float32_t.
+ */
+typedef struct {
+	float r;
+	float i;
+} StftComplex;
+
+class StftFft;
+
+/**
+ * \brief Short-time Fourier transform with overlap-add resynthesis.
+ *
+ * The input is split in overlapping windowed frames, every `hopSize`
+ * samples. Each frame is transformed to the frequency domain and passed to
+ * a callback, which can modify the spectrum in place. The spectrum is then
+ * transformed back and overlap-added to the output:
+ *
+ *     Stft stft;
+ *     stft.setup(1024, 256, [](StftComplex* spectrum, unsigned int numBins) {
+ *         for(unsigned int n = 0; n < numBins; ++n)
+ *             spectrum[n].i = 0; // zero the phase (robotisation)
+ *     });
+ *     ...
+ *     stft.process(out, in, context->audioFrames);
+ *
+ * Frames can be processed either inline, in process(), or in the
+ * background on a DeadlineScheduler. A scheduler can be shared between
+ * several Stft objects, so that they do not need a thread each. In both
+ * cases the output is delayed by a constant number of samples, returned by
+ * getLatency(): `fftSize` when processing inline, `fftSize + hopSize` in
+ * the background. A frame that is not ready in time is dropped and counted
+ * in getMissedFrames().
+ *
+ * The real FFT uses ne10 when building for NEON, and a portable
+ * implementation otherwise.
+ */
+class Stft
+{
+public:
+	typedef std::function<void(StftComplex* spectrum, unsigned int numBins)> Callback;
+	Stft();
+	~Stft();
+	/**
+	 * Set up the STFT with a Hann analysis and synthesis window.
+	 *
+	 * @param fftSize the length of each frame. Must be a power of 2.
+	 * @param hopSize the distance between successive frames. Must be
+	 * smaller than or equal to `fftSize`.
+	 * @param callback called with the spectrum of each frame, which has
+	 * `fftSize / 2 + 1` bins.
+	 * @param scheduler if not NULL, frames are processed in the
+	 * background on this scheduler, which must be tick()ed once per
+	 * block, before calling process(). The callback is then called from
+	 * a worker thread. In this case, `hopSize` should not be smaller
+	 * than the number of frames passed to process().
+	 *
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int setup(unsigned int fftSize, unsigned int hopSize, Callback callback, DeadlineScheduler* scheduler = NULL);
+	/**
+	 * Set up the STFT with custom windows.
+	 *
+	 * @param analysisWindow applied to each frame before the forward
+	 * transform. Must be `fftSize` long.
+	 * @param synthesisWindow applied to each frame after the inverse
+	 * transform. Must be `fftSize` long, or empty for none.
+	 *
+	 * The output is normalised so that an unmodified spectrum gives back
+	 * the input, as long as the windows overlap-add to a constant.
+	 */
+	int setup(unsigned int fftSize, unsigned int hopSize, const std::vector<float>& analysisWindow, const std::vector<float>& synthesisWindow, Callback callback, DeadlineScheduler* scheduler = NULL);
+	void cleanup();
+	/**
+	 * Process a block of samples.
+	 *
+	 * @param out the output buffer. It can be the same as @p in.
+	 * @param in the input buffer.
+	 * @param frames the number of samples in the buffers.
+	 */
+	void process(float* out, const float* in, unsigned int frames);
+	/**
+	 * @return the delay between the input and the output, in samples.
+	 */
+	unsigned int getLatency() { return latency; }
+	/**
+	 * @return the number of frames that were dropped because the
+	 * background processing was not ready in time.
+	 */
+	unsigned int getMissedFrames() { return missedFrames; }
+	/**
+	 * Fill @p window with a Hann window of the given length.
+	 */
+	static void hann(std::vector<float>& window, unsigned int length);
+	static bool test();
+private:
+	// each frame has its own FFT state, so that two frames can be
+	// processed at the same time by different workers
+	struct Frame {
+		Stft* stft = NULL;
+		StftFft* fft = NULL;
+		std::vector<float> data;
+		std::vector<StftComplex> spectrum;
+		int job = -1;
+		uint64_t outputStart = 0; // the first output sample for this frame
+	};
+	void newFrame();
+	void processFrame(Frame& frame);
+	void collectFrame(Frame& frame);
+	void overlapAdd(const float* data, uint64_t start);
+	static void frameJob(void* arg);
+
+	unsigned int fftSize = 0;
+	unsigned int hopSize = 0;
+	unsigned int latency = 0;
+	unsigned int missedFrames = 0;
+	uint64_t sample = 0;
+	uint64_t blockStart = 0;
+	unsigned int blockSize = 0;
+	unsigned int hopCounter = 0;
+	Callback callback;
+	std::vector<float> analysisWindow;
+	std::vector<float> synthesisWindow;
+	// circular buffers, with power-of-2 lengths
+	std::vector<float> inBuffer;
+	std::vector<float> outBuffer;
+	unsigned int inMask;
+	unsigned int outMask;
+	// only frames[0] is used when processing inline
+	DeadlineScheduler* scheduler = NULL;
+	static constexpr unsigned int kNumFrames = 2;
+	Frame frames[kNumFrames];
+	unsigned int nextFrame = 0;
+};
@@ -0,0 +1,318 @@
+/***** CentroidDetection.cpp *****/
+#include "CentroidDetection.h"
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CENTROID_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define CENTROID_SSE2
+#endif
+
+static constexpr unsigned int kVectorSize = 4;
+
+int CentroidDetection::setup(unsigned int numSensors, unsigned int numChannels, unsigned int maxTouches)
+{
+	if(!numSensors || !numChannels || numChannels > kMaxChannels || !maxTouches)
+	{
+		fprintf(stderr, "CentroidDetection: invalid number of sensors, channels or touches\n");
+		return EINVAL;
+	}
+	this->numSensors = numSensors;
+	this->numChannels = numChannels;
+	this->maxTouches = maxTouches;
+	stride = (numChannels + kVectorSize - 1) / kVectorSize * kVectorSize;
+	// the padding channels stay at 0, so they are never touched
+	input.assign(numSensors * stride, 0);
+	baselines.assign(numSensors * stride, 0);
+	diffs.assign(numSensors * stride, 0);
+	touches.assign(numSensors * maxTouches, Touch());
+	numTouches.assign(numSensors, 0);
+	hasBaseline = false;
+	return 0;
+}
+
+void CentroidDetection::process(const int* const* raw)
+{
+	for(unsigned int s = 0; s < numSensors; ++s)
+	{
+		float* in = input.data() + s * stride;
+		for(unsigned int c = 0; c < numChannels; ++c)
+			in[c] = raw[s][c];
+	}
+	processDiffs();
+	for(unsigned int s = 0; s < numSensors; ++s)
+		findTouches(s);
+}
+
+void CentroidDetection::process(const float* raw)
+{
+	for(unsigned int s = 0; s < numSensors; ++s)
+		memcpy(input.data() + s * stride, raw + s * numChannels, numChannels * sizeof(raw[0]));
+	processDiffs();
+	for(unsigned int s = 0; s < numSensors; ++s)
+		findTouches(s);
+}
+
+// Subtract the baseline from the readings of all sensors, and let the
+// baseline follow the channels that are below the threshold.
+void CentroidDetection::processDiffs()
+{
+	const unsigned int size = input.size();
+	const float* in = input.data();
+	float* baseline = baselines.data();
+	float* diff = diffs.data();
+	if(!hasBaseline)
+	{
+		memcpy(baseline, in, size * sizeof(in[0]));
+		memset(diff, 0, size * sizeof(diff[0]));
+		hasBaseline = true;
+		return;
+	}
+#if defined(CENTROID_NEON)
+	const float32x4_t threshold = vdupq_n_f32(noiseThreshold);
+	const float32x4_t rate = vdupq_n_f32(baselineRate);
+	for(unsigned int n = 0; n < size; n += kVectorSize)
+	{
+		float32x4_t r = vld1q_f32(in + n);
+		float32x4_t b = vld1q_f32(baseline + n);
+		float32x4_t d = vsubq_f32(r, b);
+		uint32x4_t touched = vcgtq_f32(d, threshold);
+		float32x4_t updated = vmlaq_f32(b, rate, d);
+		vst1q_f32(baseline + n, vbslq_f32(touched, b, updated));
+		vst1q_f32(diff + n, vreinterpretq_f32_u32(vandq_u32(touched, vreinterpretq_u32_f32(d))));
+	}
+#elif defined(CENTROID_SSE2)
+	const __m128 threshold = _mm_set1_ps(noiseThreshold);
+	const __m128 rate = _mm_set1_ps(baselineRate);
+	for(unsigned int n = 0; n < size; n += kVectorSize)
+	{
+		__m128 r = _mm_loadu_ps(in + n);
+		__m128 b = _mm_loadu_ps(baseline + n);
+		__m128 d = _mm_sub_ps(r, b);
+		__m128 touched = _mm_cmpgt_ps(d, threshold);
+		__m128 updated = _mm_add_ps(b, _mm_mul_ps(rate, d));
+		_mm_storeu_ps(baseline + n, _mm_or_ps(_mm_and_ps(touched, b), _mm_andnot_ps(touched, updated)));
+		_mm_storeu_ps(diff + n, _mm_and_ps(touched, d));
+	}
+#else
+	for(unsigned int n = 0; n < size; ++n)
+	{
+		float d = in[n] - baseline[n];
+		bool touched = d > noiseThreshold;
+		if(!touched)
+			baseline[n] += baselineRate * d;
+		diff[n] = touched ? d : 0;
+	}
+#endif
+}
+
+void CentroidDetection::findTouches(unsigned int sensor)
+{
+	const float* d = diffs.data() + sensor * stride;
+	const unsigned int n = numChannels;
+	// prefix sums of the readings and of their moments, so that the
+	// centroid of any range of channels takes two subtractions
+	float sums[kMaxChannels + 1];
+	float moments[kMaxChannels + 1];
+	sums[0] = 0;
+	moments[0] = 0;
+	for(unsigned int c = 0; c < n; ++c)
+	{
+		sums[c + 1] = sums[c] + d[c];
+		moments[c + 1] = moments[c] + c * d[c];
+	}
+	auto valley = [d](unsigned int p, unsigned int q) {
+		unsigned int v = p + 1;
+		for(unsigned int c = p + 2; c < q; ++c)
+			if(d[c] < d[v])
+				v = c;
+		return v;
+	};
+	// the local maxima. A plateau counts as one, at its first channel.
+	// Two peaks that are not separated by a deep enough valley are
+	// merged into the larger one.
+	unsigned int peaks[kMaxChannels];
+	unsigned int numPeaks = 0;
+	for(unsigned int c = 0; c < n; ++c)
+	{
+		if(!(d[c] > 0 && (0 == c || d[c] > d[c - 1]) && (n - 1 == c || d[c] >= d[c + 1])))
+			continue;
+		peaks[numPeaks++] = c;
+		while(numPeaks >= 2)
+		{
+			unsigned int p = peaks[numPeaks - 2];
+			unsigned int q = peaks[numPeaks - 1];
+			float v = d[valley(p, q)];
+			// a valley at 0 separates two groups of channels
+			if(0 == v || v < valleyRatio * fminf(d[p], d[q]))
+				break;
+			if(d[q] > d[p])
+				peaks[numPeaks - 2] = q;
+			--numPeaks;
+		}
+	}
+	// each touch goes from the valley before its peak to the one after
+	// it. The reading at a valley is split between the two touches.
+	Touch candidates[kMaxChannels];
+	unsigned int numCandidates = 0;
+	for(unsigned int k = 0; k < numPeaks; ++k)
+	{
+		unsigned int lo = k > 0 ? valley(peaks[k - 1], peaks[k]) : 0;
+		unsigned int hi = k + 1 < numPeaks ? valley(peaks[k], peaks[k + 1]) : n - 1;
+		float sum = sums[hi + 1] - sums[lo];
+		float moment = moments[hi + 1] - moments[lo];
+		if(k > 0)
+		{
+			sum -= d[lo] * 0.5f;
+			moment -= lo * d[lo] * 0.5f;
+		}
+		if(k + 1 < numPeaks)
+		{
+			sum -= d[hi] * 0.5f;
+			moment -= hi * d[hi] * 0.5f;
+		}
+		if(sum <= 0 || sum < minimumTouchSize)
+			continue;
+		candidates[numCandidates++] = { moment / sum, sum };
+	}
+	// keep the largest touches, in order of location
+	while(numCandidates > maxTouches)
+	{
+		unsigned int smallest = 0;
+		for(unsigned int k = 1; k < numCandidates; ++k)
+			if(candidates[k].size < candidates[smallest].size)
+				smallest = k;
+		memmove(candidates + smallest, candidates + smallest + 1, (numCandidates - smallest - 1) * sizeof(candidates[0]));
+		--numCandidates;
+	}
+	memcpy(touches.data() + sensor * maxTouches, candidates, numCandidates * sizeof(candidates[0]));
+	numTouches[sensor] = numCandidates;
+}
+
+// Readings of a sensor with a baseline of 1000 and touches modelled as
+// gaussians across the channels.
+static void makeFrame(float* raw, unsigned int numChannels, const float* locations, const float* amplitudes, unsigned int numTouches, float width, float noise)
+{
+	for(unsigned int c = 0; c < numChannels; ++c)
+	{
+		raw[c] = 1000 + noise * (rand() / (float)RAND_MAX - 0.5f);
+		for(unsigned int t = 0; t < numTouches; ++t)
+		{
+			float x = (c - locations[t]) / width;
+			raw[c] += amplitudes[t] * expf(-0.5f * x * x);
+		}
+	}
+}
+
+#include <time.h>
+
+void CentroidDetection::benchmark()
+{
+	const unsigned int kNumSensors = 4;
+	const unsigned int kNumChannels = 30;
+	const unsigned int kNumFrames = 64;
+	const unsigned int kRepetitions = 2000;
+	CentroidDetection detection(kNumSensors, kNumChannels, 8);
+	std::vector<float> frames(kNumFrames * kNumSensors * kNumChannels);
+	for(unsigned int f = 0; f < kNumFrames; ++f)
+	{
+		for(unsigned int s = 0; s < kNumSensors; ++s)
+		{
+			float locations[] = { 3.f + f * 0.1f + s, 15.5f, 25.f - f * 0.05f };
+			float amplitudes[] = { 400, 300, 500 };
+			makeFrame(frames.data() + (f * kNumSensors + s) * kNumChannels, kNumChannels, locations, amplitudes, f ? 1 + s % 3 : 0, 0.8, 10);
+		}
+	}
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start); // NOWRAP
+	unsigned int touches = 0;
+	for(unsigned int r = 0; r < kRepetitions; ++r)
+	{
+		for(unsigned int f = 0; f < kNumFrames; ++f)
+		{
+			detection.process(frames.data() + f * kNumSensors * kNumChannels);
+			touches += detection.getNumTouches(0);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end); // NOWRAP
+	double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+	printf("CentroidDetection: %u sensors x %u channels: %.0f ns per frame (%u touches)\n",
+		kNumSensors, kNumChannels, ns / (kRepetitions * kNumFrames), touches);
+}
+
+#undef NDEBUG
+#include <assert.h>
+
+bool CentroidDetection::test()
+{
+	srand(0);
+	const unsigned int kNumChannels = 30;
+	const float kWidth = 0.6;
+	CentroidDetection detection;
+	assert(0 != detection.setup(1, kMaxChannels + 1, 4));
+	assert(0 == detection.setup(3, kNumChannels, 3));
+	detection.setBaselineRate(0.05);
+	std::vector<float> frame(3 * kNumChannels);
+	auto processTouches = [&](const std::vector<std::vector<float>>& locations, const std::vector<std::vector<float>>& amplitudes, float baselineOffset) {
+		for(unsigned int s = 0; s < 3; ++s)
+		{
+			float* raw = frame.data() + s * kNumChannels;
+			makeFrame(raw, kNumChannels, locations[s].data(), amplitudes[s].data(), locations[s].size(), kWidth, 10);
+			for(unsigned int c = 0; c < kNumChannels; ++c)
+				raw[c] += baselineOffset;
+		}
+		detection.process(frame.data());
+	};
+	auto checkTouches = [&](unsigned int sensor, const std::vector<float>& locations) {
+		assert(detection.getNumTouches(sensor) == locations.size());
+		for(unsigned int t = 0; t < locations.size(); ++t)
+			assert(fabsf(detection.getTouches(sensor)[t].location - locations[t]) < 0.1f);
+	};
+	// the first frame is the baseline
+	processTouches({ {}, {}, {} }, { {}, {}, {} }, 0);
+	for(unsigned int s = 0; s < 3; ++s)
+		assert(0 == detection.getNumTouches(s));
+	// one touch between channels, two far apart, two close ones
+	processTouches({ { 12.3 }, { 5.2, 20.7 }, { 10, 12 } }, { { 500 }, { 400, 600 }, { 500, 500 } }, 0);
+	checkTouches(0, { 12.3 });
+	checkTouches(1, { 5.2, 20.7 });
+	checkTouches(2, { 10, 12 });
+	// a shallow valley makes a single touch
+	processTouches({ {}, {}, { 10, 11 } }, { {}, {}, { 500, 500 } }, 0);
+	checkTouches(2, { 10.5 });
+	// only the largest touches are kept, still in order of location
+	processTouches({ { 3, 10, 20, 27 }, {}, {} }, { { 300, 500, 200, 400 }, {}, {} }, 0);
+	checkTouches(0, { 3, 10, 27 });
+	// the edges of the sensor
+	processTouches({ { 0 }, { 29 }, {} }, { { 500 }, { 500 }, {} }, 0);
+	assert(1 == detection.getNumTouches(0) && detection.getTouches(0)[0].location < 0.5f);
+	assert(1 == detection.getNumTouches(1) && detection.getTouches(1)[0].location > 28.5f);
+	// the baseline follows a slow drift without reporting touches, but a
+	// touch during the drift is still found
+	for(unsigned int n = 0; n < 400; ++n)
+	{
+		processTouches({ {}, {}, {} }, { {}, {}, {} }, n * 0.5f);
+		for(unsigned int s = 0; s < 3; ++s)
+			assert(0 == detection.getNumTouches(s));
+	}
+	processTouches({ { 7.5 }, {}, {} }, { { 500 }, {}, {} }, 200);
+	checkTouches(0, { 7.5 });
+	// integer readings, as in Trill::rawData, give the same touches
+	int rawData[3][kNumChannels];
+	const int* raw[3];
+	for(unsigned int s = 0; s < 3; ++s)
+	{
+		for(unsigned int c = 0; c < kNumChannels; ++c)
+			rawData[s][c] = lrintf(frame[s * kNumChannels + c]);
+		raw[s] = rawData[s];
+	}
+	detection.process(raw);
+	checkTouches(0, { 7.5 });
+	assert(0 == detection.getNumTouches(1) && 0 == detection.getNumTouches(2));
+	return true;
+}
@@ -0,0 +1,136 @@
+/***** CentroidDetection.h *****/
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * \brief Find touches in the raw readings of one or more Trill sensors.
+ *
+ * In NORMAL mode the touches are computed by the sensor firmware, with a
+ * fixed resolution and at most 5 touches (4 per axis on 2D sensors). This
+ * does the same on the host, from the readings of the sensor in RAW mode:
+ *
+ *     Trill gTrills[2];
+ *     CentroidDetection gCentroids(2, 30, 8);
+ *
+ *     void readLoop(void*)
+ *     {
+ *         ...
+ *         gTrills[0].readI2C();
+ *         gTrills[1].readI2C();
+ *         const int* raw[2] = { gTrills[0].rawData, gTrills[1].rawData };
+ *         gCentroids.process(raw);
+ *         for(unsigned int n = 0; n < gCentroids.getNumTouches(0); ++n)
+ *             printf("%f ", gCentroids.getTouches(0)[n].location);
+ *     }
+ *
+ * For each channel a baseline is tracked while it is not touched, and the
+ * readings that exceed it by less than the noise threshold are discarded.
+ * This is done on all the channels of all the sensors at once, with NEON
+ * or SSE2. Each touch is then a peak in the remaining readings of a
+ * sensor. Peaks separated by a shallow valley are merged into a single
+ * touch, and the location of a touch is the centroid of the readings
+ * around it, with a resolution finer than the channel spacing.
+ *
+ * The readings can come from a recorded file as well as from the sensors,
+ * so that settings can be tested offline.
+ */
+class CentroidDetection
+{
+public:
+	static constexpr unsigned int kMaxChannels = 32;
+	struct Touch {
+		float location; ///< the centroid of the touch, in channels from the first channel
+		float size; ///< the sum of the readings of the touch, above the baseline
+	};
+
+	CentroidDetection() {}
+	CentroidDetection(unsigned int numSensors, unsigned int numChannels, unsigned int maxTouches)
+	{
+		setup(numSensors, numChannels, maxTouches);
+	}
+	/**
+	 * @param numSensors the number of sensors processed together
+	 * @param numChannels the number of channels of each sensor, up to
+	 * kMaxChannels
+	 * @param maxTouches the maximum number of touches reported for each
+	 * sensor. When there are more, the largest are kept.
+	 *
+	 * @return 0 on success, an error code otherwise.
+	 */
+	int setup(unsigned int numSensors, unsigned int numChannels, unsigned int maxTouches);
+	/**
+	 * Set the minimum difference from the baseline for a reading to be
+	 * considered, in the same units as the readings.
+	 */
+	void setNoiseThreshold(float threshold) { noiseThreshold = threshold; }
+	/**
+	 * Set how fast the baseline follows the readings of channels that are
+	 * not touched, between 0 (never) and 1 (immediately).
+	 */
+	void setBaselineRate(float rate) { baselineRate = rate; }
+	/**
+	 * Set the minimum size of a touch.
+	 */
+	void setMinimumTouchSize(float size) { minimumTouchSize = size; }
+	/**
+	 * Set how deep the valley between two peaks must be for them to be
+	 * separate touches, as a fraction of the smaller peak.
+	 */
+	void setValleyRatio(float ratio) { valleyRatio = ratio; }
+	/**
+	 * Use the next frame as the baseline, as Trill::updateBaseLine() does
+	 * on the sensor.
+	 */
+	void resetBaseline() { hasBaseline = false; }
+	/**
+	 * Process one frame of readings from all sensors.
+	 *
+	 * @param raw `numSensors` pointers to `numChannels` readings each,
+	 * e.g.: Trill::rawData.
+	 */
+	void process(const int* const* raw);
+	/**
+	 * Process one frame of readings from all sensors.
+	 *
+	 * @param raw `numSensors * numChannels` readings, those of the first
+	 * sensor first.
+	 */
+	void process(const float* raw);
+	/**
+	 * @return the number of touches found in the last frame.
+	 */
+	unsigned int getNumTouches(unsigned int sensor) const { return numTouches[sensor]; }
+	/**
+	 * @return the touches found in the last frame, in order of location.
+	 */
+	const Touch* getTouches(unsigned int sensor) const { return touches.data() + sensor * maxTouches; }
+	/**
+	 * @return the readings of the last frame above the baseline and
+	 * noise threshold, or 0.
+	 */
+	const float* getDiffs(unsigned int sensor) const { return diffs.data() + sensor * stride; }
+	static bool test();
+	/**
+	 * Time the processing of a batch of sensors and print the results.
+	 */
+	static void benchmark();
+private:
+	void processDiffs();
+	void findTouches(unsigned int sensor);
+	std::vector<float> input;
+	std::vector<float> baselines;
+	std::vector<float> diffs;
+	std::vector<Touch> touches;
+	std::vector<unsigned int> numTouches;
+	unsigned int numSensors = 0;
+	unsigned int numChannels = 0;
+	unsigned int stride = 0; // numChannels, rounded up to a whole vector
+	unsigned int maxTouches = 0;
+	float noiseThreshold = 40;
+	float baselineRate = 0.001;
+	float minimumTouchSize = 0;
+	float valleyRatio = 0.7;
+	bool hasBaseline = false;
+};
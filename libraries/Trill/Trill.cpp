@@ -1,4 +1,5 @@
 #include <libraries/Trill/Trill.h>
+#include <string.h>
 
 #define MAX_TOUCH_1D_OR_2D ((device_type_ == TWOD ? kMaxTouchNum2D : kMaxTouchNum1D))
 #define NUM_SENSORS ((device_type_ == ONED ? kNumSensorsBar : kNumSensors))
@@ -237,6 +238,14 @@ int Trill::prepareForDataRead() {
 	return 0;
 }
 
+unsigned int Trill::dataLength() {
+	if(mode_ != NORMAL)
+		return kRawLength;
+	if(device_type_ == TWOD)
+		return kNormalLength2D;
+	return kNormalLengthDefault;
+}
+
 // This should maybe be renamed readRawData()
 int Trill::readI2C() {
 
@@ -249,11 +258,15 @@ int Trill::readI2C() {
 		fprintf(stderr, "Failure to read Byte Stream\n");
 		return 1;
 	}
+	parseRawData();
+
+	return 0;
+}
+
+void Trill::parseRawData() {
 	for (unsigned int i=0; i < NUM_SENSORS; i++) {
 		rawData[i] = ((dataBuffer[2*i] << 8) + dataBuffer[2*i+1]) & 0x0FFF;
 	}
-
-	return 0;
 }
 
 int Trill::readLocations() {
@@ -263,14 +276,19 @@ int Trill::readLocations() {
 	uint8_t bytesToRead = kNormalLengthDefault;
 	if(device_type_ == TWOD)
 		bytesToRead = kNormalLength2D;
-	int bytesRead = ::read(i2C_file, dataBuffer, kNormalLengthDefault);
-	if (bytesRead != kNormalLengthDefault)
+	int bytesRead = ::read(i2C_file, dataBuffer, bytesToRead);
+	if (bytesRead != bytesToRead)
 	{
 		num_touches_ = 0;
 		fprintf(stderr, "Failure to read Byte Stream\n");
 		return 1;
 	}
+	parseLocations();
 
+	return 0;
+}
+
+void Trill::parseLocations() {
 	unsigned int locations = 0;
 	// Look for 1st instance of 0xFFFF (no touch) in the buffer
 	for(locations = 0; locations < MAX_TOUCH_1D_OR_2D; locations++)
@@ -292,7 +310,25 @@ int Trill::readLocations() {
 		}
 		num_touches_ |= (locations << 4);
 	}
+}
+
+int Trill::poll(I2cBus& bus, uint8_t* snapshot) {
+	// setting the data offset and reading in the same transaction needs
+	// no sleep in between
+	uint8_t offset = kOffsetData;
+	I2cBus::Message messages[2] = {
+		{ (uint16_t)i2C_address, false, 1, &offset },
+		{ (uint16_t)i2C_address, true, (uint16_t)dataLength(), snapshot },
+	};
+	return bus.transfer(messages, 2);
+}
 
+int Trill::readSnapshot(const uint8_t* snapshot) {
+	memcpy(dataBuffer, snapshot, dataLength());
+	if(mode_ == NORMAL)
+		parseLocations();
+	else
+		parseRawData();
 	return 0;
 }
 
@@ -1,7 +1,8 @@
 #include <I2c.h>
+#include <I2cScheduler.h>
 #include <stdint.h>
 
-class Trill : public I2c
+class Trill : public I2c, public I2cScheduler::Device
 {
 	private:
 
@@ -47,6 +48,10 @@ class Trill : public I2c
 		uint8_t dataBuffer[kRawLength];
 		uint16_t commandSleepTime = 10000;
 
+		unsigned int dataLength();
+		void parseRawData();
+		void parseLocations();
+
 	public:
 		int rawData[kNumSensors];
 
@@ -77,6 +82,15 @@ class Trill : public I2c
 		int prepareForDataRead();
 		int readI2C(); // This should maybe be renamed readRawData()
 		int readLocations();
+
+		/* --- Polling from an I2cScheduler --- */
+		/* The settings must not be changed while the sensor is polled */
+		unsigned int getSnapshotSize() override { return kRawLength; }
+		/* Read the data for the current mode with a single combined transfer */
+		int poll(I2cBus& bus, uint8_t* snapshot) override;
+		/* Update the raw data or touches from a snapshot returned by
+		 * I2cScheduler::getSnapshot(), as readI2C() or readLocations() would */
+		int readSnapshot(const uint8_t* snapshot);
 		/* Return the type of the device attached or 0 if none is attached */
 		int deviceType() { return device_type_; }
 		int firmwareVersion() { return firmware_version_; }
@@ -59,6 +59,15 @@ class UdpClient{
 		 * @return the number of bytes sent or -1 if an error occurred.
 		 */
 		int send(void* message, int size);
+		/**
+		 * @return the socket, e.g.: to send several packets at once with
+		 * sendmmsg() to getDestination().
+		 */
+		int getSocket() const { return outSocket; }
+		/**
+		 * @return the address packets are sent to.
+		 */
+		const struct sockaddr_in& getDestination() const { return destinationServer; }
 
 		int write(const char* remoteHostname, int remotePortNumber, void* sourceBuffer, int numBytesToWrite);
 		int waitUntilReady(bool readyForReading, int timeoutMsecs);
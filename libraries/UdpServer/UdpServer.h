@@ -42,6 +42,11 @@ class UdpServer{
 		void cleanup();
 		bool bindToPort(int aPort);
 		int getBoundPort() const;
+		/*
+		 * Returns the file descriptor of the socket, e.g.: to wait on it
+		 * with poll() or an AuxTaskReactor.
+		 */
+		int getSocket() const { return inSocket; }
 		/*
 		 * Reads bytes from the socket.
 		 *
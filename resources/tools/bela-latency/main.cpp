@@ -0,0 +1,680 @@
+/*
+ * bela-latency: measure the scheduling latency of threads running at the
+ * priorities that Bela uses, in the style of cyclictest, optionally while
+ * generating some load.
+ *
+ * - audio: a periodic thread at the priority of the Bela audio thread. It
+ *   wakes up at the end of each period with clock_nanosleep() and its latency
+ *   is how late it wakes up.
+ * - fifo: a thread at the priority of the one that calls render() when the
+ *   period size is larger than the hardware's. The audio thread wakes it up
+ *   every few periods and its latency is from then until it runs.
+ * - aux: an auxiliary task, woken up by the audio thread every few periods
+ *   in the same way as Bela_scheduleAuxiliaryTask() does.
+ *
+ * When built from the Bela folder with `make bela-latency` it uses Xenomai,
+ * with the same skin and priorities as RTAudio.cpp. Built with the Makefile
+ * in this folder, it runs on plain Linux with SCHED_FIFO threads.
+ *
+ * The report lists the configuration and, for each thread, the statistics
+ * and a histogram of the latency in 1us bins, so that reports from different
+ * images can be compared with diff.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include <Bela.h>
+#include <LatencyStats.h>
+#include <xenomai_wraps.h>
+#if XENOMAI_MAJOR == 3
+#include <xenomai/init.h>
+#endif
+#if XENOMAI_MAJOR > 0
+#include <WSServer.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#ifndef XENOMAI_SKIN_posix
+#error bela-latency requires the posix skin
+#endif
+
+#if XENOMAI_MAJOR == 0
+// Without Xenomai, the calls made through xenomai_wraps.h go to Linux
+extern "C" {
+int __wrap_pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine) (void *), void *arg)
+{
+	return pthread_create(thread, attr, start_routine, arg);
+}
+int __wrap_nanosleep(const struct timespec *req, struct timespec *rem)
+{
+	return nanosleep(req, rem);
+}
+int __wrap_clock_nanosleep(clockid_t clock_id, int flags, const struct timespec *request, struct timespec *remain)
+{
+	return clock_nanosleep(clock_id, flags, request, remain);
+}
+int __wrap_clock_gettime(clockid_t clock_id, struct timespec *tp)
+{
+	return clock_gettime(clock_id, tp);
+}
+int __wrap_pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr)
+{
+	return pthread_mutex_init(mutex, attr);
+}
+int __wrap_pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+	return pthread_mutex_lock(mutex);
+}
+int __wrap_pthread_mutex_trylock(pthread_mutex_t *mutex)
+{
+	return pthread_mutex_trylock(mutex);
+}
+int __wrap_pthread_mutex_unlock(pthread_mutex_t *mutex)
+{
+	return pthread_mutex_unlock(mutex);
+}
+int __wrap_pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr)
+{
+	return pthread_cond_init(cond, attr);
+}
+int __wrap_pthread_cond_signal(pthread_cond_t *cond)
+{
+	return pthread_cond_signal(cond);
+}
+int __wrap_pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+	return pthread_cond_wait(cond, mutex);
+}
+int __wrap_sem_init(sem_t *sem, int pshared, unsigned int value)
+{
+	return sem_init(sem, pshared, value);
+}
+int __wrap_sem_post(sem_t *sem)
+{
+	return sem_post(sem);
+}
+int __wrap_sem_wait(sem_t *sem)
+{
+	return sem_wait(sem);
+}
+}
+#endif
+
+// these are also used by AuxTaskNonRT, through WSServer
+int volatile gShouldStop = 0;
+int gRTAudioVerbose = 0;
+unsigned int gAuxiliaryTaskCpus = 0;
+
+// Wakeup latency in bins of 1us. Early wakeups count as 0 and the last bin
+// counts all the wakeups that are later than that.
+class LatencyHistogram {
+public:
+	static constexpr unsigned int kBins = 1000;
+	LatencyHistogram() : bins(kBins + 1) {}
+	void add(int64_t ns)
+	{
+		int64_t us = ns / 1000;
+		if(us < 0)
+			us = 0;
+		if(us > (int64_t)kBins)
+			us = kBins;
+		++bins[us];
+	}
+	unsigned int operator[](unsigned int bin) const { return bins[bin]; }
+private:
+	std::vector<unsigned int> bins;
+};
+
+struct Measurement {
+	Measurement(const char* name) : name(name), priority(0), periods(0), thread(0) {}
+	const char* name;
+	int priority;
+	unsigned int periods; // how often the thread wakes up, in audio periods
+	pthread_t thread;
+	LatencyStats stats;
+	LatencyHistogram histogram;
+	void add(int64_t ns)
+	{
+		stats.add(ns);
+		histogram.add(ns);
+	}
+};
+
+static Measurement gAudio("audio");
+static Measurement gFifo("fifo");
+static Measurement gAux("aux");
+static uint64_t gPeriodNs;
+static unsigned int gPeriodSize = 16;
+static unsigned int gSampleRate = 44100;
+static int gError;
+
+// the fifo thread is woken up with a semaphore
+static sem_t gFifoSem;
+static uint64_t gFifoPostNs;
+// the aux thread is woken up with a condition variable, as in AuxiliaryTasks.cpp
+static pthread_mutex_t gAuxMutex;
+static pthread_cond_t gAuxCond;
+static uint64_t gAuxScheduledNs;
+
+// load
+static unsigned int gCpuLoad;
+static unsigned int gIoLoad;
+static std::string gIoDir = "/tmp";
+static unsigned int gWsLoadKBps;
+static std::vector<pthread_t> gLoadThreads;
+
+static uint64_t getTimeNs()
+{
+	struct timespec ts;
+	__wrap_clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// if the aux thread has not gone back to waiting since it was last
+// scheduled, the wakeup is lost, as in Bela_scheduleAuxiliaryTask()
+static void scheduleAux()
+{
+	if(__wrap_pthread_mutex_trylock(&gAuxMutex))
+		return;
+	gAuxScheduledNs = getTimeNs();
+	__wrap_pthread_cond_signal(&gAuxCond);
+	__wrap_pthread_mutex_unlock(&gAuxMutex);
+}
+
+static void* audioLoop(void*)
+{
+	struct timespec next;
+	__wrap_clock_gettime(CLOCK_MONOTONIC, &next);
+	for(uint64_t n = 1; !gShouldStop; ++n)
+	{
+		next.tv_nsec += gPeriodNs;
+		while(next.tv_nsec >= 1000000000)
+		{
+			next.tv_nsec -= 1000000000;
+			++next.tv_sec;
+		}
+		int ret = __wrap_clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+		if(ret)
+		{
+			gError = ret;
+			gShouldStop = 1;
+			break;
+		}
+		gAudio.add(getTimeNs() - (next.tv_sec * 1000000000ULL + next.tv_nsec));
+		if(gFifo.periods && 0 == n % gFifo.periods)
+		{
+			gFifoPostNs = getTimeNs();
+			__wrap_sem_post(&gFifoSem);
+		}
+		if(gAux.periods && 0 == n % gAux.periods)
+			scheduleAux();
+	}
+	return NULL;
+}
+
+static void* fifoLoop(void*)
+{
+	while(1)
+	{
+		__wrap_sem_wait(&gFifoSem);
+		if(gShouldStop)
+			break;
+		gFifo.add(getTimeNs() - gFifoPostNs);
+	}
+	return NULL;
+}
+
+static void* auxLoop(void*)
+{
+	__wrap_pthread_mutex_lock(&gAuxMutex);
+	while(!gShouldStop)
+	{
+		__wrap_pthread_cond_wait(&gAuxCond, &gAuxMutex);
+		if(gAuxScheduledNs)
+		{
+			gAux.add(getTimeNs() - gAuxScheduledNs);
+			gAuxScheduledNs = 0;
+		}
+	}
+	__wrap_pthread_mutex_unlock(&gAuxMutex);
+	return NULL;
+}
+
+// The load runs in Linux threads
+
+static void* cpuLoad(void*)
+{
+	volatile double acc = 0;
+	while(!gShouldStop)
+		for(unsigned int n = 0; n < 100000; ++n)
+			acc = acc + n * 0.5;
+	return NULL;
+}
+
+// write to a file and flush it to the storage
+static void* ioLoad(void* arg)
+{
+	std::string path = gIoDir + "/bela-latency-io-" + std::to_string((uintptr_t)arg);
+	int fd = open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+	if(fd < 0)
+	{
+		fprintf(stderr, "Error: unable to open %s: %s\n", path.c_str(), strerror(errno));
+		return NULL;
+	}
+	unlink(path.c_str());
+	std::vector<char> buf(1 << 20, 'x');
+	while(!gShouldStop)
+	{
+		for(unsigned int n = 0; n < 16 && !gShouldStop; ++n)
+		{
+			if(write(fd, buf.data(), buf.size()) < 0)
+			{
+				fprintf(stderr, "Error: unable to write to %s: %s\n", path.c_str(), strerror(errno));
+				close(fd);
+				return NULL;
+			}
+		}
+		fsync(fd);
+		if(ftruncate(fd, 0) || lseek(fd, 0, SEEK_SET) < 0)
+			break;
+	}
+	close(fd);
+	return NULL;
+}
+
+#if XENOMAI_MAJOR > 0
+// Websocket traffic goes from a WSServer, the same as the Scope and the
+// Gui use, to a minimal client in this program, over the loopback interface
+static const int kWsPort = 5440;
+static const char kWsAddress[] = "bela-latency";
+static const unsigned int kWsMessageSize = WSSERVER_STREAM_BUFFERSIZE;
+static WSServer* gWsServer;
+static pthread_t gWsSenderThread;
+
+static void* wsClient(void*)
+{
+	int fd = -1;
+	// the server starts asynchronously
+	for(unsigned int n = 0; n < 50 && !gShouldStop; ++n)
+	{
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(kWsPort);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if(fd >= 0 && !connect(fd, (struct sockaddr*)&addr, sizeof(addr)))
+			break;
+		if(fd >= 0)
+			close(fd);
+		fd = -1;
+		usleep(100000);
+	}
+	if(fd < 0)
+	{
+		fprintf(stderr, "Error: unable to connect to the WSServer on port %d\n", kWsPort);
+		return NULL;
+	}
+	std::string request = std::string("GET /") + kWsAddress + " HTTP/1.1\r\n"
+		"Host: localhost\r\n"
+		"Upgrade: websocket\r\n"
+		"Connection: Upgrade\r\n"
+		"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+		"Sec-WebSocket-Version: 13\r\n\r\n";
+	if(write(fd, request.c_str(), request.size()) < 0)
+	{
+		fprintf(stderr, "Error: unable to send the websocket handshake: %s\n", strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	// time out so that gShouldStop is checked regularly
+	struct timeval timeout = { 0, 100000 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	// discard the response to the handshake and all the messages
+	char buf[4096];
+	while(!gShouldStop)
+		if(0 == read(fd, buf, sizeof(buf)))
+			break;
+	close(fd);
+	return NULL;
+}
+
+static void* wsSender(void*)
+{
+	std::vector<char> msg(kWsMessageSize);
+	long long int intervalNs = kWsMessageSize * 1000000000LL / (gWsLoadKBps * 1024LL);
+	while(!gShouldStop)
+	{
+		gWsServer->send(kWsAddress, msg.data(), msg.size());
+		task_sleep_ns(intervalNs);
+	}
+	return NULL;
+}
+
+static int startWsLoad()
+{
+	gWsServer = new WSServer(kWsPort);
+	gWsServer->addAddress(kWsAddress, [](std::string, void*, int){}, nullptr, nullptr, true);
+	pthread_t client;
+	if(int ret = pthread_create(&client, NULL, wsClient, NULL)) // NOWRAP
+		return ret;
+	gLoadThreads.push_back(client);
+	return create_and_start_thread(&gWsSenderThread, "bela-latency-ws", 0, 0, (pthread_callback_t*)wsSender, NULL);
+}
+
+static void stopWsLoad()
+{
+	void* threadReturnValue;
+	__wrap_pthread_join(gWsSenderThread, &threadReturnValue);
+	delete gWsServer;
+}
+#endif /* XENOMAI_MAJOR > 0 */
+
+static int startLoad()
+{
+	for(unsigned int n = 0; n < gCpuLoad + gIoLoad; ++n)
+	{
+		pthread_t thread;
+		bool cpu = n < gCpuLoad;
+		if(int ret = pthread_create(&thread, NULL, cpu ? cpuLoad : ioLoad, (void*)(uintptr_t)n)) // NOWRAP
+			return ret;
+		gLoadThreads.push_back(thread);
+	}
+	if(gWsLoadKBps)
+	{
+#if XENOMAI_MAJOR > 0
+		return startWsLoad();
+#else
+		fprintf(stderr, "Warning: --ws-load requires WSServer, which is only available when built with Xenomai\n");
+		gWsLoadKBps = 0;
+#endif
+	}
+	return 0;
+}
+
+static void stopLoad()
+{
+#if XENOMAI_MAJOR > 0
+	if(gWsLoadKBps)
+		stopWsLoad();
+#endif
+	for(auto thread : gLoadThreads)
+		pthread_join(thread, NULL); // NOWRAP
+}
+
+static int startMeasurement(Measurement& m, pthread_callback_t* callback)
+{
+	if(int ret = create_and_start_thread(&m.thread, (std::string("bela-latency-") + m.name).c_str(), m.priority, 0, callback, NULL))
+	{
+		fprintf(stderr, "Error: unable to start the %s thread at priority %d: (%d) %s\n", m.name, m.priority, ret, strerror(ret));
+		if(EPERM == ret)
+			fprintf(stderr, "Run as root, or with a real-time priority limit of at least %d\n", m.priority);
+		return ret;
+	}
+	return 0;
+}
+
+#if XENOMAI_MAJOR > 0
+static std::string readFirstLine(const char* path)
+{
+	char line[256] = "";
+	FILE* file = fopen(path, "r");
+	if(!file)
+		return "";
+	if(!fgets(line, sizeof(line), file))
+		line[0] = 0;
+	fclose(file);
+	line[strcspn(line, "\n")] = 0;
+	return line;
+}
+#endif
+
+static void printReport(FILE* file, unsigned int duration)
+{
+	struct utsname uts;
+	uname(&uts);
+	fprintf(file, "# bela-latency\n");
+	fprintf(file, "kernel: %s %s\n", uts.release, uts.machine);
+#if XENOMAI_MAJOR > 0
+	std::string xenomai = readFirstLine("/proc/xenomai/version");
+	fprintf(file, "xenomai: %s\n", xenomai.size() ? xenomai.c_str() : "unknown");
+#else
+	fprintf(file, "xenomai: none (SCHED_FIFO)\n");
+#endif
+	fprintf(file, "period: %u frames at %uHz (%.1fus)\n", gPeriodSize, gSampleRate, gPeriodNs / 1000.0);
+	fprintf(file, "duration: %us\n", duration);
+	fprintf(file, "load: cpu %u, io %u, ws %ukB/s\n", gCpuLoad, gIoLoad, gWsLoadKBps);
+	std::vector<Measurement*> measurements = { &gAudio };
+	fprintf(file, "threads: audio priority %d", gAudio.priority);
+	for(auto m : { &gFifo, &gAux })
+	{
+		if(!m->periods)
+			continue;
+		measurements.push_back(m);
+		fprintf(file, ", %s priority %d every %u periods", m->name, m->priority, m->periods);
+	}
+	fprintf(file, "\n\n");
+
+	LatencyStats::printHeader(file);
+	for(auto m : measurements)
+		m->stats.print(file, m->name);
+
+	fprintf(file, "\n# histogram (us), empty bins omitted\n%6s", "us");
+	for(auto m : measurements)
+		fprintf(file, " %10s", m->name);
+	fprintf(file, "\n");
+	for(unsigned int bin = 0; bin <= LatencyHistogram::kBins; ++bin)
+	{
+		bool empty = true;
+		for(auto m : measurements)
+			empty &= !m->histogram[bin];
+		if(empty)
+			continue;
+		if(bin < LatencyHistogram::kBins)
+			fprintf(file, "%6u", bin);
+		else
+			fprintf(file, "%5s%u", ">=", bin);
+		for(auto m : measurements)
+			fprintf(file, " %10u", m->histogram[bin]);
+		fprintf(file, "\n");
+	}
+}
+
+static void interrupt(int)
+{
+	gShouldStop = 1;
+}
+
+static void usage(const char* name)
+{
+	fprintf(stderr, "Usage: %s [options]\n", name);
+	fprintf(stderr, "Measure the wakeup latency of threads at the priorities of the Bela audio, fifo and auxiliary threads.\n");
+	fprintf(stderr, "   --duration [-d] s:     Duration of the measurement (default: 10)\n");
+	fprintf(stderr, "   --period [-p] frames:  Period of the audio thread, in frames (default: 16)\n");
+	fprintf(stderr, "   --sample-rate Hz:      Sample rate the period is in (default: 44100)\n");
+	fprintf(stderr, "   --fifo-periods n:      Wake up the fifo thread every n periods, 0 to disable it (default: 4)\n");
+	fprintf(stderr, "   --aux-periods n:       Wake up the aux thread every n periods, 0 to disable it (default: 8)\n");
+	fprintf(stderr, "   --aux-priority p:      Priority of the aux thread (default: 50)\n");
+	fprintf(stderr, "   --cpu-load n:          Run n threads busy-looping\n");
+	fprintf(stderr, "   --io-load n:           Run n threads writing to a file and flushing it\n");
+	fprintf(stderr, "   --io-dir dir:          Directory the --io-load files are written to (default: /tmp)\n");
+	fprintf(stderr, "   --ws-load kB/s:        Send this much websocket traffic through a WSServer (Xenomai only)\n");
+	fprintf(stderr, "   --output [-o] file:    Write the report to file rather than to the standard output\n");
+	fprintf(stderr, "   --help [-h]:           Print this message\n");
+}
+
+int main(int argc, char** argv)
+{
+	enum {
+		OPT_SAMPLE_RATE = 1000,
+		OPT_FIFO_PERIODS,
+		OPT_AUX_PERIODS,
+		OPT_AUX_PRIORITY,
+		OPT_CPU_LOAD,
+		OPT_IO_LOAD,
+		OPT_IO_DIR,
+		OPT_WS_LOAD,
+	};
+	struct option longOptions[] = {
+		{"duration", 1, NULL, 'd'},
+		{"period", 1, NULL, 'p'},
+		{"sample-rate", 1, NULL, OPT_SAMPLE_RATE},
+		{"fifo-periods", 1, NULL, OPT_FIFO_PERIODS},
+		{"aux-periods", 1, NULL, OPT_AUX_PERIODS},
+		{"aux-priority", 1, NULL, OPT_AUX_PRIORITY},
+		{"cpu-load", 1, NULL, OPT_CPU_LOAD},
+		{"io-load", 1, NULL, OPT_IO_LOAD},
+		{"io-dir", 1, NULL, OPT_IO_DIR},
+		{"ws-load", 1, NULL, OPT_WS_LOAD},
+		{"output", 1, NULL, 'o'},
+		{"help", 0, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+	unsigned int duration = 10;
+	const char* output = NULL;
+	gFifo.periods = 4;
+	gAux.periods = 8;
+	gAux.priority = 50;
+	int c;
+	while((c = getopt_long(argc, argv, "d:p:o:h", longOptions, NULL)) != -1)
+	{
+		switch(c)
+		{
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'p':
+			gPeriodSize = atoi(optarg);
+			break;
+		case OPT_SAMPLE_RATE:
+			gSampleRate = atoi(optarg);
+			break;
+		case OPT_FIFO_PERIODS:
+			gFifo.periods = atoi(optarg);
+			break;
+		case OPT_AUX_PERIODS:
+			gAux.periods = atoi(optarg);
+			break;
+		case OPT_AUX_PRIORITY:
+			gAux.priority = atoi(optarg);
+			break;
+		case OPT_CPU_LOAD:
+			gCpuLoad = atoi(optarg);
+			break;
+		case OPT_IO_LOAD:
+			gIoLoad = atoi(optarg);
+			break;
+		case OPT_IO_DIR:
+			gIoDir = optarg;
+			break;
+		case OPT_WS_LOAD:
+			gWsLoadKBps = atoi(optarg);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(!gPeriodSize || !gSampleRate)
+	{
+		fprintf(stderr, "Error: invalid period\n");
+		return 1;
+	}
+	gPeriodNs = gPeriodSize * 1000000000ULL / gSampleRate;
+	// the same priorities as the threads started by Bela_startAudio()
+	if(gFifo.periods)
+	{
+		gAudio.priority = BELA_AUDIO_PRIORITY + 1;
+		gFifo.priority = BELA_AUDIO_PRIORITY;
+	} else {
+		gAudio.priority = BELA_AUDIO_PRIORITY;
+	}
+
+#if XENOMAI_MAJOR == 3
+	int xenomaiArgc = 0;
+	char *const *xenomaiArgv;
+	xenomai_init(&xenomaiArgc, &xenomaiArgv);
+#endif
+	if(mlockall(MCL_CURRENT | MCL_FUTURE))
+		fprintf(stderr, "Warning: unable to lock memory: %s\n", strerror(errno));
+	signal(SIGINT, interrupt);
+	signal(SIGTERM, interrupt);
+
+	__wrap_sem_init(&gFifoSem, 0, 0);
+	__wrap_pthread_mutex_init(&gAuxMutex, NULL);
+	__wrap_pthread_cond_init(&gAuxCond, NULL);
+
+	if(int ret = startLoad())
+	{
+		fprintf(stderr, "Error: unable to start the load: (%d) %s\n", ret, strerror(ret));
+		gShouldStop = 1;
+		stopLoad();
+		return 1;
+	}
+	int ret = 0;
+	if(gAux.periods)
+		ret = startMeasurement(gAux, (pthread_callback_t*)auxLoop);
+	if(!ret && gFifo.periods)
+		ret = startMeasurement(gFifo, (pthread_callback_t*)fifoLoop);
+	if(!ret)
+		ret = startMeasurement(gAudio, (pthread_callback_t*)audioLoop);
+
+	if(!ret)
+	{
+		fprintf(stderr, "Measuring for %us...\n", duration);
+		uint64_t endNs = getTimeNs() + duration * 1000000000ULL;
+		while(!gShouldStop && getTimeNs() < endNs)
+			usleep(100000);
+	}
+	gShouldStop = 1;
+	void* threadReturnValue;
+	if(gAudio.thread)
+		__wrap_pthread_join(gAudio.thread, &threadReturnValue);
+	if(gFifo.thread)
+	{
+		__wrap_sem_post(&gFifoSem);
+		__wrap_pthread_join(gFifo.thread, &threadReturnValue);
+	}
+	if(gAux.thread)
+	{
+		__wrap_pthread_mutex_lock(&gAuxMutex);
+		__wrap_pthread_cond_signal(&gAuxCond);
+		__wrap_pthread_mutex_unlock(&gAuxMutex);
+		__wrap_pthread_join(gAux.thread, &threadReturnValue);
+	}
+	stopLoad();
+	if(ret)
+		return 1;
+	if(gError)
+	{
+		fprintf(stderr, "Error: clock_nanosleep() failed: (%d) %s\n", gError, strerror(gError));
+		return 1;
+	}
+
+	FILE* file = stdout;
+	if(output && !(file = fopen(output, "w")))
+	{
+		fprintf(stderr, "Error: unable to open %s: %s\n", output, strerror(errno));
+		return 1;
+	}
+	printReport(file, duration);
+	if(file != stdout)
+		fclose(file);
+	return 0;
+}
@@ -85,8 +85,9 @@ while [ $# -gt 0 ]; do
 				exit
 			fi
 			shift
-			# Get included libraries on project from pre-processor's output 
-			grep -R --include \*.ii --include \*.i "^# [1-9]\{1,\} \"./libraries/.\{1,\}\"" projects/$PROJECT/build | sed 's:.*"./libraries/\(.*\)/.*:\1:' | sort -u > tmp/libraries
+			# Get included libraries on project from the dependency files
+			# written by the compiler
+			grep -Rho --include \*.d "\./libraries/[^/[:space:]]\{1,\}/" projects/$PROJECT/build | sed 's:\./libraries/\(.*\)/:\1:' | sort -u > tmp/libraries
 			MKFILEPATH="projects/$PROJECT/build"
 			break
 			;;
@@ -0,0 +1,38 @@
+#!/bin/bash
+# Build an object file through a cache shared by all projects, where objects
+# are stored by the hash of the compiler, the options and the preprocessed
+# source. If the same object has been built before, e.g.: before a library
+# was cleaned or with a different compiler, it is copied from the cache
+# instead of being compiled again.
+#
+# Usage: objcache.sh <cache folder> <object> <compiler> <options...>
+# where the compiler and the options are those that build the object,
+# including -o <object>. The dependency file, if any, is written either way.
+
+CACHE=$1
+OBJ=$2
+shift 2
+[ -z "$CACHE" ] && exec "$@"
+mkdir -p "$CACHE" 2> /dev/null || exec "$@"
+
+# the same options, preprocessing to stdout rather than writing the object
+ARGS=()
+for ARG in "$@"; do
+	[ "$SKIP" = 1 ] && { SKIP=0; continue; }
+	[ "$ARG" = -o ] && { SKIP=1; continue; }
+	ARGS+=("$ARG")
+done
+set -o pipefail
+KEY=`{ echo "${ARGS[@]}"; "$1" --version; "${ARGS[@]}" -E -MT "$OBJ" -o - 2> /dev/null; } | sha1sum | cut -d' ' -f1` || exec "$@"
+CACHED="$CACHE/$KEY.o"
+
+if [ -f "$CACHED" ]; then
+	cp "$CACHED" "$OBJ" && touch "$CACHED" && exit 0
+fi
+"$@" || exit
+# copied and then renamed, so that a build running in parallel never finds
+# half an object
+cp "$OBJ" "$CACHED.$$" && mv "$CACHED.$$" "$CACHED"
+# forget about objects that have not been used for a month
+find "$CACHE" -name '*.o' -mtime +30 -delete 2> /dev/null
+exit 0
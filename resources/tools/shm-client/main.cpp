@@ -0,0 +1,78 @@
+/*
+ * A reference client for ShmChannel.
+ *
+ * It connects to the channel created by a Bela program, prints how much
+ * data is received every second and, with --echo, sends every message
+ * back unchanged. It only needs ShmChannelClient.h and ShmChannelQueue.h.
+ */
+#include <ShmChannelClient.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
+static volatile bool gShouldStop = false;
+
+static void interrupt(int)
+{
+	gShouldStop = true;
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 2)
+	{
+		fprintf(stderr, "Usage: %s <channel name> [--echo]\n", argv[0]);
+		return 1;
+	}
+	bool echo = argc > 2 && !strcmp("--echo", argv[2]);
+	signal(SIGINT, interrupt);
+	signal(SIGTERM, interrupt);
+
+	ShmChannelClient client;
+	int ret = client.setup(argv[1]);
+	if(ret)
+	{
+		fprintf(stderr, "Unable to connect to %s: (%d) %s\n", argv[1], -ret, strerror(-ret));
+		return 1;
+	}
+	unsigned int messages = 0;
+	size_t bytes = 0;
+	unsigned int dropped = 0;
+	struct timespec last;
+	clock_gettime(CLOCK_MONOTONIC, &last);
+	while(!gShouldStop)
+	{
+		size_t size;
+		const void* msg = client.read(size, 100);
+		if(msg)
+		{
+			++messages;
+			bytes += size;
+			if(echo)
+			{
+				void* dest = client.reserve();
+				if(dest)
+				{
+					memcpy(dest, msg, size);
+					client.commit(size);
+				} else
+					++dropped;
+			}
+			client.release();
+		}
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if(now.tv_sec > last.tv_sec)
+		{
+			printf("%u messages, %zu bytes", messages, bytes);
+			if(echo)
+				printf(", %u not echoed", dropped);
+			printf("\n");
+			messages = 0;
+			bytes = 0;
+			dropped = 0;
+			last = now;
+		}
+	}
+	return 0;
+}